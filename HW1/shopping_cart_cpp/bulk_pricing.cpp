@@ -0,0 +1,128 @@
+#include "bulk_pricing.h"
+#include "catalog.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BULK_PRICING_AVX2 1
+#endif
+
+namespace {
+	// Lines priced per pass of the kernel.
+	constexpr size_t PRICE_CHUNK = 2048;
+
+	// totals[i] = prices[items[i]] * quantities[i]. Returns false if any of the prices is missing,
+	// which the price column marks as -1.
+	bool lineTotalsScalar(const int64_t* prices, const ItemId* items, const int32_t* quantities, int64_t* totals, size_t count) {
+		int64_t missing = 0;
+		for (size_t i = 0; i < count; ++i) {
+			int64_t price = prices[items[i]];
+			missing |= price;
+			totals[i] = price * quantities[i];
+		}
+		return missing >= 0;
+	}
+
+#ifdef BULK_PRICING_AVX2
+	// Four lines at a time: one gather for the prices, and a 64 by 32 bit multiply made of two
+	// unsigned 32 bit multiplies, since prices in cents can exceed 32 bits.
+	bool lineTotalsAvx2(const int64_t* prices, const ItemId* items, const int32_t* quantities, int64_t* totals, size_t count) {
+		__m256i missing = _mm256_setzero_si256();
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m128i ids = _mm_loadu_si128(reinterpret_cast<const __m128i*>(items + i));
+			__m256i price = _mm256_i32gather_epi64(reinterpret_cast<const long long*>(prices), ids, 8);
+			missing = _mm256_or_si256(missing, price);
+			__m256i quantity = _mm256_cvtepi32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(quantities + i)));
+			__m256i low = _mm256_mul_epu32(price, quantity);
+			__m256i high = _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(price, 32), quantity), 32);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(totals + i), _mm256_add_epi64(low, high));
+		}
+		bool priced = _mm256_movemask_pd(_mm256_castsi256_pd(missing)) == 0;
+		return lineTotalsScalar(prices, items + i, quantities + i, totals + i, count - i) && priced;
+	}
+#endif
+}
+
+void BulkPricer::add(const ShoppingCart& cart) {
+	cart.appendLines(items, quantities);
+	for (size_t i = ends.empty() ? 0 : ends.back(); i < items.size(); ++i) {
+		max_item = std::max(max_item, items[i]);
+	}
+	ends.push_back(items.size());
+}
+
+void BulkPricer::clear() {
+	items.clear();
+	quantities.clear();
+	ends.clear();
+	max_item = 0;
+}
+
+std::vector<Money> BulkPricer::price([[maybe_unused]] PricingKernel kernel) const {
+	Catalog::Reader catalog;
+	const std::vector<int64_t>& prices = catalog->prices_by_id;
+	// Items interned after this snapshot was built are past the end of its price column.
+	if (!items.empty() && max_item >= prices.size()) {
+		throw std::invalid_argument("Item not found in catalog");
+	}
+	std::vector<Money> totals;
+	totals.reserve(ends.size());
+	// Lines are priced a chunk at a time into a buffer that stays in cache, and each cart's lines
+	// are summed from it; a cart whose lines span two chunks carries its partial sum over.
+	int64_t line_totals[PRICE_CHUNK];
+	bool priced = true;
+	size_t cart = 0;
+	int64_t total = 0;
+	for (size_t base = 0; base < items.size(); base += PRICE_CHUNK) {
+		size_t count = std::min<size_t>(PRICE_CHUNK, items.size() - base);
+#ifdef BULK_PRICING_AVX2
+		if (kernel == PricingKernel::Auto) {
+			priced &= lineTotalsAvx2(prices.data(), items.data() + base, quantities.data() + base, line_totals, count);
+		}
+		else
+#endif
+		{
+			priced &= lineTotalsScalar(prices.data(), items.data() + base, quantities.data() + base, line_totals, count);
+		}
+		size_t line = base;
+		for (; cart < ends.size() && ends[cart] <= base + count; ++cart) {
+			for (; line < ends[cart]; ++line) {
+				total += line_totals[line - base];
+			}
+			totals.push_back(Money(total));
+			total = 0;
+		}
+		for (; line < base + count; ++line) {
+			total += line_totals[line - base];
+		}
+	}
+	if (!priced) {
+		throw std::invalid_argument("Item not found in catalog");
+	}
+	// Empty carts after the last line.
+	for (; cart < ends.size(); ++cart) {
+		totals.push_back(Money(0));
+	}
+	return totals;
+}
+
+void BulkPricer::reserve(size_t carts, size_t lines) {
+	items.reserve(lines);
+	quantities.reserve(lines);
+	ends.reserve(carts);
+}
+
+std::vector<Money> priceCarts(std::span<const ShoppingCart> carts, PricingKernel kernel) {
+	size_t lines = 0;
+	for (const ShoppingCart& cart : carts) {
+		lines += cart.itemCount();
+	}
+	BulkPricer pricer;
+	pricer.reserve(carts.size(), lines);
+	for (const ShoppingCart& cart : carts) {
+		pricer.add(cart);
+	}
+	return pricer.price(kernel);
+}
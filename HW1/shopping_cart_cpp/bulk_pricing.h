@@ -0,0 +1,40 @@
+#pragma once
+#include "cart.h"
+#include "item_registry.h"
+#include "money.h"
+#include <cstdint>
+#include <span>
+#include <vector>
+
+// Which kernel BulkPricer::price uses. Auto picks the vectorized kernel when the build targets
+// AVX2 and the scalar one otherwise; Scalar forces the fallback.
+enum class PricingKernel { Auto, Scalar };
+
+// Prices many carts at once, for revaluations and reports that would otherwise call getTotal
+// cart by cart.
+//
+// Carts are added one at a time, which copies their lines into columns of item ids and
+// quantities. price() then prices every line against one catalog snapshot in a single pass,
+// gathering prices from the snapshot's price column, and sums each cart's lines. Collecting the
+// columns costs more than pricing them, so a pricer kept around and priced again after each
+// catalog reload is cheaper than calling priceCarts every time.
+class BulkPricer {
+public:
+	void add(const ShoppingCart& cart);
+	size_t size() const { return ends.size(); }
+	void clear();
+	// Makes room for this many carts and lines in all, when the caller knows them up front.
+	void reserve(size_t carts, size_t lines);
+	// The total of every cart added, in the order they were added. Throws
+	// std::invalid_argument("Item not found in catalog") if a line's item has no price, as
+	// getTotal does.
+	std::vector<Money> price(PricingKernel kernel = PricingKernel::Auto) const;
+private:
+	std::vector<ItemId> items;
+	std::vector<int32_t> quantities;
+	// Where each cart's lines end in the columns.
+	std::vector<size_t> ends;
+	ItemId max_item = 0;
+};
+
+std::vector<Money> priceCarts(std::span<const ShoppingCart> carts, PricingKernel kernel = PricingKernel::Auto);
@@ -1,150 +1,214 @@
-#include "cart.h"
-#include <random>
-#include <sstream>
-#include <iomanip>
-#include <regex>
+﻿#include "cart.h"
+#include "cart_events.h"
+#include "cart_id.h"
+#include "cart_metrics.h"
+#include "catalog.h"
+#include "item_registry.h"
+#include "owner_id.h"
+#include "promotions.h"
+#include "slab_pool.h"
+#include "small_flat_map.h"
 #include <utility>
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <vector>
 
-namespace Catalog {
-	static std::map<std::string, double> fetchItems() {
-		// This is where items would be fetched from a database.
-		return {
-			{"apple", 0.5},
-			{"banana", 0.25},
-			{"orange", 0.75},
-			{"grapes", 1.0},
-			{"pineapple", 2.0}
-		};
-	}
-	static std::pair<std::string, double> getItem(const std::string& item) {
-		std::map items = fetchItems();
-		std::string item_str(item);
-		auto iter = items.find(item_str);
-		if (iter != items.end()) {
-			return std::make_pair(iter->first, iter->second);
-		}
-		else {
-			throw std::invalid_argument("Item not found in catalog");
-		}
-	}
-};
-
+// An item in a cart, kept as its registry id. The name is only looked up at the API boundary.
 class ItemName {
 public:
-    ItemName(const std::string& name) : name(name) {}
-    std::string get() const { return name; };
+	ItemName(ItemId id) : id(id) {}
+	ItemId getId() const { return id; }
+	std::string get() const { return std::string(ItemRegistry::name(id)); };
+	std::string_view view() const { return ItemRegistry::name(id); }
 	bool operator<(const ItemName& other) const {
-		return name < other.name;
+		return id < other.id;
 	}
+	// Lets the line storage be searched by a plain id.
+	friend bool operator<(const ItemName& item, ItemId other) { return item.id < other; }
+	friend bool operator<(ItemId other, const ItemName& item) { return other < item.id; }
 private:
-    std::string name;
+	ItemId id;
 };
 
 class Quantity {
 public:
 	Quantity() : quantity(0) {}
     Quantity(int quantity) {
+		CartError error = check(quantity);
+		if (error != CartError::None) {
+			throwCartError(error);
+		}
+		this->quantity = quantity;
+	}
+	static CartError check(int quantity) {
 		if (quantity < 1) {
-			throw std::invalid_argument("Quantity cannot be less than 1");
+			CART_METRIC_FAILURE(QUANTITY_OUT_OF_RANGE);
+			return CartError::QuantityBelowMinimum;
 		}
 		if (quantity > 99) {
-			throw std::invalid_argument("Quantity cannot be greater than 99");
+			CART_METRIC_FAILURE(QUANTITY_OUT_OF_RANGE);
+			return CartError::QuantityAboveMaximum;
 		}
-		this->quantity = quantity;
+		return CartError::None;
+	}
+	// For a quantity that has already passed check.
+	static Quantity checked(int quantity) {
+		Quantity result;
+		result.quantity = quantity;
+		return result;
 	}
     int get() const { return quantity; }
 private:
     int quantity;
 };
 
-class CartID {
-public:
-	CartID() {
-		this->id = generate_uuid4();
-	}
-	std::string get() const { return id; };
-private:
-	std::string generate_uuid4() {
-		// Credit to happy_sisyphus on Stackoverflow: https://stackoverflow.com/a/60198074
-		// The alternative to this would be to use an external library like Boost.
-		std::random_device rd;
-		std::mt19937 gen(rd());
-		std::uniform_int_distribution<uint32_t> dis(0, 15); // 0-f
-		std::uniform_int_distribution<uint32_t> encoding_bits(8, 11); // 8-b
-
-		std::stringstream ss;
-		int i;
-		ss << std::hex;
-		for (i = 0; i < 8; i++) {
-			ss << dis(gen);
-		}
-		ss << "-";
-		for (i = 0; i < 4; i++) {
-			ss << dis(gen);
-		}
-		ss << "-4";
-		for (i = 0; i < 3; i++) {
-			ss << dis(gen);
-		}
-		ss << "-" << encoding_bits(gen);
-		for (i = 0; i < 3; i++) {
-			ss << dis(gen);
-		}
-		ss << "-";
-		for (i = 0; i < 12; i++) {
-			ss << dis(gen);
-		}
-		return ss.str();
-	}
-	std::string id;
-};
+#define SMALL_BATCH 16
+#define INLINE_LINES 16
 
-class OwnerID {
-public:
-	OwnerID() { this->id = L""; }
-	OwnerID(const std::wstring& id) {
-		if (id.size() > 12) {
-			throw std::invalid_argument("Owner ID must be 12 characters long");
-		}
-		// Must be 3 letters, 5 numbers, 2 letters, a dash, and an A or a Q.
-		std::wregex pattern(L"^[A-Z\u0080-\uFFFF]{3}[0-9]{5}[A-Z\u0080-\uFFFF]{2}-[AQ]$", std::regex_constants::icase);
-		if (!std::regex_match(id, pattern)) {
-			throw std::invalid_argument("Invalid owner ID format");
-		}
-		this->id = id;
-	}
-	std::wstring get() const { return id; };
-private:
-	std::wstring id;
-};
+// Most carts hold fewer than INLINE_LINES lines, and those never allocate for line storage.
+using LineStorage = SmallFlatMap<ItemName, Quantity, INLINE_LINES>;
 
 struct ShoppingCart::ShoppingCartData {
+	ShoppingCartData(OwnerID owner_id, CartID cart_id, LineStorage items)
+		: owner_id(owner_id), cart_id(cart_id), items(std::move(items)) {}
+	ShoppingCartData(const ShoppingCartData& other)
+		: owner_id(other.owner_id), cart_id(other.cart_id), items(other.items) {}
+
 	OwnerID owner_id;
 	CartID cart_id;
-	std::map<ItemName, Quantity> items;
+	LineStorage items;
+	// The number of carts sharing this data. Data with more than one reference is never changed.
+	std::atomic<uint32_t> references = 1;
+
+	// Finds the line for a name without taking a lock: by id for items the catalog still has,
+	// or by comparing names for lines whose item has since been dropped from the catalog.
+	LineStorage::iterator findLine(const Catalog::Reader& catalog, std::string_view item_name) {
+		if (auto entry = catalog->lookup(item_name)) {
+			return items.find(entry->id);
+		}
+		return std::find_if(items.begin(), items.end(), [item_name](const auto& item) { return item.first.view() == item_name; });
+	}
+
+	// Tells the event feed, if it is on, that a line changed.
+	void changed(ItemId item, int old_quantity, int new_quantity) const {
+		if (CartEvents::enabled()) {
+			CartEvents::publish({ 0, cart_id.getBytes(), item, (int16_t)old_quantity, (int16_t)new_quantity });
+		}
+	}
+
+	// Carts are created and dropped all the time in a long-running process, so their data comes
+	// from a slab pool instead of one small heap allocation each.
+	static void* operator new(size_t) { return SlabPool<ShoppingCartData>::allocate(); }
+	static void operator delete(void* pointer) noexcept { SlabPool<ShoppingCartData>::deallocate(pointer); }
 };
+ShoppingCart::ShoppingCart(std::wstring_view owner_id) : ShoppingCart(tryCreate(owner_id).value()) {}
 
-ShoppingCart::ShoppingCart(const std::wstring& owner_id) {
-	data = std::make_unique<ShoppingCartData>(OwnerID(owner_id), CartID(), std::map<ItemName, Quantity>());
+CartResult<ShoppingCart> ShoppingCart::tryCreate(std::wstring_view owner_id) {
+	CART_METRIC_CALL(CONSTRUCT);
+	CartResult<OwnerID> owner = OwnerID::tryMake(owner_id);
+	if (!owner) {
+		CART_METRIC_FAILURE(INVALID_OWNER_ID);
+		return owner.error();
+	}
+	ShoppingCart cart(new ShoppingCartData(*owner, CartID(), LineStorage()));
+	cart.priced_total.set(0, Catalog::version());
+	return cart;
+}
+ShoppingCart::ShoppingCart(ShoppingCartData* data) : data(data) {}
+ShoppingCart::~ShoppingCart() {
+	release();
 }
-ShoppingCart::~ShoppingCart() = default;
 
-ShoppingCart::ShoppingCart(const ShoppingCart& other) {
-	data = std::make_unique<ShoppingCartData>(other.data->owner_id, other.data->cart_id, other.data->items);
-};
+ShoppingCart::ShoppingCart(const ShoppingCart& other) : priced_total(other.priced_total) {
+	CART_METRIC_CALL(COPY);
+	data = other.share();
+}
 
-ShoppingCart::ShoppingCart(ShoppingCart&& other) noexcept = default;
+ShoppingCart::ShoppingCart(ShoppingCart&& other) noexcept
+	: data(std::exchange(other.data, nullptr)), priced_total(other.priced_total) {}
 
 ShoppingCart& ShoppingCart::operator=(const ShoppingCart& other) {
-	data = std::make_unique<ShoppingCartData>(other.data->owner_id, other.data->cart_id, other.data->items);
+	CART_METRIC_CALL(COPY);
+	if (data != other.data) {
+		ShoppingCartData* shared = other.share();
+		release();
+		data = shared;
+	}
+	priced_total = other.priced_total;
 	return *this;
 };
 
-ShoppingCart& ShoppingCart::operator=(ShoppingCart&& other) noexcept = default;
+ShoppingCart& ShoppingCart::operator=(ShoppingCart&& other) noexcept {
+	if (this != &other) {
+		release();
+		data = std::exchange(other.data, nullptr);
+		priced_total = other.priced_total;
+	}
+	return *this;
+}
+
+ShoppingCart::ShoppingCartData* ShoppingCart::share() const {
+	// Lines that fit inline are cheaper to copy outright than to share through an atomic count.
+	if (data->items.isInline()) {
+		return new ShoppingCartData(*data);
+	}
+	data->references.fetch_add(1, std::memory_order_relaxed);
+	return data;
+}
+
+void ShoppingCart::release() {
+	// A cart holding the only reference can skip the atomic decrement: no other cart can
+	// take a new reference to data it does not share.
+	if (data != nullptr && (data->references.load(std::memory_order_acquire) == 1
+		|| data->references.fetch_sub(1, std::memory_order_acq_rel) == 1)) {
+		delete data;
+	}
+	data = nullptr;
+}
+
+ShoppingCart::ShoppingCartData& ShoppingCart::mutableData() {
+	if (data->references.load(std::memory_order_acquire) != 1) {
+		ShoppingCartData* copy = new ShoppingCartData(*data);
+		release();
+		data = copy;
+	}
+	return *data;
+}
+
+void ShoppingCart::adjustTotal(const Catalog::Reader& catalog, ItemId item, int64_t quantity_change) {
+	auto price = catalog->priceOf(item);
+	std::optional<int64_t> cents = priced_total.get(catalog->version);
+	if (!cents || !price) {
+		priced_total.invalidate();
+		return;
+	}
+	priced_total.set(*cents + *price * quantity_change, catalog->version);
+}
+
+CartResult<Money> ShoppingCart::total(const Catalog::Reader& catalog) const {
+	if (std::optional<int64_t> cents = priced_total.get(catalog->version)) {
+		return Money(*cents);
+	}
+	int64_t recomputed = 0;
+	for (const auto& item : data->items) {
+		auto price = catalog->priceOf(item.first.getId());
+		if (!price) {
+			CART_METRIC_FAILURE(UNKNOWN_ITEM);
+			return CartError::UnknownItem;
+		}
+		recomputed += *price * item.second.get();
+	}
+	priced_total.trySet(recomputed, catalog->version);
+	return Money(recomputed);
+}
 
 std::wstring ShoppingCart::getId() const { return data->owner_id.get(); }
 std::string ShoppingCart::getCartId() const { return data->cart_id.get(); }
+CartUuid ShoppingCart::getCartUuid() const { return data->cart_id.getBytes(); }
+const OwnerID& ShoppingCart::getOwner() const { return data->owner_id; }
 std::map <std::string, int> ShoppingCart::getItems() const {
+		CART_METRIC_CALL(GET_ITEMS);
 		std::map <std::string, int> copied_items;
 		for (const auto& item : data->items) {
 			copied_items[item.first.get()] = item.second.get();
@@ -152,41 +216,382 @@ std::map <std::string, int> ShoppingCart::getItems() const {
 		return copied_items; 
 	}
 
+void ShoppingCart::visitItems(void (*visit)(void*, std::string_view, int), void* context) const {
+		for (const auto& item : data->items) {
+			visit(context, item.first.view(), item.second.get());
+		}
+	}
+
+void ShoppingCart::visitLines(void (*visit)(void*, ItemId, int), void* context) const {
+		for (const auto& item : data->items) {
+			visit(context, item.first.getId(), item.second.get());
+		}
+	}
+
+size_t ShoppingCart::itemCount() const { return data->items.size(); }
+
+void ShoppingCart::appendLines(std::vector<ItemId>& items, std::vector<int32_t>& quantities) const {
+		size_t at = items.size();
+		items.resize(at + data->items.size());
+		quantities.resize(at + data->items.size());
+		for (const auto& item : data->items) {
+			items[at] = item.first.getId();
+			quantities[at] = item.second.get();
+			++at;
+		}
+	}
+
 void ShoppingCart::addItem(const std::string item_name, int amount) {
-		ItemName item(item_name);
-		Quantity quantity(amount);
+		tryAddItem(item_name, amount).value();
+	}
+
+void ShoppingCart::updateItem(const std::string item_name, int amount) {
+		tryUpdateItem(item_name, amount).value();
+	}
+
+void ShoppingCart::removeItem(const std::string item_name) {
+		tryRemoveItem(item_name).value();
+	}
+
+void ShoppingCart::applyBatch(std::span<const CartOp> ops) {
+		tryApplyBatch(ops).value();
+	}
+
+void ShoppingCart::mergeFrom(const ShoppingCart& other, MergePolicy policy) {
+		tryMergeFrom(other, policy).value();
+	}
+
+CartResult<void> ShoppingCart::tryAddItem(std::string_view item_name, int amount) {
+		CART_METRIC_CALL(ADD_ITEM);
+		if (CartError error = Quantity::check(amount); error != CartError::None) {
+			return error;
+		}
 		// Only add an item if it exists in the catalog
-		std::ignore = Catalog::getItem(item_name);
+		Catalog::Reader catalog;
+		auto found = catalog->lookup(item_name);
+		if (!found) {
+			CART_METRIC_FAILURE(UNKNOWN_ITEM);
+			return CartError::UnknownItem;
+		}
+		auto entry = *found;
 		// If the item already exists, add the quantity to the existing quantity.
-		if (data->items.find(item) != data->items.end()) {
-			data->items[item] = Quantity(data->items[item].get() + quantity.get());
+		auto position = data->items.lower_bound(entry.id);
+		bool present = position != data->items.end() && position->first.getId() == entry.id;
+		int total = present ? position->second.get() + amount : amount;
+		if (CartError error = Quantity::check(total); error != CartError::None) {
+			return error;
+		}
+		size_t index = position - data->items.begin();
+		LineStorage& items = mutableData().items;
+		if (present) {
+			items.begin()[index].second = Quantity::checked(total);
 		}
 		else {
-			data->items[item] = quantity;
+			items.insert(items.begin() + index, ItemName(entry.id), Quantity::checked(amount));
 		}
-    }
+		adjustTotal(catalog, entry.id, amount);
+		data->changed(entry.id, total - amount, total);
+		return {};
+	}
 
-void ShoppingCart::updateItem(const std::string item_name, int amount) {
-		ItemName item(item_name);
-		Quantity quantity(amount);
-		if (data->items.find(item) == data->items.end()) {
-			throw std::invalid_argument("Cannot update an item not present in cart");
+CartResult<void> ShoppingCart::tryUpdateItem(std::string_view item_name, int amount) {
+		CART_METRIC_CALL(UPDATE_ITEM);
+		if (CartError error = Quantity::check(amount); error != CartError::None) {
+			return error;
+		}
+		Catalog::Reader catalog;
+		auto found = data->findLine(catalog, item_name);
+		if (found == data->items.end()) {
+			CART_METRIC_FAILURE(ITEM_NOT_IN_CART);
+			return CartError::UpdatedItemNotInCart;
 		}
-		data->items[item] = quantity;
+		size_t index = found - data->items.begin();
+		auto position = mutableData().items.begin() + index;
+		int previous = position->second.get();
+		position->second = Quantity::checked(amount);
+		adjustTotal(catalog, position->first.getId(), amount - previous);
+		data->changed(position->first.getId(), previous, amount);
+		return {};
 	}
 
-void ShoppingCart::removeItem(const std::string item_name) {
-		ItemName item(item_name);
-		if (data->items.find(item) == data->items.end()) {
-			throw std::invalid_argument("Cannot remove an item not present in cart");
+CartResult<void> ShoppingCart::tryRemoveItem(std::string_view item_name) {
+		CART_METRIC_CALL(REMOVE_ITEM);
+		Catalog::Reader catalog;
+		auto found = data->findLine(catalog, item_name);
+		if (found == data->items.end()) {
+			CART_METRIC_FAILURE(ITEM_NOT_IN_CART);
+			return CartError::RemovedItemNotInCart;
+		}
+		size_t index = found - data->items.begin();
+		LineStorage& items = mutableData().items;
+		int previous = items.begin()[index].second.get();
+		ItemId item = items.begin()[index].first.getId();
+		items.erase(items.begin() + index);
+		adjustTotal(catalog, item, -previous);
+		data->changed(item, previous, 0);
+		return {};
+	}
+
+CartResult<void> ShoppingCart::tryApplyBatch(std::span<const CartOp> ops) {
+		CART_METRIC_CALL(APPLY_BATCH);
+		// The state of one distinct item while the batch is checked.
+		struct Line {
+			std::string_view name;
+			size_t index;
+			std::optional<CatalogSnapshot::Entry> entry;
+			bool was_present;
+			int initial;
+			bool present;
+			int quantity;
+		};
+		Catalog::Reader catalog;
+
+		// Look up every distinct item once, in the cart and in the catalog. Small batches find
+		// repeated items with a linear scan; larger ones sort the operations by item first.
+		std::vector<Line> lines;
+		std::vector<size_t> line_of(ops.size());
+		auto lookUp = [&](std::string_view name) {
+			auto position = data->findLine(catalog, name);
+			bool present = position != data->items.end();
+			int quantity = present ? position->second.get() : 0;
+			lines.push_back({ name, (size_t)(position - data->items.begin()), catalog->lookup(name), present, quantity, present, quantity });
+			return lines.size() - 1;
+		};
+		if (ops.size() <= SMALL_BATCH) {
+			lines.reserve(ops.size());
+			for (size_t i = 0; i < ops.size(); ++i) {
+				auto line = std::find_if(lines.begin(), lines.end(), [&](const Line& line) { return line.name == ops[i].item_name; });
+				line_of[i] = line != lines.end() ? line - lines.begin() : lookUp(ops[i].item_name);
+			}
+		}
+		else {
+			std::vector<size_t> order(ops.size());
+			for (size_t i = 0; i < ops.size(); ++i) {
+				order[i] = i;
+			}
+			std::sort(order.begin(), order.end(), [&ops](size_t a, size_t b) { return ops[a].item_name < ops[b].item_name; });
+			for (size_t i : order) {
+				line_of[i] = !lines.empty() && lines.back().name == ops[i].item_name ? lines.size() - 1 : lookUp(ops[i].item_name);
+			}
+		}
+
+		// Check the whole batch in order before touching the cart.
+		for (size_t i = 0; i < ops.size(); ++i) {
+			Line& line = lines[line_of[i]];
+			switch (ops[i].kind) {
+			case CartOp::Kind::Add: {
+				if (CartError error = Quantity::check(ops[i].amount); error != CartError::None) {
+					return error;
+				}
+				if (!line.entry) {
+					CART_METRIC_FAILURE(UNKNOWN_ITEM);
+					return CartError::UnknownItem;
+				}
+				int total = (line.present ? line.quantity : 0) + ops[i].amount;
+				if (CartError error = Quantity::check(total); error != CartError::None) {
+					return error;
+				}
+				line.quantity = total;
+				line.present = true;
+				break;
+			}
+			case CartOp::Kind::Update: {
+				if (CartError error = Quantity::check(ops[i].amount); error != CartError::None) {
+					return error;
+				}
+				if (!line.present) {
+					CART_METRIC_FAILURE(ITEM_NOT_IN_CART);
+					return CartError::UpdatedItemNotInCart;
+				}
+				line.quantity = ops[i].amount;
+				break;
+			}
+			case CartOp::Kind::Remove:
+				if (!line.present) {
+					CART_METRIC_FAILURE(ITEM_NOT_IN_CART);
+					return CartError::RemovedItemNotInCart;
+				}
+				line.present = false;
+				line.quantity = 0;
+				break;
+			}
+		}
+
+		// Nothing can fail from here on. Quantities change in place; if lines were added or removed,
+		// the storage is rebuilt in one merge of the old lines with the new ones sorted by id.
+		LineStorage& items = mutableData().items;
+		std::vector<const Line*> added;
+		bool removed = false;
+		for (Line& line : lines) {
+			ItemId item = 0;
+			if (line.was_present) {
+				auto position = items.begin() + line.index;
+				item = position->first.getId();
+				// A quantity of 0 marks the line for removal below.
+				position->second = line.present ? Quantity::checked(line.quantity) : Quantity();
+				removed = removed || !line.present;
+			}
+			else if (line.present) {
+				item = line.entry->id;
+				added.push_back(&line);
+			}
+			if (line.quantity != line.initial) {
+				adjustTotal(catalog, item, line.quantity - line.initial);
+				data->changed(item, line.initial, line.quantity);
+			}
+		}
+		if (added.empty() && !removed) {
+			return {};
+		}
+		std::sort(added.begin(), added.end(), [](const Line* a, const Line* b) { return a->entry->id < b->entry->id; });
+		LineStorage merged;
+		merged.reserve(items.size() + added.size());
+		auto next_added = added.begin();
+		for (const auto& item : items) {
+			for (; next_added != added.end() && (*next_added)->entry->id < item.first; ++next_added) {
+				merged.push_back(ItemName((*next_added)->entry->id), Quantity::checked((*next_added)->quantity));
+			}
+			if (item.second.get() != 0) {
+				merged.push_back(item.first, item.second);
+			}
+		}
+		for (; next_added != added.end(); ++next_added) {
+			merged.push_back(ItemName((*next_added)->entry->id), Quantity::checked((*next_added)->quantity));
+		}
+		items = std::move(merged);
+		return {};
+	}
+
+CartResult<void> ShoppingCart::tryMergeFrom(const ShoppingCart& other, MergePolicy policy) {
+		CART_METRIC_CALL(MERGE);
+		const LineStorage& ours = data->items;
+		const LineStorage& theirs = other.data->items;
+		if (theirs.empty()) {
+			return {};
+		}
+		// Both line sets are sorted by item id, so one walk over the two builds the result. It
+		// only replaces the cart's lines once every line has been combined.
+		Catalog::Reader catalog;
+		std::optional<int64_t> cached = priced_total.get(catalog->version);
+		bool priced = cached.has_value();
+		int64_t total_change = 0;
+		LineStorage merged;
+		merged.reserve(ours.size() + theirs.size());
+		auto mine = ours.begin();
+		for (auto their = theirs.begin(); their != theirs.end(); ++their) {
+			for (; mine != ours.end() && mine->first < their->first; ++mine) {
+				merged.push_back(mine->first, mine->second);
+			}
+			bool held = mine != ours.end() && mine->first.getId() == their->first.getId();
+			int before = held ? mine->second.get() : 0;
+			int after = their->second.get();
+			if (held) {
+				switch (policy) {
+				case MergePolicy::Sum:
+					after += before;
+					if (CartError error = Quantity::check(after); error != CartError::None) {
+						return error;
+					}
+					break;
+				case MergePolicy::Clamp:
+					after = std::min(after + before, 99);
+					break;
+				case MergePolicy::Keep:
+					after = before;
+					break;
+				}
+				++mine;
+			}
+			merged.push_back(their->first, Quantity::checked(after));
+			if (priced && after != before) {
+				auto price = catalog->priceOf(their->first.getId());
+				priced = price.has_value();
+				total_change += price.value_or(0) * (after - before);
+			}
+		}
+		for (; mine != ours.end(); ++mine) {
+			merged.push_back(mine->first, mine->second);
+		}
+
+		// Nothing can fail from here on.
+		if (CartEvents::enabled()) {
+			auto old_line = ours.begin();
+			for (const auto& line : merged) {
+				bool held = old_line != ours.end() && old_line->first.getId() == line.first.getId();
+				int before = held ? (old_line++)->second.get() : 0;
+				if (line.second.get() != before) {
+					data->changed(line.first.getId(), before, line.second.get());
+				}
+			}
+		}
+		if (data->references.load(std::memory_order_acquire) == 1) {
+			data->items = std::move(merged);
+		}
+		else {
+			// Shared data would be copied by mutableData only to have its lines replaced.
+			ShoppingCartData* fresh = new ShoppingCartData(data->owner_id, data->cart_id, std::move(merged));
+			release();
+			data = fresh;
+		}
+		if (priced) {
+			priced_total.set(*cached + total_change, catalog->version);
+		}
+		else {
+			priced_total.invalidate();
 		}
-		data->items.erase(item);
+		return {};
+	}
+
+Money ShoppingCart::getTotal() const {
+		return tryGetTotal().value();
+	}
+
+CartResult<Money> ShoppingCart::tryGetTotal() const {
+		CART_METRIC_CALL(GET_TOTAL);
+		// Common case: nothing has been repriced since the last mutation, so the total is a field read.
+		if (std::optional<int64_t> cents = priced_total.get(Catalog::version())) {
+			return Money(*cents);
+		}
+		// Price every line against the same snapshot, even if the catalog is reloaded meanwhile.
+		Catalog::Reader catalog;
+		return total(catalog);
 	}
 
 double ShoppingCart::getTotalCost() const {
-		double total = 0.0;
-		for (const auto& item : data->items) {
-			total += (double)item.second.get() * Catalog::getItem(item.first.get()).second;
+		return getTotal().toDouble();
+	}
+
+Money ShoppingCart::getDiscountedTotal(const PromotionPlan& promotions) const {
+		return tryGetDiscountedTotal(promotions).value();
+	}
+
+CartResult<Money> ShoppingCart::tryGetDiscountedTotal(const PromotionPlan& promotions) const {
+		CART_METRIC_CALL(GET_DISCOUNTED_TOTAL);
+		Catalog::Reader catalog;
+		CartResult<Money> total = this->total(catalog);
+		if (!total) {
+			return total.error();
+		}
+		return *total - promotions.discount(*this, catalog.snapshot());
+	}
+
+ShoppingCart ShoppingCart::restore(std::wstring_view owner_id, const CartUuid& id, std::span<const CartLine> lines) {
+		LineStorage items;
+		items.reserve(lines.size());
+		for (const CartLine& line : lines) {
+			Quantity quantity(line.quantity);
+			if (line.item >= ItemRegistry::size()) {
+				throw std::out_of_range("Unknown item id");
+			}
+			items.push_back(ItemName(line.item), quantity);
+		}
+		// Restored lines usually arrive in id order already.
+		if (!std::is_sorted(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; })) {
+			std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
 		}
-		return total;
-	}
\ No newline at end of file
+		if (std::adjacent_find(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first.getId() == b.first.getId(); }) != items.end()) {
+			throw std::invalid_argument("Duplicate item in cart");
+		}
+		// Priced against no catalog yet, so the first getTotal computes the total.
+		return ShoppingCart(new ShoppingCartData(OwnerID(owner_id), CartID(id), std::move(items)));
+	}
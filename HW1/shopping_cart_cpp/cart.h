@@ -1,11 +1,52 @@
-#pragma once
+﻿#pragma once
+#include "cart_id.h"
+#include "cart_result.h"
+#include "item_registry.h"
+#include "money.h"
+#include "owner_id.h"
+#include <atomic>
 #include <map>
 #include <string>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace Catalog {
+	class Reader;
+}
+class PromotionPlan;
+
+// One operation in a ShoppingCart::applyBatch call. The item name is not copied, so it only
+// has to stay valid for the duration of the call.
+struct CartOp {
+	enum class Kind { Add, Update, Remove };
+	Kind kind;
+	std::string_view item_name;
+	int amount = 0;
+};
+
+// How ShoppingCart::mergeFrom combines an item both carts hold.
+enum class MergePolicy {
+	// Add the quantities. The merge fails, changing nothing, if any sum is over 99.
+	Sum,
+	// Add the quantities, capping each at 99.
+	Clamp,
+	// Keep this cart's quantity.
+	Keep,
+};
+
+// One line of a cart by item registry id, as persisted in snapshots.
+struct CartLine {
+	ItemId item;
+	int quantity;
+};
 
 class ShoppingCart {
 public:
-	ShoppingCart(const std::wstring& owner_id);
+	ShoppingCart(std::wstring_view owner_id);
 	~ShoppingCart(); // Rule of Five
 	ShoppingCart(const ShoppingCart& other);
 	ShoppingCart(ShoppingCart&& other) noexcept;
@@ -14,13 +55,146 @@ public:
 
 	std::wstring getId() const;
 	std::string getCartId() const;
+	CartUuid getCartUuid() const;
+	const OwnerID& getOwner() const;
 	std::map <std::string, int> getItems() const;
+	// Calls visitor(std::string_view item_name, int quantity) for every line, in item id order,
+	// without copying or allocating. The names stay valid for the life of the process.
+	template <typename Visitor>
+	void forEachItem(Visitor&& visitor) const {
+		visitItems([](void* context, std::string_view item_name, int quantity) {
+			(*static_cast<std::remove_reference_t<Visitor>*>(context))(item_name, quantity);
+		}, const_cast<void*>(static_cast<const void*>(std::addressof(visitor))));
+	}
+	// Calls visitor(ItemId item, int quantity) for every line, in item id order.
+	template <typename Visitor>
+	void forEachLine(Visitor&& visitor) const {
+		visitLines([](void* context, ItemId item, int quantity) {
+			(*static_cast<std::remove_reference_t<Visitor>*>(context))(item, quantity);
+		}, const_cast<void*>(static_cast<const void*>(std::addressof(visitor))));
+	}
+	size_t itemCount() const;
+	// Whether the cart was moved from. Such a cart has no id, owner or lines, and can only be
+	// assigned to or destroyed.
+	bool isMovedFrom() const { return data == nullptr; }
+	// Appends the lines, in item id order, to columns of item ids and quantities.
+	void appendLines(std::vector<ItemId>& items, std::vector<int32_t>& quantities) const;
 	void addItem(const std::string item_name, int amount);
 	void updateItem(const std::string item_name, int amount);
 	void removeItem(const std::string item_name);
+	// Applies the operations in order, as if by the matching single calls, but all or nothing:
+	// if any of them would throw, the cart is left unchanged and that exception is thrown.
+	void applyBatch(std::span<const CartOp> ops);
+	// Adds the other cart's lines to this one, as when a guest's cart is merged into the cart
+	// the owner saved. All or nothing. Lines are only ever added or raised, and items from the
+	// other cart are taken as already checked, so the catalog is not consulted for them.
+	void mergeFrom(const ShoppingCart& other, MergePolicy policy);
+	Money getTotal() const;
 	double getTotalCost() const;
+	// The total less what the promotions take off, both priced against one catalog snapshot.
+	Money getDiscountedTotal(const PromotionPlan& promotions) const;
+
+	// The same operations, returning the error instead of throwing it; the throwing ones above
+	// call these. A cart is left unchanged when they fail.
+	static CartResult<ShoppingCart> tryCreate(std::wstring_view owner_id);
+	CartResult<void> tryAddItem(std::string_view item_name, int amount);
+	CartResult<void> tryUpdateItem(std::string_view item_name, int amount);
+	CartResult<void> tryRemoveItem(std::string_view item_name);
+	CartResult<void> tryApplyBatch(std::span<const CartOp> ops);
+	CartResult<void> tryMergeFrom(const ShoppingCart& other, MergePolicy policy);
+	CartResult<Money> tryGetTotal() const;
+	CartResult<Money> tryGetDiscountedTotal(const PromotionPlan& promotions) const;
+
+	// Rebuilds a persisted cart with its original id. The lines may come in any order; they are
+	// checked as addItem would check them, except that the items need not be in the catalog.
+	static ShoppingCart restore(std::wstring_view owner_id, const CartUuid& id, std::span<const CartLine> lines);
 private:
-	// Using the pimpl idiom: https://herbsutter.com/gotw/_100/
 	struct ShoppingCartData;
-	std::unique_ptr<ShoppingCartData> data;
+	explicit ShoppingCart(ShoppingCartData* data);
+
+	void visitItems(void (*visit)(void*, std::string_view, int), void* context) const;
+	void visitLines(void (*visit)(void*, ItemId, int), void* context) const;
+	// Copies of large carts share their data until one of them changes. Every mutation goes
+	// through mutableData, which clones the data first if another cart still shares it.
+	ShoppingCartData* share() const;
+	ShoppingCartData& mutableData();
+	void release();
+	void adjustTotal(const Catalog::Reader& catalog, ItemId item, int64_t quantity_change);
+	CartResult<Money> total(const Catalog::Reader& catalog) const;
+
+	// A total in cents and the catalog version it was priced against, always read and written
+	// as a pair. Const calls on one cart may refresh it from several threads at once, so it is
+	// a sequence lock: readers that overlap a write see no total, and a const caller that finds
+	// another thread writing leaves the total to it. Mutations, which own the cart, write it
+	// without the atomic exchange.
+	class PricedTotal {
+	public:
+		PricedTotal() = default;
+		PricedTotal(const PricedTotal& other) { copyFrom(other); }
+		PricedTotal& operator=(const PricedTotal& other) {
+			copyFrom(other);
+			return *this;
+		}
+
+		// The total, if it was priced against this version.
+		std::optional<int64_t> get(uint64_t version) const {
+			int64_t cents;
+			uint64_t priced;
+			if (!load(cents, priced) || priced != version) {
+				return std::nullopt;
+			}
+			return cents;
+		}
+		void set(int64_t cents, uint64_t version) {
+			uint32_t current = sequence.load(std::memory_order_relaxed);
+			sequence.store(current + 1, std::memory_order_relaxed);
+			store(current, cents, version);
+		}
+		void invalidate() { set(0, 0); }
+		// Like set, from a const call: skipped if another thread is setting it.
+		void trySet(int64_t cents, uint64_t version) const {
+			uint32_t current = sequence.load(std::memory_order_relaxed);
+			if ((current & 1) == 0 && sequence.compare_exchange_strong(current, current + 1, std::memory_order_relaxed)) {
+				store(current, cents, version);
+			}
+		}
+	private:
+		bool load(int64_t& cents, uint64_t& version) const {
+			uint32_t before = sequence.load(std::memory_order_acquire);
+			cents = total_cents.load(std::memory_order_relaxed);
+			version = priced_version.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			return (before & 1) == 0 && sequence.load(std::memory_order_relaxed) == before;
+		}
+		void store(uint32_t before, int64_t cents, uint64_t version) const {
+			std::atomic_thread_fence(std::memory_order_release);
+			total_cents.store(cents, std::memory_order_relaxed);
+			priced_version.store(version, std::memory_order_relaxed);
+			sequence.store(before + 2, std::memory_order_release);
+		}
+		void copyFrom(const PricedTotal& other) {
+			int64_t cents;
+			uint64_t version;
+			if (other.load(cents, version)) {
+				set(cents, version);
+			}
+			else {
+				invalidate();
+			}
+		}
+
+		// Odd while a write is in progress.
+		mutable std::atomic<uint32_t> sequence = 0;
+		mutable std::atomic<int64_t> total_cents = 0;
+		mutable std::atomic<uint64_t> priced_version = 0;
+	};
+
+	// Using the pimpl idiom: https://herbsutter.com/gotw/_100/
+	// The data is reference counted and copied on write, so copying a cart costs the same
+	// however many lines it has.
+	ShoppingCartData* data;
+	// Running total, kept up to date by every mutation. It is only valid for the catalog
+	// version it was priced against; version 0 means it must be recomputed. It lives in each
+	// copy rather than the shared data, so copies never write to each other's cache.
+	PricedTotal priced_total;
 };
\ No newline at end of file
@@ -0,0 +1,68 @@
+#include "cart_client.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+	constexpr size_t READ_SIZE = 64 * 1024;
+}
+
+CartClient::CartClient(const std::string& path) {
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+		throw std::invalid_argument("Invalid socket path");
+	}
+	std::memcpy(address.sun_path, path.data(), path.size());
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		throw std::runtime_error("Cannot create cart client socket");
+	}
+	if (connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+		::close(fd);
+		throw std::runtime_error("Cannot connect to cart server");
+	}
+}
+
+CartClient::~CartClient() {
+	::close(fd);
+}
+
+void CartClient::send(std::string_view frames) {
+	while (!frames.empty()) {
+		ssize_t sent = ::send(fd, frames.data(), frames.size(), MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw std::runtime_error("Cannot write to cart server");
+		}
+		frames.remove_prefix((size_t)sent);
+	}
+}
+
+CartProtocol::Frame CartClient::receive() {
+	CartProtocol::Frame frame;
+	for (;;) {
+		size_t size = CartProtocol::parseFrame(std::string_view(buffer).substr(start), frame);
+		if (size != 0) {
+			start += size;
+			return frame;
+		}
+		buffer.erase(0, start);
+		start = 0;
+		size_t held = buffer.size();
+		buffer.resize(held + READ_SIZE);
+		ssize_t got = ::recv(fd, buffer.data() + held, READ_SIZE, 0);
+		if (got < 0 && errno != EINTR) {
+			throw std::runtime_error("Cannot read from cart server");
+		}
+		if (got == 0) {
+			throw std::runtime_error("Cart server closed the connection");
+		}
+		buffer.resize(held + (got > 0 ? (size_t)got : 0));
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "cart_protocol.h"
+#include <string>
+#include <string_view>
+
+// A blocking connection to a CartServer, for tools and tests. Not thread-safe; give each thread
+// its own. Linux only, as CartServer is.
+class CartClient {
+public:
+	// Throws std::runtime_error if the server cannot be reached.
+	explicit CartClient(const std::string& path);
+	~CartClient();
+	CartClient(const CartClient&) = delete;
+	CartClient& operator=(const CartClient&) = delete;
+
+	// Writes the frames, all of them, with as few writes as the socket allows.
+	void send(std::string_view frames);
+	// Waits for the next response. Its body stays valid until the next call. Throws
+	// std::runtime_error if the server closes the connection.
+	CartProtocol::Frame receive();
+private:
+	int fd;
+	std::string buffer;
+	// Where the unread part of the buffer starts.
+	size_t start = 0;
+};
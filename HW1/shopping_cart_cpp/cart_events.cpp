@@ -0,0 +1,216 @@
+#include "cart_events.h"
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace CartEvents {
+	std::atomic<bool> publishing = false;
+	constinit thread_local DeferralState deferral_state;
+
+	namespace {
+		// A single-producer, single-consumer ring. The producer owns tail and the counters, the
+		// consumer owns head, and each keeps a stale copy of the other's index so it only
+		// touches the other's cache line when the ring looks full or empty.
+		class EventRing {
+		public:
+			EventRing(size_t capacity, Overflow overflow)
+				: overflow(overflow), slots(std::bit_ceil(std::max<size_t>(capacity, 1))), mask(slots.size() - 1) {}
+
+			bool push(const CartEvent& event) {
+				uint64_t position = tail.load(std::memory_order_relaxed);
+				if (position - cached_head == slots.size()) {
+					cached_head = head.load(std::memory_order_acquire);
+					if (position - cached_head == slots.size()) {
+						return false;
+					}
+				}
+				slots[position & mask] = event;
+				tail.store(position + 1, std::memory_order_release);
+				return true;
+			}
+
+			size_t pop(std::span<CartEvent> into) {
+				uint64_t position = head.load(std::memory_order_relaxed);
+				if (cached_tail == position) {
+					cached_tail = tail.load(std::memory_order_acquire);
+				}
+				size_t count = (size_t)std::min<uint64_t>(cached_tail - position, into.size());
+				for (size_t i = 0; i < count; ++i) {
+					into[i] = slots[(position + i) & mask];
+				}
+				head.store(position + count, std::memory_order_release);
+				return count;
+			}
+
+			bool empty() const {
+				return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_acquire);
+			}
+
+			// Only the producer writes these; counters() reads them meanwhile.
+			static void bump(std::atomic<uint64_t>& counter) {
+				counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+			}
+			void addTo(Counters& totals) const {
+				totals.published += published.load(std::memory_order_relaxed);
+				totals.dropped += dropped.load(std::memory_order_relaxed);
+				totals.waits += waits.load(std::memory_order_relaxed);
+			}
+
+			const Overflow overflow;
+			std::atomic<uint64_t> published = 0;
+			std::atomic<uint64_t> dropped = 0;
+			std::atomic<uint64_t> waits = 0;
+			// Set by the producer when it will push no more: it exited, or the feed restarted.
+			std::atomic<bool> retired = false;
+		private:
+			std::vector<CartEvent> slots;
+			const uint64_t mask;
+			alignas(64) std::atomic<uint64_t> tail = 0;
+			uint64_t cached_head = 0;
+			alignas(64) std::atomic<uint64_t> head = 0;
+			uint64_t cached_tail = 0;
+		};
+
+		struct Feed {
+			std::mutex mutex;
+			std::vector<std::shared_ptr<EventRing>> rings;
+			// Counters of rings that were drained and freed.
+			Counters freed;
+			size_t capacity = CART_EVENT_RING;
+			Overflow overflow = Overflow::Drop;
+			std::atomic<uint64_t> generation = 0;
+			// Where the next drain starts, so no thread's ring is always drained last.
+			size_t next_ring = 0;
+		};
+
+		// Never destroyed, so threads that exit during static destruction can still retire.
+		Feed& feed() {
+			static Feed* instance = new Feed;
+			return *instance;
+		}
+
+		// The calling thread's ring, replaced when the feed is restarted.
+		struct ProducerSlot {
+			std::shared_ptr<EventRing> ring;
+			uint64_t generation = 0;
+			~ProducerSlot() {
+				if (ring) {
+					ring->retired.store(true, std::memory_order_release);
+				}
+			}
+		};
+
+		// Events the thread held back inside a Deferral, oldest first.
+		thread_local std::vector<CartEvent> held_events;
+
+		// Pushes the event, dropping it if the ring is full under Overflow::Drop. Under
+		// Overflow::Block waits for room, unless may_wait is false, in which case it returns
+		// false and leaves the event to the caller. Gives up and drops it if the feed stops.
+		bool deliver(EventRing& ring, const CartEvent& event, bool may_wait) {
+			if (!ring.push(event)) {
+				if (ring.overflow == Overflow::Drop) {
+					EventRing::bump(ring.dropped);
+					return true;
+				}
+				if (!may_wait) {
+					return false;
+				}
+				EventRing::bump(ring.waits);
+				while (!ring.push(event)) {
+					if (!enabled()) {
+						EventRing::bump(ring.dropped);
+						return true;
+					}
+					std::this_thread::yield();
+				}
+			}
+			EventRing::bump(ring.published);
+			return true;
+		}
+
+		EventRing& producerRing() {
+			thread_local ProducerSlot slot;
+			Feed& all = feed();
+			uint64_t generation = all.generation.load(std::memory_order_acquire);
+			if (!slot.ring || slot.generation != generation) {
+				std::lock_guard lock(all.mutex);
+				if (slot.ring) {
+					slot.ring->retired.store(true, std::memory_order_release);
+				}
+				slot.ring = std::make_shared<EventRing>(all.capacity, all.overflow);
+				slot.generation = all.generation.load(std::memory_order_relaxed);
+				all.rings.push_back(slot.ring);
+			}
+			return *slot.ring;
+		}
+	}
+
+	void start(size_t capacity, Overflow overflow) {
+		Feed& all = feed();
+		{
+			std::lock_guard lock(all.mutex);
+			all.capacity = capacity;
+			all.overflow = overflow;
+			all.generation.fetch_add(1, std::memory_order_release);
+		}
+		publishing.store(true, std::memory_order_release);
+	}
+
+	void stop() {
+		publishing.store(false, std::memory_order_release);
+	}
+
+	void publish(CartEvent event) {
+		event.timestamp = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		EventRing& ring = producerRing();
+		// Once one event is held back, the rest queue behind it so they stay in order.
+		if (deferral_state.holding || !deliver(ring, event, deferral_state.depth == 0)) {
+			held_events.push_back(event);
+			deferral_state.holding = true;
+		}
+	}
+
+	void pushHeld() {
+		EventRing& ring = producerRing();
+		for (const CartEvent& event : held_events) {
+			deliver(ring, event, true);
+		}
+		held_events.clear();
+		deferral_state.holding = false;
+	}
+
+	size_t drain(std::span<CartEvent> into) {
+		Feed& all = feed();
+		std::lock_guard lock(all.mutex);
+		size_t drained = 0;
+		size_t rings = all.rings.size();
+		for (size_t i = 0; i < rings && drained < into.size(); ++i) {
+			drained += all.rings[(all.next_ring + i) % rings]->pop(into.subspan(drained));
+		}
+		all.next_ring = rings == 0 ? 0 : (all.next_ring + 1) % rings;
+		// A retired ring gets no more events, so once it is empty it can go.
+		std::erase_if(all.rings, [&all](const std::shared_ptr<EventRing>& ring) {
+			if (!ring->retired.load(std::memory_order_acquire) || !ring->empty()) {
+				return false;
+			}
+			ring->addTo(all.freed);
+			return true;
+		});
+		return drained;
+	}
+
+	Counters counters() {
+		Feed& all = feed();
+		std::lock_guard lock(all.mutex);
+		Counters totals = all.freed;
+		for (const auto& ring : all.rings) {
+			ring->addTo(totals);
+		}
+		return totals;
+	}
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "cart_id.h"
+#include "item_registry.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// An opt-in feed of every change to a cart line, for consumers such as analytics that must not
+// slow down the cart itself. Each thread that changes carts pushes fixed-size events into a ring
+// of its own, which only it writes and only the consumer reads, so publishing takes no lock and
+// no read-modify-write atomic. The consumer drains every thread's ring in batches.
+//
+// While the feed is stopped, which it is until start is called, a mutation pays one relaxed load.
+
+#define CART_EVENT_RING 4096
+
+// One line of one cart changed. A new line has old_quantity 0, a removed one new_quantity 0.
+struct CartEvent {
+	// Nanoseconds since the Unix epoch.
+	uint64_t timestamp;
+	CartUuid cart;
+	ItemId item;
+	int16_t old_quantity;
+	int16_t new_quantity;
+};
+static_assert(sizeof(CartEvent) == 32, "two events per cache line");
+
+namespace CartEvents {
+	// What a thread does when its ring is full: drop the event and count it, or wait for the
+	// consumer to make room. Waiting stalls cart operations on that thread until the consumer
+	// catches up, or until the feed is stopped.
+	//
+	// A thread must not wait while it holds a lock the consumer may need, or neither gets on.
+	// Inside CartStore::update, which holds the cart's locks, events that find the ring full are
+	// held back instead, and pushed, waiting if need be, once update has released the locks.
+	// Code that changes carts under locks of its own should do the same with a Deferral.
+	enum class Overflow { Drop, Block };
+
+	struct Counters {
+		uint64_t published = 0;
+		uint64_t dropped = 0;
+		// Times a thread found its ring full and waited, under Overflow::Block.
+		uint64_t waits = 0;
+	};
+
+	// Starts the feed, or restarts it with new settings. Each thread's ring holds capacity
+	// events, rounded up to a power of two. Rings from before a restart are drained before they
+	// are freed.
+	void start(size_t capacity = CART_EVENT_RING, Overflow overflow = Overflow::Drop);
+	// Stops publishing. Events already published can still be drained, and threads waiting for
+	// room give up and drop their event.
+	void stop();
+
+	// Moves up to into.size() of the oldest events into into and returns how many it moved.
+	// Events from one thread come out in the order they were published; events from different
+	// threads are interleaved by ring, not by time. Calls from several threads are serialized.
+	size_t drain(std::span<CartEvent> into);
+
+	// Totals over every thread since the process started.
+	Counters counters();
+
+	extern std::atomic<bool> publishing;
+	inline bool enabled() { return publishing.load(std::memory_order_relaxed); }
+	// Called by ShoppingCart only while enabled; stamps the event with the current time.
+	void publish(CartEvent event);
+
+	// How many Deferrals the thread is inside, and whether it has events held back.
+	struct DeferralState {
+		unsigned depth = 0;
+		bool holding = false;
+	};
+	extern constinit thread_local DeferralState deferral_state;
+	// Pushes the events held back while the thread was inside a Deferral, in order.
+	void pushHeld();
+
+	// While one is alive, events this thread would have to wait to publish are held back, in
+	// order, and pushed when the outermost one ends. Create it before taking the locks it covers,
+	// so that it ends after they are released. Costs a thread-local increment and decrement.
+	class Deferral {
+	public:
+		Deferral() { ++deferral_state.depth; }
+		~Deferral() {
+			if (--deferral_state.depth == 0 && deferral_state.holding) {
+				pushHeld();
+			}
+		}
+		Deferral(const Deferral&) = delete;
+		Deferral& operator=(const Deferral&) = delete;
+	};
+}
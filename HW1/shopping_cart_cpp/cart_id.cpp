@@ -0,0 +1,112 @@
+#include "cart_id.h"
+#include <atomic>
+#include <cstring>
+#include <random>
+#include <thread>
+
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define CART_ID_SIMD_HEX 1
+#endif
+
+namespace {
+	uint64_t splitmix64(uint64_t& state) {
+		uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+		return z ^ (z >> 31);
+	}
+
+	uint64_t rotl(uint64_t x, int k) {
+		return (x << k) | (x >> (64 - k));
+	}
+
+	// xoshiro256** (Blackman and Vigna), a small, fast generator with 256 bits of state.
+	// Source: https://prng.di.unimi.it/xoshiro256starstar.c
+	class Xoshiro256 {
+	public:
+		Xoshiro256() {
+			// Seed from system entropy once per thread, mixed with a process-wide counter so that
+			// threads never share a stream even if the entropy source repeats itself.
+			static std::atomic<uint64_t> streams{ 0 };
+			std::random_device rd;
+			uint64_t seed = ((uint64_t)rd() << 32) ^ rd();
+			seed ^= streams.fetch_add(1) * 0xd1b54a32d192ed03ULL;
+			seed ^= std::hash<std::thread::id>()(std::this_thread::get_id());
+			for (uint64_t& word : state) {
+				word = splitmix64(seed);
+			}
+		}
+		uint64_t next() {
+			uint64_t result = rotl(state[1] * 5, 7) * 9;
+			uint64_t t = state[1] << 17;
+			state[2] ^= state[0];
+			state[3] ^= state[1];
+			state[1] ^= state[2];
+			state[0] ^= state[3];
+			state[2] ^= t;
+			state[3] = rotl(state[3], 45);
+			return result;
+		}
+	private:
+		uint64_t state[4];
+	};
+
+	// Writes the 32 hex digits of the 16 bytes, two per byte.
+	void toHex(const CartUuid& bytes, char* out) {
+#ifdef CART_ID_SIMD_HEX
+		const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+		const __m128i low_nibble = _mm_set1_epi8(0x0f);
+		__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes.data()));
+		__m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(value, 4), low_nibble));
+		__m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(value, low_nibble));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_unpacklo_epi8(high, low));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), _mm_unpackhi_epi8(high, low));
+#else
+		// One table lookup per byte instead of one formatted write per digit.
+		static const struct HexTable {
+			char pairs[256][2];
+			HexTable() {
+				const char* digits = "0123456789abcdef";
+				for (int i = 0; i < 256; ++i) {
+					pairs[i][0] = digits[i >> 4];
+					pairs[i][1] = digits[i & 0x0f];
+				}
+			}
+		} table;
+		for (size_t i = 0; i < bytes.size(); ++i) {
+			std::memcpy(out + i * 2, table.pairs[bytes[i]], 2);
+		}
+#endif
+	}
+}
+
+CartID::CartID() {
+	thread_local Xoshiro256 generator;
+	uint64_t high = generator.next();
+	uint64_t low = generator.next();
+	std::memcpy(bytes.data(), &high, 8);
+	std::memcpy(bytes.data() + 8, &low, 8);
+	bytes[6] = (bytes[6] & 0x0f) | 0x40; // Version 4
+	bytes[8] = (bytes[8] & 0x3f) | 0x80; // Variant 1 (8-b)
+}
+
+void CartID::format(char* out) const {
+	char hex[32];
+	toHex(bytes, hex);
+	std::memcpy(out, hex, 8);
+	out[8] = '-';
+	std::memcpy(out + 9, hex + 8, 4);
+	out[13] = '-';
+	std::memcpy(out + 14, hex + 12, 4);
+	out[18] = '-';
+	std::memcpy(out + 19, hex + 16, 4);
+	out[23] = '-';
+	std::memcpy(out + 24, hex + 20, 12);
+}
+
+std::string CartID::get() const {
+	std::string id(36, '\0');
+	format(id.data());
+	return id;
+}
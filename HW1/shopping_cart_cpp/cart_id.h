@@ -0,0 +1,26 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <string>
+
+// The 16 raw bytes of a version 4 UUID.
+using CartUuid = std::array<uint8_t, 16>;
+
+// A random (version 4) UUID identifying a cart. Stored as raw bytes and only formatted as
+// "xxxxxxxx-xxxx-4xxx-[89ab]xxx-xxxxxxxxxxxx" when asked for.
+class CartID {
+public:
+	// Draws a new id from a per-thread generator. The generator is seeded from
+	// std::random_device once per thread, so creating carts never waits on system entropy.
+	CartID();
+	explicit CartID(const CartUuid& bytes) : bytes(bytes) {}
+
+	const CartUuid& getBytes() const { return bytes; }
+	std::string get() const;
+	// Writes the 36-character canonical form to out, without allocating.
+	void format(char* out) const;
+
+	bool operator==(const CartID& other) const = default;
+private:
+	CartUuid bytes;
+};
@@ -0,0 +1,176 @@
+#include "cart_metrics.h"
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace CartMetrics {
+	namespace {
+		const char* const OP_NAMES[OP_COUNT] = {
+			"construct", "copy", "add_item", "update_item", "remove_item", "apply_batch", "merge", "get_items", "get_total", "get_discounted_total"
+		};
+		const char* const FAILURE_NAMES[FAILURE_COUNT] = {
+			"unknown_item", "quantity_out_of_range", "item_not_in_cart", "invalid_owner_id"
+		};
+		// Upper bounds of the Prometheus histogram buckets, in nanoseconds.
+		const uint64_t BUCKET_BOUNDS[] = {
+			100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000,
+			10000000, 100000000, 1000000000
+		};
+
+#ifdef CART_METRICS
+		// One thread's counters. Only that thread writes them; snapshots read them meanwhile.
+		struct ThreadMetrics {
+			std::atomic<uint64_t> calls[OP_COUNT] = {};
+			LatencyHistogram latency[OP_COUNT];
+			std::atomic<uint64_t> errors[OP_COUNT] = {};
+			std::atomic<uint64_t> failures[FAILURE_COUNT] = {};
+			// All failures, read only by the owning thread.
+			uint64_t failure_total = 0;
+		};
+
+		void bump(std::atomic<uint64_t>& counter, uint64_t amount) {
+			counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+		}
+
+		void mergeInto(Snapshot& into, const ThreadMetrics& from) {
+			for (int op = 0; op < OP_COUNT; ++op) {
+				into.calls[op] += from.calls[op].load(std::memory_order_relaxed);
+				into.latency[op].merge(from.latency[op]);
+				into.errors[op] += from.errors[op].load(std::memory_order_relaxed);
+			}
+			for (int failure = 0; failure < FAILURE_COUNT; ++failure) {
+				into.failures[failure] += from.failures[failure].load(std::memory_order_relaxed);
+			}
+		}
+
+		struct Registry {
+			std::mutex mutex;
+			std::vector<const ThreadMetrics*> live;
+			// What threads that have exited recorded.
+			ThreadMetrics retired;
+		};
+
+		// Never destroyed, so threads that exit during static destruction can still retire.
+		Registry& registry() {
+			static Registry* instance = new Registry;
+			return *instance;
+		}
+
+		// Registers the thread's counters on first use, and folds them into the retired total
+		// when the thread exits.
+		struct ThreadSlot {
+			ThreadMetrics metrics;
+			ThreadSlot() {
+				Registry& all = registry();
+				std::lock_guard lock(all.mutex);
+				all.live.push_back(&metrics);
+			}
+			~ThreadSlot() {
+				Registry& all = registry();
+				std::lock_guard lock(all.mutex);
+				std::erase(all.live, &metrics);
+				for (int op = 0; op < OP_COUNT; ++op) {
+					bump(all.retired.calls[op], metrics.calls[op].load(std::memory_order_relaxed));
+					all.retired.latency[op].merge(metrics.latency[op]);
+					bump(all.retired.errors[op], metrics.errors[op].load(std::memory_order_relaxed));
+				}
+				for (int failure = 0; failure < FAILURE_COUNT; ++failure) {
+					bump(all.retired.failures[failure], metrics.failures[failure].load(std::memory_order_relaxed));
+				}
+			}
+		};
+
+		ThreadMetrics& local() {
+			thread_local ThreadSlot slot;
+			return slot.metrics;
+		}
+#endif
+	}
+
+	const char* opName(Op op) { return OP_NAMES[op]; }
+	const char* failureName(Failure failure) { return FAILURE_NAMES[failure]; }
+
+#ifdef CART_METRICS
+	CallStart recordCall(Op op) {
+		ThreadMetrics& metrics = local();
+		uint64_t previous = metrics.calls[op].load(std::memory_order_relaxed);
+		metrics.calls[op].store(previous + 1, std::memory_order_relaxed);
+		return { metrics.failure_total, previous % CART_METRICS_SAMPLE_EVERY == 0 };
+	}
+
+	void recordEnd(Op op, const CallStart& start, uint64_t nanoseconds, bool threw) {
+		ThreadMetrics& metrics = local();
+		if (start.timed) {
+			metrics.latency[op].record(nanoseconds);
+		}
+		if (threw || metrics.failure_total != start.failures) {
+			bump(metrics.errors[op], 1);
+		}
+	}
+
+	void recordFailure(Failure failure) {
+		ThreadMetrics& metrics = local();
+		bump(metrics.failures[failure], 1);
+		++metrics.failure_total;
+	}
+
+	void snapshot(Snapshot& into) {
+		Registry& all = registry();
+		std::lock_guard lock(all.mutex);
+		mergeInto(into, all.retired);
+		for (const ThreadMetrics* metrics : all.live) {
+			mergeInto(into, *metrics);
+		}
+	}
+#else
+	void snapshot(Snapshot&) {}
+#endif
+
+	std::string prometheus() {
+		if (!ENABLED) {
+			return "";
+		}
+		Snapshot totals;
+		snapshot(totals);
+		std::ostringstream out;
+		out << "# HELP cart_operations_total ShoppingCart operations called.\n"
+			"# TYPE cart_operations_total counter\n";
+		for (int op = 0; op < OP_COUNT; ++op) {
+			out << "cart_operations_total{op=\"" << OP_NAMES[op] << "\"} " << totals.calls[op] << '\n';
+		}
+		out << "# HELP cart_operation_duration_seconds Time spent in a sample of ShoppingCart operations.\n"
+			"# TYPE cart_operation_duration_seconds histogram\n";
+		for (int op = 0; op < OP_COUNT; ++op) {
+			const LatencyHistogram& latency = totals.latency[op];
+			for (uint64_t bound : BUCKET_BOUNDS) {
+				out << "cart_operation_duration_seconds_bucket{op=\"" << OP_NAMES[op] << "\",le=\"" << bound * 1e-9 << "\"} "
+					<< latency.countAtOrBelow(bound) << '\n';
+			}
+			out << "cart_operation_duration_seconds_bucket{op=\"" << OP_NAMES[op] << "\",le=\"+Inf\"} " << latency.count() << '\n'
+				<< "cart_operation_duration_seconds_sum{op=\"" << OP_NAMES[op] << "\"} " << latency.totalNanoseconds() * 1e-9 << '\n'
+				<< "cart_operation_duration_seconds_count{op=\"" << OP_NAMES[op] << "\"} " << latency.count() << '\n';
+		}
+		out << "# HELP cart_operation_errors_total ShoppingCart operations that failed.\n"
+			"# TYPE cart_operation_errors_total counter\n";
+		for (int op = 0; op < OP_COUNT; ++op) {
+			out << "cart_operation_errors_total{op=\"" << OP_NAMES[op] << "\"} " << totals.errors[op] << '\n';
+		}
+		out << "# HELP cart_validation_failures_total Inputs ShoppingCart rejected, by reason.\n"
+			"# TYPE cart_validation_failures_total counter\n";
+		for (int failure = 0; failure < FAILURE_COUNT; ++failure) {
+			out << "cart_validation_failures_total{reason=\"" << FAILURE_NAMES[failure] << "\"} " << totals.failures[failure] << '\n';
+		}
+		return out.str();
+	}
+
+	void writePrometheus(const std::string& path) {
+		std::string text = prometheus();
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file || !file.write(text.data(), (std::streamsize)text.size()).flush()) {
+			throw std::runtime_error("Cannot write metrics file");
+		}
+	}
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "latency_histogram.h"
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <string>
+
+// Counters and latency histograms for ShoppingCart operations, recorded only in builds that
+// define CART_METRICS. Without it the recording macros below expand to nothing, and the
+// reporting functions return empty results, so callers need no #ifdefs of their own.
+//
+// Each thread records into its own counters; a snapshot merges every thread's, plus those of
+// threads that have exited. Every call is counted, but reading the clock costs more than most
+// cart operations, so only one call in CART_METRICS_SAMPLE_EVERY of each operation on each
+// thread is timed, starting with the first.
+
+#ifndef CART_METRICS_SAMPLE_EVERY
+#define CART_METRICS_SAMPLE_EVERY 16
+#endif
+
+namespace CartMetrics {
+#ifdef CART_METRICS
+	constexpr bool ENABLED = true;
+#else
+	constexpr bool ENABLED = false;
+#endif
+
+	enum Op { CONSTRUCT, COPY, ADD_ITEM, UPDATE_ITEM, REMOVE_ITEM, APPLY_BATCH, MERGE, GET_ITEMS, GET_TOTAL, GET_DISCOUNTED_TOTAL, OP_COUNT };
+	// Why an input was rejected. Counted where the check fails, so one rejected call may count
+	// more than one reason, and internal checks count too.
+	enum Failure { UNKNOWN_ITEM, QUANTITY_OUT_OF_RANGE, ITEM_NOT_IN_CART, INVALID_OWNER_ID, FAILURE_COUNT };
+
+	const char* opName(Op op);
+	const char* failureName(Failure failure);
+
+	struct Snapshot {
+		uint64_t calls[OP_COUNT] = {};
+		// Durations of the sampled calls.
+		LatencyHistogram latency[OP_COUNT];
+		// Calls that failed, by throwing or by returning an error, by operation.
+		uint64_t errors[OP_COUNT] = {};
+		uint64_t failures[FAILURE_COUNT] = {};
+	};
+
+	// Everything recorded so far, by every thread.
+	void snapshot(Snapshot& into);
+	// The snapshot in Prometheus text exposition format.
+	std::string prometheus();
+	// Writes prometheus() to a file, replacing it. Throws std::runtime_error("Cannot write metrics
+	// file") on failure.
+	void writePrometheus(const std::string& path);
+
+#ifdef CART_METRICS
+	struct CallStart {
+		// The thread's failure count when the call began.
+		uint64_t failures;
+		bool timed;
+	};
+	// Counts a call, and says whether to time it.
+	CallStart recordCall(Op op);
+	// Records the duration of a timed call, and counts the call as an error if it threw or
+	// recorded a failure.
+	void recordEnd(Op op, const CallStart& start, uint64_t nanoseconds, bool threw);
+	void recordFailure(Failure failure);
+
+	// Counts one call, times it from construction to destruction if it is sampled, and counts it
+	// as an error if it ends by throwing or a failure was recorded during it.
+	class CallTimer {
+	public:
+		explicit CallTimer(Op op) : op(op), exceptions(std::uncaught_exceptions()), start(recordCall(op)) {
+			if (start.timed) {
+				started = std::chrono::steady_clock::now();
+			}
+		}
+		~CallTimer() {
+			uint64_t nanoseconds = 0;
+			if (start.timed) {
+				auto elapsed = std::chrono::steady_clock::now() - started;
+				nanoseconds = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+			}
+			recordEnd(op, start, nanoseconds, std::uncaught_exceptions() > exceptions);
+		}
+		CallTimer(const CallTimer&) = delete;
+		CallTimer& operator=(const CallTimer&) = delete;
+	private:
+		Op op;
+		int exceptions;
+		CallStart start;
+		std::chrono::steady_clock::time_point started;
+	};
+#endif
+}
+
+#ifdef CART_METRICS
+#define CART_METRIC_CALL(op) CartMetrics::CallTimer cart_metric_call_timer(CartMetrics::op)
+#define CART_METRIC_FAILURE(failure) CartMetrics::recordFailure(CartMetrics::failure)
+#else
+#define CART_METRIC_CALL(op) ((void)0)
+#define CART_METRIC_FAILURE(failure) ((void)0)
+#endif
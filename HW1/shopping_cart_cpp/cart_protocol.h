@@ -0,0 +1,236 @@
+#pragma once
+#include "cart.h"
+#include "cart_id.h"
+#include "cart_result.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// The binary protocol CartServer speaks over a Unix domain socket.
+//
+// Every message is a frame: a 4-byte length counting the bytes after it, a 4-byte tag the client
+// picks and the response echoes, a 1-byte opcode (requests) or status (responses), then the body.
+// Integers are little-endian. Strings are a 2-byte length and that many bytes; owner ids are a
+// 1-byte length and that many 4-byte code points. Every request but Create starts its body with
+// the 16-byte cart id.
+//
+// A client may write any number of frames without waiting for answers. Each gets exactly one
+// response, but responses for different carts can come back in any order, so clients match them
+// up by tag. Requests from one connection for one cart are applied in the order they were sent.
+namespace CartProtocol {
+	static_assert(std::endian::native == std::endian::little, "The protocol is written in host byte order");
+
+	// Length, tag, and opcode or status.
+	constexpr size_t HEADER_SIZE = 9;
+	// The largest frame either side accepts, header included.
+	constexpr size_t MAX_FRAME = 1 << 20;
+
+	// Request bodies, and what the response body holds when the status is Ok.
+	enum class Op : uint8_t {
+		// Owner id. Response: cart id.
+		Create = 1,
+		// Cart id, amount (4 bytes), item name.
+		Add,
+		Update,
+		// Cart id, item name.
+		Remove,
+		// Cart id, count (4 bytes), then per operation: CartOp::Kind (1 byte), amount (4 bytes),
+		// item name. All or nothing, as ShoppingCart::applyBatch.
+		Batch,
+		// Cart id. Response: total in cents (8 bytes).
+		Total,
+		// Cart id. Response: count (4 bytes), then per line in item id order: item name, quantity
+		// (4 bytes).
+		Items,
+		// Cart id. Forgets the cart.
+		Drop,
+	};
+
+	// Ok, a CartError value for an operation the cart rejected, or a failure of the request
+	// itself. A response that is not Ok has no body.
+	enum class Status : uint8_t {
+		Ok = 0,
+		UnknownCart = 64,
+		// The body did not match the opcode.
+		Malformed,
+		UnknownOp,
+	};
+
+	constexpr Status statusOf(CartError error) {
+		return (Status)error;
+	}
+
+	// A frame as read off the wire. The body points into the buffer it was read from.
+	struct Frame {
+		uint32_t tag;
+		uint8_t code;
+		std::string_view body;
+	};
+
+	inline void putU8(std::string& out, uint8_t value) {
+		out.push_back((char)value);
+	}
+
+	template <typename T>
+	void putRaw(std::string& out, T value) {
+		char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		out.append(bytes, sizeof(T));
+	}
+
+	// Throws std::length_error if the name is longer than a string can be.
+	inline void putString(std::string& out, std::string_view text) {
+		if (text.size() > UINT16_MAX) {
+			throw std::length_error("String too long for the cart protocol");
+		}
+		putRaw<uint16_t>(out, (uint16_t)text.size());
+		out.append(text);
+	}
+
+	inline void putCart(std::string& out, const CartUuid& cart) {
+		out.append((const char*)cart.data(), cart.size());
+	}
+
+	// Appends a frame header with its length left open, and returns where the frame starts.
+	inline size_t beginFrame(std::string& out, uint32_t tag, uint8_t code) {
+		size_t start = out.size();
+		putRaw<uint32_t>(out, 0);
+		putRaw<uint32_t>(out, tag);
+		putU8(out, code);
+		return start;
+	}
+
+	// Fills in the length of the frame beginFrame started.
+	inline void endFrame(std::string& out, size_t start) {
+		uint32_t length = (uint32_t)(out.size() - start - sizeof(uint32_t));
+		std::memcpy(&out[start], &length, sizeof(length));
+	}
+
+	inline void appendCreate(std::string& out, uint32_t tag, std::wstring_view owner_id) {
+		if (owner_id.size() > UINT8_MAX) {
+			throw std::length_error("Owner ID too long for the cart protocol");
+		}
+		size_t start = beginFrame(out, tag, (uint8_t)Op::Create);
+		putU8(out, (uint8_t)owner_id.size());
+		for (wchar_t c : owner_id) {
+			putRaw<uint32_t>(out, (uint32_t)c);
+		}
+		endFrame(out, start);
+	}
+
+	// Add, Update or Remove; Remove ignores the amount.
+	inline void appendItem(std::string& out, uint32_t tag, Op op, const CartUuid& cart, std::string_view item_name, int amount = 0) {
+		size_t start = beginFrame(out, tag, (uint8_t)op);
+		putCart(out, cart);
+		if (op != Op::Remove) {
+			putRaw<int32_t>(out, amount);
+		}
+		putString(out, item_name);
+		endFrame(out, start);
+	}
+
+	inline void appendBatch(std::string& out, uint32_t tag, const CartUuid& cart, std::span<const CartOp> ops) {
+		size_t start = beginFrame(out, tag, (uint8_t)Op::Batch);
+		putCart(out, cart);
+		putRaw<uint32_t>(out, (uint32_t)ops.size());
+		for (const CartOp& op : ops) {
+			putU8(out, (uint8_t)op.kind);
+			putRaw<int32_t>(out, op.amount);
+			putString(out, op.item_name);
+		}
+		endFrame(out, start);
+	}
+
+	// Total, Items or Drop.
+	inline void appendCartOp(std::string& out, uint32_t tag, Op op, const CartUuid& cart) {
+		size_t start = beginFrame(out, tag, (uint8_t)op);
+		putCart(out, cart);
+		endFrame(out, start);
+	}
+
+	// Reads the frame at the front of data and returns its size, header included, or returns 0
+	// if data does not hold all of it yet. Throws std::length_error if the frame claims a size
+	// outside HEADER_SIZE to MAX_FRAME, after which the stream cannot be trusted.
+	inline size_t parseFrame(std::string_view data, Frame& frame) {
+		if (data.size() < sizeof(uint32_t)) {
+			return 0;
+		}
+		uint32_t length;
+		std::memcpy(&length, data.data(), sizeof(length));
+		size_t size = sizeof(uint32_t) + (size_t)length;
+		if (size < HEADER_SIZE || size > MAX_FRAME) {
+			throw std::length_error("Cart protocol frame size out of range");
+		}
+		if (data.size() < size) {
+			return 0;
+		}
+		std::memcpy(&frame.tag, data.data() + sizeof(uint32_t), sizeof(frame.tag));
+		frame.code = (uint8_t)data[HEADER_SIZE - 1];
+		frame.body = data.substr(HEADER_SIZE, size - HEADER_SIZE);
+		return size;
+	}
+
+	// Reads the fields of a body in order. A read past the end yields zeros and empty strings
+	// and leaves the reader not ok, so a body is checked once, after all of it has been read.
+	class Reader {
+	public:
+		explicit Reader(std::string_view body) : rest(body) {}
+
+		bool ok() const { return !overrun; }
+		// Ok, with every byte read.
+		bool done() const { return !overrun && rest.empty(); }
+
+		uint8_t u8() { return raw<uint8_t>(); }
+		uint32_t u32() { return raw<uint32_t>(); }
+		int32_t i32() { return raw<int32_t>(); }
+		int64_t i64() { return raw<int64_t>(); }
+
+		std::string_view string() {
+			return take(raw<uint16_t>());
+		}
+
+		CartUuid cart() {
+			CartUuid id{};
+			std::string_view bytes = take(id.size());
+			if (!bytes.empty()) {
+				std::memcpy(id.data(), bytes.data(), bytes.size());
+			}
+			return id;
+		}
+
+		std::wstring ownerId() {
+			std::wstring id(u8(), L'\0');
+			for (wchar_t& c : id) {
+				c = (wchar_t)u32();
+			}
+			return id;
+		}
+	private:
+		template <typename T>
+		T raw() {
+			T value = 0;
+			std::string_view bytes = take(sizeof(T));
+			if (!bytes.empty()) {
+				std::memcpy(&value, bytes.data(), bytes.size());
+			}
+			return value;
+		}
+
+		std::string_view take(size_t size) {
+			if (overrun || rest.size() < size) {
+				overrun = true;
+				return {};
+			}
+			std::string_view taken = rest.substr(0, size);
+			rest.remove_prefix(size);
+			return taken;
+		}
+
+		std::string_view rest;
+		bool overrun = false;
+	};
+}
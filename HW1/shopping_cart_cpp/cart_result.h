@@ -0,0 +1,116 @@
+#pragma once
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Every way a cart operation can reject its input. The try* functions return these instead of
+// throwing, since unknown items and bad quantities are ordinary in client traffic and a thrown
+// exception costs microseconds to unwind; the throwing functions are built on them.
+enum class CartError {
+	None,
+	UnknownItem,
+	QuantityBelowMinimum,
+	QuantityAboveMaximum,
+	UpdatedItemNotInCart,
+	RemovedItemNotInCart,
+	OwnerIdTooLong,
+	InvalidOwnerId,
+};
+
+// The message the throwing API uses for the error.
+constexpr const char* describe(CartError error) {
+	switch (error) {
+	case CartError::None: return "No error";
+	case CartError::UnknownItem: return "Item not found in catalog";
+	case CartError::QuantityBelowMinimum: return "Quantity cannot be less than 1";
+	case CartError::QuantityAboveMaximum: return "Quantity cannot be greater than 99";
+	case CartError::UpdatedItemNotInCart: return "Cannot update an item not present in cart";
+	case CartError::RemovedItemNotInCart: return "Cannot remove an item not present in cart";
+	case CartError::OwnerIdTooLong: return "Owner ID must be 12 characters long";
+	case CartError::InvalidOwnerId: return "Invalid owner ID format";
+	}
+	return "Unknown error";
+}
+
+// Throws std::invalid_argument with the error's message.
+[[noreturn]] inline void throwCartError(CartError error) {
+	throw std::invalid_argument(describe(error));
+}
+
+// A value or the error that prevented it, in the manner of C++23's std::expected, which this
+// C++20 code base cannot use yet. For the small, trivially copyable values most calls return, it
+// is trivially copyable too, so it is returned in registers rather than through memory.
+template <typename T>
+class [[nodiscard]] CartResult {
+public:
+	CartResult(T value) : stored(std::move(value)), failure(CartError::None) {}
+	CartResult(CartError error) : failure(error) {}
+
+	CartResult(const CartResult&) requires std::is_trivially_copy_constructible_v<T> = default;
+	CartResult(const CartResult& other) : failure(other.failure) {
+		if (has_value()) {
+			std::construct_at(&stored, other.stored);
+		}
+	}
+	CartResult(CartResult&&) requires std::is_trivially_move_constructible_v<T> = default;
+	CartResult(CartResult&& other) noexcept(std::is_nothrow_move_constructible_v<T>) : failure(other.failure) {
+		if (has_value()) {
+			std::construct_at(&stored, std::move(other.stored));
+		}
+	}
+	CartResult& operator=(const CartResult&) = delete;
+	~CartResult() requires std::is_trivially_destructible_v<T> = default;
+	~CartResult() {
+		if (has_value()) {
+			stored.~T();
+		}
+	}
+
+	bool has_value() const { return failure == CartError::None; }
+	explicit operator bool() const { return has_value(); }
+	CartError error() const { return failure; }
+
+	// The value, which must be there.
+	T& operator*() { return stored; }
+	const T& operator*() const { return stored; }
+	T* operator->() { return &stored; }
+	const T* operator->() const { return &stored; }
+	// The value, or throws the error as the throwing API would.
+	T& value() & {
+		if (!has_value()) {
+			throwCartError(failure);
+		}
+		return stored;
+	}
+	T value() && {
+		if (!has_value()) {
+			throwCartError(failure);
+		}
+		return std::move(stored);
+	}
+private:
+	union {
+		T stored;
+	};
+	CartError failure;
+};
+
+template <>
+class [[nodiscard]] CartResult<void> {
+public:
+	CartResult() : failure(CartError::None) {}
+	CartResult(CartError error) : failure(error) {}
+
+	bool has_value() const { return failure == CartError::None; }
+	explicit operator bool() const { return has_value(); }
+	CartError error() const { return failure; }
+	// Throws the error, if any, as the throwing API would.
+	void value() const {
+		if (!has_value()) {
+			throwCartError(failure);
+		}
+	}
+private:
+	CartError failure;
+};
@@ -0,0 +1,631 @@
+#include "cart_server.h"
+#include "cart.h"
+#include "cart_protocol.h"
+#include "cart_store.h"
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace CartProtocol;
+
+namespace {
+	constexpr int MAX_EVENTS = 256;
+	// Bytes read from a connection per wake-up, so that one busy client cannot starve the rest.
+	constexpr size_t READ_SIZE = 64 * 1024;
+	// Connections accepted per wake-up, so that new connections spread over the threads.
+	constexpr int ACCEPTS_PER_WAKE = 64;
+	// A connection with this much output waiting is not read from, so a client that sends
+	// requests without reading the responses cannot make the server buffer without bound.
+	// Reading resumes once the output is down to OUTPUT_LOW_WATER.
+	constexpr size_t OUTPUT_HIGH_WATER = 1 << 20;
+	constexpr size_t OUTPUT_LOW_WATER = 256 * 1024;
+	// The epoll keys of the two descriptors that are not connections.
+	constexpr uint64_t LISTEN_KEY = UINT64_MAX;
+	constexpr uint64_t WAKE_KEY = UINT64_MAX - 1;
+
+	// Where a forwarded request came from, so its response can find its way back.
+	struct Route {
+		uint32_t connection;
+		uint32_t loop;
+	};
+
+	// What one thread hands another in one batch.
+	struct Mail {
+		// Requests for carts the receiver owns, each a Route followed by the request frame.
+		std::string requests;
+		// Responses for the receiver's connections, each a 4-byte connection id followed by the
+		// response frame.
+		std::string responses;
+		// Carts created on the sender's connections that the receiver owns.
+		std::vector<ShoppingCart> carts;
+
+		bool empty() const { return requests.empty() && responses.empty() && carts.empty(); }
+
+		void clear() {
+			requests.clear();
+			responses.clear();
+			carts.clear();
+		}
+
+		void appendTo(Mail& other) {
+			other.requests.append(requests);
+			other.responses.append(responses);
+			for (ShoppingCart& cart : carts) {
+				other.carts.push_back(std::move(cart));
+			}
+		}
+	};
+
+	struct Connection {
+		explicit Connection(int fd) : fd(fd) {}
+
+		int fd;
+		// Bytes read but not yet handled: the start of a frame still arriving.
+		std::string in;
+		std::string out;
+		// What epoll is watching the socket for: more input unless paused, and room for more
+		// output while there is output waiting.
+		uint32_t events = EPOLLIN;
+		// Whether reading is held off until the output drains.
+		bool paused = false;
+		// Whether the connection is on the list of those with output to write.
+		bool queued = false;
+	};
+
+	bool watch(int epoll_fd, int operation, int fd, uint32_t events, uint64_t key) {
+		epoll_event event{};
+		event.events = events;
+		event.data.u64 = key;
+		return epoll_ctl(epoll_fd, operation, fd, &event) == 0;
+	}
+}
+
+struct CartServer::Loop {
+	Loop(CartServer& server, size_t index, size_t loops) : server(server), index(index), outbox(loops) {
+		epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (epoll_fd < 0 || wake_fd < 0 || !watch(epoll_fd, EPOLL_CTL_ADD, wake_fd, EPOLLIN, WAKE_KEY)
+			|| !watch(epoll_fd, EPOLL_CTL_ADD, server.listen_fd, EPOLLIN | EPOLLEXCLUSIVE, LISTEN_KEY)) {
+			closeDescriptors();
+			throw std::runtime_error("Cannot set up cart server thread");
+		}
+		buffer.resize(READ_SIZE);
+	}
+
+	~Loop() {
+		for (auto& [id, connection] : connections) {
+			::close(connection.fd);
+		}
+		closeDescriptors();
+	}
+
+	void closeDescriptors() {
+		if (epoll_fd >= 0) {
+			::close(epoll_fd);
+		}
+		if (wake_fd >= 0) {
+			::close(wake_fd);
+		}
+	}
+
+	void run() {
+		epoll_event events[MAX_EVENTS];
+		while (!server.stopping.load(std::memory_order_acquire)) {
+			// Connections that were just unpaused may hold whole frames already, and need no event.
+			int ready = epoll_wait(epoll_fd, events, MAX_EVENTS, resumed.empty() ? -1 : 0);
+			bool mail = false;
+			for (int i = 0; i < ready; ++i) {
+				uint64_t key = events[i].data.u64;
+				if (key == WAKE_KEY) {
+					uint64_t wakes;
+					(void)::read(wake_fd, &wakes, sizeof(wakes));
+					mail = true;
+				}
+				else if (key == LISTEN_KEY) {
+					accept();
+				}
+				else {
+					// An earlier event in this round may have closed it.
+					auto found = connections.find((uint32_t)key);
+					if (found == connections.end()) {
+						continue;
+					}
+					// A paused connection may still be reported readable from before it was paused.
+					if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !found->second.paused
+						&& !read(found->first, found->second)) {
+						continue;
+					}
+					if (events[i].events & EPOLLOUT) {
+						queue(found->first, found->second);
+					}
+				}
+			}
+			if (mail) {
+				receiveMail();
+			}
+			resume();
+			// Mail goes out before responses, so a cart created here for another thread is in
+			// that thread's inbox before its client can learn the cart's id.
+			postMail();
+			flush();
+		}
+	}
+
+	void accept() {
+		for (int i = 0; i < ACCEPTS_PER_WAKE; ++i) {
+			// Fails with EAGAIN when another thread took the connection.
+			int fd = accept4(server.listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				return;
+			}
+			while (connections.contains(next_connection)) {
+				++next_connection;
+			}
+			uint32_t id = next_connection++;
+			if (!watch(epoll_fd, EPOLL_CTL_ADD, fd, EPOLLIN, id)) {
+				::close(fd);
+				continue;
+			}
+			connections.emplace(id, Connection(fd));
+		}
+	}
+
+	void close(uint32_t id, Connection& connection) {
+		::close(connection.fd);
+		connections.erase(id);
+	}
+
+	// Reads what the connection has sent and handles every whole frame in it. Returns false if
+	// the connection was closed.
+	bool read(uint32_t id, Connection& connection) {
+		ssize_t got = ::read(connection.fd, buffer.data(), buffer.size());
+		if (got < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return true;
+		}
+		if (got <= 0) {
+			close(id, connection);
+			return false;
+		}
+		// Frames are handled straight from the read buffer unless part of one was held over.
+		std::string_view data(buffer.data(), (size_t)got);
+		if (!connection.in.empty()) {
+			connection.in.append(data);
+			data = connection.in;
+		}
+		return handleFrames(id, connection, data);
+	}
+
+	// Handles the whole frames at the start of data, which is either the read buffer or all of
+	// connection.in, and keeps the rest in connection.in. Stops early, pausing the connection,
+	// once its output reaches OUTPUT_HIGH_WATER. Returns false if the connection was closed.
+	bool handleFrames(uint32_t id, Connection& connection, std::string_view data) {
+		size_t used = 0;
+		try {
+			Frame frame;
+			while (size_t size = parseFrame(data.substr(used), frame)) {
+				if (connection.out.size() >= OUTPUT_HIGH_WATER) {
+					// Writing it out stops epoll reporting the connection readable.
+					connection.paused = true;
+					queue(id, connection);
+					break;
+				}
+				handle(id, connection, data.substr(used, size), frame);
+				used += size;
+			}
+		}
+		catch (const std::length_error&) {
+			close(id, connection);
+			return false;
+		}
+		if (connection.in.empty()) {
+			connection.in.assign(data.substr(used));
+		}
+		else {
+			connection.in.erase(0, used);
+		}
+		return true;
+	}
+
+	// A request from one of this thread's connections.
+	void handle(uint32_t id, Connection& connection, std::string_view raw, const Frame& frame) {
+		queue(id, connection);
+		switch ((Op)frame.code) {
+		case Op::Create:
+			create(frame, connection.out);
+			return;
+		case Op::Add:
+		case Op::Update:
+		case Op::Remove:
+		case Op::Batch:
+		case Op::Total:
+		case Op::Items:
+		case Op::Drop:
+			break;
+		default:
+			respond(connection.out, frame.tag, Status::UnknownOp);
+			return;
+		}
+		if (frame.body.size() < sizeof(CartUuid)) {
+			respond(connection.out, frame.tag, Status::Malformed);
+			return;
+		}
+		CartUuid cart;
+		std::memcpy(cart.data(), frame.body.data(), cart.size());
+		size_t owner = ownerOf(cart);
+		if (owner == index) {
+			execute(frame, connection.out);
+			return;
+		}
+		Mail& mail = outbox[owner];
+		putRaw(mail.requests, Route{ id, (uint32_t)index });
+		mail.requests.append(raw);
+	}
+
+	// Carts are created where the request arrives, since their id is not known until then, and
+	// sent to the thread that owns them.
+	void create(const Frame& frame, std::string& out) {
+		Reader reader(frame.body);
+		std::wstring owner_id = reader.ownerId();
+		if (!reader.done()) {
+			respond(out, frame.tag, Status::Malformed);
+			return;
+		}
+		CartResult<ShoppingCart> created = ShoppingCart::tryCreate(owner_id);
+		if (!created) {
+			respond(out, frame.tag, statusOf(created.error()));
+			return;
+		}
+		CartUuid id = created->getCartUuid();
+		size_t owner = ownerOf(id);
+		if (owner == index) {
+			adopt(std::move(*created));
+		}
+		else {
+			outbox[owner].carts.push_back(std::move(*created));
+		}
+		size_t start = beginFrame(out, frame.tag, (uint8_t)Status::Ok);
+		putCart(out, id);
+		endFrame(out, start);
+	}
+
+	void adopt(ShoppingCart&& cart) {
+		CartUuid id = cart.getCartUuid();
+		carts.try_emplace(id, std::move(cart));
+		cart_count.store(carts.size(), std::memory_order_relaxed);
+	}
+
+	// Runs a request on a cart this thread owns and appends the response to out.
+	void execute(const Frame& frame, std::string& out) {
+		Reader reader(frame.body);
+		auto found = carts.find(reader.cart());
+		ShoppingCart* cart = found == carts.end() ? nullptr : &found->second;
+		size_t start = beginFrame(out, frame.tag, (uint8_t)Status::Ok);
+		Status status = Status::Ok;
+		Op op = (Op)frame.code;
+		switch (op) {
+		case Op::Add:
+		case Op::Update: {
+			int amount = reader.i32();
+			std::string_view item_name = reader.string();
+			if (!reader.done()) {
+				status = Status::Malformed;
+			}
+			else if (!cart) {
+				status = Status::UnknownCart;
+			}
+			else {
+				CartResult<void> result = op == Op::Add ? cart->tryAddItem(item_name, amount) : cart->tryUpdateItem(item_name, amount);
+				status = statusOf(result.error());
+			}
+			break;
+		}
+		case Op::Remove: {
+			std::string_view item_name = reader.string();
+			if (!reader.done()) {
+				status = Status::Malformed;
+			}
+			else if (!cart) {
+				status = Status::UnknownCart;
+			}
+			else {
+				status = statusOf(cart->tryRemoveItem(item_name).error());
+			}
+			break;
+		}
+		case Op::Batch: {
+			uint32_t count = reader.u32();
+			batch.clear();
+			for (uint32_t i = 0; i < count && reader.ok(); ++i) {
+				uint8_t kind = reader.u8();
+				int amount = reader.i32();
+				std::string_view item_name = reader.string();
+				if (kind > (uint8_t)CartOp::Kind::Remove) {
+					status = Status::Malformed;
+				}
+				batch.push_back({ (CartOp::Kind)kind, item_name, amount });
+			}
+			if (!reader.done()) {
+				status = Status::Malformed;
+			}
+			if (status != Status::Ok) {
+				break;
+			}
+			if (!cart) {
+				status = Status::UnknownCart;
+				break;
+			}
+			status = statusOf(cart->tryApplyBatch(batch).error());
+			break;
+		}
+		case Op::Total:
+		case Op::Items:
+		case Op::Drop:
+			if (!reader.done()) {
+				status = Status::Malformed;
+			}
+			else if (!cart) {
+				status = Status::UnknownCart;
+			}
+			else if (op == Op::Total) {
+				CartResult<Money> total = cart->tryGetTotal();
+				status = statusOf(total.error());
+				if (total) {
+					putRaw<int64_t>(out, total->getCents());
+				}
+			}
+			else if (op == Op::Items) {
+				putRaw<uint32_t>(out, (uint32_t)cart->itemCount());
+				cart->forEachItem([&](std::string_view item_name, int quantity) {
+					putString(out, item_name);
+					putRaw<int32_t>(out, quantity);
+				});
+			}
+			else {
+				carts.erase(found);
+				cart_count.store(carts.size(), std::memory_order_relaxed);
+			}
+			break;
+		default:
+			status = Status::UnknownOp;
+			break;
+		}
+		if (status != Status::Ok) {
+			out.resize(start + HEADER_SIZE);
+			out[start + HEADER_SIZE - 1] = (char)status;
+		}
+		endFrame(out, start);
+	}
+
+	void respond(std::string& out, uint32_t tag, Status status) {
+		endFrame(out, beginFrame(out, tag, (uint8_t)status));
+	}
+
+	void receiveMail() {
+		{
+			std::lock_guard<std::mutex> lock(mail_mutex);
+			std::swap(inbox, received);
+		}
+		for (ShoppingCart& cart : received.carts) {
+			adopt(std::move(cart));
+		}
+		std::string_view requests = received.requests;
+		while (!requests.empty()) {
+			Route route;
+			std::memcpy(&route, requests.data(), sizeof(route));
+			requests.remove_prefix(sizeof(route));
+			Frame frame;
+			size_t size = parseFrame(requests, frame);
+			std::string& replies = outbox[route.loop].responses;
+			putRaw<uint32_t>(replies, route.connection);
+			execute(frame, replies);
+			requests.remove_prefix(size);
+		}
+		std::string_view responses = received.responses;
+		while (!responses.empty()) {
+			uint32_t id;
+			std::memcpy(&id, responses.data(), sizeof(id));
+			responses.remove_prefix(sizeof(id));
+			Frame frame;
+			size_t size = parseFrame(responses, frame);
+			// The connection may have closed while its request was away.
+			auto found = connections.find(id);
+			if (found != connections.end()) {
+				found->second.out.append(responses.substr(0, size));
+				queue(id, found->second);
+			}
+			responses.remove_prefix(size);
+		}
+		received.clear();
+	}
+
+	void postMail() {
+		for (size_t peer = 0; peer < outbox.size(); ++peer) {
+			Mail& mail = outbox[peer];
+			if (mail.empty()) {
+				continue;
+			}
+			Loop& target = *server.loops[peer];
+			// A non-empty inbox means a wake-up is already on its way.
+			bool wake;
+			{
+				std::lock_guard<std::mutex> lock(target.mail_mutex);
+				wake = target.inbox.empty();
+				if (wake) {
+					std::swap(target.inbox, mail);
+				}
+				else {
+					mail.appendTo(target.inbox);
+				}
+			}
+			mail.clear();
+			if (wake) {
+				uint64_t one = 1;
+				(void)::write(target.wake_fd, &one, sizeof(one));
+			}
+		}
+	}
+
+	void queue(uint32_t id, Connection& connection) {
+		if (!connection.queued) {
+			connection.queued = true;
+			pending.push_back(id);
+		}
+	}
+
+	void flush() {
+		for (uint32_t id : pending) {
+			auto found = connections.find(id);
+			if (found != connections.end()) {
+				found->second.queued = false;
+				write(id, found->second);
+			}
+		}
+		pending.clear();
+	}
+
+	// Writes as much output as the socket takes, and has epoll report when it takes more.
+	void write(uint32_t id, Connection& connection) {
+		size_t written = 0;
+		while (written < connection.out.size()) {
+			ssize_t sent = ::send(connection.fd, connection.out.data() + written, connection.out.size() - written, MSG_NOSIGNAL);
+			if (sent < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				if (errno == EAGAIN) {
+					break;
+				}
+				close(id, connection);
+				return;
+			}
+			written += (size_t)sent;
+		}
+		connection.out.erase(0, written);
+		// Responses to requests forwarded to other threads can take the output past the mark too.
+		if (connection.out.size() >= OUTPUT_HIGH_WATER) {
+			connection.paused = true;
+		}
+		else if (connection.paused && connection.out.size() <= OUTPUT_LOW_WATER) {
+			connection.paused = false;
+			resumed.push_back(id);
+		}
+		uint32_t events = (connection.paused ? 0u : (uint32_t)EPOLLIN) | (connection.out.empty() ? 0u : (uint32_t)EPOLLOUT);
+		if (events != connection.events && watch(epoll_fd, EPOLL_CTL_MOD, connection.fd, events, id)) {
+			connection.events = events;
+		}
+	}
+
+	// Handles the frames that unpaused connections were holding when they paused.
+	void resume() {
+		for (uint32_t id : resumed) {
+			auto found = connections.find(id);
+			if (found != connections.end() && !found->second.paused && !found->second.in.empty()) {
+				handleFrames(id, found->second, found->second.in);
+			}
+		}
+		resumed.clear();
+	}
+
+	// Like CartStore's shards, owners are picked from the upper half of the hash, which the
+	// carts map does not bucket on alone.
+	size_t ownerOf(const CartUuid& id) const {
+		return (CartUuidHash()(id) >> 32) % outbox.size();
+	}
+
+	CartServer& server;
+	size_t index;
+	int epoll_fd = -1;
+	int wake_fd = -1;
+	std::thread thread;
+	std::atomic<size_t> cart_count = 0;
+
+	std::mutex mail_mutex;
+	// Guarded by mail_mutex.
+	Mail inbox;
+
+	// Everything below is only touched by the loop's own thread.
+	Mail received;
+	// Mail for each thread, sent at the end of every loop iteration.
+	std::vector<Mail> outbox;
+	std::unordered_map<uint32_t, Connection> connections;
+	uint32_t next_connection = 0;
+	// Connections with output to write at the end of the iteration.
+	std::vector<uint32_t> pending;
+	// Connections unpaused by the last flush, whose held frames are handled next iteration.
+	std::vector<uint32_t> resumed;
+	std::unordered_map<CartUuid, ShoppingCart, CartUuidHash> carts;
+	std::string buffer;
+	std::vector<CartOp> batch;
+};
+
+CartServer::CartServer(const std::string& path, size_t threads) : path(path) {
+	if (threads == 0) {
+		throw std::invalid_argument("Cart server needs at least one thread");
+	}
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+		throw std::invalid_argument("Invalid socket path");
+	}
+	std::memcpy(address.sun_path, path.data(), path.size());
+	listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listen_fd < 0) {
+		throw std::runtime_error("Cannot create cart server socket");
+	}
+	::unlink(path.c_str());
+	try {
+		if (bind(listen_fd, (const sockaddr*)&address, sizeof(address)) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+			throw std::runtime_error("Cannot listen on cart server socket");
+		}
+		for (size_t i = 0; i < threads; ++i) {
+			loops.push_back(std::make_unique<Loop>(*this, i, threads));
+		}
+	}
+	catch (...) {
+		loops.clear();
+		::close(listen_fd);
+		::unlink(path.c_str());
+		throw;
+	}
+	// Every loop must exist before any runs, since they post to each other.
+	for (auto& loop : loops) {
+		loop->thread = std::thread(&Loop::run, loop.get());
+	}
+}
+
+CartServer::~CartServer() {
+	stop();
+}
+
+void CartServer::stop() {
+	if (stopping.exchange(true)) {
+		return;
+	}
+	for (auto& loop : loops) {
+		uint64_t one = 1;
+		(void)::write(loop->wake_fd, &one, sizeof(one));
+	}
+	for (auto& loop : loops) {
+		loop->thread.join();
+	}
+	loops.clear();
+	::close(listen_fd);
+	::unlink(path.c_str());
+}
+
+size_t CartServer::cartCount() const {
+	size_t count = 0;
+	for (const auto& loop : loops) {
+		count += loop->cart_count.load(std::memory_order_relaxed);
+	}
+	return count;
+}
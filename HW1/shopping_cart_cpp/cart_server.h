@@ -0,0 +1,42 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Serves carts over a Unix domain socket, in the protocol of cart_protocol.h, from a fixed pool
+// of event-loop threads. Linux only, as it is built on epoll.
+//
+// Each thread runs its own epoll loop and owns the carts whose ids hash to it; only that thread
+// ever touches them, so carts need no locks. Connections are spread over the threads as they
+// are accepted. A request for a cart that another thread owns is handed to that thread, and its
+// response handed back. Hand-offs between two threads are gathered into one batch per loop
+// iteration, under one lock and at most one eventfd wake-up. Every frame a read brings in is
+// handled before any response is written, so pipelined requests are answered in one write,
+// unless a megabyte of responses is already waiting: then the connection is not read from again
+// until most of its output has been written, so a client that does not read its responses holds
+// up only its own requests.
+class CartServer {
+public:
+	// Starts serving at path, replacing any socket file there. Throws std::runtime_error if the
+	// socket cannot be set up, and std::invalid_argument if the path is too long for one.
+	CartServer(const std::string& path, size_t threads);
+	~CartServer();
+	CartServer(const CartServer&) = delete;
+	CartServer& operator=(const CartServer&) = delete;
+
+	// Stops the threads, closes every connection and removes the socket file. The carts are
+	// dropped.
+	void stop();
+	size_t threadCount() const { return loops.size(); }
+	// Carts held, over all threads; a cart created on one thread for another may not be counted
+	// for a moment.
+	size_t cartCount() const;
+private:
+	struct Loop;
+
+	std::string path;
+	int listen_fd = -1;
+	std::atomic<bool> stopping = false;
+	std::vector<std::unique_ptr<Loop>> loops;
+};
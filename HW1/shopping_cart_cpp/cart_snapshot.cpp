@@ -0,0 +1,312 @@
+#include "cart_snapshot.h"
+#include "checksum.h"
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr char SNAPSHOT_MAGIC[8] = { 'C', 'A', 'R', 'T', 'S', 'N', 'P', '\0' };
+	constexpr uint32_t SNAPSHOT_FORMAT_VERSION = 2;
+	constexpr uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+	constexpr uint32_t SNAPSHOT_CHECKSUM = 1;
+
+	// Blocks are flushed once they reach this size. A single cart larger than that gets a block
+	// of its own; anything claiming to be over MAX_BLOCK_SIZE is corrupt.
+	constexpr size_t BLOCK_SIZE = 1 << 20;
+	constexpr size_t MAX_BLOCK_SIZE = 1 << 30;
+
+	constexpr char ITEM_RECORD = 'I';
+	constexpr char CART_RECORD = 'C';
+
+	// Item ids never reach the registry's capacity of 2^28; ITEM_NOT_SEEN marks ids the
+	// snapshot has not named yet.
+	constexpr ItemId MAX_ITEMS = 1u << 28;
+	constexpr ItemId ITEM_NOT_SEEN = ~ItemId(0);
+
+	struct SnapshotFileHeader {
+		char magic[8];
+		uint32_t format_version;
+		uint32_t byte_order;
+		uint32_t flags;
+		uint32_t reserved;
+		// The last write-ahead log record the carts reflect.
+		uint64_t lsn;
+	};
+
+	// Each block is its size, its records, and the checksum of the records if enabled. An empty
+	// block ends the snapshot and is followed by the number of carts.
+	struct BlockHeader {
+		uint32_t size;
+	};
+
+	template <typename T>
+	void append(std::vector<char>& block, const T& value) {
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		block.insert(block.end(), bytes, bytes + sizeof(T));
+	}
+
+	// Flushes a written file to disk, so that once it is renamed into place it is whole.
+	bool syncFile(const std::string& path) {
+#ifdef _WIN32
+		int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+		bool synced = fd >= 0 && _commit(fd) == 0;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		bool synced = fd >= 0 && ::fsync(fd) == 0;
+#endif
+		if (fd >= 0) {
+#ifdef _WIN32
+			_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+		return synced;
+	}
+
+	// Renames from over to, replacing it in one step.
+	bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	[[noreturn]] void invalidSnapshot() {
+		throw std::runtime_error("Invalid snapshot file");
+	}
+
+	// Takes a value out of the current block, or fails if the block ends first.
+	template <typename T>
+	T take(const std::vector<char>& block, size_t& position) {
+		if (block.size() - position < sizeof(T)) {
+			invalidSnapshot();
+		}
+		T value;
+		std::memcpy(&value, block.data() + position, sizeof(T));
+		position += sizeof(T);
+		return value;
+	}
+}
+
+// The snapshot is written beside the file it replaces and renamed over it once it is whole, so
+// a crash or a failed write part way through leaves the last good snapshot in place.
+CartSnapshotWriter::CartSnapshotWriter(const std::string& path, bool checksum, uint64_t lsn)
+	: path(path), temporary(path + ".tmp"), file(temporary, std::ios::binary | std::ios::trunc), checksum(checksum) {
+	if (!file) {
+		throw std::runtime_error("Cannot open snapshot file");
+	}
+	SnapshotFileHeader header = {};
+	std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+	header.format_version = SNAPSHOT_FORMAT_VERSION;
+	header.byte_order = SNAPSHOT_BYTE_ORDER;
+	header.flags = checksum ? SNAPSHOT_CHECKSUM : 0;
+	header.lsn = lsn;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	block.reserve(BLOCK_SIZE + 1024);
+}
+
+CartSnapshotWriter::~CartSnapshotWriter() {
+	if (!finished) {
+		file.close();
+		std::remove(temporary.c_str());
+	}
+}
+
+void CartSnapshotWriter::write(const ShoppingCart& cart) {
+	// Name every item this snapshot has not mentioned yet.
+	cart.forEachLine([this](ItemId item, int) {
+		if (item >= written_items.size()) {
+			written_items.resize(std::max<size_t>(item + 1, written_items.size() * 2));
+		}
+		if (!written_items[item]) {
+			written_items[item] = true;
+			std::string_view name = ItemRegistry::name(item);
+			block.push_back(ITEM_RECORD);
+			append(block, item);
+			append(block, (uint32_t)name.size());
+			block.insert(block.end(), name.begin(), name.end());
+		}
+	});
+	// Owner ids are at most 12 characters, all of them below U+10000.
+	std::wstring_view owner = cart.getOwner().view();
+	block.push_back(CART_RECORD);
+	append(block, cart.getCartUuid());
+	block.push_back((char)owner.size());
+	for (wchar_t c : owner) {
+		append(block, (uint16_t)c);
+	}
+	append(block, (uint32_t)cart.itemCount());
+	cart.forEachLine([this](ItemId item, int quantity) {
+		append(block, item);
+		block.push_back((char)quantity);
+	});
+	++carts;
+	if (block.size() >= BLOCK_SIZE) {
+		flush();
+	}
+}
+
+void CartSnapshotWriter::flush() {
+	if (block.empty()) {
+		return;
+	}
+	BlockHeader header = { (uint32_t)block.size() };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(block.data(), block.size());
+	if (checksum) {
+		uint64_t sum = blockChecksum(block.data(), block.size());
+		file.write(reinterpret_cast<const char*>(&sum), sizeof(sum));
+	}
+	block.clear();
+	if (!file) {
+		throw std::runtime_error("Cannot write snapshot file");
+	}
+}
+
+void CartSnapshotWriter::finish() {
+	flush();
+	BlockHeader end = { 0 };
+	file.write(reinterpret_cast<const char*>(&end), sizeof(end));
+	file.write(reinterpret_cast<const char*>(&carts), sizeof(carts));
+	file.close();
+	if (!file || !syncFile(temporary) || !replaceFile(temporary, path)) {
+		throw std::runtime_error("Cannot write snapshot file");
+	}
+	finished = true;
+}
+
+CartSnapshotReader::CartSnapshotReader(const std::string& path) : file(path, std::ios::binary) {
+	if (!file) {
+		throw std::runtime_error("Cannot open snapshot file");
+	}
+	SnapshotFileHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+		|| header.format_version != SNAPSHOT_FORMAT_VERSION
+		|| header.byte_order != SNAPSHOT_BYTE_ORDER) {
+		invalidSnapshot();
+	}
+	checksum = (header.flags & SNAPSHOT_CHECKSUM) != 0;
+	saved_lsn = header.lsn;
+}
+
+bool CartSnapshotReader::readBlock() {
+	BlockHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || header.size > MAX_BLOCK_SIZE) {
+		invalidSnapshot();
+	}
+	if (header.size == 0) {
+		uint64_t expected;
+		if (!file.read(reinterpret_cast<char*>(&expected), sizeof(expected)) || expected != carts) {
+			invalidSnapshot();
+		}
+		return false;
+	}
+	block.resize(header.size);
+	if (!file.read(block.data(), block.size())) {
+		invalidSnapshot();
+	}
+	if (checksum) {
+		uint64_t sum;
+		if (!file.read(reinterpret_cast<char*>(&sum), sizeof(sum)) || sum != blockChecksum(block.data(), block.size())) {
+			invalidSnapshot();
+		}
+	}
+	position = 0;
+	return true;
+}
+
+void CartSnapshotReader::readItem() {
+	ItemId item = take<ItemId>(block, position);
+	uint32_t length = take<uint32_t>(block, position);
+	if (block.size() - position < length || item >= MAX_ITEMS) {
+		invalidSnapshot();
+	}
+	if (item >= local_items.size()) {
+		local_items.resize(item + 1, ITEM_NOT_SEEN);
+	}
+	local_items[item] = ItemRegistry::intern(std::string_view(block.data() + position, length));
+	position += length;
+}
+
+std::optional<ShoppingCart> CartSnapshotReader::next() {
+	while (!finished) {
+		if (position == block.size() && !readBlock()) {
+			finished = true;
+			break;
+		}
+		char tag = take<char>(block, position);
+		if (tag == ITEM_RECORD) {
+			readItem();
+			continue;
+		}
+		if (tag != CART_RECORD) {
+			invalidSnapshot();
+		}
+		CartUuid id = take<CartUuid>(block, position);
+		size_t owner_length = (unsigned char)take<char>(block, position);
+		if (owner_length > OwnerIDFormat::LENGTH) {
+			invalidSnapshot();
+		}
+		wchar_t owner[OwnerIDFormat::LENGTH];
+		for (size_t i = 0; i < owner_length; ++i) {
+			owner[i] = (wchar_t)take<uint16_t>(block, position);
+		}
+		uint32_t count = take<uint32_t>(block, position);
+		if ((block.size() - position) / (sizeof(ItemId) + 1) < count) {
+			invalidSnapshot();
+		}
+		lines.clear();
+		for (uint32_t i = 0; i < count; ++i) {
+			ItemId item = take<ItemId>(block, position);
+			int quantity = (unsigned char)take<char>(block, position);
+			if (item >= local_items.size() || local_items[item] == ITEM_NOT_SEEN) {
+				invalidSnapshot();
+			}
+			lines.push_back({ local_items[item], quantity });
+		}
+		++carts;
+		try {
+			return ShoppingCart::restore(std::wstring_view(owner, owner_length), id, lines);
+		}
+		catch (const std::logic_error&) {
+			invalidSnapshot();
+		}
+	}
+	return std::nullopt;
+}
+
+uint64_t saveSnapshot(const CartStore& store, const std::string& path, bool checksum, uint64_t lsn) {
+	CartSnapshotWriter writer(path, checksum, lsn);
+	store.forEach([&writer](const ShoppingCart& cart) { writer.write(cart); });
+	writer.finish();
+	return writer.count();
+}
+
+uint64_t restoreSnapshot(CartStore& store, const std::string& path) {
+	uint64_t lsn;
+	return restoreSnapshot(store, path, lsn);
+}
+
+uint64_t restoreSnapshot(CartStore& store, const std::string& path, uint64_t& lsn) {
+	CartSnapshotReader reader(path);
+	lsn = reader.lsn();
+	uint64_t restored = 0;
+	while (std::optional<ShoppingCart> cart = reader.next()) {
+		store.insert(std::move(*cart));
+		++restored;
+	}
+	return restored;
+}
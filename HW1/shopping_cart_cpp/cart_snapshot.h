@@ -0,0 +1,77 @@
+#pragma once
+#include "cart.h"
+#include "cart_store.h"
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Binary snapshots of carts: owner id, cart UUID as raw bytes, and lines as (item id, quantity).
+//
+// A snapshot is a header followed by blocks of records, ending with an empty block and the
+// number of carts written. Item ids are only meaningful within one process, so each item's name
+// is written once, before the first cart that holds it, and ids are remapped on restore.
+// Blocks are checksummed if the writer was asked to, and are written and read one at a time,
+// so memory stays bounded however many carts the snapshot holds.
+
+// Streams carts into a snapshot file. lsn is the last write-ahead log record the carts reflect,
+// so that replaying the log over the restored snapshot skips what it already holds.
+//
+// Carts are written to path + ".tmp", which only replaces the file at path once finished.
+class CartSnapshotWriter {
+public:
+	explicit CartSnapshotWriter(const std::string& path, bool checksum = false, uint64_t lsn = 0);
+	// Removes the unfinished snapshot, leaving the file at path as it was.
+	~CartSnapshotWriter();
+	CartSnapshotWriter(const CartSnapshotWriter&) = delete;
+	CartSnapshotWriter& operator=(const CartSnapshotWriter&) = delete;
+	void write(const ShoppingCart& cart);
+	// Writes the end of the snapshot, syncs it to disk and renames it over the file at path.
+	void finish();
+	uint64_t count() const { return carts; }
+private:
+	void flush();
+
+	std::string path;
+	std::string temporary;
+	std::ofstream file;
+	std::vector<char> block;
+	std::vector<bool> written_items;
+	bool checksum;
+	bool finished = false;
+	uint64_t carts = 0;
+};
+
+// Streams carts back out of a snapshot file. Throws std::runtime_error("Invalid snapshot file")
+// if the file is truncated, corrupt, or fails its checksum.
+class CartSnapshotReader {
+public:
+	explicit CartSnapshotReader(const std::string& path);
+	// The next cart, or nothing once every cart has been read.
+	std::optional<ShoppingCart> next();
+	// The log sequence number the snapshot was saved with.
+	uint64_t lsn() const { return saved_lsn; }
+private:
+	bool readBlock();
+	void readItem();
+
+	std::ifstream file;
+	std::vector<char> block;
+	size_t position = 0;
+	std::vector<ItemId> local_items;
+	std::vector<CartLine> lines;
+	bool checksum = false;
+	bool finished = false;
+	uint64_t carts = 0;
+	uint64_t saved_lsn = 0;
+};
+
+// Writes every cart in the store and returns how many were written. To pair the snapshot with a
+// write-ahead log, take it while no mutations are logged and pass CartWal::lastLsn(), and
+// checkpoint the log only once this has returned: until then the old snapshot is still in place.
+uint64_t saveSnapshot(const CartStore& store, const std::string& path, bool checksum = false, uint64_t lsn = 0);
+// Adds every cart in the snapshot to the store and returns how many were read. The second form
+// also gives the log sequence number to pass to replayWal.
+uint64_t restoreSnapshot(CartStore& store, const std::string& path);
+uint64_t restoreSnapshot(CartStore& store, const std::string& path, uint64_t& lsn);
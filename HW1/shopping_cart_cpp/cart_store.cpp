@@ -0,0 +1,251 @@
+#include "cart_store.h"
+#include "work_stealing_pool.h"
+#include <algorithm>
+#include <stdexcept>
+
+// How many carts ahead a repricing job asks for the next cart's map node.
+static constexpr size_t PREFETCH_DISTANCE = 8;
+
+static size_t shardCount(size_t requested) {
+	size_t count = 1;
+	while (count < requested && count < MAX_SHARDS) {
+		count *= 2;
+	}
+	return count;
+}
+
+CartStore::CartStore(size_t shard_count, bool index_items)
+	: shard_mask(shardCount(shard_count) - 1), shards(shard_mask + 1), owners(shard_mask + 1),
+	index_items(index_items) {}
+
+CartUuid CartStore::create(std::wstring_view owner_id) {
+	return insert(ShoppingCart(owner_id));
+}
+
+CartUuid CartStore::insert(ShoppingCart cart) {
+	CartUuid id = cart.getCartUuid();
+	OwnerID owner(cart.getId());
+	{
+		Shard& shard = shardOf(id);
+		std::unique_lock lock(shard.mutex);
+		auto [entry, added] = shard.carts.try_emplace(id, std::move(cart));
+		if (!added) {
+			throw std::invalid_argument("Cart already in store");
+		}
+		// Indexed before the shard lock is released, so no update can reindex the cart first,
+		// and no erase can unlist it from its owner before it is listed.
+		if (index_items) {
+			entry->second.cart.forEachLine([&](ItemId item, int) { indexItem(shard, item, *entry); });
+		}
+		OwnerShard& owner_shard = ownerShardOf(owner);
+		std::lock_guard owner_lock(owner_shard.mutex);
+		owner_shard.carts[owner].push_back(id);
+	}
+	return id;
+}
+
+bool CartStore::erase(const CartUuid& id) {
+	Shard& shard = shardOf(id);
+	std::unique_lock lock(shard.mutex);
+	auto entry = shard.carts.find(id);
+	if (entry == shard.carts.end()) {
+		return false;
+	}
+	if (index_items) {
+		entry->second.cart.forEachLine([&](ItemId item, int) { unindexItem(shard, item, *entry); });
+	}
+	{
+		const OwnerID& owner = entry->second.cart.getOwner();
+		OwnerShard& owner_shard = ownerShardOf(owner);
+		std::lock_guard owner_lock(owner_shard.mutex);
+		auto carts = owner_shard.carts.find(owner);
+		if (carts != owner_shard.carts.end()) {
+			std::erase(carts->second, id);
+			if (carts->second.empty()) {
+				owner_shard.carts.erase(carts);
+			}
+		}
+	}
+	shard.carts.erase(entry);
+	return true;
+}
+
+bool CartStore::contains(const CartUuid& id) const {
+	const Shard& shard = shardOf(id);
+	std::shared_lock lock(shard.mutex);
+	return shard.carts.contains(id);
+}
+
+size_t CartStore::size() const {
+	size_t total = 0;
+	for (const Shard& shard : shards) {
+		std::shared_lock lock(shard.mutex);
+		total += shard.carts.size();
+	}
+	return total;
+}
+
+std::vector<CartUuid> CartStore::cartsOf(std::wstring_view owner_id) const {
+	OwnerID owner(owner_id);
+	const OwnerShard& owner_shard = ownerShardOf(owner);
+	std::lock_guard lock(owner_shard.mutex);
+	auto carts = owner_shard.carts.find(owner);
+	return carts != owner_shard.carts.end() ? carts->second : std::vector<CartUuid>();
+}
+
+std::vector<CartUuid> CartStore::cartsHolding(ItemId item) const {
+	std::vector<CartUuid> holding;
+	for (const Shard& shard : shards) {
+		std::shared_lock lock(shard.mutex);
+		if (!index_items) {
+			for (const Slot& slot : shard.carts) {
+				std::lock_guard cart_lock(slot.second.lock);
+				slot.second.cart.forEachLine([&](ItemId held, int) {
+					if (held == item) {
+						holding.push_back(slot.first);
+					}
+				});
+			}
+			continue;
+		}
+		std::lock_guard items_lock(shard.items_mutex);
+		auto carts = shard.items.find(item);
+		if (carts != shard.items.end()) {
+			carts->second.forEach([&](const Slot* slot) { holding.push_back(slot->first); });
+		}
+	}
+	return holding;
+}
+
+RepriceResult CartStore::reprice(std::span<const ItemId> items, WorkStealingPool& pool) const {
+	auto started = std::chrono::steady_clock::now();
+	std::atomic<uint64_t> repriced = 0;
+	std::atomic<uint64_t> unpriced = 0;
+	pool.parallelFor(shards.size(), 1, [&](size_t begin, size_t end) {
+		uint64_t shard_repriced = 0;
+		uint64_t shard_unpriced = 0;
+		// getTotal only writes the cart's cached total, which the cart lock covers.
+		auto repriceCart = [&](const Entry& entry) {
+			std::lock_guard cart_lock(entry.lock);
+			if (entry.cart.tryGetTotal()) {
+				++shard_repriced;
+			}
+			else {
+				++shard_unpriced;
+			}
+		};
+		std::vector<const Slot*> holding;
+		for (size_t index = begin; index < end; ++index) {
+			const Shard& shard = shards[index];
+			std::shared_lock lock(shard.mutex);
+			if (!index_items) {
+				for (const Slot& slot : shard.carts) {
+					bool holds = false;
+					{
+						std::lock_guard cart_lock(slot.second.lock);
+						slot.second.cart.forEachLine([&](ItemId held, int) {
+							holds = holds || std::find(items.begin(), items.end(), held) != items.end();
+						});
+					}
+					if (holds) {
+						repriceCart(slot.second);
+					}
+				}
+				continue;
+			}
+			holding.clear();
+			{
+				std::lock_guard items_lock(shard.items_mutex);
+				for (ItemId item : items) {
+					auto carts = shard.items.find(item);
+					if (carts != shard.items.end()) {
+						carts->second.forEach([&](const Slot* slot) { holding.push_back(slot); });
+					}
+				}
+			}
+			if (items.size() > 1) {
+				std::sort(holding.begin(), holding.end());
+				holding.erase(std::unique(holding.begin(), holding.end()), holding.end());
+			}
+			// The nodes are scattered over the heap, so ask for each one a few carts early.
+			for (size_t i = 0; i < holding.size(); ++i) {
+#if defined(__GNUC__)
+				if (i + PREFETCH_DISTANCE < holding.size()) {
+					__builtin_prefetch(holding[i + PREFETCH_DISTANCE]);
+				}
+#endif
+				repriceCart(holding[i]->second);
+			}
+		}
+		repriced += shard_repriced;
+		unpriced += shard_unpriced;
+	});
+	return { repriced, unpriced, std::chrono::steady_clock::now() - started };
+}
+
+CartStore::HeldItems::HeldItems(const ShoppingCart& cart) {
+	if (cart.itemCount() > std::size(items)) {
+		overflow.reserve(cart.itemCount());
+		cart.forEachLine([this](ItemId item, int) { overflow.push_back(item); });
+		return;
+	}
+	cart.forEachLine([this](ItemId item, int) { items[count++] = item; });
+}
+
+std::span<const ItemId> CartStore::HeldItems::get() const {
+	return overflow.empty() ? std::span<const ItemId>(items, count) : std::span<const ItemId>(overflow);
+}
+
+void CartStore::indexItem(Shard& shard, ItemId item, Slot& slot) {
+	std::lock_guard lock(shard.items_mutex);
+	shard.items[item].insert(&slot);
+}
+
+void CartStore::unindexItem(Shard& shard, ItemId item, Slot& slot) {
+	std::lock_guard lock(shard.items_mutex);
+	auto carts = shard.items.find(item);
+	if (carts != shard.items.end()) {
+		carts->second.erase(&slot);
+		if (carts->second.empty()) {
+			shard.items.erase(carts);
+		}
+	}
+}
+
+bool CartStore::keepIdentity(Slot& slot, const OwnerID& owner) {
+	ShoppingCart& cart = slot.second.cart;
+	// A cart moved out of the store took its lines with it, so an empty one is filed instead.
+	if (cart.isMovedFrom()) {
+		cart = ShoppingCart::restore(owner.view(), slot.first, {});
+		return true;
+	}
+	if (cart.getCartUuid() == slot.first && cart.getOwner() == owner) {
+		return false;
+	}
+	// The lines fn left are kept; only the id and owner the store filed the cart under are put back.
+	std::vector<CartLine> lines;
+	lines.reserve(cart.itemCount());
+	cart.forEachLine([&](ItemId item, int quantity) { lines.push_back({ item, quantity }); });
+	cart = ShoppingCart::restore(owner.view(), slot.first, lines);
+	return true;
+}
+
+void CartStore::reindex(Shard& shard, Slot& slot, const HeldItems& before) {
+	// Both sides are in item id order, so one merge finds what was added and what was removed.
+	std::span<const ItemId> held = before.get();
+	size_t next = 0;
+	slot.second.cart.forEachLine([&](ItemId item, int) {
+		for (; next < held.size() && held[next] < item; ++next) {
+			unindexItem(shard, held[next], slot);
+		}
+		if (next < held.size() && held[next] == item) {
+			++next;
+		}
+		else {
+			indexItem(shard, item, slot);
+		}
+	});
+	for (; next < held.size(); ++next) {
+		unindexItem(shard, held[next], slot);
+	}
+}
@@ -0,0 +1,229 @@
+#pragma once
+#include "cart.h"
+#include "cart_events.h"
+#include "cart_id.h"
+#include "flat_pointer_set.h"
+#include "item_registry.h"
+#include "owner_id.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class WorkStealingPool;
+
+#define DEFAULT_SHARDS 64
+#define MAX_SHARDS (1 << 16)
+
+// Cart ids are random, so their leading bytes already make a good hash.
+struct CartUuidHash {
+	size_t operator()(const CartUuid& id) const {
+		uint64_t hash;
+		std::memcpy(&hash, id.data(), sizeof(hash));
+		return (size_t)hash;
+	}
+};
+
+struct OwnerIDHash {
+	size_t operator()(const OwnerID& id) const {
+		return std::hash<std::wstring_view>()(id.view());
+	}
+};
+
+// What a repricing job did.
+struct RepriceResult {
+	// Carts whose cached total now matches the current catalog.
+	uint64_t repriced = 0;
+	// Carts holding an item the current catalog no longer has. Their totals stay stale, and
+	// getTotal on them throws, until the item is removed.
+	uint64_t unpriced = 0;
+	std::chrono::nanoseconds elapsed{ 0 };
+};
+
+// A concurrent collection of carts, keyed by cart id, with a secondary index by owner id.
+//
+// Carts are split across shards by id. Each shard is guarded by a reader/writer lock that is
+// only held exclusively to add or remove carts; reading or changing a cart takes the shard
+// lock shared plus a lock of the cart's own, so threads working on different carts never wait
+// for each other. The owner index is sharded the same way, by owner id, and is changed with the
+// cart's shard lock held exclusively, so it always lists exactly the stored carts. Locks are
+// taken in one order: shard, then cart, then owner shard or item index; never the other way.
+//
+// Stores can also keep an index from each item to the carts holding it, which lets a price
+// change be pushed to just the carts it affects. Each shard indexes its own carts, under a
+// mutex of its own. Keeping the index up to date costs every update a comparison of the cart's
+// items before and after, so it is off unless asked for.
+class CartStore {
+public:
+	// shard_count is rounded up to a power of two, up to MAX_SHARDS.
+	explicit CartStore(size_t shard_count = DEFAULT_SHARDS, bool index_items = false);
+	CartStore(const CartStore&) = delete;
+	CartStore& operator=(const CartStore&) = delete;
+
+	// Creates an empty cart for the owner and returns its id.
+	CartUuid create(std::wstring_view owner_id);
+	// Adds an existing cart. Throws if a cart with the same id is already stored.
+	CartUuid insert(ShoppingCart cart);
+	// Removes a cart, returning false if it was not stored.
+	bool erase(const CartUuid& id);
+	bool contains(const CartUuid& id) const;
+	size_t size() const;
+	// The ids of every cart the owner has, in no particular order.
+	std::vector<CartUuid> cartsOf(std::wstring_view owner_id) const;
+	// The ids of every cart holding the item, in no particular order. Without the item index
+	// this visits every cart.
+	std::vector<CartUuid> cartsHolding(ItemId item) const;
+	// Brings the cached total of every cart holding any of the items up to date with the
+	// current catalog, so the next getTotal on them is a field read. Meant to run right after
+	// publishing a catalog that changed those items' prices. Shards are split across the pool,
+	// and each cart is locked only while it is repriced, so updates to other carts carry on.
+	// Without the item index every cart is checked.
+	RepriceResult reprice(std::span<const ItemId> items, WorkStealingPool& pool) const;
+
+	// Calls fn(const ShoppingCart&) with the cart locked. Returns false if it is not stored.
+	template <typename Fn>
+	bool read(const CartUuid& id, Fn&& fn) const {
+		const Shard& shard = shardOf(id);
+		std::shared_lock lock(shard.mutex);
+		auto entry = shard.carts.find(id);
+		if (entry == shard.carts.end()) {
+			return false;
+		}
+		std::lock_guard cart_lock(entry->second.lock);
+		fn(static_cast<const ShoppingCart&>(entry->second.cart));
+		return true;
+	}
+	// Calls fn(ShoppingCart&) with the cart locked. Returns false if it is not stored.
+	// Exceptions from fn propagate, leaving the cart as fn left it. The store files carts by id
+	// and owner, so fn must not assign another cart over this one or move it out: if the id or
+	// owner changed, they are put back and std::logic_error is thrown. A cart moved out leaves an
+	// empty one behind. Cart events that would have to wait for
+	// the consumer are pushed after the locks are released.
+	template <typename Fn>
+	bool update(const CartUuid& id, Fn&& fn) {
+		CartEvents::Deferral deferral;
+		Shard& shard = shardOf(id);
+		std::shared_lock lock(shard.mutex);
+		auto entry = shard.carts.find(id);
+		if (entry == shard.carts.end()) {
+			return false;
+		}
+		std::lock_guard cart_lock(entry->second.lock);
+		OwnerID owner = entry->second.cart.getOwner();
+		if (!index_items) {
+			try {
+				fn(entry->second.cart);
+			}
+			catch (...) {
+				keepIdentity(*entry, owner);
+				throw;
+			}
+			if (keepIdentity(*entry, owner)) {
+				throw std::logic_error("Cart id or owner changed in update");
+			}
+			return true;
+		}
+		HeldItems before(entry->second.cart);
+		try {
+			fn(entry->second.cart);
+		}
+		catch (...) {
+			keepIdentity(*entry, owner);
+			reindex(shard, *entry, before);
+			throw;
+		}
+		bool replaced = keepIdentity(*entry, owner);
+		reindex(shard, *entry, before);
+		if (replaced) {
+			throw std::logic_error("Cart id or owner changed in update");
+		}
+		return true;
+	}
+	// Calls fn(const ShoppingCart&) for every cart, one shard at a time. Carts added or removed
+	// meanwhile may or may not be visited.
+	template <typename Fn>
+	void forEach(Fn&& fn) const {
+		for (const Shard& shard : shards) {
+			std::shared_lock lock(shard.mutex);
+			for (const auto& entry : shard.carts) {
+				std::lock_guard cart_lock(entry.second.lock);
+				fn(static_cast<const ShoppingCart&>(entry.second.cart));
+			}
+		}
+	}
+
+private:
+	// A one-byte lock for a single cart. Waiters sleep on the flag instead of spinning.
+	class CartLock {
+	public:
+		void lock() const {
+			while (locked.exchange(true, std::memory_order_acquire)) {
+				locked.wait(true, std::memory_order_relaxed);
+			}
+		}
+		void unlock() const {
+			locked.store(false, std::memory_order_release);
+			locked.notify_one();
+		}
+	private:
+		mutable std::atomic<bool> locked = false;
+	};
+	struct Entry {
+		explicit Entry(ShoppingCart&& cart) : cart(std::move(cart)) {}
+		CartLock lock;
+		ShoppingCart cart;
+	};
+	using Carts = std::unordered_map<CartUuid, Entry, CartUuidHash>;
+	// Map nodes never move, so the item index can point straight at them.
+	using Slot = Carts::value_type;
+	struct alignas(64) Shard {
+		mutable std::shared_mutex mutex;
+		Carts carts;
+		// The item index for this shard's carts. Changed with the shard lock held either way,
+		// so it has a mutex of its own.
+		mutable std::mutex items_mutex;
+		std::unordered_map<ItemId, FlatPointerSet<Slot>> items;
+	};
+	struct alignas(64) OwnerShard {
+		mutable std::mutex mutex;
+		std::unordered_map<OwnerID, std::vector<CartUuid>, OwnerIDHash> carts;
+	};
+	// The items a cart held when an update started, in id order. Small carts fit inline, so
+	// most updates do not allocate.
+	class HeldItems {
+	public:
+		explicit HeldItems(const ShoppingCart& cart);
+		std::span<const ItemId> get() const;
+	private:
+		ItemId items[16];
+		size_t count = 0;
+		std::vector<ItemId> overflow;
+	};
+
+	// Puts back the id and owner the cart is stored under if an update changed them, keeping
+	// its lines, or an empty cart if it was moved out. Returns whether it had to. Called with
+	// the cart locked.
+	static bool keepIdentity(Slot& slot, const OwnerID& owner);
+	// Item index upkeep, called with the shard locked exclusively or the cart locked.
+	static void indexItem(Shard& shard, ItemId item, Slot& slot);
+	static void unindexItem(Shard& shard, ItemId item, Slot& slot);
+	static void reindex(Shard& shard, Slot& slot, const HeldItems& before);
+
+	// Shards are picked from the upper half of the hash; the maps bucket on all of it.
+	Shard& shardOf(const CartUuid& id) { return shards[(CartUuidHash()(id) >> 32) & shard_mask]; }
+	const Shard& shardOf(const CartUuid& id) const { return shards[(CartUuidHash()(id) >> 32) & shard_mask]; }
+	OwnerShard& ownerShardOf(const OwnerID& owner) { return owners[OwnerIDHash()(owner) & shard_mask]; }
+	const OwnerShard& ownerShardOf(const OwnerID& owner) const { return owners[OwnerIDHash()(owner) & shard_mask]; }
+
+	size_t shard_mask;
+	std::vector<Shard> shards;
+	std::vector<OwnerShard> owners;
+	bool index_items;
+};
@@ -0,0 +1,512 @@
+#include "cart_wal.h"
+#include "checksum.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr char WAL_MAGIC[8] = { 'C', 'A', 'R', 'T', 'W', 'A', 'L', '\0' };
+	constexpr uint32_t WAL_FORMAT_VERSION = 2;
+	constexpr uint32_t WAL_BYTE_ORDER = 0x01020304;
+
+	// The log is this header followed by groups. Each group is its size, the number of its last
+	// record, its records, and the checksum of all but the size, written with one write call.
+	// Records are numbered on from base_lsn, which a checkpoint moves past the records it drops.
+	struct WalFileHeader {
+		char magic[8];
+		uint32_t format_version;
+		uint32_t byte_order;
+		uint64_t base_lsn;
+	};
+
+	// Anything larger is a torn size field rather than a group.
+	constexpr uint32_t MAX_GROUP_SIZE = 1u << 30;
+
+	constexpr char ITEM_RECORD = 'I';
+	constexpr char CREATE_RECORD = 'C';
+	constexpr char ERASE_RECORD = 'E';
+	constexpr char ADD_RECORD = 'A';
+	constexpr char UPDATE_RECORD = 'U';
+	constexpr char REMOVE_RECORD = 'R';
+
+	template <typename T>
+	void append(std::vector<char>& buffer, const T& value) {
+		const char* bytes = reinterpret_cast<const char*>(&value);
+		buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+	}
+
+	bool writeAll(int fd, const char* data, size_t size) {
+		while (size > 0) {
+#ifdef _WIN32
+			int written = _write(fd, data, (unsigned)std::min<size_t>(size, 1 << 30));
+#else
+			ssize_t written = ::write(fd, data, size);
+#endif
+			if (written <= 0) {
+				return false;
+			}
+			data += written;
+			size -= written;
+		}
+		return true;
+	}
+
+	bool syncFile(int fd) {
+#ifdef _WIN32
+		return _commit(fd) == 0;
+#else
+		return ::fdatasync(fd) == 0;
+#endif
+	}
+
+	void closeFile(int fd) {
+#ifdef _WIN32
+		_close(fd);
+#else
+		::close(fd);
+#endif
+	}
+
+	bool truncateFile(int fd, uint64_t size) {
+#ifdef _WIN32
+		return _chsize_s(fd, (long long)size) == 0;
+#else
+		return ::ftruncate(fd, (off_t)size) == 0;
+#endif
+	}
+
+	bool writeHeader(int fd, uint64_t base_lsn) {
+		WalFileHeader header = {};
+		std::memcpy(header.magic, WAL_MAGIC, sizeof(WAL_MAGIC));
+		header.format_version = WAL_FORMAT_VERSION;
+		header.byte_order = WAL_BYTE_ORDER;
+		header.base_lsn = base_lsn;
+		return writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header));
+	}
+
+	// Renames from over to, replacing it in one step.
+	bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	// Flushes the directory holding path, so that a rename into it survives a power loss.
+	bool syncDirectory(const std::string& path) {
+#ifdef _WIN32
+		// MOVEFILE_WRITE_THROUGH has already waited for the rename to reach the disk.
+		return true;
+#else
+		size_t slash = path.rfind('/');
+		std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+		int fd = ::open(directory.c_str(), O_RDONLY);
+		bool synced = fd >= 0 && ::fsync(fd) == 0;
+		if (fd >= 0) {
+			::close(fd);
+		}
+		return synced;
+#endif
+	}
+
+	// Writes a log holding only its header to a new file at path.
+	bool writeLog(const std::string& path, uint64_t base_lsn, bool sync) {
+#ifdef _WIN32
+		int fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+		int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+		if (fd < 0) {
+			return false;
+		}
+		bool written = writeHeader(fd, base_lsn) && (!sync || syncFile(fd));
+		closeFile(fd);
+		return written;
+	}
+
+	// Puts a log holding only its header at path, written beside it and renamed into place, so
+	// that a crash leaves either the old file or the whole new one behind.
+	bool replaceLog(const std::string& path, uint64_t base_lsn, bool sync) {
+		std::string temporary = path + ".tmp";
+		if (!writeLog(temporary, base_lsn, sync) || !replaceFile(temporary, path)) {
+			std::remove(temporary.c_str());
+			return false;
+		}
+		return !sync || syncDirectory(path);
+	}
+
+	int openLog(const std::string& path) {
+#ifdef _WIN32
+		return _open(path.c_str(), _O_WRONLY | _O_APPEND | _O_BINARY);
+#else
+		return ::open(path.c_str(), O_WRONLY | O_APPEND);
+#endif
+	}
+
+	void readHeader(std::ifstream& file, WalFileHeader& header) {
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header))
+			|| std::memcmp(header.magic, WAL_MAGIC, sizeof(WAL_MAGIC)) != 0
+			|| header.format_version != WAL_FORMAT_VERSION
+			|| header.byte_order != WAL_BYTE_ORDER) {
+			throw std::runtime_error("Invalid WAL file");
+		}
+	}
+
+	// Reads the next group's records and the number of its last record. Returns false at the
+	// end of the log, or at a torn write, as a crash mid-write leaves behind.
+	bool readGroup(std::ifstream& file, std::vector<char>& group, uint64_t& last_lsn) {
+		uint32_t size;
+		if (!file.read(reinterpret_cast<char*>(&size), sizeof(size)) || size < sizeof(last_lsn) || size > MAX_GROUP_SIZE) {
+			return false;
+		}
+		group.resize(size);
+		uint64_t checksum;
+		if (!file.read(group.data(), size) || !file.read(reinterpret_cast<char*>(&checksum), sizeof(checksum))
+			|| checksum != blockChecksum(group.data(), group.size())) {
+			return false;
+		}
+		std::memcpy(&last_lsn, group.data(), sizeof(last_lsn));
+		group.erase(group.begin(), group.begin() + sizeof(last_lsn));
+		return true;
+	}
+
+	// Takes a value out of a group, or reports that the group ends first.
+	template <typename T>
+	bool take(const std::vector<char>& group, size_t& position, T& value) {
+		if (group.size() - position < sizeof(T)) {
+			return false;
+		}
+		std::memcpy(&value, group.data() + position, sizeof(T));
+		position += sizeof(T);
+		return true;
+	}
+}
+
+CartWal::CartWal(const std::string& path, GroupCommitOptions options) : options(options), path(path) {
+	// An existing log is kept up to its last complete group, and numbering carries on from there.
+	// Logs are only ever renamed into place whole, so one without a header was not written here,
+	// and starting it afresh could number records below those a snapshot already holds.
+	uint64_t kept = 0;
+	{
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (file) {
+			if ((uint64_t)file.tellg() < sizeof(WalFileHeader)) {
+				throw std::runtime_error("Invalid WAL file");
+			}
+			file.seekg(0);
+			WalFileHeader header;
+			readHeader(file, header);
+			kept = sizeof(header);
+			next_lsn = header.base_lsn + 1;
+			std::vector<char> group;
+			uint64_t last_lsn;
+			while (readGroup(file, group, last_lsn)) {
+				kept = (uint64_t)file.tellg();
+				next_lsn = last_lsn + 1;
+			}
+		}
+	}
+	if (kept == 0 && !replaceLog(path, 0, options.sync)) {
+		throw std::runtime_error("Cannot open WAL file");
+	}
+	fd = openLog(path);
+	if (fd < 0) {
+		throw std::runtime_error("Cannot open WAL file");
+	}
+	if (kept != 0 && !truncateFile(fd, kept)) {
+		closeFile(fd);
+		throw std::runtime_error("Cannot write WAL file");
+	}
+	durable_lsn = next_lsn - 1;
+	writer = std::thread([this]() { writerLoop(); });
+}
+
+CartWal::~CartWal() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	pending_ready.notify_one();
+	writer.join();
+	closeFile(fd);
+}
+
+uint64_t CartWal::logCreate(const CartUuid& id, std::wstring_view owner_id) {
+	std::lock_guard lock(mutex);
+	bool starts_group = startRecord();
+	// Owner ids are at most 12 characters, all of them below U+10000.
+	pending.push_back(CREATE_RECORD);
+	append(pending, id);
+	pending.push_back((char)owner_id.size());
+	for (wchar_t c : owner_id) {
+		append(pending, (uint16_t)c);
+	}
+	return endRecord(starts_group);
+}
+
+uint64_t CartWal::logErase(const CartUuid& id) {
+	return appendRecord(ERASE_RECORD, id, std::string_view(), 0);
+}
+
+uint64_t CartWal::logAdd(const CartUuid& id, std::string_view item_name, int amount) {
+	return appendRecord(ADD_RECORD, id, item_name, amount);
+}
+
+uint64_t CartWal::logUpdate(const CartUuid& id, std::string_view item_name, int amount) {
+	return appendRecord(UPDATE_RECORD, id, item_name, amount);
+}
+
+uint64_t CartWal::logRemove(const CartUuid& id, std::string_view item_name) {
+	return appendRecord(REMOVE_RECORD, id, item_name, 0);
+}
+
+uint64_t CartWal::appendRecord(char type, const CartUuid& id, std::string_view item_name, int amount) {
+	std::lock_guard lock(mutex);
+	bool starts_group = startRecord();
+	uint32_t item = 0;
+	if (type != ERASE_RECORD) {
+		auto [number, added] = item_numbers.try_emplace(std::string(item_name), (uint32_t)item_numbers.size());
+		item = number->second;
+		if (added) {
+			pending.push_back(ITEM_RECORD);
+			append(pending, item);
+			append(pending, (uint32_t)item_name.size());
+			pending.insert(pending.end(), item_name.begin(), item_name.end());
+		}
+	}
+	pending.push_back(type);
+	append(pending, id);
+	if (type != ERASE_RECORD) {
+		append(pending, item);
+	}
+	if (type == ADD_RECORD || type == UPDATE_RECORD) {
+		pending.push_back((char)amount);
+	}
+	return endRecord(starts_group);
+}
+
+bool CartWal::startRecord() {
+	if (failed) {
+		throw std::runtime_error("Cannot write WAL file");
+	}
+	if (!pending.empty()) {
+		return false;
+	}
+	pending_since = std::chrono::steady_clock::now();
+	return true;
+}
+
+uint64_t CartWal::endRecord(bool starts_group) {
+	// The writer only needs waking to start a group's window, or to end it early.
+	if (starts_group || pending.size() >= options.max_bytes) {
+		pending_ready.notify_one();
+	}
+	return next_lsn++;
+}
+
+void CartWal::waitDurable(uint64_t lsn) {
+	std::unique_lock lock(mutex);
+	group_written.wait(lock, [&]() { return durable_lsn >= lsn || failed; });
+	if (durable_lsn < lsn) {
+		throw std::runtime_error("Cannot write WAL file");
+	}
+}
+
+uint64_t CartWal::durableLsn() const {
+	std::lock_guard lock(mutex);
+	return durable_lsn;
+}
+
+uint64_t CartWal::lastLsn() const {
+	std::lock_guard lock(mutex);
+	return next_lsn - 1;
+}
+
+uint64_t CartWal::groupCount() const {
+	std::lock_guard lock(mutex);
+	return groups;
+}
+
+bool CartWal::checkpoint(uint64_t lsn) {
+	std::unique_lock lock(mutex);
+	// With nothing pending and every group written, the writer is idle, and holding the mutex
+	// keeps it so.
+	group_written.wait(lock, [&]() { return durable_lsn == next_lsn - 1 || failed; });
+	if (failed) {
+		throw std::runtime_error("Cannot write WAL file");
+	}
+	if (lsn != durable_lsn) {
+		return false;
+	}
+	// The old log stays whole until the new one replaces it. Windows cannot replace a file that
+	// is still open, so the log is reopened afterwards rather than kept open across the rename.
+	closeFile(fd);
+	bool replaced = replaceLog(path, lsn, options.sync);
+	fd = openLog(path);
+	if (!replaced || fd < 0) {
+		failed = true;
+		throw std::runtime_error("Cannot write WAL file");
+	}
+	// Records logged from here on name their items again.
+	item_numbers.clear();
+	return true;
+}
+
+void CartWal::writerLoop() {
+	std::vector<char> group;
+	std::unique_lock lock(mutex);
+	while (true) {
+		pending_ready.wait(lock, [&]() { return stopping || !pending.empty(); });
+		if (pending.empty()) {
+			return;
+		}
+		pending_ready.wait_until(lock, pending_since + options.window, [&]() { return stopping || pending.size() >= options.max_bytes; });
+
+		// Take the whole pending group and write it without holding the lock, so appends go on.
+		group.clear();
+		uint64_t last_lsn = next_lsn - 1;
+		uint32_t size = (uint32_t)(sizeof(last_lsn) + pending.size());
+		append(group, size);
+		append(group, last_lsn);
+		group.insert(group.end(), pending.begin(), pending.end());
+		append(group, blockChecksum(group.data() + sizeof(size), size));
+		pending.clear();
+		lock.unlock();
+		bool written = writeAll(fd, group.data(), group.size()) && (!options.sync || syncFile(fd));
+		lock.lock();
+		if (!written) {
+			failed = true;
+			group_written.notify_all();
+			return;
+		}
+		durable_lsn = last_lsn;
+		++groups;
+		group_written.notify_all();
+	}
+}
+
+WalReplay replayWal(CartStore& store, const std::string& path, uint64_t after_lsn) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Cannot open WAL file");
+	}
+	WalFileHeader header;
+	readHeader(file, header);
+	if (header.base_lsn > after_lsn) {
+		throw std::runtime_error("WAL file starts after the snapshot");
+	}
+
+	WalReplay replay;
+	std::vector<std::string> items;
+	std::vector<char> group;
+	uint64_t lsn = header.base_lsn;
+	uint64_t last_lsn;
+	// A torn write ends the log: everything before it is applied.
+	while (readGroup(file, group, last_lsn)) {
+		size_t position = 0;
+		while (position < group.size()) {
+			char type = group[position++];
+			CartUuid id;
+			uint32_t item = 0;
+			if (type == ITEM_RECORD) {
+				uint32_t length;
+				if (!take(group, position, item) || !take(group, position, length) || group.size() - position < length) {
+					throw std::runtime_error("Invalid WAL file");
+				}
+				if (item >= items.size()) {
+					items.resize(item + 1);
+				}
+				items[item].assign(group.data() + position, length);
+				position += length;
+				continue;
+			}
+			if (!take(group, position, id)) {
+				throw std::runtime_error("Invalid WAL file");
+			}
+			// Records the snapshot already holds are read past, but not applied again.
+			bool held = ++lsn <= after_lsn;
+			if (type == CREATE_RECORD) {
+				unsigned char length;
+				if (!take(group, position, length) || length > OwnerIDFormat::LENGTH) {
+					throw std::runtime_error("Invalid WAL file");
+				}
+				wchar_t owner[OwnerIDFormat::LENGTH];
+				for (size_t i = 0; i < length; ++i) {
+					uint16_t c;
+					if (!take(group, position, c)) {
+						throw std::runtime_error("Invalid WAL file");
+					}
+					owner[i] = (wchar_t)c;
+				}
+				if (held) {
+					continue;
+				}
+				if (store.contains(id)) {
+					++replay.skipped;
+					continue;
+				}
+				try {
+					store.insert(ShoppingCart::restore(std::wstring_view(owner, length), id, {}));
+				}
+				catch (const std::logic_error&) {
+					throw std::runtime_error("Invalid WAL file");
+				}
+				++replay.applied;
+				continue;
+			}
+			if (type == ERASE_RECORD) {
+				if (!held) {
+					++(store.erase(id) ? replay.applied : replay.skipped);
+				}
+				continue;
+			}
+			if (type != ADD_RECORD && type != UPDATE_RECORD && type != REMOVE_RECORD) {
+				throw std::runtime_error("Invalid WAL file");
+			}
+			unsigned char amount = 0;
+			if (!take(group, position, item) || item >= items.size()
+				|| ((type == ADD_RECORD || type == UPDATE_RECORD) && !take(group, position, amount))) {
+				throw std::runtime_error("Invalid WAL file");
+			}
+			if (held) {
+				continue;
+			}
+			bool applied = false;
+			store.update(id, [&](ShoppingCart& cart) {
+				try {
+					if (type == ADD_RECORD) {
+						cart.addItem(items[item], amount);
+					}
+					else if (type == UPDATE_RECORD) {
+						cart.updateItem(items[item], amount);
+					}
+					else {
+						cart.removeItem(items[item]);
+					}
+					applied = true;
+				}
+				catch (const std::invalid_argument&) {
+				}
+			});
+			++(applied ? replay.applied : replay.skipped);
+		}
+		if (lsn != last_lsn) {
+			throw std::runtime_error("Invalid WAL file");
+		}
+	}
+	return replay;
+}
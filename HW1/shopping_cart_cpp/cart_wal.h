@@ -0,0 +1,106 @@
+#pragma once
+#include "cart_id.h"
+#include "cart_store.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// When the background writer commits a group of records: once the oldest has waited for
+// window, or once the group holds max_bytes, whichever comes first.
+struct GroupCommitOptions {
+	std::chrono::microseconds window = std::chrono::microseconds(500);
+	size_t max_bytes = 256 * 1024;
+	// Whether each group is flushed to stable storage. Without it, records survive a process
+	// crash but not a power loss.
+	bool sync = true;
+};
+
+// An append-only write-ahead log of cart mutations.
+//
+// Appending a record only copies it into the pending group and returns its log sequence number;
+// a background thread writes and syncs whole groups, so many mutations share one fsync. Callers
+// that need a mutation to be durable before answering wait for its number with waitDurable.
+//
+// Records for one cart must be logged in the order the cart changed. Log a mutation from inside
+// the CartStore::update call that made it, and log a cart's creation before its id is handed out.
+//
+// Opening an existing log appends to it, after dropping any torn group at its end, and numbers
+// records on from the last one it holds. The log only shrinks at a checkpoint. New logs, and the
+// fresh one a checkpoint starts, are written to path + ".tmp" and renamed into place, so the file
+// at path always starts with a whole header.
+class CartWal {
+public:
+	// Throws std::runtime_error("Invalid WAL file") if the file exists but is not a log, empty
+	// files included.
+	explicit CartWal(const std::string& path, GroupCommitOptions options = {});
+	// Commits whatever is pending and stops the writer.
+	~CartWal();
+	CartWal(const CartWal&) = delete;
+	CartWal& operator=(const CartWal&) = delete;
+
+	uint64_t logCreate(const CartUuid& id, std::wstring_view owner_id);
+	uint64_t logErase(const CartUuid& id);
+	uint64_t logAdd(const CartUuid& id, std::string_view item_name, int amount);
+	uint64_t logUpdate(const CartUuid& id, std::string_view item_name, int amount);
+	uint64_t logRemove(const CartUuid& id, std::string_view item_name);
+
+	// Blocks until every record up to and including lsn is written (and synced, if enabled).
+	// Throws std::runtime_error("Cannot write WAL file") if the writer has failed.
+	void waitDurable(uint64_t lsn);
+	uint64_t durableLsn() const;
+	// The number of the last record logged, durable or not.
+	uint64_t lastLsn() const;
+	// Number of groups written so far.
+	uint64_t groupCount() const;
+	// Starts the log afresh once a snapshot holds every record up to lsn, waiting for pending
+	// groups to be written first. Take the snapshot while no mutations are logged, passing it
+	// lastLsn(). Returns false, keeping the log whole, if records were logged after lsn; replay
+	// skips the ones the snapshot holds either way. Call it only once the snapshot is safely
+	// saved: a crash part way through leaves the old log or the new one, never neither.
+	bool checkpoint(uint64_t lsn);
+private:
+	uint64_t appendRecord(char type, const CartUuid& id, std::string_view item_name, int amount);
+	// Called with the mutex held around every record appended to the pending group.
+	bool startRecord();
+	uint64_t endRecord(bool starts_group);
+	void writerLoop();
+
+	GroupCommitOptions options;
+	std::string path;
+	int fd;
+	mutable std::mutex mutex;
+	std::condition_variable pending_ready;
+	std::condition_variable group_written;
+	std::vector<char> pending;
+	std::chrono::steady_clock::time_point pending_since;
+	// Items are numbered within the log, and named the first time they appear in it.
+	std::unordered_map<std::string, uint32_t> item_numbers;
+	uint64_t next_lsn = 1;
+	uint64_t durable_lsn = 0;
+	uint64_t groups = 0;
+	bool stopping = false;
+	bool failed = false;
+	std::thread writer;
+};
+
+// What replaying a log did.
+struct WalReplay {
+	// Records applied to the store.
+	uint64_t applied = 0;
+	// Records that no longer apply, such as adding an item the catalog has since dropped.
+	uint64_t skipped = 0;
+};
+
+// Applies every complete group in the log to the store, in order. A torn group at the end, as a
+// crash mid-write leaves behind, is ignored. Records numbered after_lsn or below are passed over
+// uncounted: after restoring a snapshot, pass the number it was saved with. Throws
+// std::runtime_error("Invalid WAL file") if the log is corrupt, and
+// std::runtime_error("WAL file starts after the snapshot") if a checkpoint dropped records
+// the store has not got.
+WalReplay replayWal(CartStore& store, const std::string& path, uint64_t after_lsn = 0);
@@ -0,0 +1,519 @@
+﻿#include "catalog.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+	constexpr char CATALOG_MAGIC[8] = { 'C', 'A', 'R', 'T', 'C', 'A', 'T', '\0' };
+	constexpr uint32_t CATALOG_FORMAT_VERSION = 1;
+	constexpr uint32_t CATALOG_BYTE_ORDER = 0x01020304;
+
+	// Binary catalog layout: this header, then the string table, the sorted key array and the
+	// price column. The key array and the price column start on 8-byte boundaries.
+	struct CatalogFileHeader {
+		char magic[8];
+		uint32_t format_version;
+		uint32_t byte_order;
+		uint64_t count;
+		uint64_t strings_offset;
+		uint64_t strings_size;
+		uint64_t keys_offset;
+		uint64_t prices_offset;
+	};
+
+	// The text formats accept prices up to 1e12; a binary catalog is held to the same range.
+	constexpr int64_t MAX_PRICE_CENTS = 100000000000000;
+
+	uint64_t alignUp(uint64_t offset) {
+		return (offset + 7) & ~uint64_t(7);
+	}
+
+	int64_t toCents(double price) {
+		if (!(price >= 0.0) || price > 1e12) {
+			throw std::invalid_argument("Invalid price in catalog");
+		}
+		return std::llround(price * 100.0);
+	}
+
+	// Reads a non-negative decimal price exactly, without going through a double.
+	bool parseCents(std::string_view text, int64_t& cents) {
+		size_t point = text.find('.');
+		std::string_view whole = text.substr(0, point);
+		std::string_view fraction = point == std::string_view::npos ? std::string_view() : text.substr(point + 1);
+		if (whole.empty() || whole.size() > 12 || (point != std::string_view::npos && fraction.empty())) {
+			return false;
+		}
+		int64_t value = 0;
+		for (char c : whole) {
+			if (c < '0' || c > '9') {
+				return false;
+			}
+			value = value * 10 + (c - '0');
+		}
+		for (size_t i = 0; i < fraction.size(); ++i) {
+			char c = fraction[i];
+			if (c < '0' || c > '9' || (i >= 2 && c != '0')) {
+				return false;
+			}
+		}
+		int64_t tenths = fraction.size() > 0 ? fraction[0] - '0' : 0;
+		int64_t hundredths = fraction.size() > 1 ? fraction[1] - '0' : 0;
+		cents = value * 100 + tenths * 10 + hundredths;
+		return true;
+	}
+
+	std::vector<std::pair<std::string, int64_t>> readText(std::istream& file) {
+		std::vector<std::pair<std::string, int64_t>> items;
+		std::string line;
+		while (std::getline(file, line)) {
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			size_t separator = line.find_first_of("\t,");
+			int64_t cents;
+			if (separator == std::string::npos || separator == 0 || !parseCents(std::string_view(line).substr(separator + 1), cents)) {
+				throw std::invalid_argument("Malformed catalog line");
+			}
+			items.emplace_back(line.substr(0, separator), cents);
+		}
+		return items;
+	}
+
+	// Flushes a written file to disk, so that once it is renamed into place it is whole.
+	bool syncFile(const std::string& path) {
+#ifdef _WIN32
+		int fd = _open(path.c_str(), _O_RDWR | _O_BINARY);
+		bool synced = fd >= 0 && _commit(fd) == 0;
+#else
+		int fd = ::open(path.c_str(), O_RDONLY);
+		bool synced = fd >= 0 && ::fsync(fd) == 0;
+#endif
+		if (fd >= 0) {
+#ifdef _WIN32
+			_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+		return synced;
+	}
+
+	// Renames from over to, replacing it in one step.
+	bool replaceFile(const std::string& from, const std::string& to) {
+#ifdef _WIN32
+		return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+		return std::rename(from.c_str(), to.c_str()) == 0;
+#endif
+	}
+
+	std::vector<std::pair<std::string, int64_t>> toCents(std::vector<std::pair<std::string, double>> items) {
+		std::vector<std::pair<std::string, int64_t>> converted;
+		converted.reserve(items.size());
+		for (auto& item : items) {
+			converted.emplace_back(std::move(item.first), toCents(item.second));
+		}
+		return converted;
+	}
+}
+
+struct CatalogIndex::Storage {
+	virtual ~Storage() = default;
+};
+
+struct CatalogIndex::OwnedStorage : CatalogIndex::Storage {
+	std::string strings;
+	std::vector<Key> keys;
+	std::vector<int64_t> prices;
+};
+
+struct CatalogIndex::MappedStorage : CatalogIndex::Storage {
+	const char* address = nullptr;
+	size_t size = 0;
+	~MappedStorage() override {
+#ifdef _WIN32
+		UnmapViewOfFile(address);
+#else
+		munmap(const_cast<char*>(address), size);
+#endif
+	}
+};
+
+CatalogIndex::CatalogIndex(std::shared_ptr<const Storage> storage, std::string_view strings, const Key* keys, const int64_t* prices, size_t count)
+	: storage(std::move(storage)), strings(strings), keys(keys), prices(prices), count(count) {}
+
+CatalogIndex::CatalogIndex(std::vector<std::pair<std::string, double>> items) : CatalogIndex(build(toCents(std::move(items)))) {}
+
+CatalogIndex CatalogIndex::build(std::vector<std::pair<std::string, int64_t>> items) {
+	std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+	auto duplicate = std::adjacent_find(items.begin(), items.end(), [](const auto& a, const auto& b) { return a.first == b.first; });
+	if (duplicate != items.end()) {
+		throw std::invalid_argument("Duplicate item in catalog");
+	}
+	auto owned = std::make_shared<OwnedStorage>();
+	size_t total_length = 0;
+	for (const auto& item : items) {
+		total_length += item.first.size();
+	}
+	if (total_length > UINT32_MAX) {
+		throw std::invalid_argument("Catalog is too large");
+	}
+	owned->strings.reserve(total_length);
+	owned->keys.reserve(items.size());
+	owned->prices.reserve(items.size());
+	for (const auto& item : items) {
+		owned->keys.push_back({ (uint32_t)owned->strings.size(), (uint32_t)item.first.size() });
+		owned->prices.push_back(item.second);
+		owned->strings += item.first;
+	}
+	return CatalogIndex(owned, owned->strings, owned->keys.data(), owned->prices.data(), owned->keys.size());
+}
+
+CatalogIndex CatalogIndex::map(const std::string& path) {
+	auto mapped = std::make_shared<MappedStorage>();
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("Cannot open catalog file");
+	}
+	LARGE_INTEGER file_size;
+	GetFileSizeEx(file, &file_size);
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (mapping == nullptr) {
+		throw std::runtime_error("Cannot map catalog file");
+	}
+	mapped->address = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	CloseHandle(mapping);
+	if (mapped->address == nullptr) {
+		throw std::runtime_error("Cannot map catalog file");
+	}
+	mapped->size = (size_t)file_size.QuadPart;
+#else
+	int file = ::open(path.c_str(), O_RDONLY);
+	if (file < 0) {
+		throw std::runtime_error("Cannot open catalog file");
+	}
+	struct stat file_stat;
+	if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0) {
+		::close(file);
+		throw std::runtime_error("Invalid catalog file");
+	}
+	void* address = mmap(nullptr, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	::close(file);
+	if (address == MAP_FAILED) {
+		throw std::runtime_error("Cannot map catalog file");
+	}
+	mapped->address = static_cast<const char*>(address);
+	mapped->size = (size_t)file_stat.st_size;
+#endif
+	// The sections are used in place, after one pass that checks every key and price: a
+	// negative price would let items into carts that could then never be priced.
+	if (mapped->size < sizeof(CatalogFileHeader)) {
+		throw std::runtime_error("Invalid catalog file");
+	}
+	CatalogFileHeader header;
+	std::memcpy(&header, mapped->address, sizeof(header));
+	uint64_t size = mapped->size;
+	bool valid = std::memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) == 0
+		&& header.format_version == CATALOG_FORMAT_VERSION
+		&& header.byte_order == CATALOG_BYTE_ORDER
+		&& header.count <= size / sizeof(Key)
+		&& header.strings_size <= UINT32_MAX
+		&& header.strings_offset <= size && header.strings_size <= size - header.strings_offset
+		&& header.keys_offset % 8 == 0 && header.keys_offset <= size && header.count * sizeof(Key) <= size - header.keys_offset
+		&& header.prices_offset % 8 == 0 && header.prices_offset <= size && header.count * sizeof(int64_t) <= size - header.prices_offset;
+	if (!valid) {
+		throw std::runtime_error("Invalid catalog file");
+	}
+	const char* base = mapped->address;
+	const Key* keys = reinterpret_cast<const Key*>(base + header.keys_offset);
+	const int64_t* prices = reinterpret_cast<const int64_t*>(base + header.prices_offset);
+	for (uint64_t i = 0; i < header.count; ++i) {
+		if ((uint64_t)keys[i].offset + keys[i].length > header.strings_size || prices[i] < 0 || prices[i] > MAX_PRICE_CENTS) {
+			throw std::runtime_error("Invalid catalog file");
+		}
+	}
+	return CatalogIndex(mapped, std::string_view(base + header.strings_offset, (size_t)header.strings_size), keys, prices,
+		(size_t)header.count);
+}
+
+CatalogIndex CatalogIndex::load(const std::string& path) {
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		throw std::runtime_error("Cannot open catalog file");
+	}
+	char magic[sizeof(CATALOG_MAGIC)] = {};
+	file.read(magic, sizeof(magic));
+	if (file.gcount() == sizeof(magic) && std::memcmp(magic, CATALOG_MAGIC, sizeof(magic)) == 0) {
+		file.close();
+		return map(path);
+	}
+	file.clear();
+	file.seekg(0);
+	return build(readText(file));
+}
+
+void CatalogIndex::save(const std::string& path) const {
+	CatalogFileHeader header = {};
+	std::memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+	header.format_version = CATALOG_FORMAT_VERSION;
+	header.byte_order = CATALOG_BYTE_ORDER;
+	header.count = count;
+	header.strings_offset = sizeof(CatalogFileHeader);
+	header.strings_size = strings.size();
+	header.keys_offset = alignUp(header.strings_offset + header.strings_size);
+	header.prices_offset = header.keys_offset + count * sizeof(Key);
+
+	// The file is written beside the old one and renamed over it, so a snapshot that still maps
+	// the old file keeps its pages instead of seeing the file truncated under it.
+	std::string temporary = path + ".tmp";
+	{
+		std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+		if (!file) {
+			throw std::runtime_error("Cannot open catalog file");
+		}
+		const char padding[8] = {};
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(strings.data(), strings.size());
+		file.write(padding, header.keys_offset - (header.strings_offset + header.strings_size));
+		file.write(reinterpret_cast<const char*>(keys), count * sizeof(Key));
+		file.write(reinterpret_cast<const char*>(prices), count * sizeof(int64_t));
+		file.close();
+		if (!file) {
+			std::remove(temporary.c_str());
+			throw std::runtime_error("Cannot write catalog file");
+		}
+	}
+	if (!syncFile(temporary) || !replaceFile(temporary, path)) {
+		std::remove(temporary.c_str());
+		throw std::runtime_error("Cannot write catalog file");
+	}
+}
+
+std::string_view CatalogIndex::nameAt(size_t slot) const {
+	// A corrupt binary catalog must not read past the string table.
+	const Key& key = keys[slot];
+	if (key.offset > strings.size() || key.length > strings.size() - key.offset) {
+		return std::string_view();
+	}
+	return strings.substr(key.offset, key.length);
+}
+
+std::optional<CatalogItem> CatalogIndex::find(std::string_view name) const {
+	auto slot = slotOf(name);
+	if (!slot) {
+		return std::nullopt;
+	}
+	return CatalogItem{ nameAt(*slot), prices[*slot] / 100.0, prices[*slot] };
+}
+
+std::optional<size_t> CatalogIndex::slotOf(std::string_view name) const {
+	size_t low = 0;
+	size_t high = count;
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (nameAt(mid) < name) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
+	}
+	if (low < count && nameAt(low) == name) {
+		return low;
+	}
+	return std::nullopt;
+}
+
+size_t CatalogIndex::size() const {
+	return count;
+}
+
+CatalogSnapshot::CatalogSnapshot(CatalogIndex index) : index(std::move(index)) {
+	ids.reserve(this->index.size());
+	for (size_t slot = 0; slot < this->index.size(); ++slot) {
+		ids.push_back(ItemRegistry::intern(this->index.nameAt(slot)));
+	}
+	prices_by_id.assign(ItemRegistry::size(), -1);
+	for (size_t slot = 0; slot < ids.size(); ++slot) {
+		prices_by_id[ids[slot]] = this->index.priceAt(slot);
+	}
+}
+
+std::optional<CatalogSnapshot::Entry> CatalogSnapshot::lookup(std::string_view name) const {
+	auto slot = index.slotOf(name);
+	if (!slot) {
+		return std::nullopt;
+	}
+	return Entry{ ids[*slot], index.priceAt(*slot) };
+}
+
+namespace {
+	constexpr uint64_t IDLE_EPOCH = UINT64_MAX;
+
+	// Each thread that reads the catalog owns one slot. A slot holds the epoch the thread
+	// announced when it pinned a snapshot, or IDLE_EPOCH while it holds none.
+	struct alignas(64) ReaderSlot {
+		std::atomic<uint64_t> epoch{ IDLE_EPOCH };
+		std::atomic<bool> in_use{ true };
+		ReaderSlot* next = nullptr;
+		unsigned int depth = 0; // Only touched by the owning thread
+	};
+
+	std::atomic<ReaderSlot*> reader_slots{ nullptr };
+	std::atomic<uint64_t> global_epoch{ 1 };
+	std::atomic<const CatalogSnapshot*> current_snapshot{ nullptr };
+	std::atomic<uint64_t> current_version{ 0 };
+
+	// Writer-side state, only touched while holding writer_mutex.
+	std::mutex writer_mutex;
+	std::vector<std::pair<const CatalogSnapshot*, uint64_t>> retired;
+
+	ReaderSlot* acquireSlot() {
+		// Reuse a slot left behind by a thread that has exited before adding a new one.
+		for (ReaderSlot* slot = reader_slots.load(); slot != nullptr; slot = slot->next) {
+			bool expected = false;
+			if (slot->in_use.compare_exchange_strong(expected, true)) {
+				return slot;
+			}
+		}
+		ReaderSlot* slot = new ReaderSlot();
+		slot->next = reader_slots.load();
+		while (!reader_slots.compare_exchange_weak(slot->next, slot)) {}
+		return slot;
+	}
+
+	struct ThreadSlot {
+		ReaderSlot* slot = acquireSlot();
+		~ThreadSlot() { slot->in_use.store(false); }
+	};
+
+	ReaderSlot& threadSlot() {
+		thread_local ThreadSlot thread_slot;
+		return *thread_slot.slot;
+	}
+
+	// Frees every retired snapshot that no reader can still be holding. A reader that loaded
+	// a snapshot announced an epoch no later than the one the snapshot was retired in.
+	void reclaim() {
+		uint64_t oldest = IDLE_EPOCH;
+		for (ReaderSlot* slot = reader_slots.load(); slot != nullptr; slot = slot->next) {
+			oldest = std::min(oldest, slot->epoch.load());
+		}
+		auto still_pinned = std::partition(retired.begin(), retired.end(), [oldest](const auto& entry) { return entry.second >= oldest; });
+		for (auto iter = still_pinned; iter != retired.end(); ++iter) {
+			delete iter->first;
+		}
+		retired.erase(still_pinned, retired.end());
+	}
+
+	uint64_t publishLocked(std::unique_ptr<CatalogSnapshot> snapshot) {
+		uint64_t version = current_version.load() + 1;
+		snapshot->version = version;
+		const CatalogSnapshot* old_snapshot = current_snapshot.exchange(snapshot.release());
+		current_version.store(version);
+		if (old_snapshot != nullptr) {
+			retired.emplace_back(old_snapshot, global_epoch.fetch_add(1));
+		}
+		reclaim();
+		return version;
+	}
+
+	void ensurePublished() {
+		static const bool published = [] {
+			std::lock_guard<std::mutex> lock(writer_mutex);
+			if (current_snapshot.load() == nullptr) {
+				// This is where items would be fetched from a database.
+				publishLocked(std::make_unique<CatalogSnapshot>(CatalogIndex({
+					{"apple", 0.5},
+					{"banana", 0.25},
+					{"orange", 0.75},
+					{"grapes", 1.0},
+					{"pineapple", 2.0}
+				})));
+			}
+			return true;
+		}();
+		(void)published;
+	}
+}
+
+namespace Catalog {
+	Reader::Reader() {
+		ensurePublished();
+		ReaderSlot& slot = threadSlot();
+		if (slot.depth++ == 0) {
+			slot.epoch.store(global_epoch.load());
+		}
+		current = current_snapshot.load();
+	}
+
+	Reader::~Reader() {
+		ReaderSlot& slot = threadSlot();
+		if (--slot.depth == 0) {
+			slot.epoch.store(IDLE_EPOCH);
+		}
+	}
+
+	CatalogItem Reader::getItem(std::string_view item) const {
+		return tryGetItem(item).value();
+	}
+
+	CatalogSnapshot::Entry Reader::getEntry(std::string_view item) const {
+		return tryGetEntry(item).value();
+	}
+
+	CartResult<CatalogItem> Reader::tryGetItem(std::string_view item) const {
+		auto found = current->index.find(item);
+		if (!found) {
+			return CartError::UnknownItem;
+		}
+		return *found;
+	}
+
+	CartResult<CatalogSnapshot::Entry> Reader::tryGetEntry(std::string_view item) const {
+		auto found = current->lookup(item);
+		if (!found) {
+			return CartError::UnknownItem;
+		}
+		return *found;
+	}
+
+	uint64_t publish(CatalogIndex index) {
+		ensurePublished();
+		// Assign item ids outside the writer lock; only the swap is serialized.
+		auto snapshot = std::make_unique<CatalogSnapshot>(std::move(index));
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		return publishLocked(std::move(snapshot));
+	}
+
+	uint64_t reload(const std::string& path) {
+		return publish(CatalogIndex::load(path));
+	}
+
+	uint64_t version() {
+		ensurePublished();
+		return current_version.load();
+	}
+}
@@ -0,0 +1,117 @@
+﻿#pragma once
+#include "cart_result.h"
+#include "item_registry.h"
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// A handle to an item in the catalog. The name points into the catalog's string table,
+// so it stays valid for as long as the catalog it came from.
+struct CatalogItem {
+	std::string_view name;
+	double price;
+	int64_t price_cents;
+};
+
+// Read-only catalog index, built once and never modified.
+// Names are packed into one string table and kept sorted, so a lookup is a binary search
+// over a flat array instead of a walk through tree nodes. Prices are stored in their own
+// column, in cents, so the search only touches the keys.
+//
+// The same three sections make up the binary catalog file written by save(). Opening a binary
+// catalog maps the file and points the index straight at it, so nothing is parsed at startup.
+class CatalogIndex {
+public:
+	CatalogIndex(std::vector<std::pair<std::string, double>> items);
+
+	// Opens a binary catalog, or parses a text catalog with one "name<TAB>price" or
+	// "name,price" entry per line.
+	static CatalogIndex load(const std::string& path);
+	// Writes the binary catalog to a file beside path and renames it over path, so indexes that
+	// still map the old file are not disturbed.
+	void save(const std::string& path) const;
+
+	std::optional<CatalogItem> find(std::string_view name) const;
+	std::optional<size_t> slotOf(std::string_view name) const;
+	std::string_view nameAt(size_t slot) const;
+	int64_t priceAt(size_t slot) const { return prices[slot]; }
+	size_t size() const;
+private:
+	struct Key {
+		uint32_t offset;
+		uint32_t length;
+	};
+	struct Storage;
+	struct OwnedStorage;
+	struct MappedStorage;
+
+	CatalogIndex(std::shared_ptr<const Storage> storage, std::string_view strings, const Key* keys, const int64_t* prices, size_t count);
+	static CatalogIndex build(std::vector<std::pair<std::string, int64_t>> items);
+	static CatalogIndex map(const std::string& path);
+
+	std::shared_ptr<const Storage> storage;
+	std::string_view strings;
+	const Key* keys;
+	const int64_t* prices;
+	size_t count;
+};
+
+// One published version of the catalog. Once published it is never modified; a reload
+// publishes a new snapshot and the old one is freed after its last reader has finished.
+struct CatalogSnapshot {
+	// What a cart needs to know about an item: its registry id and its price in this version.
+	struct Entry {
+		ItemId id;
+		int64_t price_cents;
+	};
+
+	CatalogSnapshot(CatalogIndex index);
+
+	std::optional<Entry> lookup(std::string_view name) const;
+	// Price by registry id, without touching the names. Empty if the item is not in this version.
+	std::optional<int64_t> priceOf(ItemId id) const {
+		return id < prices_by_id.size() && prices_by_id[id] >= 0 ? std::optional<int64_t>(prices_by_id[id]) : std::nullopt;
+	}
+
+	uint64_t version = 0;
+	CatalogIndex index;
+	// The registry id of each index slot, and the price of each registry id (-1 for items that
+	// are not in this version). Both are filled in before the snapshot is published.
+	std::vector<ItemId> ids;
+	std::vector<int64_t> prices_by_id;
+};
+
+namespace Catalog {
+	// Pins the current snapshot for as long as the reader is alive.
+	// Pinning never takes a lock: it announces the current epoch in a per-thread slot and
+	// loads the snapshot pointer, so readers are never blocked by a reload in progress.
+	class Reader {
+	public:
+		Reader();
+		~Reader();
+		Reader(const Reader&) = delete;
+		Reader& operator=(const Reader&) = delete;
+
+		const CatalogSnapshot& snapshot() const { return *current; }
+		const CatalogSnapshot* operator->() const { return current; }
+		CatalogItem getItem(std::string_view item) const;
+		// Like lookup on the snapshot, but throws if the item is not in the catalog.
+		CatalogSnapshot::Entry getEntry(std::string_view item) const;
+		// Like getItem and getEntry, but return CartError::UnknownItem instead of throwing.
+		CartResult<CatalogItem> tryGetItem(std::string_view item) const;
+		CartResult<CatalogSnapshot::Entry> tryGetEntry(std::string_view item) const;
+	private:
+		const CatalogSnapshot* current;
+	};
+
+	// Publishes a new snapshot and returns its version. Writers are serialized with each other,
+	// but never wait for readers.
+	uint64_t publish(CatalogIndex index);
+	// Loads a binary or text catalog file (see CatalogIndex::load) and publishes it.
+	uint64_t reload(const std::string& path);
+	uint64_t version();
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// A fast 64-bit checksum over whole words, for catching torn or corrupted blocks on disk.
+// Not a cryptographic hash.
+inline uint64_t blockChecksum(const char* data, size_t size) {
+	uint64_t hash = 0x9E3779B97F4A7C15ull ^ size;
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0xFF51AFD7ED558CCDull;
+		hash ^= hash >> 32;
+	}
+	uint64_t tail = 0;
+	std::memcpy(&tail, data + i, size - i);
+	hash = (hash ^ tail) * 0xC4CEB9FE1A85EC53ull;
+	return hash ^ (hash >> 29);
+}
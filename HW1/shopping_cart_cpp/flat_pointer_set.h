@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A set of pointers kept in one open-addressed array, so walking it reads memory in order
+// instead of chasing a node per element. Erased slots are marked and reused; they are dropped
+// whenever the array is rebuilt to grow.
+template <typename T>
+class FlatPointerSet {
+public:
+	void insert(T* pointer) {
+		if ((used + 1) * 4 > slots.size() * 3) {
+			rebuild();
+		}
+		size_t mask = slots.size() - 1;
+		T** reusable = nullptr;
+		for (size_t i = slotOf(pointer); ; i = (i + 1) & mask) {
+			if (slots[i] == pointer) {
+				return;
+			}
+			if (slots[i] == erased() && reusable == nullptr) {
+				reusable = &slots[i];
+			}
+			else if (slots[i] == nullptr) {
+				if (reusable == nullptr) {
+					reusable = &slots[i];
+					++used;
+				}
+				*reusable = pointer;
+				++count;
+				return;
+			}
+		}
+	}
+
+	void erase(T* pointer) {
+		if (count == 0) {
+			return;
+		}
+		size_t mask = slots.size() - 1;
+		for (size_t i = slotOf(pointer); slots[i] != nullptr; i = (i + 1) & mask) {
+			if (slots[i] == pointer) {
+				slots[i] = erased();
+				if (--count == 0) {
+					slots.clear();
+					used = 0;
+				}
+				return;
+			}
+		}
+	}
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	template <typename Fn>
+	void forEach(Fn&& fn) const {
+		for (T* slot : slots) {
+			if (slot != nullptr && slot != erased()) {
+				fn(slot);
+			}
+		}
+	}
+private:
+	// No object lives at address 1, so it can mark erased slots.
+	static T* erased() { return reinterpret_cast<T*>(uintptr_t(1)); }
+
+	size_t slotOf(T* pointer) const {
+		uint64_t hash = (uint64_t)reinterpret_cast<uintptr_t>(pointer) * 0x9E3779B97F4A7C15ull;
+		return (size_t)(hash >> 32) & (slots.size() - 1);
+	}
+
+	// Sizes the array for twice the live pointers, at least 8 slots, without erased marks.
+	void rebuild() {
+		size_t capacity = 8;
+		while (capacity < (count + 1) * 2) {
+			capacity *= 2;
+		}
+		std::vector<T*> old(capacity, nullptr);
+		old.swap(slots);
+		size_t mask = capacity - 1;
+		for (T* pointer : old) {
+			if (pointer != nullptr && pointer != erased()) {
+				size_t i = slotOf(pointer);
+				while (slots[i] != nullptr) {
+					i = (i + 1) & mask;
+				}
+				slots[i] = pointer;
+			}
+		}
+		used = count;
+	}
+
+	std::vector<T*> slots;
+	// Live pointers, and live plus erased slots.
+	size_t count = 0;
+	size_t used = 0;
+};
@@ -0,0 +1,89 @@
+#include "item_registry.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#define CHUNK_BITS 16
+#define CHUNK_SIZE (1u << CHUNK_BITS)
+#define MAX_CHUNKS 4096
+#define ARENA_BLOCK_SIZE (1u << 20)
+
+namespace {
+	// Names are copied into large arena blocks and never moved or freed. The id -> name table is
+	// a fixed array of chunk pointers; a chunk is filled before its entries' ids are published,
+	// so readers only need an acquire load of the published size.
+	struct Chunk {
+		std::string_view names[CHUNK_SIZE];
+	};
+
+	std::atomic<Chunk*> chunks[MAX_CHUNKS];
+	std::atomic<uint32_t> published_size{ 0 };
+
+	// Writer-side state, only touched while holding writer_mutex.
+	std::mutex writer_mutex;
+	std::unordered_map<std::string_view, ItemId> ids;
+	char* arena = nullptr;
+	size_t arena_left = 0;
+
+	std::string_view copyToArena(std::string_view name) {
+		if (name.size() > arena_left) {
+			size_t block_size = std::max<size_t>(ARENA_BLOCK_SIZE, name.size());
+			arena = new char[block_size];
+			arena_left = block_size;
+		}
+		std::memcpy(arena, name.data(), name.size());
+		std::string_view copy(arena, name.size());
+		arena += name.size();
+		arena_left -= name.size();
+		return copy;
+	}
+}
+
+namespace ItemRegistry {
+	ItemId intern(std::string_view name) {
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		auto found = ids.find(name);
+		if (found != ids.end()) {
+			return found->second;
+		}
+		uint32_t id = published_size.load(std::memory_order_relaxed);
+		if (id >= CHUNK_SIZE * MAX_CHUNKS) {
+			throw std::length_error("Too many distinct items");
+		}
+		Chunk* chunk = chunks[id >> CHUNK_BITS].load(std::memory_order_relaxed);
+		if (chunk == nullptr) {
+			chunk = new Chunk();
+			chunks[id >> CHUNK_BITS].store(chunk, std::memory_order_relaxed);
+		}
+		std::string_view stored = copyToArena(name);
+		chunk->names[id & (CHUNK_SIZE - 1)] = stored;
+		ids.emplace(stored, id);
+		published_size.store(id + 1, std::memory_order_release);
+		return id;
+	}
+
+	std::optional<ItemId> find(std::string_view name) {
+		std::lock_guard<std::mutex> lock(writer_mutex);
+		auto found = ids.find(name);
+		if (found == ids.end()) {
+			return std::nullopt;
+		}
+		return found->second;
+	}
+
+	std::string_view name(ItemId id) {
+		if (id >= published_size.load(std::memory_order_acquire)) {
+			throw std::out_of_range("Unknown item id");
+		}
+		return chunks[id >> CHUNK_BITS].load(std::memory_order_relaxed)->names[id & (CHUNK_SIZE - 1)];
+	}
+
+	size_t size() {
+		return published_size.load(std::memory_order_acquire);
+	}
+}
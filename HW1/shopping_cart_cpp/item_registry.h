@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string_view>
+
+// Dense, process-wide id for an item name. Ids are handed out in the order names are first
+// seen and are never reused, so carts can store a 32-bit id instead of the name.
+using ItemId = uint32_t;
+
+namespace ItemRegistry {
+	// Returns the id for name, assigning the next free one if the name is new.
+	// Interning takes a lock, so it is done when a catalog is published, not per cart operation.
+	ItemId intern(std::string_view name);
+	// Returns the id already assigned to name, if any. Takes the same lock as intern.
+	std::optional<ItemId> find(std::string_view name);
+	// Returns the name of an id handed out by intern. Never locks, and the view stays valid
+	// for the life of the process.
+	std::string_view name(ItemId id);
+	size_t size();
+}
@@ -0,0 +1,110 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+// A fixed-size histogram of latencies in nanoseconds, in the style of HdrHistogram: each power
+// of two is split into SUB_BUCKETS linear buckets, so every recorded value is kept to within
+// about 3% whatever its magnitude, in a few kilobytes and with no allocation.
+//
+// Only one thread may record into (or merge into) a histogram, but any thread may read it
+// meanwhile: the counters are atomics updated with plain loads and stores, which cost the
+// recording thread no more than ordinary increments. Give each thread its own histogram and
+// merge them when reporting.
+class LatencyHistogram {
+public:
+	static constexpr int SUB_BUCKET_BITS = 5;
+	static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	// Values from 2^40 ns (about 18 minutes) up are counted in the last bucket.
+	static constexpr int MAX_BITS = 40;
+	static constexpr size_t BUCKETS = (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	void record(uint64_t nanoseconds) {
+		add(counts[bucketOf(nanoseconds)], 1);
+		add(total, 1);
+		add(sum, nanoseconds);
+		if (nanoseconds > max_value.load(std::memory_order_relaxed)) {
+			max_value.store(nanoseconds, std::memory_order_relaxed);
+		}
+	}
+
+	void merge(const LatencyHistogram& other) {
+		for (size_t i = 0; i < BUCKETS; ++i) {
+			add(counts[i], other.counts[i].load(std::memory_order_relaxed));
+		}
+		add(total, other.count());
+		add(sum, other.sum.load(std::memory_order_relaxed));
+		max_value.store(std::max(max(), other.max()), std::memory_order_relaxed);
+	}
+
+	uint64_t count() const { return total.load(std::memory_order_relaxed); }
+	uint64_t max() const { return max_value.load(std::memory_order_relaxed); }
+	// Sum of every value recorded, in nanoseconds.
+	uint64_t totalNanoseconds() const { return sum.load(std::memory_order_relaxed); }
+	double mean() const { return count() == 0 ? 0.0 : (double)totalNanoseconds() / count(); }
+
+	// The smallest recorded value that at least fraction (0 to 1) of the values are at or below,
+	// reported as the top of its bucket and never above the largest value recorded.
+	uint64_t percentile(double fraction) const {
+		uint64_t recorded = count();
+		if (recorded == 0) {
+			return 0;
+		}
+		uint64_t rank = std::max<uint64_t>(1, (uint64_t)(fraction * recorded + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < BUCKETS; ++i) {
+			seen += counts[i].load(std::memory_order_relaxed);
+			if (seen >= rank) {
+				return i == BUCKETS - 1 ? max() : std::min(highestIn(i), max());
+			}
+		}
+		return max();
+	}
+
+	// How many recorded values are at or below the limit, counting whole buckets only, so
+	// values within about 3% above the limit may be included.
+	uint64_t countAtOrBelow(uint64_t nanoseconds) const {
+		size_t last = bucketOf(nanoseconds);
+		uint64_t seen = 0;
+		for (size_t i = 0; i <= last; ++i) {
+			seen += counts[i].load(std::memory_order_relaxed);
+		}
+		return seen;
+	}
+
+private:
+	// Only the owning thread writes, so a load and a store do instead of a locked increment.
+	static void add(std::atomic<uint64_t>& counter, uint64_t amount) {
+		counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+	}
+
+	// Values below 2 * SUB_BUCKETS have a bucket each; above that, a value with its top bit at
+	// position b lands in one of the SUB_BUCKETS buckets for 2^b, chosen by its next bits.
+	static size_t bucketOf(uint64_t value) {
+		if (value < 2 * SUB_BUCKETS) {
+			return (size_t)value;
+		}
+		int top = std::bit_width(value) - 1;
+		if (top >= MAX_BITS) {
+			return BUCKETS - 1;
+		}
+		int shift = top - SUB_BUCKET_BITS;
+		return (size_t)((shift + 1) * SUB_BUCKETS + ((value >> shift) - SUB_BUCKETS));
+	}
+
+	static uint64_t highestIn(size_t bucket) {
+		if (bucket < 2 * SUB_BUCKETS) {
+			return bucket;
+		}
+		int shift = (int)(bucket / SUB_BUCKETS) - 1;
+		uint64_t lowest = (bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+		return lowest + (uint64_t(1) << shift) - 1;
+	}
+
+	std::array<std::atomic<uint64_t>, BUCKETS> counts = {};
+	std::atomic<uint64_t> total = 0;
+	std::atomic<uint64_t> sum = 0;
+	std::atomic<uint64_t> max_value = 0;
+};
@@ -1,8 +1,41 @@
 ﻿#include "cart.h"
+#include "catalog.h"
+#include "item_registry.h"
+#include "cart_id.h"
+#include "owner_id.h"
+#include "cart_store.h"
+#include "cart_snapshot.h"
+#include "cart_wal.h"
+#include "bulk_pricing.h"
+#include "work_stealing_pool.h"
+#include "latency_histogram.h"
+#include "cart_metrics.h"
+#include "cart_events.h"
+#include "promotions.h"
+#ifdef __linux__
+#include "cart_client.h"
+#include "cart_server.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <set>
+#include <thread>
 #include <assert.h>
 #include <regex>
 #include <random>
 #include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <vector>
 
 static void TEST_CopyConstructor() {
     ShoppingCart cart1(L"ABC12345DE-A");
@@ -308,29 +341,1594 @@ static void TEST_TotalCostAfterRemoval() {
     assert(items.size() == 1);
 }
 
+static void TEST_CatalogLookup() {
+    Catalog::Reader catalog;
+    auto apple = catalog.getItem("apple");
+    assert(apple.name == "apple");
+    assert(apple.price == 0.5);
+    assert(catalog->index.size() == 5);
+    assert(!catalog->index.find("zzz").has_value());
+    assert(!catalog->index.find("appl").has_value());
+    assert(!catalog->index.find("").has_value());
+    try {
+        catalog.getItem("zzz");
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Item not found in catalog") == 0);
+    }
+    try {
+        CatalogIndex duplicates({ {"apple", 0.5}, {"apple", 0.75} });
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Duplicate item in catalog") == 0);
+    }
+}
+
+static void TEST_CatalogReload() {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    uint64_t old_version = Catalog::version();
+    {
+        std::ofstream file("reload_test_catalog.tsv");
+        file << "apple\t1.5\nbanana,0.25\r\n\norange\t0.75\ngrapes\t1\npineapple\t2\nkiwi\t0.5\n";
+    }
+    Catalog::Reader old_catalog;
+    uint64_t new_version = Catalog::reload("reload_test_catalog.tsv");
+    assert(new_version > old_version);
+    assert(Catalog::version() == new_version);
+    // A reader pinned before the reload keeps seeing the old snapshot.
+    assert(old_catalog->version == old_version);
+    assert(old_catalog.getItem("apple").price == 0.5);
+    assert(Catalog::Reader()->version == new_version);
+    assert(cart.getTotalCost() == 2 * 1.5);
+    cart.addItem("kiwi", 1);
+    assert(cart.getItems()["kiwi"] == 1);
+
+    {
+        std::ofstream file("reload_test_catalog.tsv");
+        file << "apple\tfree\n";
+    }
+    try {
+        Catalog::reload("reload_test_catalog.tsv");
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Malformed catalog line") == 0);
+    }
+    assert(Catalog::version() == new_version);
+    std::remove("reload_test_catalog.tsv");
+
+    cart.removeItem("kiwi");
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    assert(cart.getTotalCost() == 2 * 0.5);
+}
+
+static void TEST_CatalogBinaryFormat() {
+    CatalogIndex index({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} });
+    index.save("binary_test_catalog.bin");
+    {
+        CatalogIndex mapped = CatalogIndex::load("binary_test_catalog.bin");
+        assert(mapped.size() == 5);
+        assert(mapped.find("pineapple")->price_cents == 200);
+        assert(mapped.find("banana")->price == 0.25);
+        assert(mapped.find("banana")->name == "banana");
+        assert(!mapped.find("kiwi").has_value());
+        // Saving over a mapped catalog leaves the mapping reading the old prices.
+        CatalogIndex({ {"pineapple", 3.0} }).save("binary_test_catalog.bin");
+        assert(mapped.find("pineapple")->price_cents == 200);
+        assert(CatalogIndex::load("binary_test_catalog.bin").find("pineapple")->price_cents == 300);
+    }
+    {
+        // The price column ends the file; a negative price there is rejected when it is opened.
+        std::fstream file("binary_test_catalog.bin", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(-(std::streamoff)sizeof(int64_t), std::ios::end);
+        int64_t negative = -100;
+        file.write(reinterpret_cast<const char*>(&negative), sizeof(negative));
+    }
+    try {
+        CatalogIndex::load("binary_test_catalog.bin");
+        assert(false);
+    }
+    catch (const std::runtime_error& e) {
+        assert(strcmp(e.what(), "Invalid catalog file") == 0);
+    }
+    {
+        std::ofstream file("binary_test_catalog.bin", std::ios::binary | std::ios::trunc);
+        file << "CARTCAT";
+        file.put('\0');
+        file << "truncated";
+    }
+    try {
+        CatalogIndex::load("binary_test_catalog.bin");
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Invalid catalog file") == 0);
+    }
+    std::remove("binary_test_catalog.bin");
+}
+
+static void TEST_TotalIsExact() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0}, {"candy", 0.1} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("candy", 3);
+    assert(cart.getTotal() == Money(30));
+    assert(cart.getTotal().toString() == "0.30");
+    assert(cart.getTotalCost() == 0.3);
+    cart.addItem("apple", 7);
+    cart.updateItem("candy", 99);
+    cart.removeItem("apple");
+    cart.addItem("pineapple", 1);
+    assert(cart.getTotal().getCents() == 99 * 10 + 200);
+    assert(cart.getTotal().toString() == "11.90");
+    cart.removeItem("candy");
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    assert(cart.getTotal() == Money(200));
+    assert(Money(-5).toString() == "-0.05");
+    assert((Money(150) * 3 - Money(50)).toString() == "4.00");
+}
+
+static void TEST_ApplyBatch() {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("banana", 2);
+    cart.addItem("grapes", 1);
+    CartOp ops[] = {
+        { CartOp::Kind::Add, "apple", 3 },
+        { CartOp::Kind::Add, "orange", 1 },
+        { CartOp::Kind::Add, "apple", 4 },
+        { CartOp::Kind::Update, "banana", 9 },
+        { CartOp::Kind::Remove, "grapes" },
+        { CartOp::Kind::Update, "orange", 2 },
+    };
+    cart.applyBatch(ops);
+    auto items = cart.getItems();
+    assert(items.size() == 3);
+    assert(items["apple"] == 7);
+    assert(items["banana"] == 9);
+    assert(items["orange"] == 2);
+    assert(cart.getTotalCost() == 7 * 0.5 + 9 * 0.25 + 2 * 0.75);
+}
+
+static void TEST_ApplyBatchIsAllOrNothing() {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 3);
+    CartOp bad_item[] = { { CartOp::Kind::Remove, "apple" }, { CartOp::Kind::Add, "zzz", 1 } };
+    try {
+        cart.applyBatch(bad_item);
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Item not found in catalog") == 0);
+    }
+    CartOp overflow[] = { { CartOp::Kind::Add, "banana", 50 }, { CartOp::Kind::Add, "apple", 50 }, { CartOp::Kind::Add, "apple", 50 } };
+    try {
+        cart.applyBatch(overflow);
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Quantity cannot be greater than 99") == 0);
+    }
+    CartOp removed_twice[] = { { CartOp::Kind::Remove, "apple" }, { CartOp::Kind::Update, "apple", 1 } };
+    try {
+        cart.applyBatch(removed_twice);
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Cannot update an item not present in cart") == 0);
+    }
+    auto items = cart.getItems();
+    assert(items.size() == 1);
+    assert(items["apple"] == 3);
+    assert(cart.getTotalCost() == 3 * 0.5);
+}
+
+static void TEST_ForEachItem() {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.forEachItem([](std::string_view, int) { assert(false); });
+    cart.addItem("orange", 2);
+    cart.addItem("apple", 3);
+    std::vector<std::pair<std::string, int>> seen;
+    cart.forEachItem([&seen](std::string_view item_name, int quantity) {
+        seen.emplace_back(std::string(item_name), quantity);
+    });
+    assert(cart.itemCount() == 2);
+    assert(seen.size() == 2);
+    assert(seen[0] == std::make_pair(std::string("apple"), 3));
+    assert(seen[1] == std::make_pair(std::string("orange"), 2));
+}
+
+static void TEST_LargeCart() {
+    std::vector<std::pair<std::string, double>> entries = { {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} };
+    for (int i = 0; i < 40; ++i) {
+        entries.push_back({ "item" + std::to_string(100 + i), 0.01 });
+    }
+    Catalog::publish(CatalogIndex(entries));
+    ShoppingCart cart(L"ABC12345DE-A");
+    for (int i = 39; i >= 0; --i) {
+        cart.addItem("item" + std::to_string(100 + i), 2);
+    }
+    for (int i = 0; i < 40; i += 2) {
+        cart.removeItem("item" + std::to_string(100 + i));
+    }
+    std::vector<CartOp> ops = { { CartOp::Kind::Add, "apple", 1 }, { CartOp::Kind::Add, "item100", 1 }, { CartOp::Kind::Remove, "item139" } };
+    cart.applyBatch(ops);
+    ShoppingCart copy(cart);
+    cart.updateItem("item101", 9);
+    auto items = copy.getItems();
+    assert(items.size() == 21);
+    assert(items["item101"] == 2);
+    assert(items["item100"] == 1);
+    assert(items.count("item139") == 0);
+    size_t lines = 0;
+    copy.forEachItem([&lines](std::string_view, int) { ++lines; });
+    assert(lines == 21);
+    assert(copy.getTotal() == Money(50 + 1 + 19 * 2));
+    assert(cart.getTotal() == Money(50 + 1 + 18 * 2 + 9));
+    ShoppingCart moved(std::move(copy));
+    assert(moved.getItems() == items);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+static void TEST_ItemRegistry() {
+    ItemId apple = ItemRegistry::intern("apple");
+    assert(ItemRegistry::intern("apple") == apple);
+    assert(ItemRegistry::name(apple) == "apple");
+    assert(ItemRegistry::find("apple") == apple);
+    assert(Catalog::Reader()->lookup("apple")->id == apple);
+    ItemId fresh = ItemRegistry::intern("registry-test-item");
+    assert(fresh == ItemRegistry::size() - 1);
+    assert(ItemRegistry::name(fresh) == "registry-test-item");
+    assert(!ItemRegistry::find("never-interned").has_value());
+    assert(!Catalog::Reader()->priceOf(fresh).has_value());
+}
+
+static void TEST_ItemDroppedFromCatalog() {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    cart.addItem("grapes", 3);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"pineapple", 2.0} }));
+    try {
+        cart.getTotalCost();
+    }
+    catch (const std::exception& e)
+    {
+        assert(strcmp(e.what(), "Item not found in catalog") == 0);
+    }
+    cart.updateItem("grapes", 4);
+    assert(cart.getItems()["grapes"] == 4);
+    cart.removeItem("grapes");
+    assert(cart.getTotalCost() == 2 * 0.5);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+static void TEST_CartIDFormat() {
+    CartID id(CartUuid{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff });
+    assert(id.get() == "00112233-4455-6677-8899-aabbccddeeff");
+    ShoppingCart cart(L"ABC12345DE-A");
+    assert(CartID(cart.getCartUuid()).get() == cart.getCartId());
+    assert(ShoppingCart(cart).getCartUuid() == cart.getCartUuid());
+}
+
+static void TEST_CartIDsAreUnique() {
+    std::vector<std::vector<CartUuid>> generated(4);
+    std::vector<std::thread> threads;
+    for (auto& ids : generated) {
+        threads.emplace_back([&ids] {
+            for (int i = 0; i < 10000; ++i) {
+                ids.push_back(CartID().getBytes());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::set<CartUuid> unique;
+    for (const auto& ids : generated) {
+        unique.insert(ids.begin(), ids.end());
+    }
+    assert(unique.size() == 40000);
+    std::regex uuid4_pattern("^[0-9a-f]{8}-[0-9a-f]{4}-4[0-9a-f]{3}-[89ab][0-9a-f]{3}-[0-9a-f]{12}$");
+    for (int i = 0; i < 100; ++i) {
+        assert(std::regex_match(CartID(generated[0][i]).get(), uuid4_pattern));
+    }
+}
+
+static void TEST_OwnerIDMatchesRegex() {
+    // The pattern OwnerID used to check with std::wregex.
+    std::wregex pattern(L"^[A-Z\u0080-\uFFFF]{3}[0-9]{5}[A-Z\u0080-\uFFFF]{2}-[AQ]$", std::regex_constants::icase);
+    const std::wstring valid = L"ABC12345DE-A";
+    // Characters at and around every boundary the pattern cares about, plus random ones.
+    const std::vector<wchar_t> interesting = { L'0', L'9', L'/', L':', L'@', L'A', L'Z', L'[', L'`', L'a', L'z', L'{',
+        L'-', L'Q', L'q', L'R', L'_', (wchar_t)0x7F, (wchar_t)0x80, (wchar_t)0xFF, (wchar_t)0xFFFF, (wchar_t)0x3042, (wchar_t)1 };
+    std::mt19937 gen(662);
+    for (int i = 0; i < 100000; ++i) {
+        std::wstring id = valid;
+        if (gen() % 4 == 0) {
+            id.resize(10 + gen() % 4, L'A');
+        }
+        int mutations = 1 + gen() % 3;
+        for (int m = 0; m < mutations; ++m) {
+            wchar_t c = gen() % 3 == 0 ? (wchar_t)(gen() % (sizeof(wchar_t) > 2 ? 0x110000 : 0x10000)) : interesting[gen() % interesting.size()];
+            id[gen() % id.size()] = c;
+        }
+        assert(OwnerIDFormat::isValid(id) == std::regex_match(id, pattern));
+    }
+    assert(OwnerIDFormat::isValid(std::wstring_view(L"xx ABC12345DE-q xx").substr(3, 12)));
+}
+
+static void TEST_CartsFreedOnAnotherThread() {
+    // Carts built on one thread and destroyed on another, by threads that then exit.
+    std::vector<ShoppingCart> carts;
+    std::thread producer([&carts]() {
+        for (int i = 0; i < 20000; ++i) {
+            ShoppingCart cart(L"ABC12345DE-A");
+            cart.addItem("apple", 1 + i % 5);
+            carts.push_back(std::move(cart));
+        }
+    });
+    producer.join();
+    std::thread consumer([&carts]() {
+        carts.resize(10000, carts.front());
+    });
+    consumer.join();
+    // The freed blocks are reused here, and every surviving cart is intact.
+    for (int i = 0; i < 20000; ++i) {
+        carts.push_back(ShoppingCart(L"XYZ98765AB-Q"));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        assert(carts[i].getId() == L"ABC12345DE-A");
+        assert(carts[i].getItems().at("apple") == 1 + i % 5);
+    }
+    for (int i = 10000; i < 30000; ++i) {
+        assert(carts[i].getId() == L"XYZ98765AB-Q" && carts[i].itemCount() == 0);
+    }
+}
+
+static void TEST_CartStore() {
+    CartStore store(4);
+    CartUuid first = store.create(L"ABC12345DE-A");
+    CartUuid second = store.create(L"ABC12345DE-A");
+    CartUuid other = store.create(L"XYZ98765AB-Q");
+    assert(store.size() == 3 && store.contains(first));
+    assert(store.update(first, [](ShoppingCart& cart) { cart.addItem("apple", 2); }));
+    double total = 0;
+    assert(store.read(first, [&total](const ShoppingCart& cart) { total = cart.getTotalCost(); }));
+    assert(total == 1.0);
+
+    std::vector<CartUuid> owned = store.cartsOf(L"ABC12345DE-A");
+    assert(owned.size() == 2);
+    assert(std::set<CartUuid>(owned.begin(), owned.end()) == std::set<CartUuid>({ first, second }));
+    assert(store.cartsOf(L"XYZ98765AB-Q") == std::vector<CartUuid>({ other }));
+    assert(store.cartsOf(L"QQQ00000QQ-Q").empty());
+
+    assert(store.erase(first));
+    assert(!store.erase(first));
+    assert(!store.contains(first) && store.size() == 2);
+    assert(!store.update(first, [](ShoppingCart&) {}));
+    assert(store.cartsOf(L"ABC12345DE-A") == std::vector<CartUuid>({ second }));
+
+    ShoppingCart cart(L"XYZ98765AB-Q");
+    store.insert(cart);
+    bool threw = false;
+    try {
+        store.insert(cart);
+    }
+    catch (const std::invalid_argument& e) {
+        threw = std::string(e.what()) == "Cart already in store";
+    }
+    assert(threw);
+}
+
+static void TEST_CartStoreConcurrentUpdates() {
+    // Many threads adding to the same few carts, while others create and erase carts.
+    CartStore store(8);
+    std::vector<CartUuid> carts;
+    for (int i = 0; i < 8; ++i) {
+        carts.push_back(store.create(L"ABC12345DE-A"));
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&store, &carts, t]() {
+            for (int i = 0; i < 500; ++i) {
+                store.update(carts[(t + i) % carts.size()], [](ShoppingCart& cart) {
+                    cart.addItem("banana", 1);
+                    cart.removeItem("banana");
+                    cart.addItem("apple", 1);
+                    if (cart.getItems().at("apple") == 99) {
+                        cart.removeItem("apple");
+                    }
+                });
+                store.erase(store.create(L"XYZ98765AB-Q"));
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    int apples = 0;
+    store.forEach([&apples](const ShoppingCart& cart) {
+        auto items = cart.getItems();
+        apples += items.count("apple") ? items.at("apple") : 0;
+    });
+    // Each cart was bumped 500 times, wrapping back to zero after every 99.
+    assert(apples == 8 * (500 % 99));
+    assert(store.size() == 8 && store.cartsOf(L"XYZ98765AB-Q").empty());
+}
+
+static void TEST_SnapshotRoundTrip() {
+    CartStore store;
+    std::vector<CartUuid> ids;
+    for (int i = 0; i < 3000; ++i) {
+        ShoppingCart cart(i % 2 ? L"ABC12345DE-A" : L"アイウ12345エオ-Q");
+        if (i % 3 != 0) {
+            cart.addItem("apple", 1 + i % 99);
+        }
+        if (i % 5 == 0) {
+            cart.addItem("pineapple", 2);
+        }
+        ids.push_back(store.insert(cart));
+    }
+    for (bool checksum : { false, true }) {
+        const std::string path = checksum ? "test_snapshot_checksum.bin" : "test_snapshot.bin";
+        assert(saveSnapshot(store, path, checksum) == 3000);
+        CartStore restored;
+        assert(restoreSnapshot(restored, path) == 3000);
+        assert(restored.size() == 3000);
+        for (const CartUuid& id : ids) {
+            std::map<std::string, int> expected;
+            std::wstring owner;
+            store.read(id, [&](const ShoppingCart& cart) { expected = cart.getItems(); owner = cart.getId(); });
+            assert(restored.read(id, [&](const ShoppingCart& cart) {
+                assert(cart.getItems() == expected);
+                assert(cart.getId() == owner);
+                assert(cart.getTotal() == Money(50 * (expected.count("apple") ? expected.at("apple") : 0) + 200 * (expected.count("pineapple") ? expected.at("pineapple") : 0)));
+            }));
+        }
+        assert(restored.cartsOf(L"アイウ12345エオ-Q").size() == 1500);
+
+        // A flipped byte fails the checksum; a truncated file fails either way.
+        std::string bytes;
+        {
+            std::ifstream file(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        for (bool truncate : { false, true }) {
+            if (!checksum && !truncate) {
+                continue;
+            }
+            std::string damaged = truncate ? bytes.substr(0, bytes.size() - 3) : bytes;
+            if (!truncate) {
+                damaged[damaged.size() / 2] ^= 0x10;
+            }
+            std::ofstream(path, std::ios::binary | std::ios::trunc) << damaged;
+            bool threw = false;
+            try {
+                CartStore partial;
+                restoreSnapshot(partial, path);
+            }
+            catch (const std::runtime_error& e) {
+                threw = std::string(e.what()) == "Invalid snapshot file";
+            }
+            assert(threw);
+        }
+        std::remove(path.c_str());
+    }
+}
+
+static void TEST_SnapshotUnfinishedSave() {
+    const std::string path = "test_unfinished.snapshot";
+    CartStore store;
+    ShoppingCart saved(L"ABC12345DE-A");
+    saved.addItem("apple", 2);
+    CartUuid id = saved.getCartUuid();
+    store.insert(std::move(saved));
+    assert(saveSnapshot(store, path, true, 7) == 1);
+
+    // A save that stops part way, as a crash or a failed write would, leaves the last snapshot
+    // as it was and cleans up after itself.
+    {
+        CartSnapshotWriter writer(path, true, 9);
+        for (int i = 0; i < 1000; ++i) {
+            ShoppingCart cart(L"XYZ98765AB-Q");
+            cart.addItem("banana", 1);
+            writer.write(cart);
+        }
+    }
+    assert(!std::ifstream(path + ".tmp").good());
+    CartStore restored;
+    uint64_t lsn = 0;
+    assert(restoreSnapshot(restored, path, lsn) == 1);
+    assert(lsn == 7);
+    assert(restored.read(id, [](const ShoppingCart& cart) { assert(cart.getItems().at("apple") == 2); }));
+    std::remove(path.c_str());
+}
+
+static void TEST_WalReplay() {
+    const std::string path = "test_cart.wal";
+    std::remove(path.c_str());
+    CartStore store;
+    std::vector<CartUuid> ids;
+    {
+        CartWal wal(path, { std::chrono::microseconds(200), 4096, false });
+        uint64_t lsn = 0;
+        for (int i = 0; i < 200; ++i) {
+            ShoppingCart cart(i % 2 ? L"ABC12345DE-A" : L"アイウ12345エオ-Q");
+            CartUuid id = cart.getCartUuid();
+            wal.logCreate(id, cart.getId());
+            store.insert(std::move(cart));
+            ids.push_back(id);
+            store.update(id, [&](ShoppingCart& cart) {
+                cart.addItem("apple", 1 + i % 50);
+                lsn = wal.logAdd(id, "apple", 1 + i % 50);
+                cart.addItem("banana", 2);
+                lsn = wal.logAdd(id, "banana", 2);
+                if (i % 3 == 0) {
+                    cart.updateItem("apple", 7);
+                    lsn = wal.logUpdate(id, "apple", 7);
+                }
+                if (i % 4 == 0) {
+                    cart.removeItem("banana");
+                    lsn = wal.logRemove(id, "banana");
+                }
+            });
+            if (i % 10 == 0) {
+                store.erase(id);
+                lsn = wal.logErase(id);
+            }
+        }
+        wal.waitDurable(lsn);
+        assert(wal.durableLsn() == lsn);
+        assert(wal.groupCount() >= 1);
+    }
+    CartStore replayed;
+    WalReplay replay = replayWal(replayed, path);
+    assert(replay.skipped == 0);
+    assert(replayed.size() == store.size() && store.size() == 180);
+    for (const CartUuid& id : ids) {
+        std::map<std::string, int> expected;
+        bool present = store.read(id, [&](const ShoppingCart& cart) { expected = cart.getItems(); });
+        std::map<std::string, int> actual;
+        assert(replayed.read(id, [&](const ShoppingCart& cart) { actual = cart.getItems(); }) == present);
+        assert(actual == expected);
+    }
+    assert(replayed.cartsOf(L"ABC12345DE-A").size() == 100);
+
+    // A group torn by a crash mid-write is dropped, along with nothing before it.
+    std::string bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes.substr(0, bytes.size() - 5);
+    CartStore torn;
+    WalReplay partial = replayWal(torn, path);
+    assert(partial.applied < replay.applied && partial.skipped == 0);
+    std::remove(path.c_str());
+}
+
+static void TEST_WalRecovery() {
+    const std::string wal_path = "test_recovery.wal";
+    const std::string snapshot_path = "test_recovery.snapshot";
+    std::remove(wal_path.c_str());
+    CartStore store;
+    std::vector<CartUuid> ids;
+    uint64_t snapshot_lsn = 0;
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        for (int i = 0; i < 20; ++i) {
+            ShoppingCart cart(L"ABC12345DE-A");
+            CartUuid id = cart.getCartUuid();
+            wal.logCreate(id, cart.getId());
+            store.insert(std::move(cart));
+            ids.push_back(id);
+            store.update(id, [&](ShoppingCart& cart) {
+                cart.addItem("apple", 1);
+                wal.logAdd(id, "apple", 1);
+            });
+        }
+        // The snapshot is taken with no mutation in flight, so it holds exactly the records so far.
+        snapshot_lsn = wal.lastLsn();
+        assert(saveSnapshot(store, snapshot_path, false, snapshot_lsn) == 20);
+
+        // More mutations after the snapshot, which only the log has.
+        for (const CartUuid& id : ids) {
+            store.update(id, [&](ShoppingCart& cart) {
+                cart.addItem("apple", 2);
+                wal.logAdd(id, "apple", 2);
+            });
+        }
+        ShoppingCart late(L"XYZ98765AB-Q");
+        wal.logCreate(late.getCartUuid(), late.getId());
+        store.insert(std::move(late));
+        store.erase(ids[0]);
+        wal.waitDurable(wal.logErase(ids[0]));
+    }
+    // A crash in the middle of the next group leaves a torn tail behind.
+    std::ofstream(wal_path, std::ios::binary | std::ios::app) << std::string("\x40\x00\x00\x00torn", 8);
+
+    auto matches = [&](const CartStore& recovered) {
+        assert(recovered.size() == store.size());
+        store.forEach([&](const ShoppingCart& cart) {
+            assert(recovered.read(cart.getCartUuid(), [&](const ShoppingCart& restored) {
+                assert(restored.getItems() == cart.getItems());
+                assert(restored.getId() == cart.getId());
+            }));
+        });
+    };
+    CartStore recovered;
+    uint64_t restored_lsn = 0;
+    assert(restoreSnapshot(recovered, snapshot_path, restored_lsn) == 20);
+    assert(restored_lsn == snapshot_lsn);
+    WalReplay replay = replayWal(recovered, wal_path, restored_lsn);
+    assert(replay.applied == 20 + 1 + 1);
+    assert(replay.skipped == 0);
+    // Each cart got apple 1 before the snapshot and apple 2 after, and must not get the 1 twice.
+    assert(recovered.read(ids[1], [](const ShoppingCart& cart) { assert(cart.getItems().at("apple") == 3); }));
+    matches(recovered);
+
+    // Reopening the log drops the torn tail and numbers records on from the last one.
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        assert(wal.lastLsn() == snapshot_lsn + 20 + 1 + 1);
+        store.update(ids[1], [&](ShoppingCart& cart) {
+            cart.removeItem("apple");
+            wal.logRemove(ids[1], "apple");
+        });
+        snapshot_lsn = wal.lastLsn();
+        assert(saveSnapshot(store, snapshot_path, false, snapshot_lsn) == 20);
+        assert(wal.checkpoint(snapshot_lsn));
+        store.update(ids[2], [&](ShoppingCart& cart) {
+            cart.updateItem("apple", 9);
+            wal.waitDurable(wal.logUpdate(ids[2], "apple", 9));
+        });
+        assert(!wal.checkpoint(snapshot_lsn));
+    }
+    CartStore checkpointed;
+    assert(restoreSnapshot(checkpointed, snapshot_path, restored_lsn) == 20);
+    replay = replayWal(checkpointed, wal_path, restored_lsn);
+    assert(replay.applied == 1);
+    matches(checkpointed);
+    // The checkpoint dropped records a store without the snapshot would need.
+    CartStore empty;
+    bool threw = false;
+    try {
+        replayWal(empty, wal_path);
+    }
+    catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // A cart created with an invalid owner id makes the log invalid rather than failing the insert.
+    std::remove(wal_path.c_str());
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        wal.waitDurable(wal.logCreate(CartID().getBytes(), L"ABC"));
+    }
+    threw = false;
+    try {
+        replayWal(empty, wal_path);
+    }
+    catch (const std::runtime_error& e) {
+        threw = std::string(e.what()) == "Invalid WAL file";
+    }
+    assert(threw);
+    std::remove(wal_path.c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+static void TEST_WalCheckpointCrash() {
+    const std::string wal_path = "test_checkpoint.wal";
+    const std::string snapshot_path = "test_checkpoint.snapshot";
+    std::remove(wal_path.c_str());
+    CartStore store;
+    ShoppingCart cart(L"ABC12345DE-A");
+    CartUuid id = cart.getCartUuid();
+    uint64_t snapshot_lsn = 0;
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        wal.logCreate(id, cart.getId());
+        store.insert(std::move(cart));
+        store.update(id, [&](ShoppingCart& cart) {
+            cart.addItem("apple", 1);
+            wal.logAdd(id, "apple", 1);
+        });
+        snapshot_lsn = wal.lastLsn();
+        assert(saveSnapshot(store, snapshot_path, false, snapshot_lsn) == 1);
+        assert(wal.checkpoint(snapshot_lsn));
+    }
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        assert(wal.lastLsn() == snapshot_lsn);
+        store.update(id, [&](ShoppingCart& cart) {
+            cart.addItem("banana", 2);
+            wal.waitDurable(wal.logAdd(id, "banana", 2));
+        });
+    }
+    // A crash while the next checkpoint writes its new log leaves that half written beside the
+    // old log, which is still whole.
+    std::ofstream(wal_path + ".tmp", std::ios::binary | std::ios::trunc) << "CART";
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        assert(wal.lastLsn() == snapshot_lsn + 1);
+    }
+    CartStore recovered;
+    uint64_t restored_lsn = 0;
+    assert(restoreSnapshot(recovered, snapshot_path, restored_lsn) == 1);
+    WalReplay replay = replayWal(recovered, wal_path, restored_lsn);
+    assert(replay.applied == 1);
+    assert(recovered.read(id, [](const ShoppingCart& cart) {
+        assert((cart.getItems() == std::map<std::string, int>{ { "apple", 1 }, { "banana", 2 } }));
+    }));
+
+    // A log left empty, as truncating it before writing its new header would leave after a crash,
+    // is refused rather than numbered from zero again, below the records the snapshot holds.
+    std::ofstream(wal_path, std::ios::binary | std::ios::trunc);
+    bool threw = false;
+    try {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+    }
+    catch (const std::runtime_error& e) {
+        threw = std::string(e.what()) == "Invalid WAL file";
+    }
+    assert(threw);
+    std::remove(wal_path.c_str());
+    std::remove((wal_path + ".tmp").c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+static void TEST_CopiesAreIndependent() {
+    ShoppingCart original(L"ABC12345DE-A");
+    original.addItem("apple", 2);
+    ShoppingCart copy(original);
+    ShoppingCart assigned(L"XYZ98765AB-Q");
+    assigned = original;
+    copy.addItem("banana", 4);
+    assigned.removeItem("apple");
+    assert((original.getItems() == std::map<std::string, int>({ {"apple", 2} })));
+    assert((copy.getItems() == std::map<std::string, int>({ {"apple", 2}, {"banana", 4} })));
+    assert(assigned.itemCount() == 0 && assigned.getId() == L"ABC12345DE-A");
+    assert(original.getTotal() == Money(100) && copy.getTotal() == Money(200) && assigned.getTotal() == Money(0));
+    original.updateItem("apple", 3);
+    assert(copy.getItems().at("apple") == 2 && copy.getCartId() == original.getCartId());
+
+    // Copies of one cart changed and priced on many threads at once.
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches = 0;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&original, &mismatches, t]() {
+            for (int i = 0; i < 1000; ++i) {
+                ShoppingCart what_if(original);
+                ShoppingCart preview = what_if;
+                what_if.addItem("orange", 1 + t);
+                if (what_if.getTotal() != Money(150 + 75 * (1 + t)) || preview.getTotal() != Money(150)) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    assert(mismatches == 0);
+    assert((original.getItems() == std::map<std::string, int>({ {"apple", 3} })));
+}
+
+static void TEST_BulkPricing() {
+    // Prices above 2^32 cents, to check the wide multiply.
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0}, {"yacht", 123456789.99} }));
+    const std::string items[] = { "apple", "banana", "orange", "grapes", "pineapple", "yacht" };
+    std::vector<ShoppingCart> carts;
+    for (int i = 0; i < 1000; ++i) {
+        ShoppingCart cart(L"ABC12345DE-A");
+        for (int line = 0; line < i % 7; ++line) {
+            cart.addItem(items[(i + line * 5) % 6], 1 + (i + line) % 99);
+        }
+        carts.push_back(cart);
+    }
+    for (PricingKernel kernel : { PricingKernel::Auto, PricingKernel::Scalar }) {
+        std::vector<Money> totals = priceCarts(carts, kernel);
+        assert(totals.size() == carts.size());
+        for (size_t i = 0; i < carts.size(); ++i) {
+            assert(totals[i] == carts[i].getTotal());
+        }
+    }
+    assert(priceCarts(std::vector<ShoppingCart>()).empty());
+
+    // A cart holding an item the catalog has dropped cannot be priced, as with getTotal.
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    for (PricingKernel kernel : { PricingKernel::Auto, PricingKernel::Scalar }) {
+        bool threw = false;
+        try {
+            priceCarts(carts, kernel);
+        }
+        catch (const std::invalid_argument& e) {
+            threw = std::string(e.what()) == "Item not found in catalog";
+        }
+        assert(threw);
+    }
+}
+
+static void TEST_CartStoreReprice() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    // Every chunk of a parallel loop runs exactly once, and a throwing chunk fails the loop.
+    WorkStealingPool pool(3);
+    assert(pool.size() == 4);
+    std::vector<std::atomic<int>> runs(10000);
+    pool.parallelFor(runs.size(), 7, [&runs](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            ++runs[i];
+        }
+    });
+    assert(std::all_of(runs.begin(), runs.end(), [](const std::atomic<int>& count) { return count == 1; }));
+    bool threw = false;
+    try {
+        pool.parallelFor(100, 1, [](size_t begin, size_t) {
+            if (begin == 42) {
+                throw std::runtime_error("chunk failed");
+            }
+        });
+    }
+    catch (const std::runtime_error& e) {
+        threw = std::string(e.what()) == "chunk failed";
+    }
+    assert(threw);
+
+    // The item index follows inserts, updates, and erases.
+    CartStore store(4, true);
+    CartStore unindexed(4);
+    ItemId apple = *ItemRegistry::find("apple");
+    ItemId banana = *ItemRegistry::find("banana");
+    std::set<CartUuid> holding_apple;
+    for (int i = 0; i < 100; ++i) {
+        ShoppingCart cart(L"ABC12345DE-A");
+        cart.addItem(i % 2 ? "apple" : "banana", 1 + i % 5);
+        if (i % 3 == 0) {
+            cart.addItem("orange", 1);
+        }
+        if (i % 2) {
+            holding_apple.insert(cart.getCartUuid());
+        }
+        unindexed.insert(cart);
+        store.insert(cart);
+    }
+    std::vector<CartUuid> found = store.cartsHolding(apple);
+    assert(std::set<CartUuid>(found.begin(), found.end()) == holding_apple);
+    found = unindexed.cartsHolding(apple);
+    assert(std::set<CartUuid>(found.begin(), found.end()) == holding_apple);
+    CartUuid moved = *holding_apple.begin();
+    assert(store.update(moved, [](ShoppingCart& cart) {
+        cart.removeItem("apple");
+        cart.addItem("banana", 2);
+    }));
+    holding_apple.erase(moved);
+    found = store.cartsHolding(apple);
+    assert(std::set<CartUuid>(found.begin(), found.end()) == holding_apple);
+    found = store.cartsHolding(banana);
+    assert(std::count(found.begin(), found.end(), moved) == 1 && found.size() == 51);
+    // A failed update leaves the index matching whatever the cart was left holding.
+    try {
+        store.update(moved, [](ShoppingCart& cart) {
+            cart.addItem("grapes", 1);
+            cart.addItem("kiwi", 1);
+        });
+    }
+    catch (const std::invalid_argument&) {
+    }
+    assert(store.cartsHolding(*ItemRegistry::find("grapes")) == std::vector<CartUuid>({ moved }));
+    assert(store.erase(moved));
+    assert(store.cartsHolding(*ItemRegistry::find("grapes")).empty());
+    assert(store.cartsHolding(banana).size() == 50);
+
+    // Repricing after a price change brings exactly the carts holding the item up to date.
+    Catalog::publish(CatalogIndex({ {"apple", 0.6}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    RepriceResult result = store.reprice(std::vector<ItemId>({ apple }), pool);
+    assert(result.repriced == holding_apple.size() && result.unpriced == 0);
+    for (const CartUuid& id : holding_apple) {
+        assert(store.read(id, [](const ShoppingCart& cart) {
+            int64_t expected = 0;
+            for (const auto& [name, quantity] : cart.getItems()) {
+                expected += (name == "apple" ? 60 : name == "orange" ? 75 : 25) * quantity;
+            }
+            assert(cart.getTotal() == Money(expected));
+        }));
+    }
+    Catalog::publish(CatalogIndex({ {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    result = store.reprice(std::vector<ItemId>({ apple, banana }), pool);
+    assert(result.repriced == 50 && result.unpriced == 49);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+static void TEST_LatencyHistogram() {
+    LatencyHistogram empty;
+    assert(empty.count() == 0 && empty.percentile(0.99) == 0);
+
+    // Small values are exact; larger ones are kept to within about 3%.
+    LatencyHistogram small;
+    for (uint64_t value = 0; value < 50; ++value) {
+        small.record(value);
+    }
+    assert(small.percentile(0.5) == 24 && small.percentile(1.0) == 49 && small.max() == 49);
+
+    LatencyHistogram first;
+    LatencyHistogram second;
+    for (uint64_t value = 1; value <= 100000; ++value) {
+        (value % 2 ? first : second).record(value * 1000);
+    }
+    first.merge(second);
+    assert(first.count() == 100000 && first.max() == 100000000);
+    assert(first.mean() == 50000500.0);
+    for (double fraction : { 0.5, 0.99, 0.999 }) {
+        double expected = fraction * 100000000;
+        double reported = (double)first.percentile(fraction);
+        assert(reported >= expected && reported <= expected * 1.035);
+    }
+    assert(first.percentile(1.0) == 100000000);
+
+    // Values past the top bucket are still counted, and the maximum is exact.
+    LatencyHistogram huge;
+    huge.record(uint64_t(1) << 50);
+    assert(huge.count() == 1 && huge.percentile(0.5) == uint64_t(1) << 50);
+}
+
+static void TEST_CartMetrics() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    CartMetrics::Snapshot before;
+    CartMetrics::snapshot(before);
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    try { cart.addItem("kiwi", 1); } catch (const std::invalid_argument&) {}
+    try { cart.updateItem("apple", 0); } catch (const std::invalid_argument&) {}
+    try { cart.removeItem("banana"); } catch (const std::invalid_argument&) {}
+    assert(cart.getTotal().getCents() == 100);
+    assert(cart.getDiscountedTotal(PromotionPlan()).getCents() == 100);
+    // What a thread records is kept after it exits.
+    std::thread([]() {
+        try { ShoppingCart rejected(L"ABC1234XDE-A"); } catch (const std::invalid_argument&) {}
+    }).join();
+    CartMetrics::Snapshot after;
+    CartMetrics::snapshot(after);
+
+    if (!CartMetrics::ENABLED) {
+        assert(after.calls[CartMetrics::ADD_ITEM] == 0 && CartMetrics::prometheus().empty());
+        return;
+    }
+    // Every call is counted, though not every one is timed.
+    auto calls = [&](CartMetrics::Op op) { return after.calls[op] - before.calls[op]; };
+    auto errors = [&](CartMetrics::Op op) { return after.errors[op] - before.errors[op]; };
+    auto failures = [&](CartMetrics::Failure failure) { return after.failures[failure] - before.failures[failure]; };
+    assert(calls(CartMetrics::ADD_ITEM) == 2 && errors(CartMetrics::ADD_ITEM) == 1);
+    assert(calls(CartMetrics::UPDATE_ITEM) == 1 && errors(CartMetrics::UPDATE_ITEM) == 1);
+    assert(calls(CartMetrics::REMOVE_ITEM) == 1 && errors(CartMetrics::REMOVE_ITEM) == 1);
+    assert(calls(CartMetrics::CONSTRUCT) == 2 && errors(CartMetrics::CONSTRUCT) == 1);
+    assert(calls(CartMetrics::GET_TOTAL) == 1 && errors(CartMetrics::GET_TOTAL) == 0);
+    assert(calls(CartMetrics::GET_DISCOUNTED_TOTAL) == 1);
+    assert(failures(CartMetrics::UNKNOWN_ITEM) == 1 && failures(CartMetrics::QUANTITY_OUT_OF_RANGE) == 1);
+    assert(failures(CartMetrics::ITEM_NOT_IN_CART) == 1 && failures(CartMetrics::INVALID_OWNER_ID) == 1);
+
+    std::string text = CartMetrics::prometheus();
+    assert(text.find("# TYPE cart_operation_duration_seconds histogram\n") != std::string::npos);
+    assert(text.find("cart_operation_duration_seconds_bucket{op=\"add_item\",le=\"+Inf\"} ") != std::string::npos);
+    assert(text.find("cart_validation_failures_total{reason=\"invalid_owner_id\"} ") != std::string::npos);
+    assert(text.find("cart_operations_total{op=\"get_discounted_total\"} ") != std::string::npos);
+    CartMetrics::writePrometheus("metrics_test.prom");
+    std::ifstream file("metrics_test.prom");
+    std::string first_line;
+    std::getline(file, first_line);
+    assert(first_line == "# HELP cart_operations_total ShoppingCart operations called.");
+}
+
+static void TEST_TryApi() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    CartResult<ShoppingCart> created = ShoppingCart::tryCreate(L"ABC12345DE-A");
+    assert(created.has_value() && created->getId() == L"ABC12345DE-A");
+    assert(ShoppingCart::tryCreate(L"ABC12345DE-AQ").error() == CartError::OwnerIdTooLong);
+    assert(ShoppingCart::tryCreate(L"ABC1234XDE-A").error() == CartError::InvalidOwnerId);
+    assert(OwnerID::tryMake(L"abc12345de-q").has_value());
+
+    ShoppingCart& cart = *created;
+    assert(cart.tryAddItem("apple", 2).has_value());
+    assert(cart.tryAddItem("kiwi", 1).error() == CartError::UnknownItem);
+    assert(cart.tryAddItem("banana", 0).error() == CartError::QuantityBelowMinimum);
+    assert(cart.tryAddItem("apple", 98).error() == CartError::QuantityAboveMaximum);
+    assert(cart.tryUpdateItem("banana", 1).error() == CartError::UpdatedItemNotInCart);
+    assert(cart.tryUpdateItem("apple", 100).error() == CartError::QuantityAboveMaximum);
+    assert(cart.tryRemoveItem("banana").error() == CartError::RemovedItemNotInCart);
+    CartOp batch[] = { { CartOp::Kind::Add, "orange", 1 }, { CartOp::Kind::Remove, "grapes" } };
+    assert(cart.tryApplyBatch(batch).error() == CartError::RemovedItemNotInCart);
+    // Failed calls leave the cart as it was.
+    assert((cart.getItems() == std::map<std::string, int>{ { "apple", 2 } }));
+    assert(cart.tryGetTotal()->getCents() == 100);
+
+    Catalog::Reader catalog;
+    assert(catalog.tryGetItem("banana")->price_cents == 25);
+    assert(catalog.tryGetItem("kiwi").error() == CartError::UnknownItem);
+
+    // The throwing API reports the same errors with the messages it always had.
+    try {
+        cart.updateItem("banana", 1);
+        assert(false);
+    }
+    catch (const std::invalid_argument& error) {
+        assert(std::string(error.what()) == describe(CartError::UpdatedItemNotInCart));
+    }
+
+    // A catalog that drops an item the cart holds leaves its total unpriced.
+    Catalog::publish(CatalogIndex({ {"banana", 0.25} }));
+    assert(cart.tryGetTotal().error() == CartError::UnknownItem);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+static void TEST_CartEvents() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    CartEvents::start();
+    cart.addItem("apple", 2);
+    cart.addItem("apple", 1);
+    cart.updateItem("apple", 5);
+    cart.removeItem("apple");
+    CartOp batch[] = { { CartOp::Kind::Add, "banana", 4 }, { CartOp::Kind::Add, "orange", 1 }, { CartOp::Kind::Remove, "orange" } };
+    cart.applyBatch(batch);
+    try { cart.removeItem("apple"); } catch (const std::invalid_argument&) {}
+    CartEvents::stop();
+    cart.addItem("grapes", 1);
+
+    CartEvent events[16];
+    assert(CartEvents::drain(events) == 5);
+    ItemId apple = *ItemRegistry::find("apple");
+    assert(events[0].cart == cart.getCartUuid() && events[0].item == apple);
+    assert(events[0].old_quantity == 0 && events[0].new_quantity == 2);
+    assert(events[1].old_quantity == 2 && events[1].new_quantity == 3);
+    assert(events[2].old_quantity == 3 && events[2].new_quantity == 5);
+    assert(events[3].old_quantity == 5 && events[3].new_quantity == 0);
+    // The batch adds and removes orange, which nets out to no change.
+    assert(events[4].item == *ItemRegistry::find("banana") && events[4].new_quantity == 4);
+    assert(events[0].timestamp > 0 && events[0].timestamp <= events[4].timestamp);
+    assert(CartEvents::drain(events) == 0);
+
+    // A full ring drops what does not fit, and counts it.
+    CartEvents::Counters before = CartEvents::counters();
+    CartEvents::start(4, CartEvents::Overflow::Drop);
+    for (int i = 0; i < 10; ++i) {
+        cart.updateItem("banana", i % 2 + 1);
+    }
+    assert(CartEvents::drain(events) == 4);
+    CartEvents::Counters after = CartEvents::counters();
+    assert(after.published - before.published == 4 && after.dropped - before.dropped == 6);
+
+    // Under backpressure nothing is lost: the producer waits for the consumer.
+    CartEvents::start(2, CartEvents::Overflow::Block);
+    std::thread producer([]() {
+        ShoppingCart own(L"ABC12345DE-A");
+        for (int i = 0; i < 50; ++i) {
+            own.addItem("pineapple", 1);
+            own.removeItem("pineapple");
+        }
+    });
+    size_t received = 0;
+    while (received < 100) {
+        received += CartEvents::drain(events);
+        std::this_thread::yield();
+    }
+    producer.join();
+    CartEvents::stop();
+    assert(received == 100 && CartEvents::drain(events) == 0);
+    assert(CartEvents::counters().dropped == after.dropped);
+}
+
+static void TEST_CartEventsInsideStore() {
+    // The consumer reads the cart being changed between drains. A producer that waited for room
+    // while update held the cart's lock would never let it.
+    CartStore store;
+    CartUuid id = store.create(L"ABC12345DE-A");
+    CartEvents::Counters before = CartEvents::counters();
+    CartEvents::start(2, CartEvents::Overflow::Block);
+    std::atomic<bool> done = false;
+    std::thread producer([&]() {
+        for (int i = 0; i < 20; ++i) {
+            store.update(id, [](ShoppingCart& cart) {
+                for (int j = 0; j < 5; ++j) {
+                    cart.addItem("pineapple", 1);
+                    cart.removeItem("pineapple");
+                }
+            });
+        }
+        done = true;
+    });
+    std::vector<CartEvent> events(1);
+    size_t received = 0;
+    while (received < 200) {
+        store.read(id, [](const ShoppingCart& cart) { assert(cart.itemCount() == 0); });
+        received += CartEvents::drain(events);
+        std::this_thread::yield();
+    }
+    producer.join();
+    CartEvents::stop();
+    assert(done);
+    assert(received == 200);
+    CartEvents::Counters after = CartEvents::counters();
+    assert(after.published - before.published == 200);
+    assert(after.dropped == before.dropped);
+}
+
+static void TEST_Promotions() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 5);
+    cart.addItem("banana", 3);
+    cart.addItem("orange", 1);
+    cart.addItem("grapes", 2);
+    assert(cart.getTotal() == Money(600));
+    assert(cart.getDiscountedTotal(PromotionPlan()) == Money(600));
+
+    std::vector<Promotion> promotions = {
+        { Promotion::Kind::BuyGetFree, { "apple" }, 2, 1 },
+        { Promotion::Kind::PercentOff, { "apple", "kiwi" }, 0, 0, 30 },
+        { Promotion::Kind::PercentOff, { "banana", "orange" }, 0, 0, 10 },
+        { Promotion::Kind::Bundle, { "orange", "grapes" }, 0, 0, 0, Money(150) },
+        { Promotion::Kind::Bundle, { "apple", "pineapple" }, 0, 0, 0, Money(100) },
+    };
+    PromotionPlan plan(promotions);
+    assert(plan.size() == 5);
+    // Apple takes the better of one free unit (50) and 30% off (75), and banana gets 10% off (7).
+    // The orange and grapes bundle saves 25 and takes the orange, which so gets no 10% off of its
+    // own; apple and pineapple is incomplete.
+    assert(plan.discount(cart) == Money(75 + 7 + 25));
+    assert(cart.getDiscountedTotal(plan) == Money(600 - 107));
+
+    // Discounts never take the total below zero.
+    std::vector<Promotion> generous = {
+        { Promotion::Kind::PercentOff, { "apple", "banana", "orange", "grapes" }, 0, 0, 100 },
+        { Promotion::Kind::Bundle, { "apple", "banana" }, 0, 0, 0, Money(0) },
+    };
+    assert(cart.getDiscountedTotal(PromotionPlan(generous)) == Money(0));
+
+    for (const Promotion& invalid : { Promotion{ Promotion::Kind::PercentOff, { "apple" }, 0, 0, 0 },
+            Promotion{ Promotion::Kind::BuyGetFree, { "apple" }, 1, 0 },
+            Promotion{ Promotion::Kind::Bundle, { "apple", "apple" }, 0, 0, 0, Money(10) },
+            Promotion{ Promotion::Kind::PercentOff, {}, 0, 0, 10 } }) {
+        try {
+            PromotionPlan rejected(std::span<const Promotion>(&invalid, 1));
+            assert(false);
+        }
+        catch (const std::invalid_argument&) {}
+    }
+}
+
+static void TEST_PromotionsShareNoUnits() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 1);
+    cart.addItem("banana", 1);
+    cart.addItem("orange", 1);
+    std::vector<Promotion> promotions = {
+        { Promotion::Kind::Bundle, { "apple", "banana" }, 0, 0, 0, Money(50) },
+        { Promotion::Kind::Bundle, { "apple", "orange" }, 0, 0, 0, Money(50) },
+        { Promotion::Kind::PercentOff, { "apple" }, 0, 0, 50 },
+    };
+    PromotionPlan plan(promotions);
+    // The one apple goes to the bundle that saves more (75 against 25), and so gets no 50% off.
+    assert(plan.discount(cart) == Money(75));
+    assert(cart.getDiscountedTotal(plan) == Money(75));
+
+    // A second apple completes the other bundle too.
+    cart.addItem("apple", 1);
+    assert(plan.discount(cart) == Money(75 + 25));
+
+    // Apples no bundle took still get their 50% off.
+    cart.addItem("apple", 3);
+    assert(plan.discount(cart) == Money(75 + 25 + 3 * 25));
+
+    // A bundle that costs more than its items are listed at takes no units.
+    std::vector<Promotion> dear = {
+        { Promotion::Kind::Bundle, { "apple", "banana" }, 0, 0, 0, Money(100) },
+        { Promotion::Kind::PercentOff, { "apple", "banana" }, 0, 0, 10 },
+    };
+    assert(PromotionPlan(dear).discount(cart) == Money(5 * 5 + 2));
+}
+
+static void TEST_MergeFrom() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ShoppingCart saved(L"ABC12345DE-A");
+    saved.addItem("apple", 2);
+    saved.addItem("orange", 90);
+    ShoppingCart guest(L"XYZ54321QQ-Q");
+    guest.addItem("apple", 3);
+    guest.addItem("banana", 1);
+    guest.addItem("orange", 20);
+
+    // Sum fails as a whole when a line would pass 99.
+    ShoppingCart summed = saved;
+    try {
+        summed.mergeFrom(guest, MergePolicy::Sum);
+        assert(false);
+    }
+    catch (const std::invalid_argument&) {}
+    assert(summed.getItems() == saved.getItems());
+    assert(summed.tryMergeFrom(guest, MergePolicy::Sum).error() == CartError::QuantityAboveMaximum);
+
+    ShoppingCart clamped = saved;
+    clamped.mergeFrom(guest, MergePolicy::Clamp);
+    assert((clamped.getItems() == std::map<std::string, int>{ { "apple", 5 }, { "banana", 1 }, { "orange", 99 } }));
+    assert(clamped.getTotal() == Money(5 * 50 + 25 + 99 * 75));
+
+    ShoppingCart kept = saved;
+    kept.mergeFrom(guest, MergePolicy::Keep);
+    assert((kept.getItems() == std::map<std::string, int>{ { "apple", 2 }, { "banana", 1 }, { "orange", 90 } }));
+    assert(kept.getTotal() == Money(2 * 50 + 25 + 90 * 75));
+    // The guest cart and the copy source are untouched.
+    assert(saved.getItems().size() == 2 && guest.getItems().at("orange") == 20);
+
+    // Lines whose item has left the catalog are merged all the same.
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"orange", 0.75} }));
+    ShoppingCart merged = saved;
+    merged.mergeFrom(guest, MergePolicy::Keep);
+    assert(merged.getItems().at("banana") == 1);
+    assert(merged.tryGetTotal().error() == CartError::UnknownItem);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+
+    // Merging a cart into itself sums it with itself.
+    ShoppingCart doubled = guest;
+    doubled.mergeFrom(doubled, MergePolicy::Sum);
+    assert((doubled.getItems() == std::map<std::string, int>{ { "apple", 6 }, { "banana", 2 }, { "orange", 40 } }));
+    assert(doubled.getTotal() == Money(6 * 50 + 2 * 25 + 40 * 75));
+}
+
+static void TEST_ConstTotalsAcrossThreads() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    cart.addItem("banana", 4);
+    // Const readers on one cart refresh its cached total together after every reload. Each
+    // must see one of the two prices, and once the reloads stop, the latest one.
+    std::atomic<bool> stop = false;
+    std::atomic<bool> wrong = false;
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            const ShoppingCart& shared = cart;
+            while (!stop.load()) {
+                int64_t cents = shared.getTotal().getCents();
+                if (cents != 200 && cents != 400) {
+                    wrong = true;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 2000; ++i) {
+        double apple = i % 2 == 0 ? 1.0 : 0.5;
+        Catalog::publish(CatalogIndex({ {"apple", apple}, {"banana", apple / 2} }));
+    }
+    Catalog::publish(CatalogIndex({ {"apple", 1.0}, {"banana", 0.5} }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    assert(!wrong);
+    assert(cart.getTotal() == Money(400));
+}
+
+static void TEST_CartStoreOwnerIndex() {
+    // One thread inserts carts while another erases each as soon as it is stored, so every
+    // erase races the insert's owner index update.
+    CartStore store(4);
+    std::vector<ShoppingCart> carts;
+    for (int i = 0; i < 2000; ++i) {
+        carts.push_back(ShoppingCart(L"ABC12345DE-A"));
+    }
+    std::vector<CartUuid> ids;
+    for (const ShoppingCart& cart : carts) {
+        ids.push_back(cart.getCartUuid());
+    }
+    std::thread eraser([&store, &ids]() {
+        for (const CartUuid& id : ids) {
+            while (!store.erase(id)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (ShoppingCart& cart : carts) {
+        store.insert(std::move(cart));
+    }
+    eraser.join();
+    assert(store.size() == 0);
+    assert(store.cartsOf(L"ABC12345DE-A").empty());
+
+    // An update may not assign another cart over the stored one; its id and owner are put back.
+    CartUuid kept = store.create(L"ABC12345DE-A");
+    bool threw = false;
+    try {
+        store.update(kept, [](ShoppingCart& cart) {
+            cart = ShoppingCart(L"XYZ98765AB-Q");
+            cart.addItem("apple", 2);
+        });
+    }
+    catch (const std::logic_error& e) {
+        threw = std::string(e.what()) == "Cart id or owner changed in update";
+    }
+    assert(threw);
+    assert(store.read(kept, [&kept](const ShoppingCart& cart) {
+        assert(cart.getCartUuid() == kept);
+        assert(cart.getId() == L"ABC12345DE-A");
+        assert(cart.getItems() == (std::map<std::string, int>{ { "apple", 2 } }));
+    }));
+    assert(store.cartsOf(L"ABC12345DE-A") == std::vector<CartUuid>({ kept }));
+    assert(store.cartsOf(L"XYZ98765AB-Q").empty());
+}
+
+static void TEST_CartStoreMovedOut() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ItemId apple = ItemRegistry::intern("apple");
+    for (bool index_items : { false, true }) {
+        CartStore store(4, index_items);
+        CartUuid id = store.create(L"ABC12345DE-A");
+        store.update(id, [](ShoppingCart& cart) { cart.addItem("apple", 2); });
+        // An update that moves the cart out takes its lines; the store files an empty cart
+        // under the same id and owner and reports the misuse.
+        std::optional<ShoppingCart> taken;
+        bool threw = false;
+        try {
+            store.update(id, [&taken](ShoppingCart& cart) { taken.emplace(std::move(cart)); });
+        }
+        catch (const std::logic_error& e) {
+            assert(std::string(e.what()) == "Cart id or owner changed in update");
+            threw = true;
+        }
+        assert(threw);
+        assert((taken->getItems() == std::map<std::string, int>{ { "apple", 2 } }));
+        assert(store.read(id, [&id](const ShoppingCart& cart) {
+            assert(cart.getCartUuid() == id);
+            assert(cart.getId() == L"ABC12345DE-A");
+            assert(cart.itemCount() == 0);
+        }));
+        assert(store.cartsOf(L"ABC12345DE-A") == std::vector<CartUuid>({ id }));
+        assert(store.cartsHolding(apple).empty());
+        assert(store.update(id, [](ShoppingCart& cart) { cart.addItem("banana", 1); }));
+        assert(store.erase(id));
+    }
+}
+
+#ifdef __linux__
+static void TEST_CartServer() {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    CartServer server("cart_server_test.sock", 2);
+    CartClient client("cart_server_test.sock");
+    using CartProtocol::Op;
+    using CartProtocol::Status;
+
+    // Responses come back in any order, so they are kept by tag.
+    std::map<uint32_t, std::pair<uint8_t, std::string>> responses;
+    auto exchange = [&](const std::string& frames, size_t count) {
+        responses.clear();
+        client.send(frames);
+        for (size_t i = 0; i < count; ++i) {
+            CartProtocol::Frame response = client.receive();
+            responses[response.tag] = { response.code, std::string(response.body) };
+        }
+    };
+
+    std::string frames;
+    for (uint32_t tag = 0; tag < 8; ++tag) {
+        CartProtocol::appendCreate(frames, tag, L"ABC12345DE-A");
+    }
+    CartProtocol::appendCreate(frames, 8, L"ABC1234XDE-A");
+    exchange(frames, 9);
+    assert((responses[8].first == (uint8_t)CartProtocol::statusOf(CartError::InvalidOwnerId)));
+    std::vector<CartUuid> carts;
+    for (uint32_t tag = 0; tag < 8; ++tag) {
+        assert((responses[tag].first == (uint8_t)Status::Ok));
+        carts.push_back(CartProtocol::Reader(responses[tag].second).cart());
+    }
+
+    // One pipelined write with requests for carts on both threads.
+    frames.clear();
+    const CartOp ops[] = { { CartOp::Kind::Add, "banana", 4 }, { CartOp::Kind::Update, "apple", 3 } };
+    const CartOp failing[] = { { CartOp::Kind::Add, "orange", 1 }, { CartOp::Kind::Remove, "grapes" } };
+    for (uint32_t i = 0; i < 8; ++i) {
+        CartProtocol::appendItem(frames, 100 + i, Op::Add, carts[i], "apple", 2);
+        CartProtocol::appendBatch(frames, 200 + i, carts[i], ops);
+        CartProtocol::appendCartOp(frames, 300 + i, Op::Total, carts[i]);
+    }
+    CartProtocol::appendBatch(frames, 400, carts[0], failing);
+    CartProtocol::appendItem(frames, 401, Op::Add, carts[1], "durian", 1);
+    CartProtocol::appendCartOp(frames, 402, Op::Items, carts[2]);
+    CartProtocol::appendCartOp(frames, 403, Op::Drop, carts[3]);
+    CartProtocol::appendCartOp(frames, 404, Op::Total, carts[3]);
+    CartProtocol::appendCartOp(frames, 405, Op::Total, CartUuid{});
+    size_t start = CartProtocol::beginFrame(frames, 406, (uint8_t)Op::Add);
+    CartProtocol::putCart(frames, carts[4]);
+    CartProtocol::endFrame(frames, start);
+    CartProtocol::endFrame(frames, CartProtocol::beginFrame(frames, 407, 99));
+    exchange(frames, 32);
+    for (uint32_t i = 0; i < 8; ++i) {
+        assert((responses[100 + i].first == (uint8_t)Status::Ok));
+        assert((responses[200 + i].first == (uint8_t)Status::Ok));
+        CartProtocol::Reader total(responses[300 + i].second);
+        assert((responses[300 + i].first == (uint8_t)Status::Ok));
+        assert(total.i64() == 250);
+        assert(total.done());
+    }
+    assert((responses[400].first == (uint8_t)CartProtocol::statusOf(CartError::RemovedItemNotInCart)));
+    assert((responses[401].first == (uint8_t)CartProtocol::statusOf(CartError::UnknownItem)));
+    CartProtocol::Reader lines(responses[402].second);
+    assert(lines.u32() == 2);
+    std::map<std::string, int> items;
+    for (int i = 0; i < 2; ++i) {
+        std::string name(lines.string());
+        items[name] = lines.i32();
+    }
+    assert(lines.done());
+    assert((items == std::map<std::string, int>{ { "apple", 3 }, { "banana", 4 } }));
+    assert((responses[403].first == (uint8_t)Status::Ok));
+    assert((responses[404].first == (uint8_t)Status::UnknownCart));
+    assert((responses[405].first == (uint8_t)Status::UnknownCart));
+    assert((responses[406].first == (uint8_t)Status::Malformed));
+    assert((responses[407].first == (uint8_t)Status::UnknownOp));
+    assert(server.cartCount() == 7);
+}
+
+static void TEST_CartServerBackpressure() {
+    // Long item names make each Items response about 2 KB, against 25 bytes for the request.
+    std::vector<std::pair<std::string, double>> entries;
+    for (char c = 'a'; c < 'k'; ++c) {
+        entries.push_back({ std::string(200, c), 1.0 });
+    }
+    Catalog::publish(CatalogIndex(entries));
+    const std::string path = "cart_server_backpressure.sock";
+    CartServer server(path, 1);
+    CartClient client(path);
+    using CartProtocol::Op;
+    using CartProtocol::Status;
+    std::string frames;
+    CartProtocol::appendCreate(frames, 0, L"ABC12345DE-A");
+    client.send(frames);
+    CartUuid cart = CartProtocol::Reader(client.receive().body).cart();
+    frames.clear();
+    for (const auto& entry : entries) {
+        CartProtocol::appendItem(frames, 1, Op::Add, cart, entry.first, 1);
+    }
+    client.send(frames);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        assert(client.receive().code == (uint8_t)Status::Ok);
+    }
+
+    // Another connection sends 2 MB of requests, which would make 160 MB of responses, and
+    // reads none of them.
+    const uint32_t requests = 80000;
+    frames.clear();
+    for (uint32_t tag = 0; tag < requests; ++tag) {
+        CartProtocol::appendCartOp(frames, tag, Op::Items, cart);
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.data(), path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    assert(fd >= 0);
+    assert(connect(fd, (const sockaddr*)&address, sizeof(address)) == 0);
+    size_t sent = 0;
+    for (int idle = 0; sent < frames.size() && idle < 50;) {
+        ssize_t written = ::send(fd, frames.data() + sent, frames.size() - sent, MSG_NOSIGNAL);
+        if (written > 0) {
+            sent += (size_t)written;
+            idle = 0;
+        }
+        else {
+            assert(errno == EAGAIN);
+            ++idle;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    // The server stopped reading once a megabyte of responses was waiting.
+    assert(sent < frames.size() / 2);
+
+    // Other connections are still served meanwhile.
+    std::string total;
+    CartProtocol::appendCartOp(total, 2, Op::Total, cart);
+    client.send(total);
+    CartProtocol::Frame answer = client.receive();
+    assert(answer.code == (uint8_t)Status::Ok);
+    assert(CartProtocol::Reader(answer.body).i64() == 1000);
+
+    // Once the client reads, the rest of its requests are taken and every one is answered.
+    std::string rest = frames.substr(sent);
+    fcntl(fd, F_SETFL, 0);
+    std::thread writer([fd, &rest]() {
+        for (size_t done = 0; done < rest.size();) {
+            ssize_t written = ::send(fd, rest.data() + done, rest.size() - done, MSG_NOSIGNAL);
+            if (written <= 0) {
+                return;
+            }
+            done += (size_t)written;
+        }
+    });
+    std::string received;
+    size_t start = 0;
+    uint32_t answered = 0;
+    char chunk[64 * 1024];
+    while (answered < requests) {
+        ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+        assert(got > 0);
+        received.append(chunk, (size_t)got);
+        CartProtocol::Frame response;
+        while (size_t size = CartProtocol::parseFrame(std::string_view(received).substr(start), response)) {
+            assert(response.tag == answered);
+            assert(response.code == (uint8_t)Status::Ok);
+            ++answered;
+            start += size;
+        }
+        received.erase(0, start);
+        start = 0;
+    }
+    writer.join();
+    ::close(fd);
+}
+#endif
+
 int main(int argc, char** argv) {
     TEST_CopyConstructor();
-	TEST_MoveConstructor();
-	TEST_CopyAssignment();
-	TEST_MoveAssignment();
-	TEST_NonEnglishID();
-	TEST_InvalidOwnerID();
-	TEST_LargeOwnerID();
-	TEST_CartIDIsUUID4();
-	TEST_AddItem();
-	TEST_AddExistingItem();
-	TEST_AddBadItem();
-	TEST_AddBadQuantity();
-	TEST_UpdateItem();
-	TEST_UpdateMissingItem();
-	TEST_UpdateBadQuantity();
-	TEST_RemoveItem();
-	TEST_RemoveMissingItem();
-	TEST_RemoveItemMissingFromList();
-	TEST_TotalCost();
-	TEST_TotalCostWithManyItems();
-	TEST_TotalCostAfterUpdate();
-	TEST_TotalCostAfterRemoval();
+    TEST_MoveConstructor();
+    TEST_CopyAssignment();
+    TEST_MoveAssignment();
+    TEST_NonEnglishID();
+    TEST_InvalidOwnerID();
+    TEST_LargeOwnerID();
+    TEST_CartIDIsUUID4();
+    TEST_AddItem();
+    TEST_AddExistingItem();
+    TEST_AddBadItem();
+    TEST_AddBadQuantity();
+    TEST_UpdateItem();
+    TEST_UpdateMissingItem();
+    TEST_UpdateBadQuantity();
+    TEST_RemoveItem();
+    TEST_RemoveMissingItem();
+    TEST_RemoveItemMissingFromList();
+    TEST_TotalCost();
+    TEST_TotalCostWithManyItems();
+    TEST_TotalCostAfterUpdate();
+    TEST_TotalCostAfterRemoval();
+    TEST_CatalogLookup();
+    TEST_CatalogReload();
+    TEST_CatalogBinaryFormat();
+    TEST_TotalIsExact();
+    TEST_ApplyBatch();
+    TEST_ApplyBatchIsAllOrNothing();
+    TEST_ForEachItem();
+    TEST_LargeCart();
+    TEST_ItemRegistry();
+    TEST_ItemDroppedFromCatalog();
+    TEST_CartIDFormat();
+    TEST_CartIDsAreUnique();
+    TEST_OwnerIDMatchesRegex();
+    TEST_CartsFreedOnAnotherThread();
+    TEST_CartStore();
+    TEST_CartStoreConcurrentUpdates();
+    TEST_SnapshotRoundTrip();
+    TEST_SnapshotUnfinishedSave();
+    TEST_WalReplay();
+    TEST_WalRecovery();
+    TEST_WalCheckpointCrash();
+    TEST_CopiesAreIndependent();
+    TEST_BulkPricing();
+    TEST_CartStoreReprice();
+    TEST_LatencyHistogram();
+    TEST_CartMetrics();
+    TEST_TryApi();
+    TEST_CartEvents();
+    TEST_CartEventsInsideStore();
+    TEST_Promotions();
+    TEST_PromotionsShareNoUnits();
+    TEST_MergeFrom();
+    TEST_ConstTotalsAcrossThreads();
+    TEST_CartStoreOwnerIndex();
+    TEST_CartStoreMovedOut();
+#ifdef __linux__
+    TEST_CartServer();
+    TEST_CartServerBackpressure();
+#endif
 
     std::cout << "All tests passed!" << std::endl;
 }
\ No newline at end of file
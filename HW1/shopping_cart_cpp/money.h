@@ -0,0 +1,28 @@
+#pragma once
+#include <compare>
+#include <cstdint>
+#include <string>
+
+// An exact amount of money, kept as a whole number of cents so sums never drift.
+class Money {
+public:
+	constexpr Money() : cents(0) {}
+	constexpr explicit Money(int64_t cents) : cents(cents) {}
+
+	constexpr int64_t getCents() const { return cents; }
+	double toDouble() const { return cents / 100.0; }
+	std::string toString() const {
+		uint64_t magnitude = cents < 0 ? 0 - (uint64_t)cents : (uint64_t)cents;
+		std::string fraction = std::to_string(magnitude % 100);
+		return (cents < 0 ? "-" : "") + std::to_string(magnitude / 100) + "." + (fraction.size() < 2 ? "0" : "") + fraction;
+	}
+
+	constexpr Money operator+(Money other) const { return Money(cents + other.cents); }
+	constexpr Money operator-(Money other) const { return Money(cents - other.cents); }
+	constexpr Money operator*(int64_t factor) const { return Money(cents * factor); }
+	constexpr Money& operator+=(Money other) { cents += other.cents; return *this; }
+	constexpr Money& operator-=(Money other) { cents -= other.cents; return *this; }
+	constexpr auto operator<=>(const Money&) const = default;
+private:
+	int64_t cents;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include "cart_result.h"
+#include <string>
+#include <string_view>
+
+namespace OwnerIDFormat {
+	constexpr size_t LENGTH = 12;
+
+	// Letters are A-Z in either case, or any character from U+0080 to U+FFFF.
+	constexpr bool isLetter(wchar_t c) {
+		return (c >= L'A' && c <= L'Z') || (c >= L'a' && c <= L'z') || ((unsigned long)c >= 0x80 && (unsigned long)c <= 0xFFFF);
+	}
+	constexpr bool isDigit(wchar_t c) {
+		return c >= L'0' && c <= L'9';
+	}
+
+	// Must be 3 letters, 5 numbers, 2 letters, a dash, and an A or a Q (either case).
+	// One pass over the characters; accepts exactly what the case-insensitive pattern
+	// ^[A-Z\u0080-\uFFFF]{3}[0-9]{5}[A-Z\u0080-\uFFFF]{2}-[AQ]$ accepts.
+	constexpr bool isValid(std::wstring_view id) {
+		if (id.size() != LENGTH) {
+			return false;
+		}
+		for (size_t i = 0; i < 3; ++i) {
+			if (!isLetter(id[i])) {
+				return false;
+			}
+		}
+		for (size_t i = 3; i < 8; ++i) {
+			if (!isDigit(id[i])) {
+				return false;
+			}
+		}
+		wchar_t kind = id[11];
+		return isLetter(id[8]) && isLetter(id[9]) && id[10] == L'-'
+			&& (kind == L'A' || kind == L'a' || kind == L'Q' || kind == L'q');
+	}
+}
+
+// Kept inline as a fixed array of characters, so an owner id never allocates.
+class OwnerID {
+public:
+	OwnerID() : id{}, length(0) {}
+	OwnerID(std::wstring_view id) {
+		CartError error = check(id);
+		if (error != CartError::None) {
+			throwCartError(error);
+		}
+		id.copy(this->id, id.size());
+		length = (unsigned char)id.size();
+	}
+	static CartResult<OwnerID> tryMake(std::wstring_view id) {
+		CartError error = check(id);
+		if (error != CartError::None) {
+			return error;
+		}
+		OwnerID owner;
+		id.copy(owner.id, id.size());
+		owner.length = (unsigned char)id.size();
+		return owner;
+	}
+	static CartError check(std::wstring_view id) {
+		if (id.size() > OwnerIDFormat::LENGTH) {
+			return CartError::OwnerIdTooLong;
+		}
+		return OwnerIDFormat::isValid(id) ? CartError::None : CartError::InvalidOwnerId;
+	}
+	std::wstring get() const { return std::wstring(view()); };
+	std::wstring_view view() const { return std::wstring_view(id, length); }
+	bool operator==(const OwnerID& other) const { return view() == other.view(); }
+private:
+	wchar_t id[OwnerIDFormat::LENGTH];
+	unsigned char length;
+};
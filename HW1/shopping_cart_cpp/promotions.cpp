@@ -0,0 +1,201 @@
+#include "promotions.h"
+#include "cart.h"
+#include "catalog.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+namespace {
+	// How many of one bundle's items one evaluation has found in the cart.
+	struct BundleProgress {
+		uint64_t pass;
+		uint32_t seen;
+	};
+
+	// A cart line with promotions on its item, and how many of its units no bundle has taken.
+	struct RuledLine {
+		ItemId item;
+		int32_t units;
+		int64_t price_cents;
+	};
+
+	// Where an item's line is in the current evaluation's ruled lines.
+	struct LineSlot {
+		uint64_t pass;
+		uint32_t line;
+	};
+
+	// Per-thread scratch space, reused by every evaluation on the thread. Entries from earlier
+	// passes are recognised by their pass number, so nothing is cleared between evaluations.
+	struct Scratch {
+		uint64_t pass = 0;
+		std::vector<BundleProgress> bundles;
+		// Bundles this evaluation found every item of, with what one set saves.
+		std::vector<std::pair<int64_t, uint32_t>> complete;
+		std::vector<uint32_t> touched;
+		std::vector<RuledLine> lines;
+		std::vector<LineSlot> line_of;
+	};
+
+	Scratch& scratch() {
+		thread_local Scratch instance;
+		return instance;
+	}
+}
+
+PromotionPlan::PromotionPlan(std::span<const Promotion> promotions) : promotions(promotions.size()) {
+	// Gather (item, action) pairs, then sort them by item into the flat table.
+	std::vector<std::pair<ItemId, Action>> pairs;
+	for (const Promotion& promotion : promotions) {
+		if (promotion.items.empty()) {
+			throw std::invalid_argument("Promotion has no items");
+		}
+		std::vector<ItemId> items;
+		for (const std::string& name : promotion.items) {
+			items.push_back(ItemRegistry::intern(name));
+		}
+		std::sort(items.begin(), items.end());
+		items.erase(std::unique(items.begin(), items.end()), items.end());
+
+		Action action{ promotion.kind, 0, 0 };
+		switch (promotion.kind) {
+		case Promotion::Kind::BuyGetFree:
+			if (promotion.buy < 1 || promotion.free < 1) {
+				throw std::invalid_argument("Buy and free quantities must be at least 1");
+			}
+			action.first = (uint32_t)(promotion.buy + promotion.free);
+			action.second = (uint32_t)promotion.free;
+			break;
+		case Promotion::Kind::PercentOff:
+			if (promotion.percent < 1 || promotion.percent > 100) {
+				throw std::invalid_argument("Percent must be between 1 and 100");
+			}
+			action.first = (uint32_t)promotion.percent;
+			break;
+		case Promotion::Kind::Bundle:
+			if (items.size() < 2) {
+				throw std::invalid_argument("Bundle needs at least two distinct items");
+			}
+			if (promotion.bundle_price < Money()) {
+				throw std::invalid_argument("Bundle price cannot be negative");
+			}
+			action.first = (uint32_t)bundles.size();
+			bundles.push_back({ (uint32_t)bundle_items.size(), (uint32_t)items.size(), promotion.bundle_price.getCents() });
+			bundle_items.insert(bundle_items.end(), items.begin(), items.end());
+			break;
+		}
+		for (ItemId item : items) {
+			pairs.push_back({ item, action });
+		}
+	}
+	std::stable_sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+	ItemId items = pairs.empty() ? 0 : pairs.back().first + 1;
+	first_action.assign(items + 1, 0);
+	actions.reserve(pairs.size());
+	for (const auto& pair : pairs) {
+		++first_action[pair.first + 1];
+		actions.push_back(pair.second);
+	}
+	for (ItemId item = 0; item < items; ++item) {
+		first_action[item + 1] += first_action[item];
+	}
+}
+
+Money PromotionPlan::discount(const ShoppingCart& cart) const {
+	Catalog::Reader catalog;
+	return discount(cart, catalog.snapshot());
+}
+
+Money PromotionPlan::discount(const ShoppingCart& cart, const CatalogSnapshot& catalog) const {
+	if (actions.empty()) {
+		return Money();
+	}
+	Scratch& state = scratch();
+	uint32_t rule_items = (uint32_t)first_action.size() - 1;
+	if (state.bundles.size() < bundles.size()) {
+		state.bundles.resize(bundles.size(), BundleProgress{ 0, 0 });
+	}
+	if (state.line_of.size() < rule_items) {
+		state.line_of.resize(rule_items, LineSlot{ 0, 0 });
+	}
+	uint64_t pass = ++state.pass;
+	state.touched.clear();
+	state.lines.clear();
+
+	// Price every line, and note the ones with promotions and the bundles they belong to.
+	int64_t gross = 0;
+	cart.forEachLine([&](ItemId item, int quantity) {
+		auto price = catalog.priceOf(item);
+		if (!price) {
+			return;
+		}
+		gross += *price * quantity;
+		if (item >= rule_items || first_action[item] == first_action[item + 1]) {
+			return;
+		}
+		state.line_of[item] = { pass, (uint32_t)state.lines.size() };
+		state.lines.push_back({ item, quantity, *price });
+		for (uint32_t i = first_action[item]; i < first_action[item + 1]; ++i) {
+			if (actions[i].kind != Promotion::Kind::Bundle) {
+				continue;
+			}
+			BundleProgress& progress = state.bundles[actions[i].first];
+			if (progress.pass != pass) {
+				progress = { pass, 0 };
+				state.touched.push_back(actions[i].first);
+			}
+			++progress.seen;
+		}
+	});
+
+	// Bundles the cart holds every item of take their units, the best saving per set first.
+	int64_t off = 0;
+	state.complete.clear();
+	for (uint32_t bundle : state.touched) {
+		const Bundle& rule = bundles[bundle];
+		if (state.bundles[bundle].seen != rule.components) {
+			continue;
+		}
+		int64_t list_cents = 0;
+		for (uint32_t i = rule.first_item; i < rule.first_item + rule.components; ++i) {
+			list_cents += state.lines[state.line_of[bundle_items[i]].line].price_cents;
+		}
+		if (list_cents > rule.price_cents) {
+			state.complete.push_back({ list_cents - rule.price_cents, bundle });
+		}
+	}
+	std::sort(state.complete.begin(), state.complete.end(), [](const auto& a, const auto& b) {
+		return a.first != b.first ? a.first > b.first : a.second < b.second;
+	});
+	for (const auto& [saving, bundle] : state.complete) {
+		const Bundle& rule = bundles[bundle];
+		int32_t sets = std::numeric_limits<int32_t>::max();
+		for (uint32_t i = rule.first_item; i < rule.first_item + rule.components; ++i) {
+			sets = std::min(sets, state.lines[state.line_of[bundle_items[i]].line].units);
+		}
+		if (sets == 0) {
+			continue;
+		}
+		for (uint32_t i = rule.first_item; i < rule.first_item + rule.components; ++i) {
+			state.lines[state.line_of[bundle_items[i]].line].units -= sets;
+		}
+		off += sets * saving;
+	}
+
+	// Units left over get the best per-line promotion for their item.
+	for (const RuledLine& line : state.lines) {
+		int64_t best = 0;
+		for (uint32_t i = first_action[line.item]; i < first_action[line.item + 1]; ++i) {
+			const Action& action = actions[i];
+			if (action.kind == Promotion::Kind::BuyGetFree) {
+				best = std::max(best, (int64_t)(line.units / action.first * action.second) * line.price_cents);
+			}
+			else if (action.kind == Promotion::Kind::PercentOff) {
+				best = std::max(best, line.units * line.price_cents * action.first / 100);
+			}
+		}
+		off += best;
+	}
+	return Money(std::min(off, gross));
+}
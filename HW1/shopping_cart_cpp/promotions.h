@@ -0,0 +1,75 @@
+#pragma once
+#include "item_registry.h"
+#include "money.h"
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+class ShoppingCart;
+struct CatalogSnapshot;
+
+// One promotion as it is authored. The catalog has no categories, so a category is given as
+// the list of the items in it.
+struct Promotion {
+	enum class Kind { BuyGetFree, PercentOff, Bundle };
+	Kind kind;
+	std::vector<std::string> items;
+	// BuyGetFree: of every buy + free units of one of the items, free units cost nothing.
+	int buy = 0;
+	int free = 0;
+	// PercentOff: 1 to 100, off every unit of the items.
+	int percent = 0;
+	// Bundle: one unit of each of the items costs this much together, as many times as the
+	// cart holds a full set.
+	Money bundle_price = Money();
+};
+
+// A set of promotions compiled for evaluation against carts.
+//
+// Compiling resolves every item to its registry id once and lays the rules out as a flat
+// table indexed by item id, so evaluating a cart is a pass over its lines, each of which reads
+// only the rules for its own item, then a pass over the bundles the cart completes and the
+// lines that have rules. Nothing is allocated once a thread has evaluated as large a plan and
+// cart before.
+//
+// Promotions combine as follows. Each unit in the cart counts toward at most one promotion.
+// Bundles take their units first, the bundle that saves the most per set first, at list prices.
+// Each unit no bundle took then gets the largest of the BuyGetFree and PercentOff discounts for
+// its item; they do not stack. The discount never exceeds the cart's total.
+class PromotionPlan {
+public:
+	PromotionPlan() = default;
+	// Throws std::invalid_argument if a promotion has no items, a BuyGetFree has buy or free
+	// below 1, a percent is outside 1 to 100, or a bundle has fewer than two distinct items or
+	// a negative price.
+	explicit PromotionPlan(std::span<const Promotion> promotions);
+
+	size_t size() const { return promotions; }
+	// What the promotions take off the cart's total, at the prices of the current catalog.
+	// Lines whose item is not in the catalog get no discount.
+	Money discount(const ShoppingCart& cart) const;
+	Money discount(const ShoppingCart& cart, const CatalogSnapshot& catalog) const;
+private:
+	// What one promotion does for one item.
+	struct Action {
+		Promotion::Kind kind;
+		// BuyGetFree: units in a group, and free units per group. PercentOff: the percent.
+		// Bundle: the bundle's index.
+		uint32_t first;
+		uint32_t second;
+	};
+	// The bundle's items are bundle_items[first_item] up to bundle_items[first_item + components].
+	struct Bundle {
+		uint32_t first_item;
+		uint32_t components;
+		int64_t price_cents;
+	};
+
+	size_t promotions = 0;
+	// The actions for item id i are actions[first_action[i]] up to actions[first_action[i + 1]].
+	std::vector<uint32_t> first_action;
+	std::vector<Action> actions;
+	std::vector<Bundle> bundles;
+	std::vector<ItemId> bundle_items;
+};
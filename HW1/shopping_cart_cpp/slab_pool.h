@@ -0,0 +1,129 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Fixed-size blocks for objects of type T, carved out of large slabs and recycled instead of
+// being returned to the heap. Each thread allocates from and frees to its own free list
+// without locking; the lists only meet in a shared pool, under a mutex, when a thread runs dry,
+// holds too many free blocks, or exits.
+//
+// Slabs are never released, so the memory a process holds is its peak number of live
+// objects, and freed objects are reused by the next allocation on any thread.
+template <typename T>
+class SlabPool {
+public:
+	static void* allocate() {
+		Cache& cache = local();
+		if (cache.free == nullptr) {
+			refill(cache);
+		}
+		Block* block = cache.free;
+		cache.free = block->next;
+		--cache.count;
+		return block;
+	}
+
+	static void deallocate(void* pointer) noexcept {
+		Block* block = static_cast<Block*>(pointer);
+		Cache& cache = local();
+		if (!cache.active) {
+			// The thread is exiting and has already handed its blocks back.
+			std::lock_guard lock(shared().mutex);
+			block->next = nullptr;
+			shared().batches.push_back({ block, 1 });
+			return;
+		}
+		block->next = cache.free;
+		cache.free = block;
+		if (++cache.count >= 2 * SLAB_BLOCKS) {
+			release(cache, SLAB_BLOCKS);
+		}
+	}
+
+private:
+	static constexpr size_t BLOCK_SIZE = (sizeof(T) + alignof(T) - 1) / alignof(T) * alignof(T);
+	static constexpr size_t SLAB_BYTES = 64 * 1024;
+	static constexpr size_t SLAB_BLOCKS = SLAB_BYTES / BLOCK_SIZE > 0 ? SLAB_BYTES / BLOCK_SIZE : 1;
+	static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "Slab blocks must not be over-aligned");
+
+	union Block {
+		Block* next;
+		alignas(T) unsigned char storage[BLOCK_SIZE];
+	};
+	struct Batch {
+		Block* first;
+		size_t count;
+	};
+	struct Shared {
+		std::mutex mutex;
+		std::vector<Batch> batches;
+	};
+	// Trivially destructible, so it can still be read after the thread's Guard has run.
+	struct Cache {
+		Block* free;
+		size_t count;
+		bool active;
+	};
+	// Hands the thread's free blocks to the shared pool when the thread exits.
+	struct Guard {
+		~Guard() {
+			Cache& cache = local();
+			release(cache, cache.count);
+			cache.active = false;
+		}
+	};
+
+	static Shared& shared() {
+		// Never destroyed, so threads that exit during shutdown can still hand blocks back.
+		static Shared* pool = new Shared();
+		return *pool;
+	}
+
+	static Cache& local() {
+		static thread_local Cache cache = { nullptr, 0, true };
+		static thread_local Guard guard;
+		(void)guard;
+		return cache;
+	}
+
+	// Takes a batch of free blocks from the shared pool, or carves a new slab.
+	static void refill(Cache& cache) {
+		{
+			std::lock_guard lock(shared().mutex);
+			if (!shared().batches.empty()) {
+				Batch batch = shared().batches.back();
+				shared().batches.pop_back();
+				cache.free = batch.first;
+				cache.count = batch.count;
+				return;
+			}
+		}
+		Block* slab = static_cast<Block*>(::operator new(SLAB_BLOCKS * sizeof(Block)));
+		for (size_t i = 0; i + 1 < SLAB_BLOCKS; ++i) {
+			slab[i].next = &slab[i + 1];
+		}
+		slab[SLAB_BLOCKS - 1].next = nullptr;
+		cache.free = slab;
+		cache.count = SLAB_BLOCKS;
+	}
+
+	// Moves up to count blocks from the front of the thread's free list to the shared pool.
+	static void release(Cache& cache, size_t count) {
+		if (count == 0 || cache.free == nullptr) {
+			return;
+		}
+		Block* first = cache.free;
+		Block* last = first;
+		size_t moved = 1;
+		for (; moved < count && last->next != nullptr; ++moved) {
+			last = last->next;
+		}
+		cache.free = last->next;
+		cache.count -= moved;
+		last->next = nullptr;
+		std::lock_guard lock(shared().mutex);
+		shared().batches.push_back({ first, moved });
+	}
+};
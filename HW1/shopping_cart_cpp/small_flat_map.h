@@ -0,0 +1,156 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <utility>
+
+// A map kept as a sorted array of key/value pairs. Up to InlineCapacity entries are stored
+// inside the object itself, so small maps never touch the heap; larger maps move their
+// entries to a heap array that grows by doubling.
+//
+// Lookups are binary searches over contiguous entries. Inserting or erasing shifts the entries
+// after the position, and invalidates iterators at or after it (all of them if the map grows).
+template <typename Key, typename Value, size_t InlineCapacity, typename Compare = std::less<>>
+class SmallFlatMap {
+	static_assert(alignof(std::pair<Key, Value>) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "Entries must not be over-aligned");
+public:
+	using value_type = std::pair<Key, Value>;
+	using iterator = value_type*;
+	using const_iterator = const value_type*;
+
+	SmallFlatMap() : elements(inlineElements()), _size(0), _capacity(InlineCapacity) {}
+	~SmallFlatMap() {
+		clear();
+		release();
+	}
+	SmallFlatMap(const SmallFlatMap& other) : SmallFlatMap() {
+		reserve(other._size);
+		std::uninitialized_copy(other.begin(), other.end(), elements);
+		_size = other._size;
+	}
+	SmallFlatMap(SmallFlatMap&& other) noexcept : SmallFlatMap() {
+		moveFrom(other);
+	}
+	SmallFlatMap& operator=(const SmallFlatMap& other) {
+		if (this != &other) {
+			SmallFlatMap copy(other);
+			clear();
+			moveFrom(copy);
+		}
+		return *this;
+	}
+	SmallFlatMap& operator=(SmallFlatMap&& other) noexcept {
+		if (this != &other) {
+			clear();
+			moveFrom(other);
+		}
+		return *this;
+	}
+
+	iterator begin() { return elements; }
+	iterator end() { return elements + _size; }
+	const_iterator begin() const { return elements; }
+	const_iterator end() const { return elements + _size; }
+	size_t size() const { return _size; }
+	bool empty() const { return _size == 0; }
+	bool isInline() const { return elements == inlineElements(); }
+
+	template <typename K>
+	iterator lower_bound(const K& key) {
+		return std::lower_bound(begin(), end(), key, [](const value_type& entry, const K& key) { return Compare()(entry.first, key); });
+	}
+	template <typename K>
+	const_iterator lower_bound(const K& key) const {
+		return const_cast<SmallFlatMap*>(this)->lower_bound(key);
+	}
+	template <typename K>
+	iterator find(const K& key) {
+		iterator position = lower_bound(key);
+		return position != end() && !Compare()(key, position->first) ? position : end();
+	}
+	template <typename K>
+	const_iterator find(const K& key) const {
+		return const_cast<SmallFlatMap*>(this)->find(key);
+	}
+
+	// Inserts before position, which must be where the key belongs in sorted order.
+	iterator insert(const_iterator position, Key key, Value value) {
+		size_t index = position - elements;
+		if (_size == _capacity) {
+			grow(_capacity * 2);
+		}
+		if (index == _size) {
+			new (elements + _size) value_type(std::move(key), std::move(value));
+		}
+		else {
+			new (elements + _size) value_type(std::move(elements[_size - 1]));
+			std::move_backward(elements + index, elements + _size - 1, elements + _size);
+			elements[index] = value_type(std::move(key), std::move(value));
+		}
+		++_size;
+		return elements + index;
+	}
+	// Appends an entry whose key sorts after every key already in the map.
+	void push_back(Key key, Value value) {
+		insert(end(), std::move(key), std::move(value));
+	}
+	iterator erase(const_iterator position) {
+		size_t index = position - elements;
+		std::move(elements + index + 1, elements + _size, elements + index);
+		elements[--_size].~value_type();
+		return elements + index;
+	}
+	void reserve(size_t capacity) {
+		if (capacity > _capacity) {
+			grow(capacity);
+		}
+	}
+	void clear() {
+		std::destroy(begin(), end());
+		_size = 0;
+	}
+private:
+	value_type* inlineElements() { return reinterpret_cast<value_type*>(inline_storage); }
+	const value_type* inlineElements() const { return reinterpret_cast<const value_type*>(inline_storage); }
+
+	void grow(size_t capacity) {
+		value_type* grown = static_cast<value_type*>(::operator new(capacity * sizeof(value_type)));
+		std::uninitialized_move(begin(), end(), grown);
+		std::destroy(begin(), end());
+		release();
+		elements = grown;
+		_capacity = capacity;
+	}
+	void release() {
+		if (!isInline()) {
+			::operator delete(elements);
+			elements = inlineElements();
+			_capacity = InlineCapacity;
+		}
+	}
+	// Takes other's entries, leaving it empty. Expects this map to be empty.
+	void moveFrom(SmallFlatMap& other) {
+		if (other.isInline()) {
+			release();
+			std::uninitialized_move(other.begin(), other.end(), elements);
+			_size = other._size;
+			other.clear();
+		}
+		else {
+			release();
+			elements = other.elements;
+			_size = other._size;
+			_capacity = other._capacity;
+			other.elements = other.inlineElements();
+			other._size = 0;
+			other._capacity = InlineCapacity;
+		}
+	}
+
+	value_type* elements;
+	size_t _size;
+	size_t _capacity;
+	alignas(value_type) unsigned char inline_storage[InlineCapacity * sizeof(value_type)];
+};
@@ -0,0 +1,126 @@
+#include "work_stealing_pool.h"
+#include <algorithm>
+#include <utility>
+
+WorkStealingPool::WorkStealingPool()
+	: WorkStealingPool(std::max(std::thread::hardware_concurrency(), 1u) - 1) {}
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+	// The caller's queue is the last one.
+	for (size_t i = 0; i <= threads; ++i) {
+		queues.push_back(std::make_unique<Queue>());
+	}
+	for (size_t i = 0; i < threads; ++i) {
+		workers.emplace_back([this, i]() { workerLoop(i); });
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		std::lock_guard lock(mutex);
+		stopping = true;
+	}
+	loop_started.notify_all();
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+uint64_t WorkStealingPool::steals() const {
+	return stolen.load(std::memory_order_relaxed);
+}
+
+void WorkStealingPool::run(size_t count, size_t grain, void (*loop_body)(void*, size_t, size_t), void* loop_context) {
+	std::lock_guard run_lock(run_mutex);
+	if (count == 0) {
+		return;
+	}
+	grain = std::max<size_t>(grain, 1);
+	// Each queue gets a contiguous run of chunks, so threads start on neighbouring data.
+	size_t chunks = (count + grain - 1) / grain;
+	for (size_t chunk = 0; chunk < chunks; ++chunk) {
+		Queue& queue = *queues[chunk * queues.size() / chunks];
+		std::lock_guard lock(queue.mutex);
+		queue.chunks.push_back({ chunk * grain, std::min(count, (chunk + 1) * grain) });
+	}
+	{
+		std::lock_guard lock(mutex);
+		body = loop_body;
+		context = loop_context;
+		failure = nullptr;
+		cancelled.store(false, std::memory_order_relaxed);
+		workers_busy = workers.size();
+		++generation;
+	}
+	loop_started.notify_all();
+	drain(queues.size() - 1);
+
+	std::unique_lock lock(mutex);
+	loop_finished.wait(lock, [this]() { return workers_busy == 0; });
+	if (failure) {
+		std::rethrow_exception(std::exchange(failure, nullptr));
+	}
+}
+
+void WorkStealingPool::workerLoop(size_t index) {
+	uint64_t seen = 0;
+	while (true) {
+		{
+			std::unique_lock lock(mutex);
+			loop_started.wait(lock, [&]() { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+		}
+		drain(index);
+		std::lock_guard lock(mutex);
+		if (--workers_busy == 0) {
+			loop_finished.notify_all();
+		}
+	}
+}
+
+void WorkStealingPool::drain(size_t index) {
+	Chunk chunk;
+	while (take(index, chunk)) {
+		if (cancelled.load(std::memory_order_relaxed)) {
+			continue;
+		}
+		try {
+			body(context, chunk.begin, chunk.end);
+		}
+		catch (...) {
+			std::lock_guard lock(mutex);
+			if (!failure) {
+				failure = std::current_exception();
+			}
+			cancelled.store(true, std::memory_order_relaxed);
+		}
+	}
+}
+
+bool WorkStealingPool::take(size_t index, Chunk& chunk) {
+	{
+		Queue& own = *queues[index];
+		std::lock_guard lock(own.mutex);
+		if (!own.chunks.empty()) {
+			chunk = own.chunks.back();
+			own.chunks.pop_back();
+			return true;
+		}
+	}
+	// Chunks are never added during a loop, so one pass finding every queue empty means the
+	// loop has no work left.
+	for (size_t offset = 1; offset < queues.size(); ++offset) {
+		Queue& victim = *queues[(index + offset) % queues.size()];
+		std::lock_guard lock(victim.mutex);
+		if (!victim.chunks.empty()) {
+			chunk = victim.chunks.front();
+			victim.chunks.pop_front();
+			stolen.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// A fixed set of worker threads that run one parallel loop at a time.
+//
+// The loop's range is cut into chunks and dealt out evenly to one queue per worker, plus one
+// for the calling thread, which works too. Each thread takes chunks from the back of its own
+// queue, and once that is empty steals from the front of the others, so threads that draw
+// cheap chunks end up helping with the expensive ones.
+class WorkStealingPool {
+public:
+	// One thread per core, counting the caller.
+	WorkStealingPool();
+	// threads is the number of workers besides the calling thread; 0 runs every loop inline.
+	explicit WorkStealingPool(size_t threads);
+	~WorkStealingPool();
+	WorkStealingPool(const WorkStealingPool&) = delete;
+	WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+	// Threads taking part in each loop, counting the caller.
+	size_t size() const { return queues.size(); }
+
+	// Calls fn(begin, end) over [0, count) in chunks of at most grain, and returns once every
+	// chunk has run. If a chunk throws, the remaining chunks are skipped and the first exception
+	// is rethrown here. Loops from several threads take turns.
+	template <typename Fn>
+	void parallelFor(size_t count, size_t grain, Fn&& fn) {
+		run(count, grain, [](void* context, size_t begin, size_t end) {
+			(*static_cast<std::remove_reference_t<Fn>*>(context))(begin, end);
+		}, const_cast<void*>(static_cast<const void*>(std::addressof(fn))));
+	}
+
+	// Chunks taken from another thread's queue since the pool started.
+	uint64_t steals() const;
+private:
+	struct Chunk {
+		size_t begin;
+		size_t end;
+	};
+	struct alignas(64) Queue {
+		std::mutex mutex;
+		std::deque<Chunk> chunks;
+	};
+
+	void run(size_t count, size_t grain, void (*body)(void*, size_t, size_t), void* context);
+	void workerLoop(size_t index);
+	// Runs chunks until every queue is empty, starting with the thread's own.
+	void drain(size_t index);
+	bool take(size_t index, Chunk& chunk);
+
+	std::vector<std::unique_ptr<Queue>> queues;
+	std::vector<std::thread> workers;
+	// Serializes loops started from different threads.
+	std::mutex run_mutex;
+
+	// The loop in progress, guarded by mutex. Workers wake when generation changes, and the
+	// caller waits for every one of them to finish with it, since context lives on its stack.
+	std::mutex mutex;
+	std::condition_variable loop_started;
+	std::condition_variable loop_finished;
+	uint64_t generation = 0;
+	void (*body)(void*, size_t, size_t) = nullptr;
+	void* context = nullptr;
+	size_t workers_busy = 0;
+	std::exception_ptr failure;
+	std::atomic<bool> cancelled = false;
+	std::atomic<uint64_t> stolen = 0;
+	bool stopping = false;
+};
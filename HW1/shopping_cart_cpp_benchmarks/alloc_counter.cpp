@@ -0,0 +1,51 @@
+#include "alloc_counter.h"
+#include <cstdlib>
+#include <new>
+
+// Every block carries its size in a header in front of it, so frees can be counted too.
+#define HEADER_SIZE 16
+
+static thread_local uint64_t allocations = 0;
+static thread_local int64_t live_bytes = 0;
+
+uint64_t allocationCount() {
+	return allocations;
+}
+
+int64_t liveBytes() {
+	return live_bytes;
+}
+
+void* operator new(std::size_t size) {
+	++allocations;
+	live_bytes += size;
+	if (char* block = static_cast<char*>(std::malloc(size + HEADER_SIZE))) {
+		*reinterpret_cast<std::size_t*>(block) = size;
+		return block + HEADER_SIZE;
+	}
+	throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+	return ::operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+	if (pointer != nullptr) {
+		char* block = static_cast<char*>(pointer) - HEADER_SIZE;
+		live_bytes -= *reinterpret_cast<std::size_t*>(block);
+		std::free(block);
+	}
+}
+
+void operator delete[](void* pointer) noexcept {
+	::operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::size_t) noexcept {
+	::operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t) noexcept {
+	::operator delete(pointer);
+}
@@ -0,0 +1,8 @@
+#pragma once
+#include <cstdint>
+
+// Number of calls to the global operator new made by the calling thread so far.
+// Every benchmark in this executable goes through the counting operator new in alloc_counter.cpp.
+uint64_t allocationCount();
+// Bytes allocated minus bytes freed through the global operator new by the calling thread.
+int64_t liveBytes();
@@ -0,0 +1,89 @@
+#include "../shopping_cart_cpp/bulk_pricing.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+// Revaluing 1M carts of 1 to 8 lines over a 10000-item catalog right after a reload, when every
+// cached total is stale: cart by cart with getTotal, against the bulk pricer.
+
+#define BULK_CARTS (1 << 20)
+#define BULK_ITEMS 10000
+
+static CatalogIndex bulkCatalog(int cents_offset) {
+	std::vector<std::pair<std::string, double>> entries;
+	for (int i = 0; i < BULK_ITEMS; ++i) {
+		entries.push_back({ "sku-" + std::to_string(i), 0.01 * ((i * 37 + cents_offset) % 5000 + 1) });
+	}
+	return CatalogIndex(entries);
+}
+
+static const std::vector<ShoppingCart>& bulkCarts() {
+	static std::vector<ShoppingCart> carts = []() {
+		Catalog::publish(bulkCatalog(0));
+		std::vector<ShoppingCart> made;
+		made.reserve(BULK_CARTS);
+		for (int i = 0; i < BULK_CARTS; ++i) {
+			ShoppingCart cart(L"ABC12345DE-A");
+			for (int line = 0; line < 1 + i % 8; ++line) {
+				cart.addItem("sku-" + std::to_string(((int64_t)i * 7919 + line * 104729) % BULK_ITEMS), 1 + line);
+			}
+			made.push_back(std::move(cart));
+		}
+		return made;
+	}();
+	return carts;
+}
+
+// Republishes the catalog outside the timed region, so every cached total is stale.
+static void reload(benchmark::State& state, int& round) {
+	state.PauseTiming();
+	Catalog::publish(bulkCatalog(++round));
+	state.ResumeTiming();
+}
+
+static void BM_Revalue_PerCart(benchmark::State& state) {
+	const std::vector<ShoppingCart>& carts = bulkCarts();
+	int round = 0;
+	for (auto _ : state) {
+		reload(state, round);
+		int64_t sum = 0;
+		for (const ShoppingCart& cart : carts) {
+			sum += cart.getTotal().getCents();
+		}
+		benchmark::DoNotOptimize(sum);
+	}
+	state.SetItemsProcessed(state.iterations() * carts.size());
+}
+BENCHMARK(BM_Revalue_PerCart)->Unit(benchmark::kMillisecond);
+
+// Gathering the columns and pricing them, with the kernel the build picks or the scalar one.
+static void BM_Revalue_Bulk(benchmark::State& state) {
+	const std::vector<ShoppingCart>& carts = bulkCarts();
+	PricingKernel kernel = state.range(0) ? PricingKernel::Auto : PricingKernel::Scalar;
+	int round = 0;
+	for (auto _ : state) {
+		reload(state, round);
+		benchmark::DoNotOptimize(priceCarts(carts, kernel));
+	}
+	state.SetItemsProcessed(state.iterations() * carts.size());
+}
+BENCHMARK(BM_Revalue_Bulk)->ArgName("simd")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+
+// Pricing columns that were gathered once, as a report repricing the same carts under
+// several catalogs would.
+static void BM_Revalue_BulkPriceOnly(benchmark::State& state) {
+	const std::vector<ShoppingCart>& carts = bulkCarts();
+	BulkPricer pricer;
+	for (const ShoppingCart& cart : carts) {
+		pricer.add(cart);
+	}
+	PricingKernel kernel = state.range(0) ? PricingKernel::Auto : PricingKernel::Scalar;
+	int round = 0;
+	for (auto _ : state) {
+		reload(state, round);
+		benchmark::DoNotOptimize(pricer.price(kernel));
+	}
+	state.SetItemsProcessed(state.iterations() * carts.size());
+}
+BENCHMARK(BM_Revalue_BulkPriceOnly)->ArgName("simd")->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
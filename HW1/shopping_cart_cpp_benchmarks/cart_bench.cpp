@@ -0,0 +1,172 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+static const char* const ITEMS[] = { "apple", "banana", "orange", "grapes", "pineapple" };
+
+// The UI polls the total after every mutation.
+static void BM_Cart_MutateThenTotal(benchmark::State& state) {
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (const char* item : ITEMS) {
+		cart.addItem(item, 1);
+	}
+	int amount = 1;
+	for (auto _ : state) {
+		cart.updateItem("orange", amount);
+		amount = amount % 99 + 1;
+		benchmark::DoNotOptimize(cart.getTotalCost());
+	}
+}
+BENCHMARK(BM_Cart_MutateThenTotal);
+
+static void BM_Cart_GetTotalCost(benchmark::State& state) {
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (const char* item : ITEMS) {
+		cart.addItem(item, 1);
+	}
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cart.getTotalCost());
+	}
+}
+BENCHMARK(BM_Cart_GetTotalCost);
+
+// The default catalog plus "item0".."itemN" so carts can hold more than five lines.
+static std::vector<std::string> publishBenchCatalog(int64_t items) {
+	std::vector<std::pair<std::string, double>> entries = { {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} };
+	std::vector<std::string> names;
+	for (int64_t i = 0; i < items; ++i) {
+		names.push_back("item" + std::to_string(i));
+		entries.push_back({ names.back(), 0.01 * (i % 500 + 1) });
+	}
+	Catalog::publish(CatalogIndex(entries));
+	return names;
+}
+
+// Importing a cart: N lines added, then removed again, one call at a time.
+static void BM_Cart_SingleCalls(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (auto _ : state) {
+		for (const std::string& name : names) {
+			cart.addItem(name, 2);
+		}
+		for (const std::string& name : names) {
+			cart.removeItem(name);
+		}
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+}
+BENCHMARK(BM_Cart_SingleCalls)->RangeMultiplier(4)->Range(4, 256);
+
+static void BM_Cart_ApplyBatch(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	std::vector<CartOp> adds;
+	std::vector<CartOp> removes;
+	for (const std::string& name : names) {
+		adds.push_back({ CartOp::Kind::Add, name, 2 });
+		removes.push_back({ CartOp::Kind::Remove, name });
+	}
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (auto _ : state) {
+		cart.applyBatch(adds);
+		cart.applyBatch(removes);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+}
+BENCHMARK(BM_Cart_ApplyBatch)->RangeMultiplier(4)->Range(4, 256);
+
+static void BM_Cart_GetItemsCopy(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (const std::string& name : names) {
+		cart.addItem(name, 1);
+	}
+	for (auto _ : state) {
+		int total = 0;
+		for (const auto& item : cart.getItems()) {
+			total += item.second;
+		}
+		benchmark::DoNotOptimize(total);
+	}
+}
+BENCHMARK(BM_Cart_GetItemsCopy)->RangeMultiplier(8)->Range(1, 1024);
+
+static void BM_Cart_ForEachItem(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (const std::string& name : names) {
+		cart.addItem(name, 1);
+	}
+	for (auto _ : state) {
+		int total = 0;
+		cart.forEachItem([&total](std::string_view, int quantity) { total += quantity; });
+		benchmark::DoNotOptimize(total);
+	}
+}
+BENCHMARK(BM_Cart_ForEachItem)->RangeMultiplier(8)->Range(1, 1024);
+
+// A cart holding "item0".."itemN-1", one of each.
+static ShoppingCart benchCart(const std::vector<std::string>& names) {
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (const std::string& name : names) {
+		cart.addItem(name, 1);
+	}
+	return cart;
+}
+
+// An empty cart: owner id check, a fresh cart id, and the cart's data block.
+static void BM_Cart_Construct(benchmark::State& state) {
+	for (auto _ : state) {
+		ShoppingCart cart(L"ABC12345DE-A");
+		benchmark::DoNotOptimize(cart);
+	}
+}
+BENCHMARK(BM_Cart_Construct);
+
+static void BM_Cart_UpdateItem(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	ShoppingCart cart = benchCart(names);
+	size_t next = 0;
+	int amount = 1;
+	for (auto _ : state) {
+		cart.updateItem(names[next], amount);
+		next = (next + 1) % names.size();
+		amount = amount % 99 + 1;
+	}
+}
+BENCHMARK(BM_Cart_UpdateItem)->RangeMultiplier(8)->Range(1, 1024);
+
+// The total with nothing changed since the last call, at every cart size.
+static void BM_Cart_GetTotalCostLines(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	ShoppingCart cart = benchCart(names);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cart.getTotalCost());
+	}
+}
+BENCHMARK(BM_Cart_GetTotalCostLines)->RangeMultiplier(8)->Range(1, 1024);
+
+static void BM_Cart_CopyAssign(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	ShoppingCart cart = benchCart(names);
+	ShoppingCart copy(L"XYZ98765AB-Q");
+	for (auto _ : state) {
+		copy = cart;
+		benchmark::DoNotOptimize(copy);
+	}
+}
+BENCHMARK(BM_Cart_CopyAssign)->RangeMultiplier(8)->Range(1, 1024);
+
+// Moving a cart out and back, as containers of carts do when they grow.
+static void BM_Cart_Move(benchmark::State& state) {
+	std::vector<std::string> names = publishBenchCatalog(state.range(0));
+	ShoppingCart cart = benchCart(names);
+	for (auto _ : state) {
+		ShoppingCart moved(std::move(cart));
+		cart = std::move(moved);
+		benchmark::DoNotOptimize(cart);
+	}
+}
+BENCHMARK(BM_Cart_Move)->RangeMultiplier(8)->Range(1, 1024);
@@ -0,0 +1,69 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include "alloc_counter.h"
+#include <benchmark/benchmark.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+// Churn in a long-running process: a large population of carts where old carts keep being
+// dropped and new ones created in their place. Reports heap allocations per cart created
+// and the resident set size once the churn is done.
+
+#define CHURN_ROUNDS 4
+
+static double residentMegabytes() {
+#ifdef __linux__
+	long pages = 0, resident = 0;
+	if (FILE* statm = std::fopen("/proc/self/statm", "r")) {
+		if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+			resident = 0;
+		}
+		std::fclose(statm);
+	}
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1 << 20);
+#else
+	return 0;
+#endif
+}
+
+static ShoppingCart churnCart(int64_t i) {
+	static const std::string items[] = { "apple", "banana", "orange", "grapes", "pineapple" };
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (int64_t line = 0; line < 1 + i % 3; ++line) {
+		cart.addItem(items[(i + line) % 5], 1);
+	}
+	return cart;
+}
+
+// Fills the population, then replaces every cart CHURN_ROUNDS times in a scattered order.
+static void BM_CartChurn(benchmark::State& state) {
+	Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+	const int64_t carts = state.range(0);
+	uint64_t allocations = 0;
+	double resident = 0;
+	for (auto _ : state) {
+		std::vector<ShoppingCart> population;
+		population.reserve(carts);
+		uint64_t before = allocationCount();
+		for (int64_t i = 0; i < carts; ++i) {
+			population.push_back(churnCart(i));
+		}
+		for (int64_t round = 1; round <= CHURN_ROUNDS; ++round) {
+			for (int64_t i = 0; i < carts; ++i) {
+				int64_t victim = (i * 7919 + round * 104729) % carts;
+				population[victim] = churnCart(i + round);
+			}
+		}
+		allocations += allocationCount() - before;
+		resident = residentMegabytes();
+		benchmark::DoNotOptimize(population.data());
+	}
+	state.counters["allocs_per_cart"] = (double)allocations / (state.iterations() * carts * (CHURN_ROUNDS + 1));
+	state.counters["rss_mb"] = resident;
+	state.SetItemsProcessed(state.iterations() * carts * (CHURN_ROUNDS + 1));
+}
+BENCHMARK(BM_CartChurn)->Arg(1 << 20)->Iterations(2)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,47 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include "alloc_counter.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+// Copying carts of 1 to 1024 lines for previews and audit snapshots that are rarely changed,
+// and the cost of the first change to such a copy.
+
+static ShoppingCart copyCart(int64_t lines) {
+	std::vector<std::pair<std::string, double>> entries = { {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} };
+	std::vector<std::string> names;
+	for (int64_t i = 0; i < lines; ++i) {
+		names.push_back("sku-" + std::to_string(100000 + i * 7));
+		entries.push_back({ names.back(), 0.01 * (i % 500 + 1) });
+	}
+	Catalog::publish(CatalogIndex(entries));
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (const std::string& name : names) {
+		cart.addItem(name, 1);
+	}
+	return cart;
+}
+
+// Copying a cart and reading its total, as a price preview does.
+static void BM_CartCopy_Preview(benchmark::State& state) {
+	ShoppingCart cart = copyCart(state.range(0));
+	uint64_t before = allocationCount();
+	for (auto _ : state) {
+		ShoppingCart preview(cart);
+		benchmark::DoNotOptimize(preview.getTotal());
+	}
+	state.counters["allocs_per_iter"] = (double)(allocationCount() - before) / state.iterations();
+}
+BENCHMARK(BM_CartCopy_Preview)->Arg(1)->Arg(16)->Arg(64)->Arg(1024);
+
+// Copying a cart and then changing the copy once, which is when the lines are cloned.
+static void BM_CartCopy_ThenMutate(benchmark::State& state) {
+	ShoppingCart cart = copyCart(state.range(0));
+	for (auto _ : state) {
+		ShoppingCart what_if(cart);
+		what_if.addItem("apple", 1);
+		benchmark::DoNotOptimize(what_if.getTotal());
+	}
+}
+BENCHMARK(BM_CartCopy_ThenMutate)->Arg(1)->Arg(16)->Arg(64)->Arg(1024);
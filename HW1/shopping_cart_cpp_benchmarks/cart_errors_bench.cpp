@@ -0,0 +1,73 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <benchmark/benchmark.h>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Updates where a share of the calls carry bad input, as client traffic does: half of the bad
+// ones name an item the cart does not hold, half a quantity of 0. The throwing API pays for
+// unwinding on every rejected call; the try* API returns the error.
+
+struct ErrorBenchOp {
+	std::string item;
+	int amount;
+};
+
+static std::vector<ErrorBenchOp> errorBenchOps(int64_t failure_percent) {
+	std::vector<ErrorBenchOp> ops;
+	for (int i = 0; i < 1000; ++i) {
+		bool bad = (i * 7919) % 100 < failure_percent;
+		if (!bad) {
+			ops.push_back({ "orange", i % 99 + 1 });
+		}
+		else {
+			ops.push_back(i % 2 ? ErrorBenchOp{ "kiwi", 1 } : ErrorBenchOp{ "orange", 0 });
+		}
+	}
+	return ops;
+}
+
+static ShoppingCart errorBenchCart() {
+	Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (const char* item : { "apple", "banana", "orange", "grapes", "pineapple" }) {
+		cart.addItem(item, 1);
+	}
+	return cart;
+}
+
+static void BM_CartErrors_Throwing(benchmark::State& state) {
+	std::vector<ErrorBenchOp> ops = errorBenchOps(state.range(0));
+	ShoppingCart cart = errorBenchCart();
+	size_t i = 0;
+	int64_t rejected = 0;
+	for (auto _ : state) {
+		const ErrorBenchOp& op = ops[i++ % ops.size()];
+		try {
+			cart.updateItem(op.item, op.amount);
+		}
+		catch (const std::invalid_argument&) {
+			++rejected;
+		}
+	}
+	benchmark::DoNotOptimize(rejected);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartErrors_Throwing)->ArgName("failure_pct")->Arg(0)->Arg(2)->Arg(10)->Arg(50);
+
+static void BM_CartErrors_Try(benchmark::State& state) {
+	std::vector<ErrorBenchOp> ops = errorBenchOps(state.range(0));
+	ShoppingCart cart = errorBenchCart();
+	size_t i = 0;
+	int64_t rejected = 0;
+	for (auto _ : state) {
+		const ErrorBenchOp& op = ops[i++ % ops.size()];
+		if (!cart.tryUpdateItem(op.item, op.amount)) {
+			++rejected;
+		}
+	}
+	benchmark::DoNotOptimize(rejected);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartErrors_Try)->ArgName("failure_pct")->Arg(0)->Arg(2)->Arg(10)->Arg(50);
@@ -0,0 +1,34 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/cart_events.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <benchmark/benchmark.h>
+#include <vector>
+
+// What the event feed adds to a mutation: off, and on with the same thread draining a batch of
+// events every 1024 mutations.
+static void BM_CartEvents_Update(benchmark::State& state) {
+	Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+	ShoppingCart cart(L"ABC12345DE-A");
+	cart.addItem("orange", 1);
+	bool enabled = state.range(0) != 0;
+	if (enabled) {
+		CartEvents::start();
+	}
+	std::vector<CartEvent> batch(1024);
+	int amount = 1;
+	size_t drained = 0;
+	size_t pending = 0;
+	for (auto _ : state) {
+		cart.updateItem("orange", amount);
+		amount = amount % 99 + 1;
+		if (enabled && ++pending == batch.size()) {
+			drained += CartEvents::drain(batch);
+			pending = 0;
+		}
+	}
+	CartEvents::stop();
+	drained += CartEvents::drain(batch);
+	benchmark::DoNotOptimize(drained);
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartEvents_Update)->ArgName("events")->Arg(0)->Arg(1);
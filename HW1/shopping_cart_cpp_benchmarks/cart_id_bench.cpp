@@ -0,0 +1,70 @@
+#include "../shopping_cart_cpp/cart_id.h"
+#include <benchmark/benchmark.h>
+#include <random>
+#include <sstream>
+
+// The id generator as it used to be: a fresh random_device and mt19937 per cart, and one
+// formatted write per hex digit.
+static std::string generateUuid4Stringstream() {
+	std::random_device rd;
+	std::mt19937 gen(rd());
+	std::uniform_int_distribution<uint32_t> dis(0, 15);
+	std::uniform_int_distribution<uint32_t> encoding_bits(8, 11);
+	std::stringstream ss;
+	int i;
+	ss << std::hex;
+	for (i = 0; i < 8; i++) {
+		ss << dis(gen);
+	}
+	ss << "-";
+	for (i = 0; i < 4; i++) {
+		ss << dis(gen);
+	}
+	ss << "-4";
+	for (i = 0; i < 3; i++) {
+		ss << dis(gen);
+	}
+	ss << "-" << encoding_bits(gen);
+	for (i = 0; i < 3; i++) {
+		ss << dis(gen);
+	}
+	ss << "-";
+	for (i = 0; i < 12; i++) {
+		ss << dis(gen);
+	}
+	return ss.str();
+}
+
+static void BM_CartID_Stringstream(benchmark::State& state) {
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(generateUuid4Stringstream());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartID_Stringstream)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_CartID_Generate(benchmark::State& state) {
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(CartID());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartID_Generate)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_CartID_GenerateAndFormat(benchmark::State& state) {
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(CartID().get());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartID_GenerateAndFormat)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_CartID_Format(benchmark::State& state) {
+	CartID id;
+	char out[36];
+	for (auto _ : state) {
+		id.format(out);
+		benchmark::DoNotOptimize(out);
+	}
+}
+BENCHMARK(BM_CartID_Format);
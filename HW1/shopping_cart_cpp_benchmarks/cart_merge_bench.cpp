@@ -0,0 +1,55 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Merging a guest cart of N lines into a saved cart of N lines, half of them the same items:
+// with mergeFrom, and the way callers had to before, through getItems and addItem. Both copy
+// the saved cart first, so the copy is in both numbers.
+
+static std::vector<ShoppingCart> mergeBenchCarts(int64_t lines) {
+	std::vector<std::pair<std::string, double>> entries;
+	for (int64_t i = 0; i < 2 * lines; ++i) {
+		entries.push_back({ "item" + std::to_string(i), 0.01 * (i % 500 + 1) });
+	}
+	Catalog::publish(CatalogIndex(entries));
+	ShoppingCart saved(L"ABC12345DE-A");
+	ShoppingCart guest(L"XYZ54321QQ-Q");
+	for (int64_t i = 0; i < lines; ++i) {
+		saved.addItem("item" + std::to_string(2 * i), 1);
+		guest.addItem("item" + std::to_string(i), 2);
+	}
+	return { saved, guest };
+}
+
+static void BM_CartMerge_MergeFrom(benchmark::State& state) {
+	std::vector<ShoppingCart> carts = mergeBenchCarts(state.range(0));
+	for (auto _ : state) {
+		ShoppingCart merged = carts[0];
+		merged.mergeFrom(carts[1], MergePolicy::Clamp);
+		benchmark::DoNotOptimize(merged.getTotal());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+}
+BENCHMARK(BM_CartMerge_MergeFrom)->ArgName("lines")->Arg(8)->Arg(64)->Arg(512);
+
+static void BM_CartMerge_AddItems(benchmark::State& state) {
+	std::vector<ShoppingCart> carts = mergeBenchCarts(state.range(0));
+	for (auto _ : state) {
+		ShoppingCart merged = carts[0];
+		std::map<std::string, int> held = merged.getItems();
+		for (const auto& [item, quantity] : carts[1].getItems()) {
+			auto found = held.find(item);
+			int room = 99 - (found == held.end() ? 0 : found->second);
+			if (room > 0) {
+				merged.addItem(item, std::min(quantity, room));
+			}
+		}
+		benchmark::DoNotOptimize(merged.getTotal());
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0) * 2);
+}
+BENCHMARK(BM_CartMerge_AddItems)->ArgName("lines")->Arg(8)->Arg(64)->Arg(512);
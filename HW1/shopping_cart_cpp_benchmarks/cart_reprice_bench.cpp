@@ -0,0 +1,90 @@
+#include "../shopping_cart_cpp/cart_store.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include "../shopping_cart_cpp/work_stealing_pool.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+// Pushing a price change of one hot SKU, held by every one of 1M carts, to their cached totals:
+// through the item index on 1 to 8 threads, and by scanning a store without the index.
+
+#define REPRICE_CARTS (1 << 20)
+#define REPRICE_ITEMS 1000
+
+static CatalogIndex repriceCatalog(int hot_cents) {
+	std::vector<std::pair<std::string, double>> entries = { { "hot", 0.01 * hot_cents } };
+	for (int i = 0; i < REPRICE_ITEMS; ++i) {
+		entries.push_back({ "sku-" + std::to_string(i), 0.01 * (i % 500 + 1) });
+	}
+	return CatalogIndex(entries);
+}
+
+static CartStore& repriceStore(bool index_items) {
+	static auto fill = [](CartStore& store) {
+		Catalog::publish(repriceCatalog(100));
+		for (int i = 0; i < REPRICE_CARTS; ++i) {
+			ShoppingCart cart(L"ABC12345DE-A");
+			cart.addItem("hot", 1);
+			for (int line = 0; line < i % 4; ++line) {
+				cart.addItem("sku-" + std::to_string(((int64_t)i * 7919 + line * 104729) % REPRICE_ITEMS), 1);
+			}
+			store.insert(std::move(cart));
+		}
+	};
+	if (index_items) {
+		static CartStore indexed(DEFAULT_SHARDS, true);
+		static bool filled = false;
+		if (!filled) {
+			fill(indexed);
+			filled = true;
+		}
+		return indexed;
+	}
+	static CartStore unindexed(DEFAULT_SHARDS);
+	static bool filled = false;
+	if (!filled) {
+		fill(unindexed);
+		filled = true;
+	}
+	return unindexed;
+}
+
+static void repriceHotSku(benchmark::State& state, bool index_items) {
+	CartStore& store = repriceStore(index_items);
+	WorkStealingPool pool(state.range(0) - 1);
+	std::vector<ItemId> hot = { *ItemRegistry::find("hot") };
+	int cents = 100;
+	for (auto _ : state) {
+		state.PauseTiming();
+		Catalog::publish(repriceCatalog(++cents));
+		state.ResumeTiming();
+		RepriceResult result = store.reprice(hot, pool);
+		benchmark::DoNotOptimize(result);
+	}
+	state.SetItemsProcessed(state.iterations() * REPRICE_CARTS);
+}
+
+static void BM_Reprice_HotSku(benchmark::State& state) {
+	repriceHotSku(state, true);
+}
+BENCHMARK(BM_Reprice_HotSku)->ArgName("threads")->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+static void BM_Reprice_HotSkuScan(benchmark::State& state) {
+	repriceHotSku(state, false);
+}
+BENCHMARK(BM_Reprice_HotSkuScan)->ArgName("threads")->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// What keeping the index costs an update that adds and removes a line.
+static void BM_Reprice_IndexedUpdate(benchmark::State& state) {
+	CartStore& store = repriceStore(state.range(0) != 0);
+	std::vector<CartUuid> ids = store.cartsHolding(*ItemRegistry::find("hot"));
+	size_t i = 0;
+	for (auto _ : state) {
+		store.update(ids[i++ % ids.size()], [](ShoppingCart& cart) {
+			cart.addItem("sku-1", 1);
+			cart.removeItem("sku-1");
+		});
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Reprice_IndexedUpdate)->ArgName("indexed")->Arg(0)->Arg(1);
@@ -0,0 +1,78 @@
+#include "../shopping_cart_cpp/cart_snapshot.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <benchmark/benchmark.h>
+#include <map>
+#include <memory>
+#include <string>
+
+// Dumping and restoring whole populations of carts, up to 10M. Carts have 0 to 4 lines.
+
+static ShoppingCart snapshotCart(int64_t i) {
+	static const std::string items[] = { "apple", "banana", "orange", "grapes", "pineapple" };
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (int64_t line = 0; line < i % 5; ++line) {
+		cart.addItem(items[(i + line) % 5], 1 + i % 7);
+	}
+	return cart;
+}
+
+// Streams freshly made carts into a file, so even 10M carts never have to be in memory at once.
+static const std::string& snapshotFile(int64_t carts, bool checksum) {
+	static std::map<std::pair<int64_t, bool>, std::string> paths;
+	std::string& path = paths[{ carts, checksum }];
+	if (path.empty()) {
+		Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+		path = "snapshot_bench_" + std::to_string(carts) + (checksum ? "_checksum" : "") + ".bin";
+		CartSnapshotWriter writer(path, checksum);
+		for (int64_t i = 0; i < carts; ++i) {
+			writer.write(snapshotCart(i));
+		}
+		writer.finish();
+	}
+	return path;
+}
+
+static void BM_Snapshot_Write(benchmark::State& state) {
+	Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+	std::vector<ShoppingCart> carts;
+	for (int64_t i = 0; i < state.range(0); ++i) {
+		carts.push_back(snapshotCart(i));
+	}
+	for (auto _ : state) {
+		CartSnapshotWriter writer("snapshot_bench_write.bin", state.range(1));
+		for (const ShoppingCart& cart : carts) {
+			writer.write(cart);
+		}
+		writer.finish();
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Snapshot_Write)->Args({ 1 << 20, 0 })->Args({ 1 << 20, 1 })->Unit(benchmark::kMillisecond);
+
+// Reading every cart back, dropping each one once it is rebuilt.
+static void BM_Snapshot_Restore(benchmark::State& state) {
+	const std::string& path = snapshotFile(state.range(0), state.range(1));
+	for (auto _ : state) {
+		CartSnapshotReader reader(path);
+		int64_t restored = 0;
+		while (std::optional<ShoppingCart> cart = reader.next()) {
+			++restored;
+		}
+		benchmark::DoNotOptimize(restored);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Snapshot_Restore)->Args({ 1 << 20, 0 })->Args({ 10000000, 0 })->Args({ 10000000, 1 })->Iterations(1)->Unit(benchmark::kMillisecond);
+
+static void BM_Snapshot_RestoreIntoStore(benchmark::State& state) {
+	const std::string& path = snapshotFile(state.range(0), false);
+	for (auto _ : state) {
+		auto store = std::make_unique<CartStore>();
+		benchmark::DoNotOptimize(restoreSnapshot(*store, path));
+		state.PauseTiming();
+		store.reset();
+		state.ResumeTiming();
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Snapshot_RestoreIntoStore)->Arg(1 << 20)->Iterations(1)->Unit(benchmark::kMillisecond);
@@ -0,0 +1,108 @@
+#include "../shopping_cart_cpp/cart_store.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <benchmark/benchmark.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Scaling of cart lookups and mutations from 1 to 64 threads over a population of 1M carts,
+// against the single mutex-wrapped unordered_map that deployments used to write themselves.
+
+#define POPULATION (1 << 20)
+
+struct Population {
+	CartStore store;
+	std::mutex map_mutex;
+	std::unordered_map<CartUuid, ShoppingCart, CartUuidHash> map;
+	std::vector<CartUuid> ids;
+
+	Population() {
+		Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+		ids.reserve(POPULATION);
+		for (int i = 0; i < POPULATION; ++i) {
+			// About ten carts for each of 100000 owners.
+			std::wstring digits = std::to_wstring(100000 + i % 100000).substr(1);
+			ShoppingCart cart(L"ABC" + digits + L"DE-A");
+			cart.addItem("apple", 1);
+			ids.push_back(store.insert(cart));
+			map.emplace(ids.back(), std::move(cart));
+		}
+	}
+};
+
+static Population& population() {
+	static Population carts;
+	return carts;
+}
+
+// A different walk through the population on every thread.
+static const CartUuid& nextCart(const benchmark::State& state, uint64_t& i) {
+	i += 0x9E3779B97F4A7C15ull;
+	return population().ids[(i ^ (uint64_t)state.thread_index() * 0xBF58476D1CE4E5B9ull) % POPULATION];
+}
+
+static void BM_CartStore_Update(benchmark::State& state) {
+	Population& carts = population();
+	uint64_t i = 0;
+	for (auto _ : state) {
+		carts.store.update(nextCart(state, i), [](ShoppingCart& cart) {
+			cart.addItem("banana", 1);
+			cart.removeItem("banana");
+		});
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartStore_Update)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_GlobalMutexMap_Update(benchmark::State& state) {
+	Population& carts = population();
+	uint64_t i = 0;
+	for (auto _ : state) {
+		std::lock_guard lock(carts.map_mutex);
+		ShoppingCart& cart = carts.map.find(nextCart(state, i))->second;
+		cart.addItem("banana", 1);
+		cart.removeItem("banana");
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GlobalMutexMap_Update)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_CartStore_ReadTotal(benchmark::State& state) {
+	Population& carts = population();
+	uint64_t i = 0;
+	for (auto _ : state) {
+		carts.store.read(nextCart(state, i), [](const ShoppingCart& cart) { benchmark::DoNotOptimize(cart.getTotal()); });
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartStore_ReadTotal)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_GlobalMutexMap_ReadTotal(benchmark::State& state) {
+	Population& carts = population();
+	uint64_t i = 0;
+	for (auto _ : state) {
+		std::lock_guard lock(carts.map_mutex);
+		benchmark::DoNotOptimize(carts.map.find(nextCart(state, i))->second.getTotal());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_GlobalMutexMap_ReadTotal)->ThreadRange(1, 64)->UseRealTime();
+
+// Creating a cart and dropping it again, which takes the shard lock exclusively.
+static void BM_CartStore_CreateErase(benchmark::State& state) {
+	Population& carts = population();
+	for (auto _ : state) {
+		carts.store.erase(carts.store.create(L"XYZ98765AB-Q"));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CartStore_CreateErase)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_CartStore_CartsOfOwner(benchmark::State& state) {
+	CartStore& store = population().store;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(store.cartsOf(L"ABC12345DE-A"));
+	}
+}
+BENCHMARK(BM_CartStore_CartsOfOwner)->ThreadRange(1, 64)->UseRealTime();
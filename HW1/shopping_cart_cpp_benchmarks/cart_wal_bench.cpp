@@ -0,0 +1,49 @@
+#include "../shopping_cart_cpp/cart_wal.h"
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+// Logged mutations per second, and how long each waits to be durable, for group commit windows
+// from 0 (write as soon as the writer is free) to 5 ms. Every mutation waits for its own commit,
+// as a request handler would before answering, so throughput comes from many threads sharing
+// each fsync.
+
+static std::unique_ptr<CartWal> bench_wal;
+
+static void BM_Wal_AddAndWait(benchmark::State& state) {
+	if (state.thread_index() == 0) {
+		bench_wal = std::make_unique<CartWal>("wal_bench.wal", GroupCommitOptions{ std::chrono::microseconds(state.range(0)), 256 * 1024, true });
+	}
+	CartUuid id = CartID().getBytes();
+	std::vector<double> latencies;
+	for (auto _ : state) {
+		auto start = std::chrono::steady_clock::now();
+		bench_wal->waitDurable(bench_wal->logAdd(id, "apple", 1));
+		latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+	}
+	std::sort(latencies.begin(), latencies.end());
+	state.counters["p50_us"] = benchmark::Counter(latencies[latencies.size() / 2], benchmark::Counter::kAvgThreads);
+	state.counters["p99_us"] = benchmark::Counter(latencies[latencies.size() * 99 / 100], benchmark::Counter::kAvgThreads);
+	state.SetItemsProcessed(state.iterations());
+	if (state.thread_index() == 0) {
+		state.counters["ops_per_group"] = (double)state.iterations() * state.threads() / bench_wal->groupCount();
+		bench_wal.reset();
+		std::remove("wal_bench.wal");
+	}
+}
+BENCHMARK(BM_Wal_AddAndWait)->ArgName("window_us")->Arg(0)->Arg(100)->Arg(1000)->Arg(5000)->Threads(1)->Threads(16)->UseRealTime();
+
+// Appending without waiting: the cost a mutation pays on its own thread.
+static void BM_Wal_Append(benchmark::State& state) {
+	CartWal wal("wal_bench_append.wal", GroupCommitOptions{ std::chrono::microseconds(1000), 256 * 1024, true });
+	CartUuid id = CartID().getBytes();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(wal.logAdd(id, "apple", 1));
+	}
+	state.SetItemsProcessed(state.iterations());
+	std::remove("wal_bench_append.wal");
+}
+BENCHMARK(BM_Wal_Append);
@@ -0,0 +1,128 @@
+#include "../shopping_cart_cpp/catalog.h"
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <map>
+#include <string>
+
+// The catalog lookup as it used to be: a fresh map is built for every call.
+static std::map<std::string, double> fetchItemsMap() {
+	return {
+		{"apple", 0.5},
+		{"banana", 0.25},
+		{"orange", 0.75},
+		{"grapes", 1.0},
+		{"pineapple", 2.0}
+	};
+}
+
+static void BM_CatalogLookup_MapRebuild(benchmark::State& state) {
+	const std::string item = "orange";
+	for (auto _ : state) {
+		std::map items = fetchItemsMap();
+		auto iter = items.find(item);
+		benchmark::DoNotOptimize(std::make_pair(iter->first, iter->second));
+	}
+}
+BENCHMARK(BM_CatalogLookup_MapRebuild);
+
+static void BM_CatalogLookup_Index(benchmark::State& state) {
+	const std::string item = "orange";
+	Catalog::Reader catalog;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(catalog->index.find(item));
+	}
+}
+BENCHMARK(BM_CatalogLookup_Index);
+
+// Pinning a snapshot and looking an item up, as addItem does.
+static void BM_CatalogLookup_PinnedReader(benchmark::State& state) {
+	const std::string item = "orange";
+	for (auto _ : state) {
+		Catalog::Reader catalog;
+		benchmark::DoNotOptimize(catalog->index.find(item));
+	}
+}
+BENCHMARK(BM_CatalogLookup_PinnedReader)->ThreadRange(1, 8);
+
+// Readers on every thread but the first, which republishes the catalog as fast as it can.
+static void BM_CatalogLookup_DuringReload(benchmark::State& state) {
+	const std::string item = "orange";
+	for (auto _ : state) {
+		if (state.thread_index() == 0) {
+			Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+		}
+		else {
+			Catalog::Reader catalog;
+			benchmark::DoNotOptimize(catalog->index.find(item));
+		}
+	}
+}
+BENCHMARK(BM_CatalogLookup_DuringReload)->ThreadRange(2, 8);
+
+static void BM_CatalogLookup_LargeIndex(benchmark::State& state) {
+	std::vector<std::pair<std::string, double>> items;
+	for (int64_t i = 0; i < state.range(0); ++i) {
+		items.push_back({ "item" + std::to_string(i), 1.0 });
+	}
+	CatalogIndex index(std::move(items));
+	int64_t i = 0;
+	std::vector<std::string> names;
+	for (int64_t n = 0; n < 1024; ++n) {
+		names.push_back("item" + std::to_string((n * 7919) % state.range(0)));
+	}
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(index.find(names[i++ & 1023]));
+	}
+}
+BENCHMARK(BM_CatalogLookup_LargeIndex)->Range(8, 1 << 20);
+
+// Cold start: turning a catalog file into something that can answer the first lookup.
+static const std::string& startupCatalog(int64_t items, bool binary) {
+	static std::map<std::pair<int64_t, bool>, std::string> paths;
+	std::string& path = paths[{ items, binary }];
+	if (path.empty()) {
+		path = "startup_bench_" + std::to_string(items) + (binary ? ".bin" : ".tsv");
+		std::ofstream file(path);
+		for (int64_t i = 0; i < items; ++i) {
+			file << "item" << i << "\t" << (i % 1000) << "." << (i % 100 < 10 ? "0" : "") << (i % 100) << "\n";
+		}
+		file.close();
+		if (binary) {
+			CatalogIndex::load(path).save(path);
+		}
+	}
+	return path;
+}
+
+static void BM_CatalogStartup_TextToMap(benchmark::State& state) {
+	const std::string& path = startupCatalog(state.range(0), false);
+	for (auto _ : state) {
+		std::ifstream file(path);
+		std::map<std::string, double> items;
+		std::string line;
+		while (std::getline(file, line)) {
+			size_t separator = line.find('\t');
+			items[line.substr(0, separator)] = std::stod(line.substr(separator + 1));
+		}
+		benchmark::DoNotOptimize(items.find("item1"));
+	}
+}
+BENCHMARK(BM_CatalogStartup_TextToMap)->RangeMultiplier(8)->Range(1 << 10, 1 << 19)->Unit(benchmark::kMillisecond);
+
+static void BM_CatalogStartup_TextToIndex(benchmark::State& state) {
+	const std::string& path = startupCatalog(state.range(0), false);
+	for (auto _ : state) {
+		CatalogIndex index = CatalogIndex::load(path);
+		benchmark::DoNotOptimize(index.find("item1"));
+	}
+}
+BENCHMARK(BM_CatalogStartup_TextToIndex)->RangeMultiplier(8)->Range(1 << 10, 1 << 19)->Unit(benchmark::kMillisecond);
+
+static void BM_CatalogStartup_MappedBinary(benchmark::State& state) {
+	const std::string& path = startupCatalog(state.range(0), true);
+	for (auto _ : state) {
+		CatalogIndex index = CatalogIndex::load(path);
+		benchmark::DoNotOptimize(index.find("item1"));
+	}
+}
+BENCHMARK(BM_CatalogStartup_MappedBinary)->RangeMultiplier(8)->Range(1 << 10, 1 << 19)->Unit(benchmark::kMillisecond);
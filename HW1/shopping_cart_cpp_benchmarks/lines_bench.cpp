@@ -0,0 +1,133 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include "alloc_counter.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+// Line storage benchmarks at the cart sizes we see in practice (1, 8) and beyond (64, 1024).
+// Each one reports the heap allocations made per iteration alongside the latency.
+
+static std::vector<std::string> linesCatalog(int64_t lines) {
+	std::vector<std::pair<std::string, double>> entries = { {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} };
+	std::vector<std::string> names;
+	for (int64_t i = 0; i < lines + 1; ++i) {
+		names.push_back("sku-" + std::to_string(100000 + i * 7));
+		entries.push_back({ names.back(), 0.01 * (i % 500 + 1) });
+	}
+	Catalog::publish(CatalogIndex(entries));
+	return names;
+}
+
+static ShoppingCart filledCart(const std::vector<std::string>& names, int64_t lines) {
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (int64_t i = 0; i < lines; ++i) {
+		cart.addItem(names[i], 1);
+	}
+	return cart;
+}
+
+static void reportAllocations(benchmark::State& state, uint64_t before) {
+	state.counters["allocs_per_iter"] = benchmark::Counter((double)(allocationCount() - before) / state.iterations());
+}
+
+// Building a cart of N lines from scratch, one addItem at a time.
+static void BM_Lines_Build(benchmark::State& state) {
+	std::vector<std::string> names = linesCatalog(state.range(0));
+	uint64_t before = allocationCount();
+	for (auto _ : state) {
+		ShoppingCart cart = filledCart(names, state.range(0));
+		benchmark::DoNotOptimize(cart.itemCount());
+	}
+	reportAllocations(state, before);
+}
+BENCHMARK(BM_Lines_Build)->Arg(1)->Arg(8)->Arg(64)->Arg(1024);
+
+// Adding a new line to a cart of N lines and removing it again.
+static void BM_Lines_AddRemove(benchmark::State& state) {
+	std::vector<std::string> names = linesCatalog(state.range(0));
+	ShoppingCart cart = filledCart(names, state.range(0));
+	const std::string& extra = names[state.range(0) / 2];
+	cart.removeItem(extra);
+	uint64_t before = allocationCount();
+	for (auto _ : state) {
+		cart.addItem(extra, 1);
+		cart.removeItem(extra);
+	}
+	reportAllocations(state, before);
+}
+BENCHMARK(BM_Lines_AddRemove)->Arg(1)->Arg(8)->Arg(64)->Arg(1024);
+
+// Adding to a line that is already in the cart.
+static void BM_Lines_AddExisting(benchmark::State& state) {
+	std::vector<std::string> names = linesCatalog(state.range(0));
+	ShoppingCart cart = filledCart(names, state.range(0));
+	const std::string& item = names[state.range(0) / 2];
+	uint64_t before = allocationCount();
+	for (auto _ : state) {
+		cart.addItem(item, 1);
+		cart.updateItem(item, 1);
+	}
+	reportAllocations(state, before);
+}
+BENCHMARK(BM_Lines_AddExisting)->Arg(1)->Arg(8)->Arg(64)->Arg(1024);
+
+static void BM_Lines_Update(benchmark::State& state) {
+	std::vector<std::string> names = linesCatalog(state.range(0));
+	ShoppingCart cart = filledCart(names, state.range(0));
+	const std::string& item = names[state.range(0) / 2];
+	int amount = 1;
+	uint64_t before = allocationCount();
+	for (auto _ : state) {
+		cart.updateItem(item, amount);
+		amount = amount % 99 + 1;
+	}
+	reportAllocations(state, before);
+}
+BENCHMARK(BM_Lines_Update)->Arg(1)->Arg(8)->Arg(64)->Arg(1024);
+
+// Recomputing the total from every line, as happens after a catalog reload.
+static void BM_Lines_RepricedTotal(benchmark::State& state) {
+	std::vector<std::string> names = linesCatalog(state.range(0));
+	ShoppingCart cart = filledCart(names, state.range(0));
+	std::vector<std::pair<std::string, double>> entries;
+	for (const std::string& name : names) {
+		entries.push_back({ name, 0.25 });
+	}
+	CatalogIndex repriced(entries);
+	uint64_t before = allocationCount();
+	for (auto _ : state) {
+		state.PauseTiming();
+		Catalog::publish(repriced);
+		state.ResumeTiming();
+		benchmark::DoNotOptimize(cart.getTotalCost());
+	}
+	reportAllocations(state, before);
+}
+BENCHMARK(BM_Lines_RepricedTotal)->Arg(1)->Arg(8)->Arg(64)->Arg(1024);
+
+// Heap bytes held by one live cart of N lines, with SKU names too long for the small string buffer.
+// The cart data itself comes from a slab pool that recycles blocks across iterations, so this is
+// mostly line storage that spills to the heap, plus the occasional new slab.
+static void BM_Lines_MemoryPerCart(benchmark::State& state) {
+	std::vector<std::pair<std::string, double>> entries;
+	std::vector<std::string> names;
+	for (int64_t i = 0; i < state.range(0); ++i) {
+		names.push_back("grocery-produce-sku-" + std::to_string(100000 + i));
+		entries.push_back({ names.back(), 1.0 });
+	}
+	Catalog::publish(CatalogIndex(entries));
+	const int carts = 1000;
+	int64_t bytes = 0;
+	for (auto _ : state) {
+		std::vector<ShoppingCart> live;
+		live.reserve(carts);
+		int64_t before = liveBytes();
+		for (int i = 0; i < carts; ++i) {
+			live.push_back(filledCart(names, state.range(0)));
+		}
+		bytes = liveBytes() - before;
+	}
+	state.counters["bytes_per_cart"] = benchmark::Counter((double)bytes / carts + sizeof(ShoppingCart));
+}
+BENCHMARK(BM_Lines_MemoryPerCart)->Arg(1)->Arg(8)->Arg(64)->Iterations(1);
@@ -0,0 +1,32 @@
+#include "../shopping_cart_cpp/owner_id.h"
+#include <benchmark/benchmark.h>
+#include <regex>
+
+static const std::wstring OWNER_IDS[] = { L"ABC12345DE-A", L"アイウ12345エオ-Q", L"ABC12345DE-Z", L"INVALID_ID" };
+
+// The check as it used to be: the pattern is compiled on every call.
+static void BM_OwnerID_RegexPerCall(benchmark::State& state) {
+	size_t i = 0;
+	for (auto _ : state) {
+		std::wregex pattern(L"^[A-Z\u0080-\uFFFF]{3}[0-9]{5}[A-Z\u0080-\uFFFF]{2}-[AQ]$", std::regex_constants::icase);
+		benchmark::DoNotOptimize(std::regex_match(OWNER_IDS[i++ & 3], pattern));
+	}
+}
+BENCHMARK(BM_OwnerID_RegexPerCall);
+
+static void BM_OwnerID_RegexCompiledOnce(benchmark::State& state) {
+	std::wregex pattern(L"^[A-Z\u0080-\uFFFF]{3}[0-9]{5}[A-Z\u0080-\uFFFF]{2}-[AQ]$", std::regex_constants::icase);
+	size_t i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(std::regex_match(OWNER_IDS[i++ & 3], pattern));
+	}
+}
+BENCHMARK(BM_OwnerID_RegexCompiledOnce);
+
+static void BM_OwnerID_Validator(benchmark::State& state) {
+	size_t i = 0;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(OwnerIDFormat::isValid(OWNER_IDS[i++ & 3]));
+	}
+}
+BENCHMARK(BM_OwnerID_Validator);
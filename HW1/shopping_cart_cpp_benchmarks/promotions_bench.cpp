@@ -0,0 +1,78 @@
+#include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include "../shopping_cart_cpp/promotions.h"
+#include <benchmark/benchmark.h>
+#include <string>
+#include <vector>
+
+// A 20-line cart priced with 10, 100 and 1,000 active promotions over a 2,000-item catalog,
+// against the plain total. A third of the promotions are of each kind, each over a few items.
+
+#define PROMOTION_ITEMS 2000
+#define PROMOTION_CART_LINES 20
+
+static std::vector<Promotion> benchPromotions(int64_t count) {
+	std::vector<Promotion> promotions;
+	for (int64_t i = 0; i < count; ++i) {
+		std::vector<std::string> items;
+		for (int64_t k = 0; k < 3; ++k) {
+			items.push_back("sku-" + std::to_string((i * 7919 + k * 104729) % PROMOTION_ITEMS));
+		}
+		switch (i % 3) {
+		case 0:
+			promotions.push_back({ Promotion::Kind::BuyGetFree, items, 2, 1 });
+			break;
+		case 1:
+			promotions.push_back({ Promotion::Kind::PercentOff, items, 0, 0, (int)(i % 50 + 1) });
+			break;
+		default:
+			promotions.push_back({ Promotion::Kind::Bundle, items, 0, 0, 0, Money(100) });
+			break;
+		}
+	}
+	return promotions;
+}
+
+static ShoppingCart promotionCart() {
+	std::vector<std::pair<std::string, double>> entries;
+	for (int i = 0; i < PROMOTION_ITEMS; ++i) {
+		entries.push_back({ "sku-" + std::to_string(i), 0.01 * (i % 500 + 1) });
+	}
+	Catalog::publish(CatalogIndex(entries));
+	ShoppingCart cart(L"ABC12345DE-A");
+	for (int i = 0; i < PROMOTION_CART_LINES; ++i) {
+		cart.addItem("sku-" + std::to_string(i * 97 % PROMOTION_ITEMS), i % 5 + 1);
+	}
+	return cart;
+}
+
+static void BM_Promotions_DiscountedTotal(benchmark::State& state) {
+	ShoppingCart cart = promotionCart();
+	std::vector<Promotion> promotions = benchPromotions(state.range(0));
+	PromotionPlan plan(promotions);
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cart.getDiscountedTotal(plan));
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Promotions_DiscountedTotal)->ArgName("rules")->Arg(10)->Arg(100)->Arg(1000);
+
+static void BM_Promotions_PlainTotal(benchmark::State& state) {
+	ShoppingCart cart = promotionCart();
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(cart.getTotal());
+	}
+	state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Promotions_PlainTotal);
+
+static void BM_Promotions_Compile(benchmark::State& state) {
+	promotionCart();
+	std::vector<Promotion> promotions = benchPromotions(state.range(0));
+	for (auto _ : state) {
+		PromotionPlan plan(promotions);
+		benchmark::DoNotOptimize(plan);
+	}
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Promotions_Compile)->ArgName("rules")->Arg(10)->Arg(100)->Arg(1000);
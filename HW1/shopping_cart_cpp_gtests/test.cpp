@@ -1,7 +1,40 @@
 ﻿#include "pch.h"
 #include "../shopping_cart_cpp/cart.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include "../shopping_cart_cpp/item_registry.h"
+#include "../shopping_cart_cpp/cart_id.h"
+#include "../shopping_cart_cpp/owner_id.h"
+#include "../shopping_cart_cpp/cart_store.h"
+#include "../shopping_cart_cpp/cart_snapshot.h"
+#include "../shopping_cart_cpp/cart_wal.h"
+#include "../shopping_cart_cpp/bulk_pricing.h"
+#include "../shopping_cart_cpp/work_stealing_pool.h"
+#include "../shopping_cart_cpp/latency_histogram.h"
+#include "../shopping_cart_cpp/cart_metrics.h"
+#include "../shopping_cart_cpp/cart_events.h"
+#include "../shopping_cart_cpp/promotions.h"
+#ifdef __linux__
+#include "../shopping_cart_cpp/cart_client.h"
+#include "../shopping_cart_cpp/cart_server.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <optional>
+#include <set>
+#include <thread>
 #include <regex>
 #include <random>
+#include <fstream>
+#include <cstdio>
+#include <vector>
 
 TEST(ShoppingCartTest, CopyConstructor) {
     ShoppingCart cart1(L"ABC12345DE-A");
@@ -279,4 +312,1511 @@ TEST(ShoppingCartTest, TotalCostAfterRemoval) {
     ASSERT_EQ(total, 5 * 0.25);
     auto items = cart.getItems();
     ASSERT_EQ(items.size(), 1);
-}
\ No newline at end of file
+}
+
+TEST(CatalogTest, Lookup) {
+    Catalog::Reader catalog;
+    auto apple = catalog.getItem("apple");
+    ASSERT_EQ(apple.name, "apple");
+    ASSERT_EQ(apple.price, 0.5);
+    ASSERT_EQ(catalog->index.size(), 5);
+    ASSERT_FALSE(catalog->index.find("zzz").has_value());
+    ASSERT_FALSE(catalog->index.find("appl").has_value());
+    ASSERT_FALSE(catalog->index.find("").has_value());
+    ASSERT_THROW(catalog.getItem("zzz"), std::invalid_argument);
+    ASSERT_THROW(CatalogIndex({ {"apple", 0.5}, {"apple", 0.75} }), std::invalid_argument);
+}
+
+TEST(CatalogTest, Reload) {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    uint64_t old_version = Catalog::version();
+    {
+        std::ofstream file("reload_test_catalog.tsv");
+        file << "apple\t1.5\nbanana,0.25\r\n\norange\t0.75\ngrapes\t1\npineapple\t2\nkiwi\t0.5\n";
+    }
+    Catalog::Reader old_catalog;
+    uint64_t new_version = Catalog::reload("reload_test_catalog.tsv");
+    ASSERT_GT(new_version, old_version);
+    ASSERT_EQ(Catalog::version(), new_version);
+    ASSERT_EQ(old_catalog->version, old_version);
+    ASSERT_EQ(old_catalog.getItem("apple").price, 0.5);
+    ASSERT_EQ(Catalog::Reader()->version, new_version);
+    ASSERT_EQ(cart.getTotalCost(), 2 * 1.5);
+    cart.addItem("kiwi", 1);
+    ASSERT_EQ(cart.getItems()["kiwi"], 1);
+
+    {
+        std::ofstream file("reload_test_catalog.tsv");
+        file << "apple\tfree\n";
+    }
+    ASSERT_THROW(Catalog::reload("reload_test_catalog.tsv"), std::invalid_argument);
+    ASSERT_EQ(Catalog::version(), new_version);
+    std::remove("reload_test_catalog.tsv");
+
+    cart.removeItem("kiwi");
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ASSERT_EQ(cart.getTotalCost(), 2 * 0.5);
+}
+
+TEST(CatalogTest, BinaryFormat) {
+    CatalogIndex index({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} });
+    index.save("binary_test_catalog.bin");
+    {
+        CatalogIndex mapped = CatalogIndex::load("binary_test_catalog.bin");
+        ASSERT_EQ(mapped.size(), 5);
+        ASSERT_EQ(mapped.find("pineapple")->price_cents, 200);
+        ASSERT_EQ(mapped.find("banana")->price, 0.25);
+        ASSERT_EQ(mapped.find("banana")->name, "banana");
+        ASSERT_FALSE(mapped.find("kiwi").has_value());
+        // Saving over a mapped catalog leaves the mapping reading the old prices.
+        CatalogIndex({ {"pineapple", 3.0} }).save("binary_test_catalog.bin");
+        ASSERT_EQ(mapped.find("pineapple")->price_cents, 200);
+        ASSERT_EQ(CatalogIndex::load("binary_test_catalog.bin").find("pineapple")->price_cents, 300);
+    }
+    {
+        // The price column ends the file; a negative price there is rejected when it is opened.
+        std::fstream file("binary_test_catalog.bin", std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(-(std::streamoff)sizeof(int64_t), std::ios::end);
+        int64_t negative = -100;
+        file.write(reinterpret_cast<const char*>(&negative), sizeof(negative));
+    }
+    ASSERT_THROW(CatalogIndex::load("binary_test_catalog.bin"), std::runtime_error);
+    {
+        std::ofstream file("binary_test_catalog.bin", std::ios::binary | std::ios::trunc);
+        file << "CARTCAT";
+        file.put('\0');
+        file << "truncated";
+    }
+    ASSERT_THROW(CatalogIndex::load("binary_test_catalog.bin"), std::runtime_error);
+    std::remove("binary_test_catalog.bin");
+}
+
+TEST(ShoppingCartTest, TotalIsExact) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0}, {"candy", 0.1} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("candy", 3);
+    ASSERT_EQ(cart.getTotal(), Money(30));
+    ASSERT_EQ(cart.getTotal().toString(), "0.30");
+    ASSERT_EQ(cart.getTotalCost(), 0.3);
+    cart.addItem("apple", 7);
+    cart.updateItem("candy", 99);
+    cart.removeItem("apple");
+    cart.addItem("pineapple", 1);
+    ASSERT_EQ(cart.getTotal().getCents(), 99 * 10 + 200);
+    ASSERT_EQ(cart.getTotal().toString(), "11.90");
+    cart.removeItem("candy");
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ASSERT_EQ(cart.getTotal(), Money(200));
+    ASSERT_EQ(Money(-5).toString(), "-0.05");
+    ASSERT_EQ((Money(150) * 3 - Money(50)).toString(), "4.00");
+}
+
+TEST(ShoppingCartTest, ApplyBatch) {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("banana", 2);
+    cart.addItem("grapes", 1);
+    CartOp ops[] = {
+        { CartOp::Kind::Add, "apple", 3 },
+        { CartOp::Kind::Add, "orange", 1 },
+        { CartOp::Kind::Add, "apple", 4 },
+        { CartOp::Kind::Update, "banana", 9 },
+        { CartOp::Kind::Remove, "grapes" },
+        { CartOp::Kind::Update, "orange", 2 },
+    };
+    cart.applyBatch(ops);
+    auto items = cart.getItems();
+    ASSERT_EQ(items.size(), 3);
+    ASSERT_EQ(items["apple"], 7);
+    ASSERT_EQ(items["banana"], 9);
+    ASSERT_EQ(items["orange"], 2);
+    ASSERT_EQ(cart.getTotalCost(), 7 * 0.5 + 9 * 0.25 + 2 * 0.75);
+}
+
+TEST(ShoppingCartTest, ApplyBatchIsAllOrNothing) {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 3);
+    CartOp bad_item[] = { { CartOp::Kind::Remove, "apple" }, { CartOp::Kind::Add, "zzz", 1 } };
+    ASSERT_THROW(cart.applyBatch(bad_item), std::invalid_argument);
+    CartOp overflow[] = { { CartOp::Kind::Add, "banana", 50 }, { CartOp::Kind::Add, "apple", 50 }, { CartOp::Kind::Add, "apple", 50 } };
+    try {
+        cart.applyBatch(overflow);
+    }
+    catch (const std::exception& e)
+    {
+        ASSERT_STREQ(e.what(), "Quantity cannot be greater than 99");
+    }
+    CartOp removed_twice[] = { { CartOp::Kind::Remove, "apple" }, { CartOp::Kind::Update, "apple", 1 } };
+    ASSERT_THROW(cart.applyBatch(removed_twice), std::invalid_argument);
+    auto items = cart.getItems();
+    ASSERT_EQ(items.size(), 1);
+    ASSERT_EQ(items["apple"], 3);
+    ASSERT_EQ(cart.getTotalCost(), 3 * 0.5);
+}
+
+TEST(ShoppingCartTest, ForEachItem) {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.forEachItem([](std::string_view, int) { FAIL(); });
+    cart.addItem("orange", 2);
+    cart.addItem("apple", 3);
+    std::vector<std::pair<std::string, int>> seen;
+    cart.forEachItem([&seen](std::string_view item_name, int quantity) {
+        seen.emplace_back(std::string(item_name), quantity);
+    });
+    ASSERT_EQ(cart.itemCount(), 2);
+    ASSERT_EQ(seen.size(), 2);
+    ASSERT_EQ(seen[0], std::make_pair(std::string("apple"), 3));
+    ASSERT_EQ(seen[1], std::make_pair(std::string("orange"), 2));
+}
+
+TEST(ShoppingCartTest, LargeCart) {
+    std::vector<std::pair<std::string, double>> entries = { {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} };
+    for (int i = 0; i < 40; ++i) {
+        entries.push_back({ "item" + std::to_string(100 + i), 0.01 });
+    }
+    Catalog::publish(CatalogIndex(entries));
+    ShoppingCart cart(L"ABC12345DE-A");
+    for (int i = 39; i >= 0; --i) {
+        cart.addItem("item" + std::to_string(100 + i), 2);
+    }
+    for (int i = 0; i < 40; i += 2) {
+        cart.removeItem("item" + std::to_string(100 + i));
+    }
+    std::vector<CartOp> ops = { { CartOp::Kind::Add, "apple", 1 }, { CartOp::Kind::Add, "item100", 1 }, { CartOp::Kind::Remove, "item139" } };
+    cart.applyBatch(ops);
+    ShoppingCart copy(cart);
+    cart.updateItem("item101", 9);
+    auto items = copy.getItems();
+    ASSERT_EQ(items.size(), 21);
+    ASSERT_EQ(items["item101"], 2);
+    ASSERT_EQ(items["item100"], 1);
+    ASSERT_EQ(items.count("item139"), 0);
+    size_t lines = 0;
+    copy.forEachItem([&lines](std::string_view, int) { ++lines; });
+    ASSERT_EQ(lines, 21);
+    ASSERT_EQ(copy.getTotal(), Money(50 + 1 + 19 * 2));
+    ASSERT_EQ(cart.getTotal(), Money(50 + 1 + 18 * 2 + 9));
+    ShoppingCart moved(std::move(copy));
+    ASSERT_EQ(moved.getItems(), items);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+TEST(ItemRegistryTest, Intern) {
+    ItemId apple = ItemRegistry::intern("apple");
+    ASSERT_EQ(ItemRegistry::intern("apple"), apple);
+    ASSERT_EQ(ItemRegistry::name(apple), "apple");
+    ASSERT_EQ(ItemRegistry::find("apple"), apple);
+    ASSERT_EQ(Catalog::Reader()->lookup("apple")->id, apple);
+    ItemId fresh = ItemRegistry::intern("registry-test-item");
+    ASSERT_EQ(fresh, ItemRegistry::size() - 1);
+    ASSERT_EQ(ItemRegistry::name(fresh), "registry-test-item");
+    ASSERT_FALSE(ItemRegistry::find("never-interned").has_value());
+    ASSERT_FALSE(Catalog::Reader()->priceOf(fresh).has_value());
+}
+
+TEST(ShoppingCartTest, ItemDroppedFromCatalog) {
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    cart.addItem("grapes", 3);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"pineapple", 2.0} }));
+    ASSERT_THROW(cart.getTotalCost(), std::invalid_argument);
+    cart.updateItem("grapes", 4);
+    ASSERT_EQ(cart.getItems()["grapes"], 4);
+    cart.removeItem("grapes");
+    ASSERT_EQ(cart.getTotalCost(), 2 * 0.5);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+TEST(CartIDTest, Format) {
+    CartID id(CartUuid{ 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff });
+    ASSERT_EQ(id.get(), "00112233-4455-6677-8899-aabbccddeeff");
+    ShoppingCart cart(L"ABC12345DE-A");
+    ASSERT_EQ(CartID(cart.getCartUuid()).get(), cart.getCartId());
+    ASSERT_EQ(ShoppingCart(cart).getCartUuid(), cart.getCartUuid());
+}
+
+TEST(CartIDTest, Unique) {
+    std::vector<std::vector<CartUuid>> generated(4);
+    std::vector<std::thread> threads;
+    for (auto& ids : generated) {
+        threads.emplace_back([&ids] {
+            for (int i = 0; i < 10000; ++i) {
+                ids.push_back(CartID().getBytes());
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::set<CartUuid> unique;
+    for (const auto& ids : generated) {
+        unique.insert(ids.begin(), ids.end());
+    }
+    ASSERT_EQ(unique.size(), 40000);
+    std::regex uuid4_pattern("^[0-9a-f]{8}-[0-9a-f]{4}-4[0-9a-f]{3}-[89ab][0-9a-f]{3}-[0-9a-f]{12}$");
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_TRUE(std::regex_match(CartID(generated[0][i]).get(), uuid4_pattern));
+    }
+}
+
+TEST(OwnerIDTest, MatchesRegex) {
+    // The pattern OwnerID used to check with std::wregex.
+    std::wregex pattern(L"^[A-Z\u0080-\uFFFF]{3}[0-9]{5}[A-Z\u0080-\uFFFF]{2}-[AQ]$", std::regex_constants::icase);
+    const std::wstring valid = L"ABC12345DE-A";
+    // Characters at and around every boundary the pattern cares about, plus random ones.
+    const std::vector<wchar_t> interesting = { L'0', L'9', L'/', L':', L'@', L'A', L'Z', L'[', L'`', L'a', L'z', L'{',
+        L'-', L'Q', L'q', L'R', L'_', (wchar_t)0x7F, (wchar_t)0x80, (wchar_t)0xFF, (wchar_t)0xFFFF, (wchar_t)0x3042, (wchar_t)1 };
+    std::mt19937 gen(662);
+    for (int i = 0; i < 100000; ++i) {
+        std::wstring id = valid;
+        if (gen() % 4 == 0) {
+            id.resize(10 + gen() % 4, L'A');
+        }
+        int mutations = 1 + gen() % 3;
+        for (int m = 0; m < mutations; ++m) {
+            wchar_t c = gen() % 3 == 0 ? (wchar_t)(gen() % (sizeof(wchar_t) > 2 ? 0x110000 : 0x10000)) : interesting[gen() % interesting.size()];
+            id[gen() % id.size()] = c;
+        }
+        ASSERT_EQ(OwnerIDFormat::isValid(id), std::regex_match(id, pattern));
+    }
+    ASSERT_TRUE(OwnerIDFormat::isValid(std::wstring_view(L"xx ABC12345DE-q xx").substr(3, 12)));
+}
+
+TEST(CartTest, CartsFreedOnAnotherThread) {
+    // Carts built on one thread and destroyed on another, by threads that then exit.
+    std::vector<ShoppingCart> carts;
+    std::thread producer([&carts]() {
+        for (int i = 0; i < 20000; ++i) {
+            ShoppingCart cart(L"ABC12345DE-A");
+            cart.addItem("apple", 1 + i % 5);
+            carts.push_back(std::move(cart));
+        }
+    });
+    producer.join();
+    std::thread consumer([&carts]() {
+        carts.resize(10000, carts.front());
+    });
+    consumer.join();
+    // The freed blocks are reused here, and every surviving cart is intact.
+    for (int i = 0; i < 20000; ++i) {
+        carts.push_back(ShoppingCart(L"XYZ98765AB-Q"));
+    }
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(carts[i].getId(), L"ABC12345DE-A");
+        ASSERT_EQ(carts[i].getItems().at("apple"), 1 + i % 5);
+    }
+    for (int i = 10000; i < 30000; ++i) {
+        ASSERT_EQ(carts[i].getId(), L"XYZ98765AB-Q");
+        ASSERT_EQ(carts[i].itemCount(), 0);
+    }
+}
+
+TEST(CartStoreTest, CreateFindErase) {
+    CartStore store(4);
+    CartUuid first = store.create(L"ABC12345DE-A");
+    CartUuid second = store.create(L"ABC12345DE-A");
+    CartUuid other = store.create(L"XYZ98765AB-Q");
+    ASSERT_EQ(store.size(), 3);
+    ASSERT_TRUE(store.contains(first));
+    ASSERT_TRUE(store.update(first, [](ShoppingCart& cart) { cart.addItem("apple", 2); }));
+    double total = 0;
+    ASSERT_TRUE(store.read(first, [&total](const ShoppingCart& cart) { total = cart.getTotalCost(); }));
+    ASSERT_EQ(total, 1.0);
+
+    std::vector<CartUuid> owned = store.cartsOf(L"ABC12345DE-A");
+    ASSERT_EQ(owned.size(), 2);
+    ASSERT_EQ(std::set<CartUuid>(owned.begin(), owned.end()), std::set<CartUuid>({ first, second }));
+    ASSERT_EQ(store.cartsOf(L"XYZ98765AB-Q"), std::vector<CartUuid>({ other }));
+    ASSERT_TRUE(store.cartsOf(L"QQQ00000QQ-Q").empty());
+
+    ASSERT_TRUE(store.erase(first));
+    ASSERT_FALSE(store.erase(first));
+    ASSERT_FALSE(store.contains(first));
+    ASSERT_EQ(store.size(), 2);
+    ASSERT_FALSE(store.update(first, [](ShoppingCart&) {}));
+    ASSERT_EQ(store.cartsOf(L"ABC12345DE-A"), std::vector<CartUuid>({ second }));
+
+    ShoppingCart cart(L"XYZ98765AB-Q");
+    store.insert(cart);
+    bool threw = false;
+    try {
+        store.insert(cart);
+    }
+    catch (const std::invalid_argument& e) {
+        threw = std::string(e.what()) == "Cart already in store";
+    }
+    ASSERT_TRUE(threw);
+}
+
+TEST(CartStoreTest, ConcurrentUpdates) {
+    // Many threads adding to the same few carts, while others create and erase carts.
+    CartStore store(8);
+    std::vector<CartUuid> carts;
+    for (int i = 0; i < 8; ++i) {
+        carts.push_back(store.create(L"ABC12345DE-A"));
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&store, &carts, t]() {
+            for (int i = 0; i < 500; ++i) {
+                store.update(carts[(t + i) % carts.size()], [](ShoppingCart& cart) {
+                    cart.addItem("banana", 1);
+                    cart.removeItem("banana");
+                    cart.addItem("apple", 1);
+                    if (cart.getItems().at("apple") == 99) {
+                        cart.removeItem("apple");
+                    }
+                });
+                store.erase(store.create(L"XYZ98765AB-Q"));
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    int apples = 0;
+    store.forEach([&apples](const ShoppingCart& cart) {
+        auto items = cart.getItems();
+        apples += items.count("apple") ? items.at("apple") : 0;
+    });
+    // Each cart was bumped 500 times, wrapping back to zero after every 99.
+    ASSERT_EQ(apples, 8 * (500 % 99));
+    ASSERT_EQ(store.size(), 8);
+    ASSERT_TRUE(store.cartsOf(L"XYZ98765AB-Q").empty());
+}
+
+TEST(CartSnapshotTest, RoundTrip) {
+    CartStore store;
+    std::vector<CartUuid> ids;
+    for (int i = 0; i < 3000; ++i) {
+        ShoppingCart cart(i % 2 ? L"ABC12345DE-A" : L"アイウ12345エオ-Q");
+        if (i % 3 != 0) {
+            cart.addItem("apple", 1 + i % 99);
+        }
+        if (i % 5 == 0) {
+            cart.addItem("pineapple", 2);
+        }
+        ids.push_back(store.insert(cart));
+    }
+    for (bool checksum : { false, true }) {
+        const std::string path = checksum ? "test_snapshot_checksum.bin" : "test_snapshot.bin";
+        ASSERT_EQ(saveSnapshot(store, path, checksum), 3000);
+        CartStore restored;
+        ASSERT_EQ(restoreSnapshot(restored, path), 3000);
+        ASSERT_EQ(restored.size(), 3000);
+        for (const CartUuid& id : ids) {
+            std::map<std::string, int> expected;
+            std::wstring owner;
+            store.read(id, [&](const ShoppingCart& cart) { expected = cart.getItems(); owner = cart.getId(); });
+            ASSERT_TRUE(restored.read(id, [&](const ShoppingCart& cart) {
+                ASSERT_EQ(cart.getItems(), expected);
+                ASSERT_EQ(cart.getId(), owner);
+                ASSERT_EQ(cart.getTotal(), Money(50 * (expected.count("apple") ? expected.at("apple") : 0) + 200 * (expected.count("pineapple") ? expected.at("pineapple") : 0)));
+            }));
+        }
+        ASSERT_EQ(restored.cartsOf(L"アイウ12345エオ-Q").size(), 1500);
+
+        // A flipped byte fails the checksum; a truncated file fails either way.
+        std::string bytes;
+        {
+            std::ifstream file(path, std::ios::binary);
+            bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        for (bool truncate : { false, true }) {
+            if (!checksum && !truncate) {
+                continue;
+            }
+            std::string damaged = truncate ? bytes.substr(0, bytes.size() - 3) : bytes;
+            if (!truncate) {
+                damaged[damaged.size() / 2] ^= 0x10;
+            }
+            std::ofstream(path, std::ios::binary | std::ios::trunc) << damaged;
+            bool threw = false;
+            try {
+                CartStore partial;
+                restoreSnapshot(partial, path);
+            }
+            catch (const std::runtime_error& e) {
+                threw = std::string(e.what()) == "Invalid snapshot file";
+            }
+            ASSERT_TRUE(threw);
+        }
+        std::remove(path.c_str());
+    }
+}
+
+TEST(CartSnapshotTest, UnfinishedSaveKeepsLastSnapshot) {
+    const std::string path = "test_unfinished.snapshot";
+    CartStore store;
+    ShoppingCart saved(L"ABC12345DE-A");
+    saved.addItem("apple", 2);
+    CartUuid id = saved.getCartUuid();
+    store.insert(std::move(saved));
+    ASSERT_EQ(saveSnapshot(store, path, true, 7), 1);
+
+    // A save that stops part way, as a crash or a failed write would, leaves the last snapshot
+    // as it was and cleans up after itself.
+    {
+        CartSnapshotWriter writer(path, true, 9);
+        for (int i = 0; i < 1000; ++i) {
+            ShoppingCart cart(L"XYZ98765AB-Q");
+            cart.addItem("banana", 1);
+            writer.write(cart);
+        }
+    }
+    ASSERT_FALSE(std::ifstream(path + ".tmp").good());
+    CartStore restored;
+    uint64_t lsn = 0;
+    ASSERT_EQ(restoreSnapshot(restored, path, lsn), 1);
+    ASSERT_EQ(lsn, 7);
+    ASSERT_TRUE(restored.read(id, [](const ShoppingCart& cart) { ASSERT_EQ(cart.getItems().at("apple"), 2); }));
+    std::remove(path.c_str());
+}
+
+TEST(CartWalTest, Replay) {
+    const std::string path = "test_cart.wal";
+    std::remove(path.c_str());
+    CartStore store;
+    std::vector<CartUuid> ids;
+    {
+        CartWal wal(path, { std::chrono::microseconds(200), 4096, false });
+        uint64_t lsn = 0;
+        for (int i = 0; i < 200; ++i) {
+            ShoppingCart cart(i % 2 ? L"ABC12345DE-A" : L"アイウ12345エオ-Q");
+            CartUuid id = cart.getCartUuid();
+            wal.logCreate(id, cart.getId());
+            store.insert(std::move(cart));
+            ids.push_back(id);
+            store.update(id, [&](ShoppingCart& cart) {
+                cart.addItem("apple", 1 + i % 50);
+                lsn = wal.logAdd(id, "apple", 1 + i % 50);
+                cart.addItem("banana", 2);
+                lsn = wal.logAdd(id, "banana", 2);
+                if (i % 3 == 0) {
+                    cart.updateItem("apple", 7);
+                    lsn = wal.logUpdate(id, "apple", 7);
+                }
+                if (i % 4 == 0) {
+                    cart.removeItem("banana");
+                    lsn = wal.logRemove(id, "banana");
+                }
+            });
+            if (i % 10 == 0) {
+                store.erase(id);
+                lsn = wal.logErase(id);
+            }
+        }
+        wal.waitDurable(lsn);
+        ASSERT_EQ(wal.durableLsn(), lsn);
+        ASSERT_GE(wal.groupCount(), 1);
+    }
+    CartStore replayed;
+    WalReplay replay = replayWal(replayed, path);
+    ASSERT_EQ(replay.skipped, 0);
+    ASSERT_EQ(replayed.size(), store.size());
+    ASSERT_EQ(store.size(), 180);
+    for (const CartUuid& id : ids) {
+        std::map<std::string, int> expected;
+        bool present = store.read(id, [&](const ShoppingCart& cart) { expected = cart.getItems(); });
+        std::map<std::string, int> actual;
+        ASSERT_EQ(replayed.read(id, [&](const ShoppingCart& cart) { actual = cart.getItems(); }), present);
+        ASSERT_EQ(actual, expected);
+    }
+    ASSERT_EQ(replayed.cartsOf(L"ABC12345DE-A").size(), 100);
+
+    // A group torn by a crash mid-write is dropped, along with nothing before it.
+    std::string bytes;
+    {
+        std::ifstream file(path, std::ios::binary);
+        bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << bytes.substr(0, bytes.size() - 5);
+    CartStore torn;
+    WalReplay partial = replayWal(torn, path);
+    ASSERT_LT(partial.applied, replay.applied);
+    ASSERT_EQ(partial.skipped, 0);
+    std::remove(path.c_str());
+}
+
+TEST(CartWalTest, RecoverFromSnapshotAndLog) {
+    const std::string wal_path = "test_recovery.wal";
+    const std::string snapshot_path = "test_recovery.snapshot";
+    std::remove(wal_path.c_str());
+    CartStore store;
+    std::vector<CartUuid> ids;
+    uint64_t snapshot_lsn = 0;
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        for (int i = 0; i < 20; ++i) {
+            ShoppingCart cart(L"ABC12345DE-A");
+            CartUuid id = cart.getCartUuid();
+            wal.logCreate(id, cart.getId());
+            store.insert(std::move(cart));
+            ids.push_back(id);
+            store.update(id, [&](ShoppingCart& cart) {
+                cart.addItem("apple", 1);
+                wal.logAdd(id, "apple", 1);
+            });
+        }
+        // The snapshot is taken with no mutation in flight, so it holds exactly the records so far.
+        snapshot_lsn = wal.lastLsn();
+        ASSERT_EQ(saveSnapshot(store, snapshot_path, false, snapshot_lsn), 20);
+
+        // More mutations after the snapshot, which only the log has.
+        for (const CartUuid& id : ids) {
+            store.update(id, [&](ShoppingCart& cart) {
+                cart.addItem("apple", 2);
+                wal.logAdd(id, "apple", 2);
+            });
+        }
+        ShoppingCart late(L"XYZ98765AB-Q");
+        wal.logCreate(late.getCartUuid(), late.getId());
+        store.insert(std::move(late));
+        store.erase(ids[0]);
+        wal.waitDurable(wal.logErase(ids[0]));
+    }
+    // A crash in the middle of the next group leaves a torn tail behind.
+    std::ofstream(wal_path, std::ios::binary | std::ios::app) << std::string("\x40\x00\x00\x00torn", 8);
+
+    auto matches = [&](const CartStore& recovered) {
+        ASSERT_EQ(recovered.size(), store.size());
+        store.forEach([&](const ShoppingCart& cart) {
+            ASSERT_TRUE(recovered.read(cart.getCartUuid(), [&](const ShoppingCart& restored) {
+                ASSERT_EQ(restored.getItems(), cart.getItems());
+                ASSERT_EQ(restored.getId(), cart.getId());
+            }));
+        });
+    };
+    CartStore recovered;
+    uint64_t restored_lsn = 0;
+    ASSERT_EQ(restoreSnapshot(recovered, snapshot_path, restored_lsn), 20);
+    ASSERT_EQ(restored_lsn, snapshot_lsn);
+    WalReplay replay = replayWal(recovered, wal_path, restored_lsn);
+    ASSERT_EQ(replay.applied, 20 + 1 + 1);
+    ASSERT_EQ(replay.skipped, 0);
+    // Each cart got apple 1 before the snapshot and apple 2 after, and must not get the 1 twice.
+    ASSERT_TRUE(recovered.read(ids[1], [](const ShoppingCart& cart) { ASSERT_EQ(cart.getItems().at("apple"), 3); }));
+    matches(recovered);
+
+    // Reopening the log drops the torn tail and numbers records on from the last one.
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        ASSERT_EQ(wal.lastLsn(), snapshot_lsn + 20 + 1 + 1);
+        store.update(ids[1], [&](ShoppingCart& cart) {
+            cart.removeItem("apple");
+            wal.logRemove(ids[1], "apple");
+        });
+        snapshot_lsn = wal.lastLsn();
+        ASSERT_EQ(saveSnapshot(store, snapshot_path, false, snapshot_lsn), 20);
+        ASSERT_TRUE(wal.checkpoint(snapshot_lsn));
+        store.update(ids[2], [&](ShoppingCart& cart) {
+            cart.updateItem("apple", 9);
+            wal.waitDurable(wal.logUpdate(ids[2], "apple", 9));
+        });
+        ASSERT_FALSE(wal.checkpoint(snapshot_lsn));
+    }
+    CartStore checkpointed;
+    ASSERT_EQ(restoreSnapshot(checkpointed, snapshot_path, restored_lsn), 20);
+    replay = replayWal(checkpointed, wal_path, restored_lsn);
+    ASSERT_EQ(replay.applied, 1);
+    matches(checkpointed);
+    // The checkpoint dropped records a store without the snapshot would need.
+    CartStore empty;
+    ASSERT_THROW(replayWal(empty, wal_path), std::runtime_error);
+
+    // A cart created with an invalid owner id makes the log invalid rather than failing the insert.
+    std::remove(wal_path.c_str());
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        wal.waitDurable(wal.logCreate(CartID().getBytes(), L"ABC"));
+    }
+    try {
+        replayWal(empty, wal_path);
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Invalid WAL file");
+    }
+    std::remove(wal_path.c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+TEST(CartWalTest, CheckpointSurvivesACrash) {
+    const std::string wal_path = "test_checkpoint.wal";
+    const std::string snapshot_path = "test_checkpoint.snapshot";
+    std::remove(wal_path.c_str());
+    CartStore store;
+    ShoppingCart cart(L"ABC12345DE-A");
+    CartUuid id = cart.getCartUuid();
+    uint64_t snapshot_lsn = 0;
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        wal.logCreate(id, cart.getId());
+        store.insert(std::move(cart));
+        store.update(id, [&](ShoppingCart& cart) {
+            cart.addItem("apple", 1);
+            wal.logAdd(id, "apple", 1);
+        });
+        snapshot_lsn = wal.lastLsn();
+        ASSERT_EQ(saveSnapshot(store, snapshot_path, false, snapshot_lsn), 1);
+        ASSERT_TRUE(wal.checkpoint(snapshot_lsn));
+    }
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        ASSERT_EQ(wal.lastLsn(), snapshot_lsn);
+        store.update(id, [&](ShoppingCart& cart) {
+            cart.addItem("banana", 2);
+            wal.waitDurable(wal.logAdd(id, "banana", 2));
+        });
+    }
+    // A crash while the next checkpoint writes its new log leaves that half written beside the
+    // old log, which is still whole.
+    std::ofstream(wal_path + ".tmp", std::ios::binary | std::ios::trunc) << "CART";
+    {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        ASSERT_EQ(wal.lastLsn(), snapshot_lsn + 1);
+    }
+    CartStore recovered;
+    uint64_t restored_lsn = 0;
+    ASSERT_EQ(restoreSnapshot(recovered, snapshot_path, restored_lsn), 1);
+    WalReplay replay = replayWal(recovered, wal_path, restored_lsn);
+    ASSERT_EQ(replay.applied, 1);
+    ASSERT_TRUE(recovered.read(id, [](const ShoppingCart& cart) {
+        ASSERT_EQ(cart.getItems(), (std::map<std::string, int>({ {"apple", 1}, {"banana", 2} })));
+    }));
+
+    // A log left empty, as truncating it before writing its new header would leave after a crash,
+    // is refused rather than numbered from zero again, below the records the snapshot holds.
+    std::ofstream(wal_path, std::ios::binary | std::ios::trunc);
+    try {
+        CartWal wal(wal_path, { std::chrono::microseconds(200), 4096, false });
+        FAIL();
+    }
+    catch (const std::runtime_error& e) {
+        ASSERT_STREQ(e.what(), "Invalid WAL file");
+    }
+    std::remove(wal_path.c_str());
+    std::remove((wal_path + ".tmp").c_str());
+    std::remove(snapshot_path.c_str());
+}
+
+TEST(CartTest, CopiesAreIndependent) {
+    ShoppingCart original(L"ABC12345DE-A");
+    original.addItem("apple", 2);
+    ShoppingCart copy(original);
+    ShoppingCart assigned(L"XYZ98765AB-Q");
+    assigned = original;
+    copy.addItem("banana", 4);
+    assigned.removeItem("apple");
+    ASSERT_EQ(original.getItems(), (std::map<std::string, int>({ {"apple", 2} })));
+    ASSERT_EQ(copy.getItems(), (std::map<std::string, int>({ {"apple", 2}, {"banana", 4} })));
+    ASSERT_EQ(assigned.itemCount(), 0);
+    ASSERT_EQ(assigned.getId(), L"ABC12345DE-A");
+    ASSERT_EQ(original.getTotal(), Money(100));
+    ASSERT_EQ(copy.getTotal(), Money(200));
+    ASSERT_EQ(assigned.getTotal(), Money(0));
+    original.updateItem("apple", 3);
+    ASSERT_EQ(copy.getItems().at("apple"), 2);
+    ASSERT_EQ(copy.getCartId(), original.getCartId());
+
+    // Copies of one cart changed and priced on many threads at once.
+    std::vector<std::thread> threads;
+    std::atomic<int> mismatches = 0;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&original, &mismatches, t]() {
+            for (int i = 0; i < 1000; ++i) {
+                ShoppingCart what_if(original);
+                ShoppingCart preview = what_if;
+                what_if.addItem("orange", 1 + t);
+                if (what_if.getTotal() != Money(150 + 75 * (1 + t)) || preview.getTotal() != Money(150)) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    ASSERT_EQ(mismatches, 0);
+    ASSERT_EQ(original.getItems(), (std::map<std::string, int>({ {"apple", 3} })));
+}
+
+TEST(BulkPricingTest, MatchesGetTotal) {
+    // Prices above 2^32 cents, to check the wide multiply.
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0}, {"yacht", 123456789.99} }));
+    const std::string items[] = { "apple", "banana", "orange", "grapes", "pineapple", "yacht" };
+    std::vector<ShoppingCart> carts;
+    for (int i = 0; i < 1000; ++i) {
+        ShoppingCart cart(L"ABC12345DE-A");
+        for (int line = 0; line < i % 7; ++line) {
+            cart.addItem(items[(i + line * 5) % 6], 1 + (i + line) % 99);
+        }
+        carts.push_back(cart);
+    }
+    for (PricingKernel kernel : { PricingKernel::Auto, PricingKernel::Scalar }) {
+        std::vector<Money> totals = priceCarts(carts, kernel);
+        ASSERT_EQ(totals.size(), carts.size());
+        for (size_t i = 0; i < carts.size(); ++i) {
+            ASSERT_EQ(totals[i], carts[i].getTotal());
+        }
+    }
+    ASSERT_TRUE(priceCarts(std::vector<ShoppingCart>()).empty());
+
+    // A cart holding an item the catalog has dropped cannot be priced, as with getTotal.
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    for (PricingKernel kernel : { PricingKernel::Auto, PricingKernel::Scalar }) {
+        bool threw = false;
+        try {
+            priceCarts(carts, kernel);
+        }
+        catch (const std::invalid_argument& e) {
+            threw = std::string(e.what()) == "Item not found in catalog";
+        }
+        ASSERT_TRUE(threw);
+    }
+}
+
+TEST(CartStoreTest, Reprice) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    // Every chunk of a parallel loop runs exactly once, and a throwing chunk fails the loop.
+    WorkStealingPool pool(3);
+    ASSERT_EQ(pool.size(), 4);
+    std::vector<std::atomic<int>> runs(10000);
+    pool.parallelFor(runs.size(), 7, [&runs](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            ++runs[i];
+        }
+    });
+    ASSERT_TRUE(std::all_of(runs.begin(), runs.end(), [](const std::atomic<int>& count) { return count == 1; }));
+    bool threw = false;
+    try {
+        pool.parallelFor(100, 1, [](size_t begin, size_t) {
+            if (begin == 42) {
+                throw std::runtime_error("chunk failed");
+            }
+        });
+    }
+    catch (const std::runtime_error& e) {
+        threw = std::string(e.what()) == "chunk failed";
+    }
+    ASSERT_TRUE(threw);
+
+    // The item index follows inserts, updates, and erases.
+    CartStore store(4, true);
+    CartStore unindexed(4);
+    ItemId apple = *ItemRegistry::find("apple");
+    ItemId banana = *ItemRegistry::find("banana");
+    std::set<CartUuid> holding_apple;
+    for (int i = 0; i < 100; ++i) {
+        ShoppingCart cart(L"ABC12345DE-A");
+        cart.addItem(i % 2 ? "apple" : "banana", 1 + i % 5);
+        if (i % 3 == 0) {
+            cart.addItem("orange", 1);
+        }
+        if (i % 2) {
+            holding_apple.insert(cart.getCartUuid());
+        }
+        unindexed.insert(cart);
+        store.insert(cart);
+    }
+    std::vector<CartUuid> found = store.cartsHolding(apple);
+    ASSERT_EQ(std::set<CartUuid>(found.begin(), found.end()), holding_apple);
+    found = unindexed.cartsHolding(apple);
+    ASSERT_EQ(std::set<CartUuid>(found.begin(), found.end()), holding_apple);
+    CartUuid moved = *holding_apple.begin();
+    ASSERT_TRUE(store.update(moved, [](ShoppingCart& cart) {
+        cart.removeItem("apple");
+        cart.addItem("banana", 2);
+    }));
+    holding_apple.erase(moved);
+    found = store.cartsHolding(apple);
+    ASSERT_EQ(std::set<CartUuid>(found.begin(), found.end()), holding_apple);
+    found = store.cartsHolding(banana);
+    ASSERT_EQ(std::count(found.begin(), found.end(), moved), 1);
+    ASSERT_EQ(found.size(), 51);
+    // A failed update leaves the index matching whatever the cart was left holding.
+    try {
+        store.update(moved, [](ShoppingCart& cart) {
+            cart.addItem("grapes", 1);
+            cart.addItem("kiwi", 1);
+        });
+    }
+    catch (const std::invalid_argument&) {
+    }
+    ASSERT_EQ(store.cartsHolding(*ItemRegistry::find("grapes")), std::vector<CartUuid>({ moved }));
+    ASSERT_TRUE(store.erase(moved));
+    ASSERT_TRUE(store.cartsHolding(*ItemRegistry::find("grapes")).empty());
+    ASSERT_EQ(store.cartsHolding(banana).size(), 50);
+
+    // Repricing after a price change brings exactly the carts holding the item up to date.
+    Catalog::publish(CatalogIndex({ {"apple", 0.6}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    RepriceResult result = store.reprice(std::vector<ItemId>({ apple }), pool);
+    ASSERT_EQ(result.repriced, holding_apple.size());
+    ASSERT_EQ(result.unpriced, 0);
+    for (const CartUuid& id : holding_apple) {
+        ASSERT_TRUE(store.read(id, [](const ShoppingCart& cart) {
+            int64_t expected = 0;
+            for (const auto& [name, quantity] : cart.getItems()) {
+                expected += (name == "apple" ? 60 : name == "orange" ? 75 : 25) * quantity;
+            }
+            ASSERT_EQ(cart.getTotal(), Money(expected));
+        }));
+    }
+    Catalog::publish(CatalogIndex({ {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    result = store.reprice(std::vector<ItemId>({ apple, banana }), pool);
+    ASSERT_EQ(result.repriced, 50);
+    ASSERT_EQ(result.unpriced, 49);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+TEST(LatencyHistogramTest, Percentiles) {
+    LatencyHistogram empty;
+    ASSERT_EQ(empty.count(), 0);
+    ASSERT_EQ(empty.percentile(0.99), 0);
+
+    // Small values are exact; larger ones are kept to within about 3%.
+    LatencyHistogram small;
+    for (uint64_t value = 0; value < 50; ++value) {
+        small.record(value);
+    }
+    ASSERT_EQ(small.percentile(0.5), 24);
+    ASSERT_EQ(small.percentile(1.0), 49);
+    ASSERT_EQ(small.max(), 49);
+
+    LatencyHistogram first;
+    LatencyHistogram second;
+    for (uint64_t value = 1; value <= 100000; ++value) {
+        (value % 2 ? first : second).record(value * 1000);
+    }
+    first.merge(second);
+    ASSERT_EQ(first.count(), 100000);
+    ASSERT_EQ(first.max(), 100000000);
+    ASSERT_EQ(first.mean(), 50000500.0);
+    for (double fraction : { 0.5, 0.99, 0.999 }) {
+        double expected = fraction * 100000000;
+        double reported = (double)first.percentile(fraction);
+        ASSERT_GE(reported, expected);
+        ASSERT_LE(reported, expected * 1.035);
+    }
+    ASSERT_EQ(first.percentile(1.0), 100000000);
+
+    // Values past the top bucket are still counted, and the maximum is exact.
+    LatencyHistogram huge;
+    huge.record(uint64_t(1) << 50);
+    ASSERT_EQ(huge.count(), 1);
+    ASSERT_EQ(huge.percentile(0.5), uint64_t(1) << 50);
+}
+
+TEST(CartMetricsTest, CountsOperationsAndFailures) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    CartMetrics::Snapshot before;
+    CartMetrics::snapshot(before);
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    try { cart.addItem("kiwi", 1); } catch (const std::invalid_argument&) {}
+    try { cart.updateItem("apple", 0); } catch (const std::invalid_argument&) {}
+    try { cart.removeItem("banana"); } catch (const std::invalid_argument&) {}
+    ASSERT_EQ(cart.getTotal().getCents(), 100);
+    ASSERT_EQ(cart.getDiscountedTotal(PromotionPlan()).getCents(), 100);
+    // What a thread records is kept after it exits.
+    std::thread([]() {
+        try { ShoppingCart rejected(L"ABC1234XDE-A"); } catch (const std::invalid_argument&) {}
+    }).join();
+    CartMetrics::Snapshot after;
+    CartMetrics::snapshot(after);
+
+    if (!CartMetrics::ENABLED) {
+        ASSERT_EQ(after.calls[CartMetrics::ADD_ITEM], 0);
+        ASSERT_TRUE(CartMetrics::prometheus().empty());
+        return;
+    }
+    // Every call is counted, though not every one is timed.
+    auto calls = [&](CartMetrics::Op op) { return after.calls[op] - before.calls[op]; };
+    auto errors = [&](CartMetrics::Op op) { return after.errors[op] - before.errors[op]; };
+    auto failures = [&](CartMetrics::Failure failure) { return after.failures[failure] - before.failures[failure]; };
+    ASSERT_EQ(calls(CartMetrics::ADD_ITEM), 2);
+    ASSERT_EQ(errors(CartMetrics::ADD_ITEM), 1);
+    ASSERT_EQ(calls(CartMetrics::UPDATE_ITEM), 1);
+    ASSERT_EQ(errors(CartMetrics::UPDATE_ITEM), 1);
+    ASSERT_EQ(calls(CartMetrics::REMOVE_ITEM), 1);
+    ASSERT_EQ(errors(CartMetrics::REMOVE_ITEM), 1);
+    ASSERT_EQ(calls(CartMetrics::CONSTRUCT), 2);
+    ASSERT_EQ(errors(CartMetrics::CONSTRUCT), 1);
+    ASSERT_EQ(calls(CartMetrics::GET_TOTAL), 1);
+    ASSERT_EQ(errors(CartMetrics::GET_TOTAL), 0);
+    ASSERT_EQ(calls(CartMetrics::GET_DISCOUNTED_TOTAL), 1);
+    ASSERT_EQ(failures(CartMetrics::UNKNOWN_ITEM), 1);
+    ASSERT_EQ(failures(CartMetrics::QUANTITY_OUT_OF_RANGE), 1);
+    ASSERT_EQ(failures(CartMetrics::ITEM_NOT_IN_CART), 1);
+    ASSERT_EQ(failures(CartMetrics::INVALID_OWNER_ID), 1);
+
+    std::string text = CartMetrics::prometheus();
+    ASSERT_NE(text.find("# TYPE cart_operation_duration_seconds histogram\n"), std::string::npos);
+    ASSERT_NE(text.find("cart_operation_duration_seconds_bucket{op=\"add_item\",le=\"+Inf\"} "), std::string::npos);
+    ASSERT_NE(text.find("cart_validation_failures_total{reason=\"invalid_owner_id\"} "), std::string::npos);
+    ASSERT_NE(text.find("cart_operations_total{op=\"get_discounted_total\"} "), std::string::npos);
+    CartMetrics::writePrometheus("metrics_test.prom");
+    std::ifstream file("metrics_test.prom");
+    std::string first_line;
+    std::getline(file, first_line);
+    ASSERT_EQ(first_line, "# HELP cart_operations_total ShoppingCart operations called.");
+}
+
+TEST(ShoppingCartTest, TryApiReturnsErrors) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    CartResult<ShoppingCart> created = ShoppingCart::tryCreate(L"ABC12345DE-A");
+    ASSERT_TRUE(created.has_value());
+    ASSERT_EQ(created->getId(), L"ABC12345DE-A");
+    ASSERT_EQ(ShoppingCart::tryCreate(L"ABC12345DE-AQ").error(), CartError::OwnerIdTooLong);
+    ASSERT_EQ(ShoppingCart::tryCreate(L"ABC1234XDE-A").error(), CartError::InvalidOwnerId);
+    ASSERT_TRUE(OwnerID::tryMake(L"abc12345de-q").has_value());
+
+    ShoppingCart& cart = *created;
+    ASSERT_TRUE(cart.tryAddItem("apple", 2).has_value());
+    ASSERT_EQ(cart.tryAddItem("kiwi", 1).error(), CartError::UnknownItem);
+    ASSERT_EQ(cart.tryAddItem("banana", 0).error(), CartError::QuantityBelowMinimum);
+    ASSERT_EQ(cart.tryAddItem("apple", 98).error(), CartError::QuantityAboveMaximum);
+    ASSERT_EQ(cart.tryUpdateItem("banana", 1).error(), CartError::UpdatedItemNotInCart);
+    ASSERT_EQ(cart.tryUpdateItem("apple", 100).error(), CartError::QuantityAboveMaximum);
+    ASSERT_EQ(cart.tryRemoveItem("banana").error(), CartError::RemovedItemNotInCart);
+    CartOp batch[] = { { CartOp::Kind::Add, "orange", 1 }, { CartOp::Kind::Remove, "grapes" } };
+    ASSERT_EQ(cart.tryApplyBatch(batch).error(), CartError::RemovedItemNotInCart);
+    // Failed calls leave the cart as it was.
+    ASSERT_EQ(cart.getItems(), (std::map<std::string, int>{ { "apple", 2 } }));
+    ASSERT_EQ(cart.tryGetTotal()->getCents(), 100);
+
+    Catalog::Reader catalog;
+    ASSERT_EQ(catalog.tryGetItem("banana")->price_cents, 25);
+    ASSERT_EQ(catalog.tryGetItem("kiwi").error(), CartError::UnknownItem);
+
+    // The throwing API reports the same errors with the messages it always had.
+    try {
+        cart.updateItem("banana", 1);
+        ASSERT_TRUE(false);
+    }
+    catch (const std::invalid_argument& error) {
+        ASSERT_EQ(std::string(error.what()), describe(CartError::UpdatedItemNotInCart));
+    }
+
+    // A catalog that drops an item the cart holds leaves its total unpriced.
+    Catalog::publish(CatalogIndex({ {"banana", 0.25} }));
+    ASSERT_EQ(cart.tryGetTotal().error(), CartError::UnknownItem);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+}
+
+TEST(CartEventsTest, PublishesDrainsAndOverflows) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    CartEvents::start();
+    cart.addItem("apple", 2);
+    cart.addItem("apple", 1);
+    cart.updateItem("apple", 5);
+    cart.removeItem("apple");
+    CartOp batch[] = { { CartOp::Kind::Add, "banana", 4 }, { CartOp::Kind::Add, "orange", 1 }, { CartOp::Kind::Remove, "orange" } };
+    cart.applyBatch(batch);
+    try { cart.removeItem("apple"); } catch (const std::invalid_argument&) {}
+    CartEvents::stop();
+    cart.addItem("grapes", 1);
+
+    CartEvent events[16];
+    ASSERT_EQ(CartEvents::drain(events), 5);
+    ItemId apple = *ItemRegistry::find("apple");
+    ASSERT_EQ(events[0].cart, cart.getCartUuid());
+    ASSERT_EQ(events[0].item, apple);
+    ASSERT_EQ(events[0].old_quantity, 0);
+    ASSERT_EQ(events[0].new_quantity, 2);
+    ASSERT_EQ(events[1].old_quantity, 2);
+    ASSERT_EQ(events[1].new_quantity, 3);
+    ASSERT_EQ(events[2].old_quantity, 3);
+    ASSERT_EQ(events[2].new_quantity, 5);
+    ASSERT_EQ(events[3].old_quantity, 5);
+    ASSERT_EQ(events[3].new_quantity, 0);
+    // The batch adds and removes orange, which nets out to no change.
+    ASSERT_EQ(events[4].item, *ItemRegistry::find("banana"));
+    ASSERT_EQ(events[4].new_quantity, 4);
+    ASSERT_GT(events[0].timestamp, 0);
+    ASSERT_LE(events[0].timestamp, events[4].timestamp);
+    ASSERT_EQ(CartEvents::drain(events), 0);
+
+    // A full ring drops what does not fit, and counts it.
+    CartEvents::Counters before = CartEvents::counters();
+    CartEvents::start(4, CartEvents::Overflow::Drop);
+    for (int i = 0; i < 10; ++i) {
+        cart.updateItem("banana", i % 2 + 1);
+    }
+    ASSERT_EQ(CartEvents::drain(events), 4);
+    CartEvents::Counters after = CartEvents::counters();
+    ASSERT_EQ(after.published - before.published, 4);
+    ASSERT_EQ(after.dropped - before.dropped, 6);
+
+    // Under backpressure nothing is lost: the producer waits for the consumer.
+    CartEvents::start(2, CartEvents::Overflow::Block);
+    std::thread producer([]() {
+        ShoppingCart own(L"ABC12345DE-A");
+        for (int i = 0; i < 50; ++i) {
+            own.addItem("pineapple", 1);
+            own.removeItem("pineapple");
+        }
+    });
+    size_t received = 0;
+    while (received < 100) {
+        received += CartEvents::drain(events);
+        std::this_thread::yield();
+    }
+    producer.join();
+    CartEvents::stop();
+    ASSERT_EQ(received, 100);
+    ASSERT_EQ(CartEvents::drain(events), 0);
+    ASSERT_EQ(CartEvents::counters().dropped, after.dropped);
+}
+
+TEST(CartEventsTest, BlocksOutsideStoreLocks) {
+    // The consumer reads the cart being changed between drains. A producer that waited for room
+    // while update held the cart's lock would never let it.
+    CartStore store;
+    CartUuid id = store.create(L"ABC12345DE-A");
+    CartEvents::Counters before = CartEvents::counters();
+    CartEvents::start(2, CartEvents::Overflow::Block);
+    std::atomic<bool> done = false;
+    std::thread producer([&]() {
+        for (int i = 0; i < 20; ++i) {
+            store.update(id, [](ShoppingCart& cart) {
+                for (int j = 0; j < 5; ++j) {
+                    cart.addItem("pineapple", 1);
+                    cart.removeItem("pineapple");
+                }
+            });
+        }
+        done = true;
+    });
+    std::vector<CartEvent> events(1);
+    size_t received = 0;
+    while (received < 200) {
+        store.read(id, [](const ShoppingCart& cart) { ASSERT_EQ(cart.itemCount(), 0); });
+        received += CartEvents::drain(events);
+        std::this_thread::yield();
+    }
+    producer.join();
+    CartEvents::stop();
+    ASSERT_TRUE(done);
+    ASSERT_EQ(received, 200);
+    CartEvents::Counters after = CartEvents::counters();
+    ASSERT_EQ(after.published - before.published, 200);
+    ASSERT_EQ(after.dropped, before.dropped);
+}
+
+TEST(PromotionPlanTest, CombinesPromotions) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 5);
+    cart.addItem("banana", 3);
+    cart.addItem("orange", 1);
+    cart.addItem("grapes", 2);
+    ASSERT_EQ(cart.getTotal(), Money(600));
+    ASSERT_EQ(cart.getDiscountedTotal(PromotionPlan()), Money(600));
+
+    std::vector<Promotion> promotions = {
+        { Promotion::Kind::BuyGetFree, { "apple" }, 2, 1 },
+        { Promotion::Kind::PercentOff, { "apple", "kiwi" }, 0, 0, 30 },
+        { Promotion::Kind::PercentOff, { "banana", "orange" }, 0, 0, 10 },
+        { Promotion::Kind::Bundle, { "orange", "grapes" }, 0, 0, 0, Money(150) },
+        { Promotion::Kind::Bundle, { "apple", "pineapple" }, 0, 0, 0, Money(100) },
+    };
+    PromotionPlan plan(promotions);
+    ASSERT_EQ(plan.size(), 5);
+    // Apple takes the better of one free unit (50) and 30% off (75), and banana gets 10% off (7).
+    // The orange and grapes bundle saves 25 and takes the orange, which so gets no 10% off of its
+    // own; apple and pineapple is incomplete.
+    ASSERT_EQ(plan.discount(cart), Money(75 + 7 + 25));
+    ASSERT_EQ(cart.getDiscountedTotal(plan), Money(600 - 107));
+
+    // Discounts never take the total below zero.
+    std::vector<Promotion> generous = {
+        { Promotion::Kind::PercentOff, { "apple", "banana", "orange", "grapes" }, 0, 0, 100 },
+        { Promotion::Kind::Bundle, { "apple", "banana" }, 0, 0, 0, Money(0) },
+    };
+    ASSERT_EQ(cart.getDiscountedTotal(PromotionPlan(generous)), Money(0));
+
+    for (const Promotion& invalid : { Promotion{ Promotion::Kind::PercentOff, { "apple" }, 0, 0, 0 },
+            Promotion{ Promotion::Kind::BuyGetFree, { "apple" }, 1, 0 },
+            Promotion{ Promotion::Kind::Bundle, { "apple", "apple" }, 0, 0, 0, Money(10) },
+            Promotion{ Promotion::Kind::PercentOff, {}, 0, 0, 10 } }) {
+        try {
+            PromotionPlan rejected(std::span<const Promotion>(&invalid, 1));
+            ASSERT_TRUE(false);
+        }
+        catch (const std::invalid_argument&) {}
+    }
+}
+
+TEST(PromotionPlanTest, UnitsCountTowardOnePromotion) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 1);
+    cart.addItem("banana", 1);
+    cart.addItem("orange", 1);
+    std::vector<Promotion> promotions = {
+        { Promotion::Kind::Bundle, { "apple", "banana" }, 0, 0, 0, Money(50) },
+        { Promotion::Kind::Bundle, { "apple", "orange" }, 0, 0, 0, Money(50) },
+        { Promotion::Kind::PercentOff, { "apple" }, 0, 0, 50 },
+    };
+    PromotionPlan plan(promotions);
+    // The one apple goes to the bundle that saves more (75 against 25), and so gets no 50% off.
+    ASSERT_EQ(plan.discount(cart), Money(75));
+    ASSERT_EQ(cart.getDiscountedTotal(plan), Money(75));
+
+    // A second apple completes the other bundle too.
+    cart.addItem("apple", 1);
+    ASSERT_EQ(plan.discount(cart), Money(75 + 25));
+
+    // Apples no bundle took still get their 50% off.
+    cart.addItem("apple", 3);
+    ASSERT_EQ(plan.discount(cart), Money(75 + 25 + 3 * 25));
+
+    // A bundle that costs more than its items are listed at takes no units.
+    std::vector<Promotion> dear = {
+        { Promotion::Kind::Bundle, { "apple", "banana" }, 0, 0, 0, Money(100) },
+        { Promotion::Kind::PercentOff, { "apple", "banana" }, 0, 0, 10 },
+    };
+    ASSERT_EQ(PromotionPlan(dear).discount(cart), Money(5 * 5 + 2));
+}
+
+TEST(ShoppingCartTest, MergeFromAppliesPolicy) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ShoppingCart saved(L"ABC12345DE-A");
+    saved.addItem("apple", 2);
+    saved.addItem("orange", 90);
+    ShoppingCart guest(L"XYZ54321QQ-Q");
+    guest.addItem("apple", 3);
+    guest.addItem("banana", 1);
+    guest.addItem("orange", 20);
+
+    // Sum fails as a whole when a line would pass 99.
+    ShoppingCart summed = saved;
+    try {
+        summed.mergeFrom(guest, MergePolicy::Sum);
+        ASSERT_TRUE(false);
+    }
+    catch (const std::invalid_argument&) {}
+    ASSERT_EQ(summed.getItems(), saved.getItems());
+    ASSERT_EQ(summed.tryMergeFrom(guest, MergePolicy::Sum).error(), CartError::QuantityAboveMaximum);
+
+    ShoppingCart clamped = saved;
+    clamped.mergeFrom(guest, MergePolicy::Clamp);
+    ASSERT_EQ(clamped.getItems(), (std::map<std::string, int>{ { "apple", 5 }, { "banana", 1 }, { "orange", 99 } }));
+    ASSERT_EQ(clamped.getTotal(), Money(5 * 50 + 25 + 99 * 75));
+
+    ShoppingCart kept = saved;
+    kept.mergeFrom(guest, MergePolicy::Keep);
+    ASSERT_EQ(kept.getItems(), (std::map<std::string, int>{ { "apple", 2 }, { "banana", 1 }, { "orange", 90 } }));
+    ASSERT_EQ(kept.getTotal(), Money(2 * 50 + 25 + 90 * 75));
+    // The guest cart and the copy source are untouched.
+    ASSERT_EQ(saved.getItems().size(), 2);
+    ASSERT_EQ(guest.getItems().at("orange"), 20);
+
+    // Lines whose item has left the catalog are merged all the same.
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"orange", 0.75} }));
+    ShoppingCart merged = saved;
+    merged.mergeFrom(guest, MergePolicy::Keep);
+    ASSERT_EQ(merged.getItems().at("banana"), 1);
+    ASSERT_EQ(merged.tryGetTotal().error(), CartError::UnknownItem);
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+
+    // Merging a cart into itself sums it with itself.
+    ShoppingCart doubled = guest;
+    doubled.mergeFrom(doubled, MergePolicy::Sum);
+    ASSERT_EQ(doubled.getItems(), (std::map<std::string, int>{ { "apple", 6 }, { "banana", 2 }, { "orange", 40 } }));
+    ASSERT_EQ(doubled.getTotal(), Money(6 * 50 + 2 * 25 + 40 * 75));
+}
+
+TEST(ShoppingCartTest, ConstTotalsAcrossThreads) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25} }));
+    ShoppingCart cart(L"ABC12345DE-A");
+    cart.addItem("apple", 2);
+    cart.addItem("banana", 4);
+    // Const readers on one cart refresh its cached total together after every reload. Each
+    // must see one of the two prices, and once the reloads stop, the latest one.
+    std::atomic<bool> stop = false;
+    std::atomic<bool> wrong = false;
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&]() {
+            const ShoppingCart& shared = cart;
+            while (!stop.load()) {
+                int64_t cents = shared.getTotal().getCents();
+                if (cents != 200 && cents != 400) {
+                    wrong = true;
+                }
+            }
+        });
+    }
+    for (int i = 0; i < 2000; ++i) {
+        double apple = i % 2 == 0 ? 1.0 : 0.5;
+        Catalog::publish(CatalogIndex({ {"apple", apple}, {"banana", apple / 2} }));
+    }
+    Catalog::publish(CatalogIndex({ {"apple", 1.0}, {"banana", 0.5} }));
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    stop = true;
+    for (std::thread& reader : readers) {
+        reader.join();
+    }
+    ASSERT_FALSE(wrong);
+    ASSERT_EQ(cart.getTotal(), Money(400));
+}
+
+TEST(CartStoreTest, OwnerIndexUnderChurn) {
+    // One thread inserts carts while another erases each as soon as it is stored, so every
+    // erase races the insert's owner index update.
+    CartStore store(4);
+    std::vector<ShoppingCart> carts;
+    for (int i = 0; i < 2000; ++i) {
+        carts.push_back(ShoppingCart(L"ABC12345DE-A"));
+    }
+    std::vector<CartUuid> ids;
+    for (const ShoppingCart& cart : carts) {
+        ids.push_back(cart.getCartUuid());
+    }
+    std::thread eraser([&store, &ids]() {
+        for (const CartUuid& id : ids) {
+            while (!store.erase(id)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    for (ShoppingCart& cart : carts) {
+        store.insert(std::move(cart));
+    }
+    eraser.join();
+    ASSERT_EQ(store.size(), 0);
+    ASSERT_TRUE(store.cartsOf(L"ABC12345DE-A").empty());
+
+    // An update may not assign another cart over the stored one; its id and owner are put back.
+    CartUuid kept = store.create(L"ABC12345DE-A");
+    bool threw = false;
+    try {
+        store.update(kept, [](ShoppingCart& cart) {
+            cart = ShoppingCart(L"XYZ98765AB-Q");
+            cart.addItem("apple", 2);
+        });
+    }
+    catch (const std::logic_error& e) {
+        ASSERT_STREQ(e.what(), "Cart id or owner changed in update");
+        threw = true;
+    }
+    ASSERT_TRUE(threw);
+    ASSERT_TRUE(store.read(kept, [&kept](const ShoppingCart& cart) {
+        ASSERT_EQ(cart.getCartUuid(), kept);
+        ASSERT_EQ(cart.getId(), L"ABC12345DE-A");
+        ASSERT_EQ(cart.getItems(), (std::map<std::string, int>{ { "apple", 2 } }));
+    }));
+    ASSERT_EQ(store.cartsOf(L"ABC12345DE-A"), std::vector<CartUuid>({ kept }));
+    ASSERT_TRUE(store.cartsOf(L"XYZ98765AB-Q").empty());
+}
+
+TEST(CartStoreTest, UpdateThatMovesTheCartOut) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    ItemId apple = ItemRegistry::intern("apple");
+    for (bool index_items : { false, true }) {
+        CartStore store(4, index_items);
+        CartUuid id = store.create(L"ABC12345DE-A");
+        store.update(id, [](ShoppingCart& cart) { cart.addItem("apple", 2); });
+        // An update that moves the cart out takes its lines; the store files an empty cart
+        // under the same id and owner and reports the misuse.
+        std::optional<ShoppingCart> taken;
+        bool threw = false;
+        try {
+            store.update(id, [&taken](ShoppingCart& cart) { taken.emplace(std::move(cart)); });
+        }
+        catch (const std::logic_error& e) {
+            ASSERT_STREQ(e.what(), "Cart id or owner changed in update");
+            threw = true;
+        }
+        ASSERT_TRUE(threw);
+        ASSERT_EQ(taken->getItems(), (std::map<std::string, int>{ { "apple", 2 } }));
+        ASSERT_TRUE(store.read(id, [&id](const ShoppingCart& cart) {
+            ASSERT_EQ(cart.getCartUuid(), id);
+            ASSERT_EQ(cart.getId(), L"ABC12345DE-A");
+            ASSERT_EQ(cart.itemCount(), 0);
+        }));
+        ASSERT_EQ(store.cartsOf(L"ABC12345DE-A"), std::vector<CartUuid>({ id }));
+        ASSERT_TRUE(store.cartsHolding(apple).empty());
+        ASSERT_TRUE(store.update(id, [](ShoppingCart& cart) { cart.addItem("banana", 1); }));
+        ASSERT_TRUE(store.erase(id));
+    }
+}
+
+#ifdef __linux__
+TEST(CartServerTest, ServesPipelinedRequests) {
+    Catalog::publish(CatalogIndex({ {"apple", 0.5}, {"banana", 0.25}, {"orange", 0.75}, {"grapes", 1.0}, {"pineapple", 2.0} }));
+    CartServer server("cart_server_test.sock", 2);
+    CartClient client("cart_server_test.sock");
+    using CartProtocol::Op;
+    using CartProtocol::Status;
+
+    // Responses come back in any order, so they are kept by tag.
+    std::map<uint32_t, std::pair<uint8_t, std::string>> responses;
+    auto exchange = [&](const std::string& frames, size_t count) {
+        responses.clear();
+        client.send(frames);
+        for (size_t i = 0; i < count; ++i) {
+            CartProtocol::Frame response = client.receive();
+            responses[response.tag] = { response.code, std::string(response.body) };
+        }
+    };
+
+    std::string frames;
+    for (uint32_t tag = 0; tag < 8; ++tag) {
+        CartProtocol::appendCreate(frames, tag, L"ABC12345DE-A");
+    }
+    CartProtocol::appendCreate(frames, 8, L"ABC1234XDE-A");
+    exchange(frames, 9);
+    ASSERT_EQ(responses[8].first, (uint8_t)CartProtocol::statusOf(CartError::InvalidOwnerId));
+    std::vector<CartUuid> carts;
+    for (uint32_t tag = 0; tag < 8; ++tag) {
+        ASSERT_EQ(responses[tag].first, (uint8_t)Status::Ok);
+        carts.push_back(CartProtocol::Reader(responses[tag].second).cart());
+    }
+
+    // One pipelined write with requests for carts on both threads.
+    frames.clear();
+    const CartOp ops[] = { { CartOp::Kind::Add, "banana", 4 }, { CartOp::Kind::Update, "apple", 3 } };
+    const CartOp failing[] = { { CartOp::Kind::Add, "orange", 1 }, { CartOp::Kind::Remove, "grapes" } };
+    for (uint32_t i = 0; i < 8; ++i) {
+        CartProtocol::appendItem(frames, 100 + i, Op::Add, carts[i], "apple", 2);
+        CartProtocol::appendBatch(frames, 200 + i, carts[i], ops);
+        CartProtocol::appendCartOp(frames, 300 + i, Op::Total, carts[i]);
+    }
+    CartProtocol::appendBatch(frames, 400, carts[0], failing);
+    CartProtocol::appendItem(frames, 401, Op::Add, carts[1], "durian", 1);
+    CartProtocol::appendCartOp(frames, 402, Op::Items, carts[2]);
+    CartProtocol::appendCartOp(frames, 403, Op::Drop, carts[3]);
+    CartProtocol::appendCartOp(frames, 404, Op::Total, carts[3]);
+    CartProtocol::appendCartOp(frames, 405, Op::Total, CartUuid{});
+    size_t start = CartProtocol::beginFrame(frames, 406, (uint8_t)Op::Add);
+    CartProtocol::putCart(frames, carts[4]);
+    CartProtocol::endFrame(frames, start);
+    CartProtocol::endFrame(frames, CartProtocol::beginFrame(frames, 407, 99));
+    exchange(frames, 32);
+    for (uint32_t i = 0; i < 8; ++i) {
+        ASSERT_EQ(responses[100 + i].first, (uint8_t)Status::Ok);
+        ASSERT_EQ(responses[200 + i].first, (uint8_t)Status::Ok);
+        CartProtocol::Reader total(responses[300 + i].second);
+        ASSERT_EQ(responses[300 + i].first, (uint8_t)Status::Ok);
+        ASSERT_EQ(total.i64(), 250);
+        ASSERT_TRUE(total.done());
+    }
+    ASSERT_EQ(responses[400].first, (uint8_t)CartProtocol::statusOf(CartError::RemovedItemNotInCart));
+    ASSERT_EQ(responses[401].first, (uint8_t)CartProtocol::statusOf(CartError::UnknownItem));
+    CartProtocol::Reader lines(responses[402].second);
+    ASSERT_EQ(lines.u32(), 2);
+    std::map<std::string, int> items;
+    for (int i = 0; i < 2; ++i) {
+        std::string name(lines.string());
+        items[name] = lines.i32();
+    }
+    ASSERT_TRUE(lines.done());
+    ASSERT_EQ(items, (std::map<std::string, int>{ { "apple", 3 }, { "banana", 4 } }));
+    ASSERT_EQ(responses[403].first, (uint8_t)Status::Ok);
+    ASSERT_EQ(responses[404].first, (uint8_t)Status::UnknownCart);
+    ASSERT_EQ(responses[405].first, (uint8_t)Status::UnknownCart);
+    ASSERT_EQ(responses[406].first, (uint8_t)Status::Malformed);
+    ASSERT_EQ(responses[407].first, (uint8_t)Status::UnknownOp);
+    ASSERT_EQ(server.cartCount(), 7);
+}
+
+TEST(CartServerTest, StopsReadingFromClientsThatDoNotRead) {
+    // Long item names make each Items response about 2 KB, against 25 bytes for the request.
+    std::vector<std::pair<std::string, double>> entries;
+    for (char c = 'a'; c < 'k'; ++c) {
+        entries.push_back({ std::string(200, c), 1.0 });
+    }
+    Catalog::publish(CatalogIndex(entries));
+    const std::string path = "cart_server_backpressure.sock";
+    CartServer server(path, 1);
+    CartClient client(path);
+    using CartProtocol::Op;
+    using CartProtocol::Status;
+    std::string frames;
+    CartProtocol::appendCreate(frames, 0, L"ABC12345DE-A");
+    client.send(frames);
+    CartUuid cart = CartProtocol::Reader(client.receive().body).cart();
+    frames.clear();
+    for (const auto& entry : entries) {
+        CartProtocol::appendItem(frames, 1, Op::Add, cart, entry.first, 1);
+    }
+    client.send(frames);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        ASSERT_EQ(client.receive().code, (uint8_t)Status::Ok);
+    }
+
+    // Another connection sends 2 MB of requests, which would make 160 MB of responses, and
+    // reads none of them.
+    const uint32_t requests = 80000;
+    frames.clear();
+    for (uint32_t tag = 0; tag < requests; ++tag) {
+        CartProtocol::appendCartOp(frames, tag, Op::Items, cart);
+    }
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    std::memcpy(address.sun_path, path.data(), path.size());
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(connect(fd, (const sockaddr*)&address, sizeof(address)), 0);
+    size_t sent = 0;
+    for (int idle = 0; sent < frames.size() && idle < 50;) {
+        ssize_t written = ::send(fd, frames.data() + sent, frames.size() - sent, MSG_NOSIGNAL);
+        if (written > 0) {
+            sent += (size_t)written;
+            idle = 0;
+        }
+        else {
+            ASSERT_EQ(errno, EAGAIN);
+            ++idle;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    // The server stopped reading once a megabyte of responses was waiting.
+    ASSERT_LT(sent, frames.size() / 2);
+
+    // Other connections are still served meanwhile.
+    std::string total;
+    CartProtocol::appendCartOp(total, 2, Op::Total, cart);
+    client.send(total);
+    CartProtocol::Frame answer = client.receive();
+    ASSERT_EQ(answer.code, (uint8_t)Status::Ok);
+    ASSERT_EQ(CartProtocol::Reader(answer.body).i64(), 1000);
+
+    // Once the client reads, the rest of its requests are taken and every one is answered.
+    std::string rest = frames.substr(sent);
+    fcntl(fd, F_SETFL, 0);
+    std::thread writer([fd, &rest]() {
+        for (size_t done = 0; done < rest.size();) {
+            ssize_t written = ::send(fd, rest.data() + done, rest.size() - done, MSG_NOSIGNAL);
+            if (written <= 0) {
+                return;
+            }
+            done += (size_t)written;
+        }
+    });
+    std::string received;
+    size_t start = 0;
+    uint32_t answered = 0;
+    char chunk[64 * 1024];
+    while (answered < requests) {
+        ssize_t got = ::recv(fd, chunk, sizeof(chunk), 0);
+        ASSERT_GT(got, 0);
+        received.append(chunk, (size_t)got);
+        CartProtocol::Frame response;
+        while (size_t size = CartProtocol::parseFrame(std::string_view(received).substr(start), response)) {
+            ASSERT_EQ(response.tag, answered);
+            ASSERT_EQ(response.code, (uint8_t)Status::Ok);
+            ++answered;
+            start += size;
+        }
+        received.erase(0, start);
+        start = 0;
+    }
+    writer.join();
+    ::close(fd);
+}
+#endif
@@ -0,0 +1,332 @@
+#include "../shopping_cart_cpp/cart_client.h"
+#include "../shopping_cart_cpp/cart_protocol.h"
+#include "../shopping_cart_cpp/latency_histogram.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Drives a running cart_server over many connections and prints requests per second and the
+// latency clients see, per operation.
+//
+// Every connection writes a window of --pipeline requests in one write, and the next window once
+// all of its responses are in, so that is how many requests each connection keeps in flight. A
+// request's latency runs from its window's write to its response. With --batch above 1, adds go
+// out as Batch requests of that many operations each. Rejected requests (a full line, an update
+// of an item not in the cart) are counted and timed like the rest.
+
+namespace {
+	using namespace CartProtocol;
+
+	enum RequestKind { ADD, UPDATE, REMOVE, TOTAL, KIND_COUNT };
+	const char* const KIND_NAMES[KIND_COUNT] = { "add", "update", "remove", "total" };
+
+	struct Options {
+		std::string socket = "cart.sock";
+		size_t connections = 64;
+		unsigned threads = 1;
+		size_t pipeline = 16;
+		size_t batch = 1;
+		size_t carts = 10000;
+		// Items sku-0 to sku-<N-1>, all of which the server's catalog must hold.
+		size_t items = 100;
+		double seconds = 5;
+		// Relative weights of the requests, in RequestKind order.
+		double mix[KIND_COUNT] = { 40, 20, 10, 30 };
+	};
+
+	struct Connection {
+		explicit Connection(int fd) : fd(fd) {}
+
+		int fd;
+		std::string in;
+		std::string out;
+		size_t outstanding = 0;
+		std::chrono::steady_clock::time_point sent;
+	};
+
+	struct ThreadResult {
+		LatencyHistogram latency[KIND_COUNT];
+		uint64_t rejected[KIND_COUNT] = {};
+		// Responses that say the request itself was wrong: these mean a bug, not a busy server.
+		uint64_t failed = 0;
+	};
+
+	[[noreturn]] void usage() {
+		std::cerr << "Usage: cart_client_bench [--socket PATH] [--connections N] [--threads N] [--pipeline N]\n"
+			"                         [--batch N] [--carts N] [--items N] [--seconds S]" << std::endl;
+		std::exit(2);
+	}
+
+	Options parseOptions(int argc, char** argv) {
+		Options options;
+		try {
+			for (int i = 1; i < argc; ++i) {
+				std::string flag = argv[i];
+				if (i + 1 == argc) {
+					usage();
+				}
+				std::string value = argv[++i];
+				if (flag == "--socket") {
+					options.socket = value;
+				}
+				else if (flag == "--connections") {
+					options.connections = std::stoul(value);
+				}
+				else if (flag == "--threads") {
+					options.threads = (unsigned)std::stoul(value);
+				}
+				else if (flag == "--pipeline") {
+					options.pipeline = std::stoul(value);
+				}
+				else if (flag == "--batch") {
+					options.batch = std::stoul(value);
+				}
+				else if (flag == "--carts") {
+					options.carts = std::stoul(value);
+				}
+				else if (flag == "--items") {
+					options.items = std::stoul(value);
+				}
+				else if (flag == "--seconds") {
+					options.seconds = std::stod(value);
+				}
+				else {
+					usage();
+				}
+			}
+		}
+		catch (const std::logic_error&) {
+			usage();
+		}
+		if (options.connections == 0 || options.threads == 0 || options.pipeline == 0 || options.batch == 0
+			|| options.carts == 0 || options.items == 0) {
+			usage();
+		}
+		options.threads = (unsigned)std::min<size_t>(options.threads, options.connections);
+		return options;
+	}
+
+	std::wstring ownerId(size_t i) {
+		return L"SRV" + std::to_wstring(100000 + i % 100000).substr(1) + L"AA-A";
+	}
+
+	std::vector<CartUuid> createCarts(const Options& options) {
+		CartClient client(options.socket);
+		std::vector<CartUuid> carts;
+		std::string frames;
+		while (carts.size() < options.carts) {
+			size_t chunk = std::min<size_t>(options.carts - carts.size(), 1024);
+			frames.clear();
+			for (size_t i = 0; i < chunk; ++i) {
+				appendCreate(frames, (uint32_t)i, ownerId(carts.size() + i));
+			}
+			client.send(frames);
+			for (size_t i = 0; i < chunk; ++i) {
+				Frame response = client.receive();
+				if (response.code != (uint8_t)Status::Ok) {
+					throw std::runtime_error("Server refused to create a cart");
+				}
+				carts.push_back(Reader(response.body).cart());
+			}
+		}
+		return carts;
+	}
+
+	void runConnections(const Options& options, const std::vector<CartUuid>& carts, size_t count, unsigned seed,
+		const std::atomic<bool>& stop, ThreadResult& result) {
+		std::mt19937_64 rng(seed);
+		std::discrete_distribution<int> pick_kind(std::begin(options.mix), std::end(options.mix));
+		std::uniform_int_distribution<size_t> pick_cart(0, carts.size() - 1);
+		std::uniform_int_distribution<size_t> pick_item(0, options.items - 1);
+		std::uniform_int_distribution<int> pick_quantity(1, 5);
+		std::vector<std::string> items;
+		for (size_t i = 0; i < options.items; ++i) {
+			items.push_back("sku-" + std::to_string(i));
+		}
+		std::vector<CartOp> ops(options.batch);
+
+		// Tags carry the request kind in their low bits, so responses need no lookup.
+		auto fill = [&](Connection& connection) {
+			connection.out.clear();
+			for (size_t i = 0; i < options.pipeline; ++i) {
+				RequestKind kind = (RequestKind)pick_kind(rng);
+				const CartUuid& cart = carts[pick_cart(rng)];
+				uint32_t tag = (uint32_t)(i * KIND_COUNT + kind);
+				switch (kind) {
+				case ADD:
+					if (options.batch == 1) {
+						appendItem(connection.out, tag, Op::Add, cart, items[pick_item(rng)], 1);
+						break;
+					}
+					for (CartOp& op : ops) {
+						op = { CartOp::Kind::Add, items[pick_item(rng)], 1 };
+					}
+					appendBatch(connection.out, tag, cart, ops);
+					break;
+				case UPDATE:
+					appendItem(connection.out, tag, Op::Update, cart, items[pick_item(rng)], pick_quantity(rng));
+					break;
+				case REMOVE:
+					appendItem(connection.out, tag, Op::Remove, cart, items[pick_item(rng)]);
+					break;
+				default:
+					appendCartOp(connection.out, tag, Op::Total, cart);
+					break;
+				}
+			}
+			connection.outstanding = options.pipeline;
+			connection.sent = std::chrono::steady_clock::now();
+			std::string_view frames = connection.out;
+			while (!frames.empty()) {
+				ssize_t sent = ::send(connection.fd, frames.data(), frames.size(), MSG_NOSIGNAL);
+				if (sent < 0 && errno != EINTR) {
+					throw std::runtime_error("Cannot write to cart server");
+				}
+				frames.remove_prefix(sent > 0 ? (size_t)sent : 0);
+			}
+		};
+
+		// Sockets stay blocking, so a window is always written whole; reads never wait.
+		std::vector<Connection> connections;
+		int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		for (size_t i = 0; i < count; ++i) {
+			sockaddr_un address{};
+			address.sun_family = AF_UNIX;
+			std::copy(options.socket.begin(), options.socket.end(), address.sun_path);
+			int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+			if (fd < 0 || connect(fd, (const sockaddr*)&address, sizeof(address)) != 0) {
+				throw std::runtime_error("Cannot connect to cart server");
+			}
+			connections.emplace_back(fd);
+			epoll_event event{};
+			event.events = EPOLLIN;
+			event.data.u64 = i;
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+		}
+		for (Connection& connection : connections) {
+			fill(connection);
+		}
+
+		std::vector<char> buffer(64 * 1024);
+		epoll_event events[256];
+		while (!stop.load(std::memory_order_relaxed)) {
+			int ready = epoll_wait(epoll_fd, events, 256, 100);
+			for (int i = 0; i < ready; ++i) {
+				Connection& connection = connections[events[i].data.u64];
+				ssize_t got = ::recv(connection.fd, buffer.data(), buffer.size(), MSG_DONTWAIT);
+				if (got == 0 || (got < 0 && errno != EAGAIN && errno != EINTR)) {
+					throw std::runtime_error("Cart server closed the connection");
+				}
+				if (got < 0) {
+					continue;
+				}
+				connection.in.append(buffer.data(), (size_t)got);
+				auto now = std::chrono::steady_clock::now();
+				uint64_t latency = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(now - connection.sent).count();
+				size_t used = 0;
+				Frame response;
+				while (size_t size = parseFrame(std::string_view(connection.in).substr(used), response)) {
+					RequestKind kind = (RequestKind)(response.tag % KIND_COUNT);
+					result.latency[kind].record(latency);
+					if (response.code != (uint8_t)Status::Ok) {
+						++result.rejected[kind];
+						result.failed += response.code >= (uint8_t)Status::UnknownCart;
+					}
+					--connection.outstanding;
+					used += size;
+				}
+				connection.in.erase(0, used);
+				if (connection.outstanding == 0) {
+					fill(connection);
+				}
+			}
+		}
+		for (Connection& connection : connections) {
+			::close(connection.fd);
+		}
+		::close(epoll_fd);
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options = parseOptions(argc, argv);
+	std::vector<CartUuid> carts;
+	try {
+		carts = createCarts(options);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "cart_client_bench: " << e.what() << std::endl;
+		return 1;
+	}
+	std::cout << "Running " << options.connections << " connections on " << options.threads << " threads for "
+		<< options.seconds << " s, " << options.pipeline << " requests in flight each, over " << options.carts
+		<< " carts" << std::endl;
+
+	std::vector<ThreadResult> results(options.threads);
+	std::atomic<bool> stop = false;
+	std::atomic<bool> broken = false;
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < options.threads; ++t) {
+		size_t count = options.connections / options.threads + (t < options.connections % options.threads ? 1 : 0);
+		threads.emplace_back([&, t, count]() {
+			try {
+				runConnections(options, carts, count, 0x5EED0000 + t, stop, results[t]);
+			}
+			catch (const std::exception& e) {
+				std::cerr << "cart_client_bench: " << e.what() << std::endl;
+				broken = true;
+			}
+		});
+	}
+	auto started = std::chrono::steady_clock::now();
+	std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+	stop = true;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	if (broken) {
+		return 1;
+	}
+
+	ThreadResult total;
+	for (const ThreadResult& result : results) {
+		for (int kind = 0; kind < KIND_COUNT; ++kind) {
+			total.latency[kind].merge(result.latency[kind]);
+			total.rejected[kind] += result.rejected[kind];
+		}
+		total.failed += result.failed;
+	}
+	LatencyHistogram all;
+	std::printf("%-8s %12s %10s %10s %10s %10s %12s\n", "request", "count", "rejected", "p50 ns", "p99 ns", "p999 ns", "max ns");
+	for (int kind = 0; kind < KIND_COUNT; ++kind) {
+		const LatencyHistogram& latency = total.latency[kind];
+		all.merge(latency);
+		std::printf("%-8s %12llu %10llu %10llu %10llu %10llu %12llu\n", KIND_NAMES[kind],
+			(unsigned long long)latency.count(), (unsigned long long)total.rejected[kind],
+			(unsigned long long)latency.percentile(0.5), (unsigned long long)latency.percentile(0.99),
+			(unsigned long long)latency.percentile(0.999), (unsigned long long)latency.max());
+	}
+	std::printf("%-8s %12llu %10s %10llu %10llu %10llu %12llu\n", "all", (unsigned long long)all.count(), "",
+		(unsigned long long)all.percentile(0.5), (unsigned long long)all.percentile(0.99),
+		(unsigned long long)all.percentile(0.999), (unsigned long long)all.max());
+	uint64_t cart_ops = all.count() + total.latency[ADD].count() * (options.batch - 1);
+	std::printf("throughput: %.0f requests/s, %.0f cart operations/s\n", all.count() / elapsed, cart_ops / elapsed);
+	if (total.failed != 0) {
+		std::printf("malformed or misrouted requests: %llu\n", (unsigned long long)total.failed);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,267 @@
+#include "../shopping_cart_cpp/cart_store.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include "../shopping_cart_cpp/latency_histogram.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Drives a CartStore from many threads with a production-shaped mix of operations and prints
+// per-operation latency percentiles and overall throughput.
+//
+// Items are picked with Zipf-distributed popularity, and a share of the operations carry the
+// invalid input real clients send: unknown items, quantities outside 1 to 99, and malformed
+// owner ids. Rejected operations are timed like the rest, since their cost is paid in
+// production too.
+
+namespace {
+	enum Op { ADD, UPDATE, REMOVE, TOTAL, COPY, CREATE, OP_COUNT };
+	const char* const OP_NAMES[OP_COUNT] = { "add", "update", "remove", "total", "copy", "create" };
+
+	struct Options {
+		unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+		size_t carts = 100000;
+		size_t items = 10000;
+		double zipf = 1.0;
+		double seconds = 5;
+		double invalid = 0.02;
+		// Relative weights of the operations, in Op order.
+		double mix[OP_COUNT] = { 40, 15, 10, 25, 5, 5 };
+	};
+
+	// Samples item ranks 0..n-1 with probability proportional to 1 / (rank + 1)^s.
+	class ZipfDistribution {
+	public:
+		ZipfDistribution(size_t n, double s) : cdf(n) {
+			double sum = 0;
+			for (size_t i = 0; i < n; ++i) {
+				sum += 1.0 / std::pow((double)(i + 1), s);
+				cdf[i] = sum;
+			}
+			for (double& value : cdf) {
+				value /= sum;
+			}
+		}
+		template <typename Rng>
+		size_t operator()(Rng& rng) const {
+			double u = std::uniform_real_distribution<double>(0, 1)(rng);
+			return std::min<size_t>(std::lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), cdf.size() - 1);
+		}
+	private:
+		std::vector<double> cdf;
+	};
+
+	struct ThreadResult {
+		LatencyHistogram latency[OP_COUNT];
+		uint64_t rejected[OP_COUNT] = {};
+	};
+
+	[[noreturn]] void usage() {
+		std::cerr << "Usage: cart_load [--threads N] [--carts N] [--items N] [--zipf S] [--seconds S]\n"
+			"                 [--invalid RATE] [--mix add=40,update=15,remove=10,total=25,copy=5,create=5]" << std::endl;
+		std::exit(2);
+	}
+
+	void parseMix(const std::string& text, Options& options) {
+		size_t start = 0;
+		while (start < text.size()) {
+			size_t end = text.find(',', start);
+			std::string part = text.substr(start, end == std::string::npos ? std::string::npos : end - start);
+			size_t equals = part.find('=');
+			const char* const* name = equals == std::string::npos ? std::end(OP_NAMES)
+				: std::find(std::begin(OP_NAMES), std::end(OP_NAMES), part.substr(0, equals));
+			if (name == std::end(OP_NAMES)) {
+				usage();
+			}
+			options.mix[name - std::begin(OP_NAMES)] = std::stod(part.substr(equals + 1));
+			start = end == std::string::npos ? text.size() : end + 1;
+		}
+	}
+
+	Options parseOptions(int argc, char** argv) {
+		Options options;
+		try {
+			for (int i = 1; i < argc; ++i) {
+				std::string flag = argv[i];
+				if (i + 1 == argc) {
+					usage();
+				}
+				std::string value = argv[++i];
+				if (flag == "--threads") {
+					options.threads = (unsigned)std::stoul(value);
+				}
+				else if (flag == "--carts") {
+					options.carts = std::stoul(value);
+				}
+				else if (flag == "--items") {
+					options.items = std::stoul(value);
+				}
+				else if (flag == "--zipf") {
+					options.zipf = std::stod(value);
+				}
+				else if (flag == "--seconds") {
+					options.seconds = std::stod(value);
+				}
+				else if (flag == "--invalid") {
+					options.invalid = std::stod(value);
+				}
+				else if (flag == "--mix") {
+					parseMix(value, options);
+				}
+				else {
+					usage();
+				}
+			}
+		}
+		catch (const std::logic_error&) {
+			usage();
+		}
+		if (options.threads == 0 || options.carts == 0 || options.items == 0) {
+			usage();
+		}
+		return options;
+	}
+
+	std::vector<std::string> publishCatalog(size_t items) {
+		std::vector<std::string> names;
+		std::vector<std::pair<std::string, double>> entries;
+		for (size_t i = 0; i < items; ++i) {
+			names.push_back("sku-" + std::to_string(i));
+			entries.push_back({ names.back(), 0.01 * (i % 5000 + 1) });
+		}
+		Catalog::publish(CatalogIndex(entries));
+		return names;
+	}
+
+	std::wstring ownerId(size_t i) {
+		return L"LDG" + std::to_wstring(100000 + i % 100000).substr(1) + L"AA-A";
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options = parseOptions(argc, argv);
+	std::vector<std::string> items = publishCatalog(options.items);
+	ZipfDistribution popularity(options.items, options.zipf);
+
+	CartStore store;
+	std::vector<CartUuid> carts;
+	carts.reserve(options.carts);
+	for (size_t i = 0; i < options.carts; ++i) {
+		carts.push_back(store.create(ownerId(i)));
+	}
+	std::cout << "Running " << options.threads << " threads for " << options.seconds << " s over "
+		<< options.carts << " carts and " << options.items << " items" << std::endl;
+
+	std::discrete_distribution<int> mix(std::begin(options.mix), std::end(options.mix));
+	std::vector<ThreadResult> results(options.threads);
+	std::atomic<bool> stop = false;
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < options.threads; ++t) {
+		threads.emplace_back([&, t]() {
+			ThreadResult& result = results[t];
+			std::mt19937_64 rng(0x5EED0000 + t);
+			std::discrete_distribution<int> ops = mix;
+			std::uniform_int_distribution<size_t> pick_cart(0, carts.size() - 1);
+			std::uniform_int_distribution<int> pick_quantity(1, 5);
+			std::bernoulli_distribution invalid(options.invalid);
+			const int bad_quantities[] = { 0, -3, 100, 250 };
+			const wchar_t* const bad_owners[] = { L"ABC1234XDE-A", L"ABC12345DE", L"ABC12345DE-B", L"" };
+
+			while (!stop.load(std::memory_order_relaxed)) {
+				Op op = (Op)ops(rng);
+				const CartUuid& cart = carts[pick_cart(rng)];
+				bool bad = invalid(rng);
+				// Which kind of invalid input: an unknown item, or a quantity out of range.
+				bool bad_item = bad && rng() % 2 == 0;
+				std::string name = bad_item ? "no-such-sku" : items[popularity(rng)];
+				// Clients update and remove lines they were shown, so those pick one the cart holds.
+				if ((op == UPDATE || op == REMOVE) && !bad_item) {
+					store.read(cart, [&](const ShoppingCart& c) {
+						size_t line = c.itemCount() == 0 ? 0 : rng() % c.itemCount();
+						c.forEachItem([&](std::string_view held, int) {
+							if (line-- == 0) {
+								name = held;
+							}
+						});
+					});
+				}
+				int quantity = bad && !bad_item ? bad_quantities[rng() % 4] : pick_quantity(rng);
+				std::wstring owner;
+				if (op == CREATE) {
+					owner = bad ? std::wstring(bad_owners[rng() % 4]) : ownerId(rng());
+				}
+
+				auto started = std::chrono::steady_clock::now();
+				try {
+					switch (op) {
+					case ADD:
+						store.update(cart, [&](ShoppingCart& c) { c.addItem(name, quantity); });
+						break;
+					case UPDATE:
+						store.update(cart, [&](ShoppingCart& c) { c.updateItem(name, quantity); });
+						break;
+					case REMOVE:
+						store.update(cart, [&](ShoppingCart& c) { c.removeItem(name); });
+						break;
+					case TOTAL:
+						store.read(cart, [](const ShoppingCart& c) { (void)c.getTotalCost(); });
+						break;
+					case COPY:
+						store.read(cart, [](const ShoppingCart& c) {
+							ShoppingCart copy(c);
+							(void)copy.getTotal();
+						});
+						break;
+					default: {
+						ShoppingCart created(owner);
+						(void)created;
+						break;
+					}
+					}
+				}
+				catch (const std::exception&) {
+					++result.rejected[op];
+				}
+				auto elapsed = std::chrono::steady_clock::now() - started;
+				result.latency[op].record((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+			}
+		});
+	}
+	auto started = std::chrono::steady_clock::now();
+	std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+	stop = true;
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+	ThreadResult total;
+	for (const ThreadResult& result : results) {
+		for (int op = 0; op < OP_COUNT; ++op) {
+			total.latency[op].merge(result.latency[op]);
+			total.rejected[op] += result.rejected[op];
+		}
+	}
+	LatencyHistogram all;
+	std::printf("%-8s %12s %10s %10s %10s %10s %12s\n", "op", "count", "rejected", "p50 ns", "p99 ns", "p999 ns", "max ns");
+	for (int op = 0; op < OP_COUNT; ++op) {
+		const LatencyHistogram& latency = total.latency[op];
+		all.merge(latency);
+		std::printf("%-8s %12llu %10llu %10llu %10llu %10llu %12llu\n", OP_NAMES[op],
+			(unsigned long long)latency.count(), (unsigned long long)total.rejected[op],
+			(unsigned long long)latency.percentile(0.5), (unsigned long long)latency.percentile(0.99),
+			(unsigned long long)latency.percentile(0.999), (unsigned long long)latency.max());
+	}
+	std::printf("%-8s %12llu %10s %10llu %10llu %10llu %12llu\n", "all", (unsigned long long)all.count(), "",
+		(unsigned long long)all.percentile(0.5), (unsigned long long)all.percentile(0.99),
+		(unsigned long long)all.percentile(0.999), (unsigned long long)all.max());
+	std::printf("throughput: %.0f ops/s\n", all.count() / elapsed);
+	return 0;
+}
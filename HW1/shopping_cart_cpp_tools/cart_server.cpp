@@ -0,0 +1,101 @@
+#include "../shopping_cart_cpp/cart_server.h"
+#include "../shopping_cart_cpp/catalog.h"
+#include <algorithm>
+#include <csignal>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Serves carts over a Unix domain socket until interrupted. The catalog is read from a file, or
+// made up of items sku-0 to sku-<N-1> as cart_load and cart_client_bench expect.
+
+namespace {
+	struct Options {
+		std::string socket = "cart.sock";
+		unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+		std::string catalog;
+		size_t items = 10000;
+	};
+
+	[[noreturn]] void usage() {
+		std::cerr << "Usage: cart_server [--socket PATH] [--threads N] [--catalog FILE | --items N]" << std::endl;
+		std::exit(2);
+	}
+
+	Options parseOptions(int argc, char** argv) {
+		Options options;
+		try {
+			for (int i = 1; i < argc; ++i) {
+				std::string flag = argv[i];
+				if (i + 1 == argc) {
+					usage();
+				}
+				std::string value = argv[++i];
+				if (flag == "--socket") {
+					options.socket = value;
+				}
+				else if (flag == "--threads") {
+					options.threads = (unsigned)std::stoul(value);
+				}
+				else if (flag == "--catalog") {
+					options.catalog = value;
+				}
+				else if (flag == "--items") {
+					options.items = std::stoul(value);
+				}
+				else {
+					usage();
+				}
+			}
+		}
+		catch (const std::logic_error&) {
+			usage();
+		}
+		if (options.threads == 0 || options.items == 0) {
+			usage();
+		}
+		return options;
+	}
+
+	size_t publishCatalog(const Options& options) {
+		if (!options.catalog.empty()) {
+			Catalog::reload(options.catalog);
+			return Catalog::Reader().snapshot().index.size();
+		}
+		std::vector<std::pair<std::string, double>> entries;
+		for (size_t i = 0; i < options.items; ++i) {
+			entries.push_back({ "sku-" + std::to_string(i), 0.01 * (i % 5000 + 1) });
+		}
+		Catalog::publish(CatalogIndex(entries));
+		return options.items;
+	}
+}
+
+int main(int argc, char** argv) {
+	Options options = parseOptions(argc, argv);
+	// Block the stop signals before any thread starts, so that they all inherit the mask and
+	// only sigwait below sees the signals.
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+	try {
+		size_t items = publishCatalog(options);
+		CartServer server(options.socket, options.threads);
+		std::cout << "Serving " << items << " items on " << options.socket << " with " << options.threads
+			<< " threads" << std::endl;
+		int received;
+		sigwait(&signals, &received);
+		std::cout << "Stopping with " << server.cartCount() << " carts" << std::endl;
+		server.stop();
+	}
+	catch (const std::exception& e) {
+		std::cerr << "cart_server: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}
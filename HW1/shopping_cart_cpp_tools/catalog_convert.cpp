@@ -0,0 +1,21 @@
+#include "../shopping_cart_cpp/catalog.h"
+#include <iostream>
+
+// Converts a CSV or TSV item list ("name,price" or "name<TAB>price" per line) into the
+// binary catalog format that the cart module maps at startup.
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cerr << "Usage: catalog_convert <items.csv|items.tsv> <catalog.bin>" << std::endl;
+		return 2;
+	}
+	try {
+		CatalogIndex index = CatalogIndex::load(argv[1]);
+		index.save(argv[2]);
+		std::cout << "Wrote " << index.size() << " items to " << argv[2] << std::endl;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "catalog_convert: " << e.what() << std::endl;
+		return 1;
+	}
+	return 0;
+}